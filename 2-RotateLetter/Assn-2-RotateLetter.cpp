@@ -3,6 +3,7 @@
 #include <glad.h>
 #include <glfw3.h>
 #include "GLXtras.h"
+#include "PointKernels.h"
 #include "VecMat.h"
 
 GLuint vBuffer = 0; // GPU buffer ID
@@ -76,12 +77,7 @@ void BufferVertices() {
 
 void NormalizePoints(float s = 1) {
 	// scale and offset so points are in range +/-s, centered at origin 
-	vec2 min, max;
-	float range = Bounds(points, nPoints, min, max); // in VecMat.h  
-	float scale = 2 * s / range;
-	vec2 center = (min + max) / 2;
-	for (int i = 0; i < nPoints; i++)
-		points[i] = scale * (points[i] - center);
+	StandardizePoints(points, nPoints, s); // in PointKernels.h
 }
 
 void MouseButton(float x, float y, bool left, bool down) {
@@ -2,7 +2,10 @@
 
 #include <glad.h>
 #include <glfw3.h>
+#include <string.h>
 #include "GLXtras.h"
+#include "PointKernels.h"
+#include "SoftRaster.h"
 #include "VecMat.h"
 #include "Draw.h"
 #include "Text.h"
@@ -179,12 +182,7 @@ void BufferVertices() {
 
 void NormalizePoints(float s = 1) {
 	// scale and offset so points are in range +/-s, centered at origin 
-	vec3 min, max;
-	float range = Bounds(points, nPoints, min, max); // in VecMat.h  
-	float scale = 2 * s / range;
-	vec3 center = (min + max) / 2;
-	for (int i = 0; i < nPoints; i++)
-		points[i] = scale * (points[i] - center);
+	StandardizePoints(points, nPoints, s); // in PointKernels.h
 }
 
 void MouseButton(float x, float y, bool left, bool down) {
@@ -206,7 +204,46 @@ void Resize(int width, int height) {
 	camera.Resize(width, height);
 }
 
-int main() {
+// software reference
+
+vec3 LetterShader(const SoftFragment &f, const SoftShading &s) {
+	// as pixelShader: two-sided diffuse, highlight added after the clamp
+	vec3 L = normalize(s.lights[0]-f.point), E = normalize(f.point), R = L-2*dot(f.normal, L)*f.normal;
+	float d = fabsf(dot(f.normal, L)), h = powf(fmaxf(0, dot(R, E)), s.shininess);
+	return (fminf(1, s.amb+s.dif*d)+s.spc*h)*f.color;
+}
+
+int SoftRender(const char *imageName, const char *goldenName) {
+	// the letter rendered on the CPU without a GL context; with a golden image, returns 1 if
+	// more than 1% of pixels differ
+	NormalizePoints(0.8);
+	vector<vec3> p(points, points+nPoints), c(colors, colors+nPoints);
+	vector<int3> t((int3 *) triangles, (int3 *) triangles+nTriangles);
+	SoftShading shading;
+	shading.nLights = 1;
+	shading.lights[0] = vec3(1, 1, 1);          // pixelShader's default, eye space
+	shading.colors = &c;
+	shading.faceted = true;
+	shading.shader = LetterShader;
+	SoftRaster raster;
+	raster.Resize(winWidth, winHeight);
+	raster.Clear(vec3(1, 1, 1));
+	raster.Draw(p, vector<vec3>(), vector<vec2>(), t, camera.modelview, camera.persp, shading);
+	return SoftGolden(raster, imageName, goldenName);
+}
+
+int main(int ac, char **av) {
+	// -soft image.png [-golden reference.png]: render on the CPU and exit, no GPU needed;
+	// nonzero if more than 1% of pixels differ from the golden image
+	const char *softName = NULL, *goldenName = NULL;
+	for (int i = 1; i+1 < ac; i++) {
+		if (!strcmp(av[i], "-soft"))
+			softName = av[++i];
+		else if (!strcmp(av[i], "-golden"))
+			goldenName = av[++i];
+	}
+	if (softName)
+		return SoftRender(softName, goldenName);
 	// init window
 	GLFWwindow *w = InitGLFW(100, 100, 800, 800, "Shaded Letter");
 	// build shader program
@@ -2,12 +2,23 @@
 
 #include <glad.h>
 #include <glfw3.h>
+#include <string>
+#include <string.h>
+#include "ExtrudedText.h"
+#include "FramePacer.h"
+#include "GLState.h"
 #include "GLXtras.h"
+#include "GPUResources.h"
 #include "VecMat.h"
 #include "Text.h"
 #include "Camera.h"
 #include "Draw.h"  // ScreenD, Star 
 #include "IO.h"   // ReadTexture 
+#include "MatKernels.h"
+#include "MeshWriter.h"
+#include "PointKernels.h"
+#include "SharedUniforms.h"
+#include "SoftRaster.h"
 #include "Widgets.h" // Mover 
 
 GLuint vBuffer = 0; // GPU buffer ID
@@ -34,6 +45,13 @@ int triangles[][3] = {
 
 int nTriangles = sizeof(triangles) / (3 * sizeof(int));
 
+/**
+	paragraph globals: the letter generalized to any outline, a whole paragraph in one draw
+*/
+ExtrudedFont font;
+TextBatch paragraph;
+bool showParagraph = false;
+
 
 /**
 	texture globals 
@@ -56,27 +74,18 @@ Camera camera(0, 0, winWidth, winHeight, vec3(15, -30, 0), vec3(0, 0, -5), 30);
 vec3 lights[] = { {.5, 0, 1}, {1, 1, 0} };  // movable lights 
 const int nLights = sizeof(lights) / sizeof(vec3);
 Mover mover;         // to move light 
+SharedUniforms uniforms;  // camera and eye-space lights, written once per frame
+FramePacer pacer;         // N frames in flight, the uniform ring follows its slot
 void* picked = NULL; // user selection (&mover or null/camera) 
 
 /** methods **********************************************************************************/
 
-/** 
-	texture methods 
-*/
-void SetUvs() {
-	vec3 min, max;
-	Bounds(points, nPoints, min, max);
-	vec3 dif(max - min);
-	for (int i = 0; i < nPoints; i++)
-		uvs[i] = vec2((points[i].x - min.x) / dif.x, (points[i].y - min.y) / dif.y);
-}
-
 /** 
 	shaders 
 */
 const char *vertexShader = R"(
-	#version 130
-	uniform mat4 modelview, persp; 
+	#version 330
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
 	in vec3 point;
 	out vec3 vPoint; 
 	in vec2 uv; 
@@ -89,13 +98,12 @@ const char *vertexShader = R"(
 )";
 
 const char *pixelShader = R"(
-	#version 130
+	#version 330
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
 	in vec3 vPoint;
 	in vec2 vUv; 
 	out vec4 pColor;
 
-	uniform int nLights = 0; 
-	uniform vec3 lights[20];
 	uniform sampler2D textureImage; 
 	uniform float amb = .1, dif = .8, spc =.7; 
 	uniform bool highlights = true; 	
@@ -109,7 +117,7 @@ const char *pixelShader = R"(
 		// init diffuse and spec to 0, increment along nLights 
 		float d = 0.0; float s = 0.0;                  
         for (int i = 0; i < nLights; i++) {
-            vec3 L = normalize(lights[i] - vPoint);
+            vec3 L = normalize(lights[i].xyz - vPoint);
             d += abs(dot(N, L)); 
             vec3 R = reflect(L, N);                       
             float h = max(0.0, dot(R, E));               
@@ -124,18 +132,19 @@ const char *pixelShader = R"(
 void Display(GLFWwindow *w) {
 
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	// Draw.h calls at the end of last frame changed GL state behind the cache
+	glState.Invalidate();
+	glState.Enable(GL_DEPTH_TEST);
 
 	// clear background
 	glClearColor(1, 1, 1, 1);
 
 	// run shader program, enable GPU vertex buffer
-	glUseProgram(program);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glState.UseProgram(program);
+	glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
 
-	// send modelview and perspective matrices to vertex shader
-	SetUniform(program, "modelview", camera.modelview);
-	SetUniform(program, "persp", camera.persp);
+	// camera and lights (transformed to eye space) to the Frame block shared by the shaders
+	uniforms.BeginFrame(camera.modelview, camera.persp, lights, nLights);
 
 	// connect GPU point and uv coordinates to shader inputs
 	VertexAttribPointer(program, "point", 3, 0, (void *) 0);
@@ -144,19 +153,14 @@ void Display(GLFWwindow *w) {
 	// Inform pixel shade which image buffer to read from 
 	SetUniform(program, "textureImage", textureUnit);
 
-	// enable GPU buffer of uv coordinates
-	glBindTexture(GL_TEXTURE_2D, textureName);
-	glActiveTexture(GL_TEXTURE0 + textureUnit);
-
-	// transform lights, send to GPU 
-	vec3 xLights[nLights];
-	for (int i = 0; i < nLights; i++)
-		xLights[i] = Vec3(camera.modelview * vec4(lights[i], 1));
-	SetUniform(program, "nLights", nLights);
-	SetUniform3v(program, "lights", nLights, (float*)xLights);
+	// bind texture to the unit the sampler reads (unit selected before the bind)
+	glState.BindTexture(textureUnit, textureName);
 
-	// render three vertices as one triangle
-	glDrawElements(GL_TRIANGLES, nTriangles*3, GL_UNSIGNED_INT, triangles);
+	// render the letter, or the paragraph as one batch
+	if (showParagraph)
+		paragraph.Draw(program);
+	else
+		glDrawElements(GL_TRIANGLES, nTriangles*3, GL_UNSIGNED_INT, triangles);
 
 	// draw lights as disks 
 	UseDrawShader(camera.fullview);
@@ -167,7 +171,10 @@ void Display(GLFWwindow *w) {
 	if (!Shift() && glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_LEFT))
 		camera.arcball.Draw(Control());
 
-	glFlush();
+	if (showParagraph)
+		Text(10, 10, vec3(0, 0, 0), 10, "%i glyphs, %i triangles, 1 draw call", paragraph.NGlyphs(), paragraph.NTriangles());
+
+	uniforms.EndFrame();
 }
 
 void BufferVertices() {
@@ -183,17 +190,28 @@ void BufferVertices() {
 
 	// cppy points to beginning of buffer, for length of points array
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sPoints, points);
+	gpuRegistry.Track(GPURegistry::Buffer, vBuffer, sPoints+sUvs, "letter");
 
 }
 
+void BuildParagraph() {
+	// 40 lines of 60 glyphs, fit to +/- .8
+	const char *words = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG. 0123456789! ";
+	const int nLines = 40, nColumns = 60, nWords = (int) strlen(words);
+	float height = 1.6f/(nColumns*6.f/7);
+	std::string text;
+	for (int line = 0, k = 0; line < nLines; line++, text += '\n')
+		for (int c = 0; c < nColumns; c++)
+			text += words[k++ % nWords];
+	paragraph.Clear();
+	paragraph.Add(font, text.c_str(), vec3(-.8f, .8f-height, 0), height);
+	paragraph.Upload();
+}
+
 void NormalizePoints(float s = 1) {
-	// scale and offset so points are in range +/-s, centered at origin 
-	vec3 min, max;
-	float range = Bounds(points, nPoints, min, max); // in VecMat.h  
-	float scale = 2 * s / range;
-	vec3 center = (min + max) / 2;
-	for (int i = 0; i < nPoints; i++)
-		points[i] = scale * (points[i] - center);
+	// scale and offset so points are in range +/-s, centered at origin;
+	// uvs are the xy projection over the letter's original bounds
+	StandardizePoints(points, nPoints, s, uvs); // in PointKernels.h
 }
 
 /**
@@ -226,6 +244,14 @@ void MouseWheel(float spin) {
 	camera.Wheel(spin, Shift()); 
 }
 
+void Keyboard(int key, bool press, bool shift, bool control) {
+	if (press && key == 'T') {
+		showParagraph = !showParagraph;
+		if (showParagraph && !paragraph.NTriangles())
+			BuildParagraph();
+	}
+}
+
 void Resize(int width, int height) {
 	camera.Resize(width, height);
 }
@@ -235,24 +261,72 @@ void Resize(int width, int height) {
 	IO
 */
 void WriteObjFile(const char* filename) {
-	FILE* file = fopen(filename, "w");
-	if (file) {
-		fprintf(file, "\n# %i vertices\n", nPoints);
-		for (int i = 0; i < nPoints; i++)
-			fprintf(file, "v %f %f %f \n", points[i].x, points[i].y, points[i].z);
-		fprintf(file, "\n# %i textures\n", nPoints);
-		for (int i = 0; i < nPoints; i++)
-			fprintf(file, "vt %f %f \n", uvs[i].x, uvs[i].y);
-		fprintf(file, "\n# %i triangles\n", nTriangles);
-		for (int i = 0; i < nTriangles; i++)
-			fprintf(file, "f %i %i %i \n",
-				1 + triangles[i][0], 1 + triangles[i][1], 1 + triangles[i][2]);
-		fclose(file);
+	MeshData mesh;                               // in MeshWriter.h
+	mesh.points = points;
+	mesh.uvs = uvs;
+	mesh.nPoints = nPoints;
+	mesh.triangles = (const int3 *) triangles;
+	mesh.nTriangles = nTriangles;
+	WriteObj(filename, mesh);
+}
+
+/**
+	software reference
+*/
+vec3 LetterShader(const SoftFragment &f, const SoftShading &s) {
+	// as pixelShader: two-sided diffuse, highlights added after the clamp
+	vec3 E = normalize(f.point);
+	float d = 0, h = 0;
+	for (int i = 0; i < s.nLights; i++) {
+		vec3 L = normalize(s.lights[i]-f.point), R = L-2*dot(f.normal, L)*f.normal;
+		d += fabsf(dot(f.normal, L));
+		h += powf(fmaxf(0, dot(R, E)), s.shininess);
 	}
+	return (fminf(1, s.amb+s.dif*d)+s.spc*h)*s.texture->Sample(f.uv);
 }
 
+int SoftRender(const char *imageName, const char *goldenName) {
+	// the letter rendered on the CPU without a GL context (lights not drawn); with a golden
+	// image, returns 1 if more than 1% of pixels differ
+	NormalizePoints(0.8);
+	SoftTexture texture;
+	if (!texture.Read(textureFilename))
+		printf("can't read %s\n", textureFilename);
+	vector<vec3> p(points, points+nPoints);
+	vector<vec2> uv(uvs, uvs+nPoints);
+	vector<int3> t((int3 *) triangles, (int3 *) triangles+nTriangles);
+	SoftShading shading;
+	shading.nLights = nLights;
+	TransformPoints(camera.modelview, lights, shading.lights, nLights);
+	shading.texture = &texture;
+	shading.faceted = true;
+	shading.shader = LetterShader;
+	SoftRaster raster;
+	raster.Resize(winWidth, winHeight);
+	raster.Clear(vec3(1, 1, 1));
+	raster.Draw(p, vector<vec3>(), uv, t, camera.modelview, camera.persp, shading);
+	return SoftGolden(raster, imageName, goldenName);
+}
+
+int main(int ac, char **av) {
+	// -soft image.png [-golden reference.png]: render on the CPU and exit, no GPU needed;
+	// nonzero if more than 1% of pixels differ from the golden image
+	// -inflight N: frames the GPU may queue, 1 to 3 (default 2)
+	// -bench: time glyph triangulation, check winding, holes and facing, exit nonzero on failure
+	if (ac > 1 && !strcmp(av[1], "-bench"))
+		return ExtrudedTextBenchmark() != 0;
+	const char *softName = NULL, *goldenName = NULL;
+	for (int i = 1; i+1 < ac; i++) {
+		if (!strcmp(av[i], "-soft"))
+			softName = av[++i];
+		else if (!strcmp(av[i], "-golden"))
+			goldenName = av[++i];
+		else if (!strcmp(av[i], "-inflight"))
+			pacer.SetFramesInFlight(atoi(av[++i]));
+	}
+	if (softName)
+		return SoftRender(softName, goldenName);
 
-int main() {
 	
 	// write to file 
 	const char* fileName = "output.obj";
@@ -262,23 +336,37 @@ int main() {
 	
 	program = LinkProgramViaCode(&vertexShader, &pixelShader);  // build shader program
 	textureName = ReadTexture(textureFilename);  // read and store texture img in GPU
-	SetUvs();                                    // init uv coords 
-	NormalizePoints(0.8);                        // fit the letter
+	gpuRegistry.Track(GPURegistry::Texture, textureName, TextureBytes(textureName), textureFilename);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "letter");
+	uniforms.Init(0);                            // frame block only
+	uniforms.Bind(program);
+	uniforms.SetPacer(&pacer);
+	NormalizePoints(0.8);                        // fit the letter, init uv coords
 	BufferVertices();                            // allocate GPU vertex memory
 
 	while (!glfwWindowShouldClose(w)) {
+		pacer.BeginFrame();                      // the frame N ago is done
 		Display(w);
 		glfwSwapBuffers(w);
+		pacer.EndFrame();
 		glfwPollEvents();
 		RegisterResize(Resize);
 		RegisterMouseButton(MouseButton);
 		RegisterMouseMove(MouseMove);
 		RegisterMouseWheel(MouseWheel); 
+		RegisterKeyboard(Keyboard);
 	}
 
 	// unbind vertex buffer, free GPU memory
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &vBuffer);
+	DeleteBuffer(vBuffer);
+	DeleteTexture(textureName);
+	DeleteProgram(program);
+	paragraph.Release();
+	uniforms.Release();
+	pacer.Report();
+	pacer.Release();
+	gpuRegistry.DumpLive();                      // anything listed leaked
 	glfwDestroyWindow(w);
 	glfwTerminate();
 }
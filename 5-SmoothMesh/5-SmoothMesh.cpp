@@ -1,12 +1,29 @@
 // SmoothMesh.cpp: texture-map facet or smooth shaded 3D letter
 
+#include <chrono>
+#include <string>
+#include <string.h>
 #include <vector>
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include "AssetLoader.h"
+#include "BVH.h"
 #include "Camera.h"
 #include "Draw.h"
+#include "FrameCapture.h"
+#include "FramePacer.h"
+#include "GLState.h"
 #include "GLXtras.h"
+#include "GPUResources.h"
 #include "IO.h"
+#include "MatKernels.h"
+#include "MeshProcess.h"
+#include "Meshlets.h"
+#include "MeshStream.h"
+#include "MeshWriter.h"
+#include "PointKernels.h"
+#include "RenderThread.h"
+#include "SoftRaster.h"
 #include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
@@ -29,6 +46,14 @@ GLuint vBuffer = 0, program = 0;
 // OBJ file 
 const char *objFilename = "pumpkin_scan.obj";
 
+// out-of-core display (-stream), from <objFilename>.chunks
+MeshStream stream;
+bool streaming = false;
+
+// meshlets, frustum and back-face culled on the GPU (M toggles), cached in <objFilename>.meshlets
+Meshlets meshlets;
+bool meshletCulling = true;
+
 // texture image
 const char *texFilename = "horse_base.png";
 GLuint textureName = 0;
@@ -38,9 +63,49 @@ int textureUnit = 0;
 vec3 lights[] = { {.5, 0, 1}, {1, 1, 0} };
 const int nLights = sizeof(lights)/sizeof(vec3);
 
+// background loading
+AssetLoader loader;
+
+// turntable recording (-record frame%04d.png or name.y4m, -frames N): one turn in N frames
+FrameCapture capture;
+FrameClock frameClock;
+bool recording = false;
+int recordFrames = 120;
+
 // interaction
 void *picked = NULL;
-Mover mover;
+GLFWwindow *window = NULL;
+// light dragged in the plane through it facing the camera; GL-free, unlike Mover
+struct LightDrag { vec3 *light = NULL, normal; } lightDrag;
+
+// input and GLFW on the main thread; GL, the loader and picking on the render thread
+typedef std::chrono::steady_clock Clock;
+struct View {
+	mat4 modelview, persp, fullview;
+	vec3 lights[nLights];
+	Arcball arcball;
+	bool drawArcball = false, arcballControl = false;
+	bool meshletCulling = true;
+	int width = 0, height = 0;
+	Clock::time_point input;                // oldest event since the previous snapshot
+	int inputId = 0;                        // 0: no input yet
+};
+TripleBuffer<View> views;
+RenderThread renderThread;
+LatencyMeter latency;
+bool inputPending = false, viewChanged = true;
+Clock::time_point inputTime;
+int nInputs = 0;
+int viewWidth = 0, viewHeight = 0;
+// mouse motion coalesced: only the latest position in a batch of events is applied
+bool moved = false;
+float moveX = 0, moveY = 0;
+
+// ray picking (right button), BVH rebuilt when the mesh changes
+BVH bvh;
+size_t bvhTriangles = 0;
+RayHit hits[2];             // last two picks
+int nHits = 0;
 
 // Shaders
 const char *vertexShader = R"(
@@ -98,127 +163,418 @@ const char *pixelShader = R"(
 
 // Display
 
-void Display(GLFWwindow *w) {
+void Display(const View &v) {
 	// clear screen, enable blend, z-buffer
 	glClearColor(1, 1, 1, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	glState.Invalidate();                   // annotation below bypasses the cache
+	glState.Enable(GL_DEPTH_TEST);
 	// init shader program, connect GPU buffer to vertex shader
-	glUseProgram(program);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-	VertexAttribPointer(program, "point", 3, 0, (void *) 0);
-	VertexAttribPointer(program, "uv", 2, 0, (void *) points.size());
-	VertexAttribPointer(program, "normal", 3, 0, (void*) normals.size()); 
+	glState.UseProgram(program);
+	mat4 turntable = recording? RotateY(360*(float) frameClock.Seconds()*capture.fps/recordFrames) : mat4();
+	if (streaming)
+		SetUniform(program, "modelview", v.modelview*turntable*stream.Fit(.8f));
+	else {
+		glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
+		VertexAttribPointer(program, "point", 3, 0, (void *) 0);
+		VertexAttribPointer(program, "uv", 2, 0, (void *) points.size());
+		VertexAttribPointer(program, "normal", 3, 0, (void*) normals.size()); 
+		SetUniform(program, "modelview", v.modelview*turntable);
+	}
 	// update matrices
-	SetUniform(program, "modelview", camera.modelview);
-	SetUniform(program, "persp", camera.persp);
+	SetUniform(program, "persp", v.persp);
 	// transform and update lights
 	vec3 xLights[nLights];
-	for (int i = 0; i < nLights; i++) {
-		vec4 xLight = camera.modelview*vec4(lights[i], 1);
-		xLights[i] = vec3((float*) &xLight);
-	}
+	TransformPoints(v.modelview, v.lights, xLights, nLights);
 	SetUniform(program, "nLights", nLights);
 	SetUniform3v(program, "lights", nLights, (float *) xLights);
 	// bind textureName to textureUnit
-	glBindTexture(GL_TEXTURE_2D, textureName);
-	glActiveTexture(GL_TEXTURE0+textureUnit);
+	glState.BindTexture(textureUnit, textureName);
 	SetUniform(program, "textureImage", textureUnit);
-	// render
-	glDrawElements(GL_TRIANGLES, (GLsizei) 3 * triangles.size(), GL_UNSIGNED_INT, triangles.data());
+	// render (streaming: chunks arrived so far)
+	if (streaming)
+		stream.Draw(program);
+	else if (v.meshletCulling && loader.Loaded() && meshlets.NMeshlets()) {
+		if (!meshlets.Uploaded())
+			meshlets.Upload(triangles);
+		meshlets.CullAndDraw(v.modelview*turntable, v.persp);
+	}
+	else
+		glDrawElements(GL_TRIANGLES, (GLsizei) 3 * triangles.size(), GL_UNSIGNED_INT, triangles.data());
 	// annotation
-	glDisable(GL_DEPTH_TEST);
-	UseDrawShader(camera.fullview);
+	glState.Disable(GL_DEPTH_TEST);
+	UseDrawShader(v.fullview);
 	for (int i = 0; i < nLights; i++)
-		Star(lights[i], 8, vec3(1, .8f, 0), vec3(0, 0, 1));
-	if (picked == &camera && !Shift())
-		camera.arcball.Draw(Control());
-	glFlush();
+		Star(v.lights[i], 8, vec3(1, .8f, 0), vec3(0, 0, 1));
+	if (v.drawArcball) {
+		Arcball arcball = v.arcball;
+		arcball.Draw(v.arcballControl);
+	}
+	for (int i = 0; i < nHits; i++)
+		Disk(hits[i].point, 9, vec3(1, 0, 0));
+	if (nHits == 2)
+		Line(hits[0].point, hits[1].point, 2, vec3(1, 0, 0));
+}
+
+// Picking
+
+void Pick(float x, float y, mat4 modelview, mat4 persp) {
+	if (bvhTriangles != triangles.size()) {
+		// first pick, or mesh arrived since last build
+		time_t start = clock();
+		bvh.Build(points, triangles);
+		bvhTriangles = triangles.size();
+		printf("BVH: %i triangles, %i nodes, built in %.1f ms\n", bvh.NTriangles(), bvh.NNodes(), 1000.f*(clock()-start)/CLOCKS_PER_SEC);
+	}
+	vec3 origin, direction;
+	ScreenRay(x, y, modelview, persp, origin, direction);
+	RayHit hit;
+	if (!bvh.Intersect(origin, direction, hit, &uvs))
+		return;
+	if (nHits == 2)
+		hits[0] = hits[1];
+	hits[nHits < 2? nHits++ : 1] = hit;
+	vec3 b = hit.barycentric;
+	printf("triangle %i, barycentric (%3.2f, %3.2f, %3.2f), uv (%3.2f, %3.2f)", hit.triangle, b.x, b.y, b.z, hit.uv.x, hit.uv.y);
+	if (nHits == 2)
+		printf(", %3.2f from previous pick", length(hits[1].point-hits[0].point));
+	printf("\n");
+}
+
+// Input (main thread)
+// the render thread owns the GL context: no Shift(), Control(), MouseOver or Mover here
+
+bool ShiftDown() {
+	return glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
+}
+
+bool ControlDown() {
+	return glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS;
+}
+
+bool LightOver(float x, float y, vec3 p, float proximity = 12) {
+	// project with the tracked viewport size, origin at lower left
+	vec4 c = camera.fullview*vec4(p, 1);
+	if (c.w <= 0 || !viewWidth || !viewHeight)
+		return false;
+	float sx = .5f*(c.x/c.w+1)*viewWidth, sy = .5f*(c.y/c.w+1)*viewHeight;
+	return (sx-x)*(sx-x)+(sy-y)*(sy-y) < proximity*proximity;
+}
+
+void LightDown(vec3 *light) {
+	mat4 m = camera.modelview;
+	lightDrag.light = light;
+	lightDrag.normal = normalize(vec3(m[2][0], m[2][1], m[2][2]));  // view axis in world space
+}
+
+void LightDrag(float x, float y) {
+	vec3 origin, direction, *p = lightDrag.light;
+	ScreenRay(x, y, viewWidth, viewHeight, camera.modelview, camera.persp, origin, direction);
+	float d = dot(lightDrag.normal, direction);
+	if (p && fabs(d) > 1e-6f)
+		*p = origin+(dot(lightDrag.normal, *p-origin)/d)*direction;
+}
+
+void Input() {
+	// timestamp the oldest event not yet in a snapshot
+	if (!inputPending)
+		inputTime = Clock::now();
+	inputPending = viewChanged = true;
+}
+
+void ApplyMove() {
+	if (!moved)
+		return;
+	if (picked == &lightDrag)
+		LightDrag(moveX, moveY);
+	if (picked == &camera)
+		camera.Drag(moveX, moveY);
+	moved = false;
+}
+
+void PublishView() {
+	View &v = views.Back();
+	v.modelview = camera.modelview;
+	v.persp = camera.persp;
+	v.fullview = camera.fullview;
+	for (int i = 0; i < nLights; i++)
+		v.lights[i] = lights[i];
+	v.arcball = camera.arcball;
+	v.drawArcball = picked == &camera && !ShiftDown();
+	v.arcballControl = ControlDown();
+	v.meshletCulling = meshletCulling;
+	v.width = viewWidth;
+	v.height = viewHeight;
+	if (inputPending) {
+		v.input = inputTime;
+		v.inputId = ++nInputs;
+	}
+	else
+		v.inputId = nInputs;
+	inputPending = viewChanged = false;
+	views.Publish();
 }
 
 // Mouse Callbacks
 
 void MouseButton(float x, float y, bool left, bool down) {
+	Input();
+	ApplyMove();                                // motion before the button, in order
 	picked = NULL;
+	if (!left && down && !streaming) {
+		mat4 modelview = camera.modelview, persp = camera.persp;
+		renderThread.Post([=]() { Pick(x, y, modelview, persp); });
+	}
 	if (left && down) {
 		// light picked?
 		for (int i = 0; i < nLights; i++)
-			if (MouseOver(x, y, lights[i], camera.fullview)) {
-				picked = &mover;
-				mover.Down(&lights[i], (int) x, (int) y, camera.modelview, camera.persp);
+			if (LightOver(x, y, lights[i])) {
+				picked = &lightDrag;
+				LightDown(&lights[i]);
 			}
 		if (picked == NULL) {
 			picked = &camera;
-			camera.Down(x, y, Shift(), Control());
+			camera.Down(x, y, ShiftDown(), ControlDown());
 		}
 	}
 	else camera.Up();
 }
 
 void MouseMove(float x, float y, bool leftDown, bool rightDown) {
-	if (leftDown) {
-		if (picked == &mover)
-			mover.Drag((int) x, (int) y, camera.modelview, camera.persp);
-		if (picked == &camera)
-			camera.Drag(x, y);
+	// applied once per batch of events, see ApplyMove
+	if (leftDown && picked) {
+		Input();
+		moved = true;
+		moveX = x;
+		moveY = y;
 	}
 }
 
 void MouseWheel(float spin) {
-	camera.Wheel(spin, Shift());
+	Input();
+	camera.Wheel(spin, ShiftDown());
 }
 
-// Initialization
+// Application
 
-void BufferVertices() {
-	// create GPU buffer, make it active
-	glGenBuffers(1, &vBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-	// allocate/load memory for points and uvs
-	size_t sPoints = points.size() * sizeof(vec3), sUvs = uvs.size() * sizeof(vec2), sNormals = normals.size() * sizeof(vec3);;
-	size_t sTotal = sPoints + sUvs + sNormals;
-	glBufferData(GL_ARRAY_BUFFER, sTotal, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sPoints, points.data());
-	glBufferSubData(GL_ARRAY_BUFFER, sPoints, sUvs, uvs.data());
-	glBufferSubData(GL_ARRAY_BUFFER, sPoints + sUvs, sNormals, normals.data());
+void Export() {
+	// write the processed mesh as OBJ and binary PLY at once
+	vector<MeshFile> files(2);
+	files[0].filename = "SmoothMesh.obj";
+	files[1].filename = "SmoothMesh.ply";
+	for (MeshFile &f : files)
+		f.mesh = MeshData(points, normals, uvs, triangles);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t bytes = WriteMeshes(files);
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	for (MeshFile &f : files)
+		printf("wrote %s (%.1f MB)\n", f.filename.c_str(), f.bytes/1e6);
+	printf("export: %.1f ms, %.0f MB/s\n", 1000*s, bytes/s/1e6);
 }
 
-// Application
+void Keyboard(int key, bool press, bool shift, bool control) {
+	// mesh data belongs to the render thread, where the loader installs it
+	if (press && key == 'B' && !streaming)
+		renderThread.Post([]() { BVHBenchmark(points, triangles); });
+	if (press && key == 'W' && !streaming)
+		renderThread.Post([]() { if (loader.Loaded()) Export(); });
+	if (press && key == 'M' && !streaming) {
+		meshletCulling = !meshletCulling;
+		printf("meshlet culling %s\n", meshletCulling? "on" : "off");
+		renderThread.Post([]() { meshlets.Report(); meshlets.ResetStats(); });
+	}
+	if (press && key == 'L') {
+		latency.Report("input to swap");
+		latency.Reset();
+	}
+	viewChanged = true;                         // shift, control change the arcball display
+}
 
 void Resize(int width, int height) {
+	Input();
 	camera.Resize(width, height);
-	glViewport(0, 0, width, height);
+	viewWidth = width;                          // viewport set on the render thread
+	viewHeight = height;
+}
+
+// Render Thread
+
+bool recorded = false;
+int viewportWidth = 0, viewportHeight = 0, nMeasured = 0;
+FramePacer pacer;                               // -inflight N: frames in flight, 1 to 3 (default 2)
+
+void RenderFrame(GLFWwindow *w) {
+	pacer.BeginFrame();                         // the frame N ago is done
+	views.Acquire();
+	const View &v = views.Front();
+	if (v.width != viewportWidth || v.height != viewportHeight) {
+		glViewport(0, 0, v.width, v.height);
+		viewportWidth = v.width;
+		viewportHeight = v.height;
+	}
+	// record only once everything has arrived, so output doesn't depend on load timing
+	bool record = recording && !recorded && loader.Loaded() && (!streaming || stream.NArrived() == stream.NChunks());
+	if (record)
+		capture.BeginFrame();
+	Display(v);
+	if (record) {
+		capture.EndFrame();
+		frameClock.Tick();
+		if (frameClock.Frame() == recordFrames) {
+			recorded = true;
+			glfwSetWindowShouldClose(w, GLFW_TRUE);
+			glfwPostEmptyEvent();               // wake the main thread
+		}
+	}
+	glfwSwapBuffers(w);
+	pacer.EndFrame();
+	if (v.inputId != nMeasured) {
+		// first swap showing this snapshot's input
+		latency.Record(v.input);
+		nMeasured = v.inputId;
+	}
+	loader.Update();
+	stream.Update();
+}
+
+// Software Reference
+
+int SoftRender(const char *imageName, const char *goldenName) {
+	// the first frame, rendered on the CPU without a GL context (annotation not drawn);
+	// with a golden image, returns 1 if more than 1% of pixels differ
+	if (!ReadAsciiObj(objFilename, points, triangles, &normals, &uvs)) {
+		printf("can't read %s\n", objFilename);
+		return 1;
+	}
+	ProcessMesh(points, uvs, normals, triangles);
+	StandardizePoints(points.data(), (int) points.size(), .8f);
+	SoftTexture texture;
+	if (!texture.Read(texFilename))
+		printf("can't read %s\n", texFilename);
+	SoftShading shading;                        // defaults match pixelShader
+	shading.nLights = nLights;
+	TransformPoints(camera.modelview, lights, shading.lights, nLights);
+	shading.texture = texture.width? &texture : NULL;
+	SoftRaster raster;
+	raster.Resize(winWidth, winHeight);
+	raster.Clear(vec3(1, 1, 1));
+	raster.Draw(points, normals, uvs, triangles, camera.modelview, camera.persp, shading);
+	return SoftGolden(raster, imageName, goldenName);
 }
 
 int main(int ac, char **av) {
-	// read OBJ file
-	if (!ReadAsciiObj(objFilename, points, triangles, &normals, &uvs))
-		printf("cant read %s\n", objFilename);
-	else
-		printf("opened %s\n", objFilename);
+	// no GPU needed: -soft image.png [-golden reference.png], -rasterbench [millions of triangles], -matbench,
+	// -pointbench [millions of points]; benchmarks exit nonzero if their results are wrong
+	const char *softName = NULL, *goldenName = NULL;
+	for (int i = 1; i < ac; i++) {
+		if (!strcmp(av[i], "-soft") && i+1 < ac)
+			softName = av[++i];
+		if (!strcmp(av[i], "-golden") && i+1 < ac)
+			goldenName = av[++i];
+		if (!strcmp(av[i], "-rasterbench")) {
+			double millions = i+1 < ac? atof(av[i+1]) : 0;
+			return (millions > 0? SoftRasterBenchmark((int) (1e6*millions)) : SoftRasterBenchmark()) != 0;
+		}
+		if (!strcmp(av[i], "-pointbench")) {
+			double millions = i+1 < ac? atof(av[i+1]) : 0;
+			return (millions > 0? PointKernelBenchmark((int) (1e6*millions)) : PointKernelBenchmark()) != 0;
+		}
+		if (!strcmp(av[i], "-matbench"))
+			return MatKernelBenchmark() != 0;
+	}
+	if (softName)
+		return SoftRender(softName, goldenName);
 	// enable anti-alias, init app window and GL context
 	GLFWwindow *w = InitGLFW(100, 100, winWidth, winHeight, "Smooth Mesh");
-	// init shader program, set GPU buffer, read texture image
+	window = w;
+	// read OBJ file and texture image in background, placeholders until loaded
+	loader.Start(w);
+	const char *recordName = NULL;
+	for (int i = 1; i < ac; i++) {
+		if (!strcmp(av[i], "-stream"))
+			streaming = true;
+		if (!strcmp(av[i], "-record") && i+1 < ac)
+			recordName = av[++i];
+		if (!strcmp(av[i], "-frames") && i+1 < ac)
+			recordFrames = atoi(av[++i]);
+		if (!strcmp(av[i], "-inflight") && i+1 < ac)
+			pacer.SetFramesInFlight(atoi(av[++i]));
+	}
+	if (recordName) {
+		// offscreen at framebuffer size, fixed time step, window hidden
+		int width, height;
+		glfwGetFramebufferSize(w, &width, &height);
+		recording = capture.Start(recordName, width, height);
+		frameClock.SetFixed(1./capture.fps);
+		if (recording)
+			glfwHideWindow(w);
+	}
+	if (streaming) {
+		// convert once, then stream chunks from the cache
+		std::string cacheFilename = std::string(objFilename)+".chunks";
+		FILE *cache = fopen(cacheFilename.c_str(), "rb");
+		if (cache)
+			fclose(cache);
+		else if (!ConvertObjToChunkCache(objFilename, cacheFilename.c_str()))
+			printf("can't convert %s\n", objFilename);
+		streaming = stream.Open(cacheFilename.c_str());
+		if (streaming)
+			printf("streaming %i chunks from %s\n", stream.NChunks(), cacheFilename.c_str());
+	}
+	if (!streaming)
+		loader.LoadMesh(objFilename, &points, &triangles, &normals, &uvs, &vBuffer,
+			[](vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+				ProcessMesh(points, uvs, normals, triangles);   // weld, smooth normals if none in file
+				StandardizePoints(points.data(), (int) points.size(), .8f); // fit to +/- .8 space
+				// meshlets reorder the triangles; built once, then read from the cache
+				std::string cache = std::string(objFilename)+".meshlets";
+				if (meshlets.Read(cache.c_str(), points, triangles))
+					printf("read %i meshlets from %s\n", meshlets.NMeshlets(), cache.c_str());
+				else {
+					meshlets.Build(points, triangles);
+					if (meshlets.Write(cache.c_str(), points, triangles))
+						printf("built %i meshlets, cached in %s\n", meshlets.NMeshlets(), cache.c_str());
+				}
+			});
+	loader.LoadTexture(texFilename, &textureName);
+	// init shader program while assets decode
 	program = LinkProgramViaCode(&vertexShader, &pixelShader);
-	// SetUvs();
-
-	Standardize(points.data(), points.size(), .8f); // fit points to +/- .8 space
-	
-	BufferVertices();
-	textureName = ReadTexture(texFilename);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "smooth mesh");
 	// callbacks
 	RegisterMouseMove(MouseMove);
 	RegisterMouseButton(MouseButton);
 	RegisterMouseWheel(MouseWheel);
 	RegisterResize(Resize);
-	// event loop
+	RegisterKeyboard(Keyboard);
+	printf("right-click: pick mesh, B: BVH benchmark, L: input latency, M: meshlet culling\n");
+	// hand the context to the render thread; this thread waits on events
+	glfwGetFramebufferSize(w, &viewWidth, &viewHeight);
+	PublishView();
+	renderThread.Start(w, [w]() { RenderFrame(w); });
 	while (!glfwWindowShouldClose(w)) {
-		glfwPollEvents();
-		Display(w);
-		glfwSwapBuffers(w);
+		glfwWaitEvents();
+		ApplyMove();
+		if (viewChanged)
+			PublishView();
+	}
+	renderThread.Stop();
+	latency.Report("input to swap");
+	pacer.Report();
+	if (meshletCulling && !streaming)
+		meshlets.Report();
+	if (recording) {
+		capture.Stop();
+		printf("recorded %i frames to %s\n", capture.FramesWritten(), recordName);
 	}
+	stream.Close();
+	loader.Stop();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &vBuffer);
+	DeleteBuffer(vBuffer);
+	meshlets.Release();
+	pacer.Release();
+	DeleteTexture(textureName);                  // after Stop, which zeroes it if still the placeholder
+	DeleteProgram(program);
+	gpuRegistry.DumpLive();                      // anything listed leaked
 	glfwDestroyWindow(w);
 	glfwTerminate();
 
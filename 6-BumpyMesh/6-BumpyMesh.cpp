@@ -1,12 +1,22 @@
 // BumpMap.cpp: bumpy object 
 
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include "AssetLoader.h"
 #include "Camera.h"
 #include "Draw.h"
+#include "DynamicResolution.h"
+#include "FramePacer.h"
+#include "GLState.h"
 #include "GLXtras.h"
+#include "GPUResources.h"
 #include "IO.h"
+#include "Material.h"
+#include "PointKernels.h"
+#include "SharedUniforms.h"
 #include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
@@ -39,10 +49,28 @@ const char* bumpFilename = "Monster_Normal.jpg";
 GLuint bumpName = 0;
 int bumpUnit = 1;
 
+// channel-packed wood materials, loaded on first use
+Material materials[2];
+const char *materialNames[] = { "color + bump map", "metal/rough", "spec/gloss" };
+bool materialRequested[2] = { false, false };
+int materialMode = 0;       // 0: textureImage and bumpMap, else materials[materialMode-1]
+int materialUnit = 2;       // and materialUnit+1
+
+// dynamic resolution: R toggles, F switches the upscale filter
+DynamicResolution dynamicRes;
+bool dynamicResolution = false;
+
 // movable lights       
 vec3 lights[] = { {.5, 0, 1}, {1, 1, 0} };
 const int nLights = sizeof(lights) / sizeof(vec3);
 
+// background loading
+AssetLoader loader;
+
+// camera and lights, one uniform block per frame in the pacer's slot
+SharedUniforms uniforms;
+FramePacer pacer;
+
 // interaction
 void* picked = NULL;
 Mover mover;
@@ -50,14 +78,14 @@ Mover mover;
 // Shaders
 
 const char* vertexShader = R"(
-	#version 130
+	#version 330
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
 	in vec3 point;
 	in vec2 uv;
 	in vec3 normal;
 	out vec3 vPoint;
 	out vec2 vUv;
 	out vec3 vNormal;
-	uniform mat4 modelview, persp;
 	void main() {
 		vPoint = (modelview*vec4(point, 1)).xyz;
 		gl_Position = persp*vec4(vPoint, 1);
@@ -67,15 +95,17 @@ const char* vertexShader = R"(
 )";
 
 const char* pixelShader = R"(
-    #version 130
+    #version 330
+    layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
     in vec3 vPoint;
     in vec2 vUv;
     in vec3 vNormal; 
     out vec4 pColor;
     uniform sampler2D textureImage;
     uniform sampler2D bumpMap;
-    uniform int nLights;
-    uniform vec3 lights[20];
+    uniform bool useMaterial = false, specGloss = false;
+    uniform sampler2D materialParams;   // metal, rough, height or specular rgb, gloss
+    uniform sampler2D materialNormal;   // normal xy
     
     uniform float amb = 0.1;
     uniform float dif = 0.8;
@@ -88,22 +118,46 @@ const char* pixelShader = R"(
         vec3 X = normalize(du.x * dx + du.y * dy); 
         vec3 Y = normalize(dv.x * dx + dv.y * dy);
         vec3 Z = normalize(vNormal);
-        vec4 t = texture(bumpMap, vUv);
-        vec3 b = vec3(2.0 * t.r - 1.0, 2.0 * t.g - 1.0, t.b);
+        vec3 albedo = texture(textureImage, vUv).rgb;
+        vec3 b, specColor = vec3(spc);
+        float kd = dif, shininess = 100.0;
+        if (useMaterial) {
+            // two fetches: packed scalars, then normal xy with z rebuilt
+            vec4 m = texture(materialParams, vUv);
+            vec2 n = 2.0 * texture(materialNormal, vUv).rg - 1.0;
+            b = vec3(n, sqrt(max(0.0, 1.0 - dot(n, n))));
+            if (specGloss) {
+                specColor = m.rgb;
+                shininess = exp2(1.0 + 10.0 * m.a);
+            }
+            else {
+                specColor = mix(vec3(spc), albedo, m.r);
+                kd = dif * (1.0 - m.r);
+                shininess = exp2(1.0 + 10.0 * (1.0 - m.g));
+            }
+        }
+        else {
+            vec4 t = texture(bumpMap, vUv);
+            b = vec3(2.0 * t.r - 1.0, 2.0 * t.g - 1.0, t.b);
+        }
         vec3 N = normalize(b.x * X + b.y * Y + b.z * Z); 
         
         float d = 0.0, s = 0.0;
         vec3 E = normalize(vPoint);  
         for (int i = 0; i < nLights; i++) {
-            vec3 L = normalize(lights[i] - vPoint);  
+            vec3 L = normalize(lights[i].xyz - vPoint);  
             vec3 R = reflect(L, N);  
             d += max(0.0, dot(N, L));  
             float h = max(0.0, dot(R, E));  
-            s += pow(h, 100.0);  
+            s += pow(h, shininess);  
         }
         
-        float ads = clamp(amb + dif * d + spc * s, 0.0, 1.0);
-        pColor = vec4(ads * texture(textureImage, vUv).rgb, 1.0);
+        if (useMaterial)
+            pColor = vec4(clamp((amb + kd * d) * albedo + s * specColor, 0.0, 1.0), 1.0);
+        else {
+            float ads = clamp(amb + dif * d + spc * s, 0.0, 1.0);
+            pColor = vec4(ads * albedo, 1.0);
+        }
     }
 )";
 
@@ -111,47 +165,52 @@ const char* pixelShader = R"(
 // Display
 
 void Display(GLFWwindow* w) {
+	// scene offscreen, at the controller's resolution
+	int width, height;
+	glfwGetFramebufferSize(w, &width, &height);
+	if (dynamicResolution)
+		dynamicRes.BeginFrame(width, height);
 	// clear screen, enable blend, z-buffer
 	glClearColor(1, 1, 1, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	glState.Invalidate();                   // annotation below bypasses the cache
+	glState.Enable(GL_DEPTH_TEST);
 	// init shader program, connect GPU buffer to vertex shader
-	glUseProgram(program);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glState.UseProgram(program);
+	glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
 	// [point, uv, normal]
 	const size_t pointsOffset = points.size() * sizeof(vec3);
 	const size_t pointsUvOffeset = pointsOffset + uvs.size() * sizeof(vec2);
 	VertexAttribPointer(program, "point", 3, 0, (GLvoid*)0);
 	VertexAttribPointer(program, "uv", 2, 0, (GLvoid*)pointsOffset);
 	VertexAttribPointer(program, "normal", 3, 0, (GLvoid*)pointsUvOffeset);
-	// update matrices
-	SetUniform(program, "modelview", camera.modelview);
-	SetUniform(program, "persp", camera.persp);
-	// transform and update lights
-	vec3 xLights[nLights];
-	for (int i = 0; i < nLights; i++) {
-		vec4 xLight = camera.modelview * vec4(lights[i], 1);
-		xLights[i] = vec3((float*)&xLight);
-	}
-	SetUniform(program, "nLights", nLights);
-	SetUniform3v(program, "lights", nLights, (float*)xLights);
+	// update matrices and lights (transformed to eye space in the frame block)
+	uniforms.BeginFrame(camera.modelview, camera.persp, lights, nLights);
 	// bind textureName to textureUnit and bumpMap to bumpUnit
 	SetUniform(program, "textureImage", textureUnit);
-	glBindTexture(GL_TEXTURE_2D, textureName);
-
-	glActiveTexture(GL_TEXTURE0 + bumpUnit);
-	glBindTexture(GL_TEXTURE_2D, bumpName);
+	glState.BindTexture(textureUnit, textureName);
+	glState.BindTexture(bumpUnit, bumpName);
 	SetUniform(program, "bumpMap", bumpUnit);
+	// or a packed material: two textures, one call
+	bool useMaterial = materialMode > 0 && materials[materialMode-1].Bind(program, materialUnit);
+	SetUniform(program, "useMaterial", useMaterial? 1 : 0);
 	// render
 	glDrawElements(GL_TRIANGLES, (GLsizei)3 * triangles.size(), GL_UNSIGNED_INT, triangles.data());
+	// upscale to window, annotate at full resolution
+	if (dynamicResolution) {
+		dynamicRes.EndFrame();
+		Text(10, 10, vec3(0, 0, 0), 8, "%ix%i (%.0f%%), GPU %.2f ms, target %.1f ms, %s", dynamicRes.Width(), dynamicRes.Height(),
+			 100*dynamicRes.Scale(), dynamicRes.GpuMs(), dynamicRes.targetMs, dynamicRes.filter == DynamicResolution::EdgeAware? "edge-aware" : "bilinear");
+		glState.Invalidate();
+	}
 	// annotation
-	glDisable(GL_DEPTH_TEST);
+	glState.Disable(GL_DEPTH_TEST);
 	UseDrawShader(camera.fullview);
 	for (int i = 0; i < nLights; i++)
 		Star(lights[i], 8, vec3(1, .8f, 0), vec3(0, 0, 1));
 	if (picked == &camera && !Shift())
 		camera.arcball.Draw(Control());
-	glFlush();
+	uniforms.EndFrame();
 }
 
 // Mouse Callbacks
@@ -186,60 +245,122 @@ void MouseWheel(float spin) {
 	camera.Wheel(spin, Shift());
 }
 
-// Initialization
-
-void BufferVertices() {
-	// create GPU buffer, make it active
-	glGenBuffers(1, &vBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-	// allocate/load memory for points and uvs
-	size_t sPoints = points.size() * sizeof(vec3), sUvs = uvs.size() * sizeof(vec2), sNormals = normals.size() * sizeof(vec3);;
-	size_t sTotal = sPoints + sUvs + sNormals;
-	glBufferData(GL_ARRAY_BUFFER, sTotal, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sPoints, points.data());
-	glBufferSubData(GL_ARRAY_BUFFER, sPoints, sUvs, uvs.data());
-	glBufferSubData(GL_ARRAY_BUFFER, sPoints + sUvs, sNormals, normals.data());
-}
-
 // Application
 
+void Keyboard(int key, bool press, bool shift, bool control) {
+	if (press && key == 'M') {
+		materialMode = (materialMode+1)%3;
+		printf("material: %s\n", materialNames[materialMode]);
+		if (materialMode == 1 && !materialRequested[0])
+			materials[0].LoadMetalRough("Tex_Metal_Rough/wood_Mat_Metallic.png", "Tex_Metal_Rough/wood_Mat_Roughness.png",
+				"Tex_Metal_Rough/wood_Mat_Height.png", "Tex_Metal_Rough/wood_Mat_Normal.png", "Tex_Metal_Rough/wood_Mat.packed");
+		if (materialMode == 2 && !materialRequested[1])
+			materials[1].LoadSpecGloss("Tex_Spec_Gloss/wood_Mat_Specular.png", "Tex_Spec_Gloss/wood_Mat_Glossiness.png",
+				"Tex_Spec_Gloss/wood_Mat_Normal.png", "Tex_Spec_Gloss/wood_Mat.packed");
+		if (materialMode > 0)
+			materialRequested[materialMode-1] = true;
+	}
+	if (press && key == 'R') {
+		dynamicResolution = !dynamicResolution;
+		if (!dynamicResolution)
+			dynamicRes.Report();
+		dynamicRes.ResetStats();
+	}
+	if (press && key == 'F')
+		dynamicRes.filter = dynamicRes.filter == DynamicResolution::EdgeAware? DynamicResolution::Bilinear : DynamicResolution::EdgeAware;
+}
+
 void Resize(int width, int height) {
 	camera.Resize(width, height);
 	glViewport(0, 0, width, height);
 }
 
 int main(int ac, char** av) {
-	// read OBJ file
-	if (!ReadAsciiObj(objFilename, points, triangles, &normals, &uvs))
-		printf("cant read %s\n", objFilename);
-	else
-		printf("opened %s\n", objFilename);
-
+	// -target ms: start with dynamic resolution holding ms of GPU time per frame
+	// -resbench [ms]: 300 frames at full resolution, then 600 holding ms (default 8), report, exit
+	//                 nonzero if the target wasn't held
+	// -inflight N: frames the GPU may queue, 1 to 3 (default 2)
+	int benchFrames = 0, status = 0;
+	for (int i = 1; i < ac; i++) {
+		if (!strcmp(av[i], "-inflight") && i+1 < ac)
+			pacer.SetFramesInFlight(atoi(av[++i]));
+		bool bench = !strcmp(av[i], "-resbench");
+		if (bench || !strcmp(av[i], "-target")) {
+			dynamicResolution = true;
+			dynamicRes.targetMs = bench? 8.f : 16.f;
+			if (i+1 < ac && atof(av[i+1]) > 0)
+				dynamicRes.targetMs = (float) atof(av[++i]);
+		}
+		if (bench) {
+			benchFrames = 900;
+			dynamicRes.enabled = false;
+		}
+	}
 	// enable anti-alias, init app window and GL context
 	GLFWwindow* w = InitGLFW(100, 100, winWidth, winHeight, "Bumpy Mesh");
-	// init shader program, set GPU buffer, read texture image
+	// read OBJ file, texture and bump map in background, placeholders until loaded
+	loader.Start(w);
+	loader.LoadMesh(objFilename, &points, &triangles, &normals, &uvs, &vBuffer,
+		[](vector<vec3>& points, vector<vec3>& normals, vector<vec2>& uvs, vector<int3>& triangles) {
+			StandardizePoints(points.data(), (int)points.size(), .8f);
+		});
+	loader.LoadTexture(texFilename, &textureName);
+	loader.LoadTexture(bumpFilename, &bumpName);
+	// init shader program while assets decode
 	program = LinkProgramViaCode(&vertexShader, &pixelShader);
-	Standardize(points.data(), (int)points.size(), .8f);
-
-	BufferVertices();
-	textureName = ReadTexture(texFilename);
-	printf("opened %s\n", texFilename);
-	bumpName = ReadTexture(bumpFilename);
-	printf("opened %s\n", bumpFilename);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "bumpy mesh");
+	uniforms.Init(0);
+	uniforms.Bind(program);
+	uniforms.SetPacer(&pacer);
 
 	// callbacks
 	RegisterMouseMove(MouseMove);
 	RegisterMouseButton(MouseButton);
 	RegisterMouseWheel(MouseWheel);
 	RegisterResize(Resize);
+	RegisterKeyboard(Keyboard);
 	// event loop
 	while (!glfwWindowShouldClose(w)) {
 		glfwPollEvents();
+		pacer.BeginFrame();                      // the frame N ago is done
 		Display(w);
 		glfwSwapBuffers(w);
+		pacer.EndFrame();
+		loader.Update();
+		for (Material &m : materials)
+			m.Update();
+		if (benchFrames && loader.Loaded()) {
+			if (benchFrames == 900)
+				dynamicRes.ResetStats();            // time from when the assets are in
+			if (--benchFrames%600 == 0) {
+				// fixed resolution baseline done, or controlled run done
+				dynamicRes.Report();
+				if (dynamicRes.enabled) {
+					status = !dynamicRes.Held();
+					if (status)
+						printf("FAILED: target %.1f ms not held\n", dynamicRes.targetMs);
+					break;
+				}
+				dynamicRes.ResetStats();
+				dynamicRes.enabled = true;
+			}
+		}
 	}
+	loader.Stop();
+	uniforms.Release();
+	pacer.Report();
+	pacer.Release();
+	dynamicRes.Release();
+	for (Material &m : materials)
+		m.Release();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &vBuffer);
+	DeleteBuffer(vBuffer);
+	DeleteTexture(textureName);                  // after Stop, which zeroes it if still the placeholder
+	DeleteTexture(bumpName);
+	DeleteProgram(program);
+	gpuRegistry.Report();
+	gpuRegistry.DumpLive();                      // anything listed leaked
 	glfwDestroyWindow(w);
 	glfwTerminate();
+	return status;
 }
@@ -1,13 +1,16 @@
 // Assn-7.cpp: Bezier Curve with 4 Control Points by Narissa Tsuboi
 
 #include <vector>
+#include <string.h>
 #include <time.h>
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include "BezierBatch.h"
 #include "Camera.h"
 #include "Draw.h"
 #include "GLXtras.h"
 #include "IO.h"
+#include "SoftRaster.h"
 #include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
@@ -51,13 +54,19 @@ public:
 	}
 
 	vec3 Point(float t) {
-		float t2 = t * t, t3 = t * t2, x = 1 - t, x2 = x * x, x3 = x * x2;
-		return x3 * ctrlPoints[0] + (3 * t * x2) * ctrlPoints[1] + (3 * t2 * x) * ctrlPoints[2] + t3 * ctrlPoints[3];
+		return BezierPosition(ctrlPoints.data(), t);
 	}
 
 	void DrawBezierCurve() {
-		for (int i = 0; i < resolution; i++)  
-			Line(Point((float) (i + 1) / resolution), Point((float) i / resolution), width, curveColor, opacity);
+		// evaluate all curve points in one batch
+		int n = (int) resolution + 1;
+		vector<float> ts(n);
+		vector<vec3> ps(n);
+		for (int i = 0; i < n; i++)
+			ts[i] = (float) i / resolution;
+		BezierPositions(ctrlPoints.data(), ts.data(), n, ps.data());
+		for (int i = 0; i < n - 1; i++)
+			Line(ps[i + 1], ps[i], width, curveColor, opacity);
 	}
 
 	void DrawControlPolygon() {
@@ -76,6 +85,8 @@ public:
 		float t = (float)(sin(2 * PI * elapsedTime / duration) + 1) / 2;
 		Disk(Point(t), dotThickness, dotColor);
 	}
+
+	void DrawSoft(SoftRaster &r);                // the above, in software, dot at t = .5
 };
 
 GLuint program = 0;
@@ -109,6 +120,91 @@ void Display(GLFWwindow* w) {
 	glFlush();
 }
 
+// Software Reference
+// lines and disks as window-space triangles, one Draw per color, each nearer than the last
+// (the GL display draws without depth test, in order)
+
+vector<vec3> softPoints;
+vector<int3> softTriangles;
+float softDepth = 1;
+
+vec2 SoftWindow(vec3 p) {
+	vec4 c = camera.fullview*vec4(p, 1);
+	return vec2((c.x/c.w+1)*winWidth/2, (c.y/c.w+1)*winHeight/2);
+}
+
+void SoftVertex(vec2 w) {
+	// to normalized device coordinates, drawn with identity matrices
+	softPoints.push_back(vec3(2*w.x/winWidth-1, 2*w.y/winHeight-1, 0));
+}
+
+void SoftLine(vec3 p1, vec3 p2, float width) {
+	vec2 a = SoftWindow(p1), b = SoftWindow(p2), d = b-a;
+	float l = length(d);
+	if (l <= 0)
+		return;
+	vec2 n = (width/(2*l))*vec2(-d.y, d.x);
+	int i = (int) softPoints.size();
+	SoftVertex(a-n); SoftVertex(a+n); SoftVertex(b+n); SoftVertex(b-n);
+	softTriangles.push_back(int3(i, i+1, i+2));
+	softTriangles.push_back(int3(i, i+2, i+3));
+}
+
+void SoftDisk(vec3 p, float diameter) {
+	const int nSides = 24;
+	vec2 c = SoftWindow(p);
+	int i = (int) softPoints.size();
+	SoftVertex(c);
+	for (int k = 0; k < nSides; k++) {
+		float a = 2*3.1415927f*k/nSides;
+		SoftVertex(c+(diameter/2)*vec2(cosf(a), sinf(a)));
+	}
+	for (int k = 0; k < nSides; k++)
+		softTriangles.push_back(int3(i, i+1+k, i+1+(k+1)%nSides));
+}
+
+void SoftFlush(SoftRaster &r, vec3 color) {
+	SoftShading shading;
+	shading.amb = 1;                            // no lights: ads = amb, unlit
+	shading.color = color;
+	softDepth -= .1f;
+	for (vec3 &p : softPoints)
+		p.z = softDepth;
+	r.Draw(softPoints, vector<vec3>(), vector<vec2>(), softTriangles, mat4(), mat4(), shading);
+	softPoints.resize(0);
+	softTriangles.resize(0);
+}
+
+void Bezier::DrawSoft(SoftRaster &r) {
+	for (int i = 0; i < nCtrlPoints-1; i++)
+		SoftLine(ctrlPoints[i], ctrlPoints[i+1], width);
+	SoftFlush(r, lineColor);
+	for (int i = 0; i < nCtrlPoints; i++)
+		SoftDisk(ctrlPoints[i], ctrlPointThickness);
+	SoftFlush(r, pointColor);
+	int n = (int) resolution+1;
+	vector<float> ts(n);
+	vector<vec3> ps(n);
+	for (int i = 0; i < n; i++)
+		ts[i] = (float) i/resolution;
+	BezierPositions(ctrlPoints.data(), ts.data(), n, ps.data());
+	for (int i = 0; i < n-1; i++)
+		SoftLine(ps[i+1], ps[i], width);
+	SoftFlush(r, curveColor);
+	SoftDisk(Point(.5f), dotThickness);
+	SoftFlush(r, dotColor);
+}
+
+int SoftRender(const char *imageName, const char *goldenName) {
+	// the curve rendered on the CPU without a GL context; with a golden image, returns 1 if more
+	// than 1% of pixels differ
+	SoftRaster raster;
+	raster.Resize(winWidth, winHeight);
+	raster.Clear(vec3(1, 1, 1));
+	Bezier(cps).DrawSoft(raster);
+	return SoftGolden(raster, imageName, goldenName);
+}
+
 void MouseButton(float x, float y, bool left, bool down) {
 	picked = NULL;
 	if (left && down) {
@@ -144,6 +240,17 @@ void Resize(int width, int height) {
 }
 
 int main(int ac, char** av) {
+	// -soft image.png [-golden reference.png]: render on the CPU and exit, no GPU needed;
+	// nonzero if more than 1% of pixels differ from the golden image
+	const char *softName = NULL, *goldenName = NULL;
+	for (int i = 1; i+1 < ac; i++) {
+		if (!strcmp(av[i], "-soft"))
+			softName = av[++i];
+		else if (!strcmp(av[i], "-golden"))
+			goldenName = av[++i];
+	}
+	if (softName)
+		return SoftRender(softName, goldenName);
 	GLFWwindow* w = InitGLFW(100, 100, winWidth, winHeight, "Bezier Curve - 4 Control Points");
 
 	RegisterMouseMove(MouseMove);
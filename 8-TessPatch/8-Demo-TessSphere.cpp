@@ -2,11 +2,17 @@
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include <string.h>
 #include <Time.h>
+#include "BezierPatch.h"
 #include "Camera.h"
 #include "Draw.h"
 #include "GLXtras.h"
+#include "GPUResources.h"
 #include "IO.h"
+#include "MorphTargets.h"
+#include "PointKernels.h"
+#include "SoftRaster.h"
 #include "Widgets.h"
 
 // display parameters
@@ -19,6 +25,15 @@ GLuint		textureName = 0;
 int			textureUnit = 0;
 const char *textureFilename = "katsbits-rock5/rocks_4.tga";
 
+// Bezier patches (optional, e.g. teapot file given on command line)
+BezierPatches patches;
+bool        cpuPatches = false;                 // CPU-tessellated fallback, for comparison
+
+// morph targets (optional, -morph base.obj [target.obj ...]): the TES blend above, generalized
+MorphMesh   morph;
+GLuint      morphProgram = 0, morphVArray = 0, morphIndices = 0;
+mat4        morphXform;                         // fit to +/- .8
+
 // interaction
 vec3        light(-1.4f, 1.f, 1.f);
 void       *picked = NULL;
@@ -111,25 +126,113 @@ const char *pShader = R"(
 	}
 )";
 
+// morph mesh shaders (vertex buffer written by the morph compute shader)
+const char *morphVShader = R"(
+	#version 330
+	in vec3 point, normal;
+	out vec3 vPoint, vNormal;
+	uniform mat4 modelview, persp;
+	void main() {
+		vPoint = (modelview*vec4(point, 1)).xyz;
+		vNormal = (modelview*vec4(normal, 0)).xyz;
+		gl_Position = persp*vec4(vPoint, 1);
+	}
+)";
+
+const char *morphPShader = R"(
+	#version 330
+	in vec3 vPoint, vNormal;
+	out vec4 pColor;
+	uniform vec3 light, color = vec3(.8, .6, .3);
+	void main() {
+		vec3 N = normalize(vNormal);
+		vec3 L = normalize(light-vPoint), E = normalize(vPoint), R = reflect(L, N);
+		float dif = abs(dot(N, L)), spec = pow(max(0, dot(E, R)), 50);
+		pColor = vec4((.15+.85*dif)*color+vec3(spec), 1);
+	}
+)";
+
+// morph targets
+
+void AddBulgeTargets(int nTargets) {
+	// no target files: smooth bulges along the normal around random vertices
+	vector<vec3> points, normals;
+	morph.Evaluate(points, normals);
+	vec3 min, max;
+	PointBounds(points.data(), (int) points.size(), min, max);
+	float radius = .25f*length(max-min);
+	srand(1);
+	for (int t = 0; t < nTargets; t++) {
+		vec3 c = points[rand()%points.size()];
+		vector<int> vertices;
+		vector<vec3> dPoints;
+		for (int i = 0; i < (int) points.size(); i++) {
+			float d = length(points[i]-c)/radius;
+			if (d < 1) {
+				vertices.push_back(i);
+				dPoints.push_back(.3f*radius*(1-d*d)*(1-d*d)*normals[i]);
+			}
+		}
+		morph.AddSparseTarget(vertices, dPoints, vector<vec3>());
+	}
+}
+
+bool ReadMorph(int nFiles, char **files) {
+	if (nFiles < 1 || !morph.ReadBase(files[0]))
+		return false;
+	for (int i = 1; i < nFiles; i++)
+		morph.AddTarget(files[i], 1e-5f);
+	if (!morph.NTargets())
+		AddBulgeTargets(16);
+	vector<vec3> points, normals;
+	morph.Evaluate(points, normals);
+	vec3 min, max;
+	float extent = PointBounds(points.data(), (int) points.size(), min, max);
+	morphXform = Scale(1.6f/extent)*Translate(-.5f*(min+max));
+	morphProgram = LinkProgramViaCode(&morphVShader, &morphPShader);
+	gpuRegistry.Track(GPURegistry::Program, morphProgram, 0, "morph mesh");
+	printf("morph: %i vertices, %i targets, %i deltas (%.1f per target)\n", morph.NVertices(), morph.NTargets(),
+		   morph.NDeltas(), (float) morph.NDeltas()/morph.NTargets());
+	return true;
+}
+
+void DrawMorph(float time, vec3 xLight) {
+	// weights clamped sine waves, so at any moment about half the targets are skipped
+	for (int t = 0; t < morph.NTargets(); t++) {
+		float w = sin(2*PI*time/duration+1.7f*t);
+		morph.SetWeight(t, w > 0? w : 0);
+	}
+	morph.Update();
+	if (!morphVArray) {                             // output buffer exists after first update
+		glGenVertexArrays(1, &morphVArray);
+		glBindVertexArray(morphVArray);
+		glBindBuffer(GL_ARRAY_BUFFER, morph.VertexBuffer());
+		glGenBuffers(1, &morphIndices);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, morphIndices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, morph.triangles.size()*sizeof(int3), morph.triangles.data(), GL_STATIC_DRAW);
+		gpuRegistry.Track(GPURegistry::Buffer, morphIndices, morph.triangles.size()*sizeof(int3), "morph triangles");
+		glUseProgram(morphProgram);
+		VertexAttribPointer(morphProgram, "point", 3, 0, (void *) 0);
+		VertexAttribPointer(morphProgram, "normal", 3, 0, (void *) (morph.NVertices()*sizeof(vec3)));
+	}
+	glUseProgram(morphProgram);
+	glBindVertexArray(morphVArray);
+	SetUniform(morphProgram, "modelview", camera.modelview*morphXform);
+	SetUniform(morphProgram, "persp", camera.persp);
+	SetUniform(morphProgram, "light", xLight);
+	glDrawElements(GL_TRIANGLES, 3*(int) morph.triangles.size(), GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
+
 // display
 
-void Display(GLFWwindow *w) {
-	float elapsedTime = (float)(clock() - startTime) / CLOCKS_PER_SEC;
-	float alpha = (float)(sin(2 * PI * elapsedTime / duration) + 1) / 2;
-	// background, zbuffer, anti-alias lines
-	glClearColor(.6f, .6f, .6f, 1);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND);
+void DrawSphere(float alpha, vec3 xLight) {
 	glUseProgram(program);
 	// set alpha for interpolation between shapes
 	SetUniform(program, "alpha", alpha);
 	// send matrices to vertex shader
 	SetUniform(program, "modelview", camera.modelview);
 	SetUniform(program, "persp", camera.persp);
-	// send transformed light to pixel shader
-	vec3 xLight = Vec3(camera.modelview*vec4(light, 1));
 	SetUniform(program, "light", xLight);
 	// set texture
 	glActiveTexture(GL_TEXTURE0+textureUnit);       // active texture corresponds with textureUnit
@@ -141,6 +244,25 @@ void Display(GLFWwindow *w) {
 	glPatchParameterfv(GL_PATCH_DEFAULT_OUTER_LEVEL, outerLevels);
 	glPatchParameterfv(GL_PATCH_DEFAULT_INNER_LEVEL, innerLevels);
 	glDrawArrays(GL_PATCHES, 0, 4);
+}
+
+void Display(GLFWwindow *w) {
+	float elapsedTime = (float)(clock() - startTime) / CLOCKS_PER_SEC;
+	float alpha = (float)(sin(2 * PI * elapsedTime / duration) + 1) / 2;
+	// background, zbuffer, anti-alias lines
+	glClearColor(.6f, .6f, .6f, 1);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_BLEND);
+	// send transformed light to pixel shader
+	vec3 xLight = Vec3(camera.modelview*vec4(light, 1));
+	if (morph.NVertices())
+		DrawMorph(elapsedTime, xLight);
+	else if (patches.NPatches())                    // patch files are z-up
+		patches.Draw(camera.modelview*RotateX(-90), camera.persp, xLight, vec3(.8f, .6f, .3f), cpuPatches);
+	else
+		DrawSphere(alpha, xLight);
 	// draw arcball, light
 	glDisable(GL_DEPTH_TEST);
 	if (glfwGetMouseButton(w, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && picked == &camera)
@@ -150,6 +272,59 @@ void Display(GLFWwindow *w) {
 	glFlush();
 }
 
+// software reference
+
+void TessellateSphere(int res, float alpha, vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	// teShader over a (res+1) x (res+1) grid of tessellation coordinates (innerRadius 1)
+	for (int j = 0; j <= res; j++)
+		for (int i = 0; i <= res; i++) {
+			float u = (float) i/res, v = (float) j/res, a = 2*PI*u, c = cos(a), s = sin(a), angle = PI*v-PI/2;
+			vec2 p1(cos(angle), sin(angle)), n1 = p1;                     // SemiCircle
+			vec2 p2(1-v, 2*v-1), n2 = normalize(vec2(2, -1));             // Slant
+			vec2 p = p1+alpha*(p2-p1), n = n1+alpha*(n2-n1);
+			points.push_back(vec3(c*p.x, p.y, s*p.x));                    // RotateAboutY
+			normals.push_back(normalize(vec3(c*n.x, n.y, s*n.x)));
+			uvs.push_back(vec2(u, v));
+		}
+	for (int j = 0; j < res; j++)
+		for (int i = 0; i < res; i++) {
+			int k = j*(res+1)+i;
+			triangles.push_back(int3(k, k+1, k+res+2));
+			triangles.push_back(int3(k, k+res+2, k+res+1));
+		}
+}
+
+vec3 TessShader(const SoftFragment &f, const SoftShading &s) {
+	// as pShader: one-sided diffuse, white highlight added to the textured color
+	vec3 L = normalize(s.lights[0]-f.point), E = normalize(f.point), R = L-2*dot(f.normal, L)*f.normal;
+	float dif = fmaxf(0, dot(f.normal, L)), spec = powf(fmaxf(0, dot(E, R)), s.shininess);
+	return fminf(1, s.amb+dif)*s.texture->Sample(f.uv)+vec3(spec, spec, spec);
+}
+
+int SoftRender(const char *imageName, const char *goldenName) {
+	// the sphere's first frame (alpha .5) on the CPU without a GL context (light not drawn);
+	// with a golden image, returns 1 if more than 1% of pixels differ
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	TessellateSphere(64, .5f, points, normals, uvs, triangles);
+	SoftTexture texture;
+	if (!texture.Read(textureFilename))
+		printf("can't read %s\n", textureFilename);
+	SoftShading shading;
+	shading.nLights = 1;
+	shading.lights[0] = Vec3(camera.modelview*vec4(light, 1));
+	shading.amb = .15f;
+	shading.shininess = 50;
+	shading.texture = &texture;
+	shading.shader = TessShader;
+	SoftRaster raster;
+	raster.Resize(winWidth, winHeight);
+	raster.Clear(vec3(.6f, .6f, .6f));
+	raster.Draw(points, normals, uvs, triangles, camera.modelview, camera.persp, shading);
+	return SoftGolden(raster, imageName, goldenName);
+}
+
 // mouse callbacks
 
 void MouseButton(float x, float y, bool left, bool down) {
@@ -179,6 +354,17 @@ void MouseWheel(float spin) {
 	camera.Wheel(spin, Shift());
 }
 
+// keyboard
+
+void Keyboard(int key, bool press, bool shift, bool control) {
+	if (press && key == 'M' && morph.NVertices())
+		printf("morph: %i of %i targets applied\n", morph.NActive(), morph.NTargets());
+	if (press && key == 'C' && patches.NPatches()) {
+		printf("%s tessellation: %i triangles\n", cpuPatches? "CPU" : "GPU", patches.Triangles());
+		cpuPatches = !cpuPatches;
+	}
+}
+
 // application
 
 void Resize(int width, int height) {
@@ -187,21 +373,65 @@ void Resize(int width, int height) {
 }
 
 int main(int ac, char **av) {
+	// -soft image.png [-golden reference.png]: render the sphere on the CPU and exit, no GPU
+	// needed; nonzero if more than 1% of pixels differ from the golden image
+	const char *softName = NULL, *goldenName = NULL;
+	for (int i = 1; i+1 < ac; i++) {
+		if (!strcmp(av[i], "-soft"))
+			softName = av[++i];
+		else if (!strcmp(av[i], "-golden"))
+			goldenName = av[++i];
+	}
+	if (softName)
+		return SoftRender(softName, goldenName);
 	// init app window, OpenGL, shader program, texture
 	GLFWwindow *w = InitGLFW(100, 100, winWidth, winHeight, "Tessellate a Sphere");
 	program = LinkProgramViaCode(&vShader, NULL, &teShader, NULL, &pShader);
 	textureName = ReadTexture(textureFilename);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "tessellated sphere");
+	gpuRegistry.Track(GPURegistry::Texture, textureName, TextureBytes(textureName), textureFilename);
+	// -morphbench: time morph target evaluation, then exit, nonzero if GPU and CPU results differ
+	if (ac > 1 && !strcmp(av[1], "-morphbench")) {
+		int nFailed = MorphBenchmark();
+		DeleteTexture(textureName);
+		DeleteProgram(program);
+		glfwDestroyWindow(w);
+		glfwTerminate();
+		return nFailed != 0;
+	}
+	// -morph base.obj [target.obj ...]: blend OBJ targets (or generated bulges)
+	if (ac > 2 && !strcmp(av[1], "-morph") && ReadMorph(ac-2, av+2))
+		printf("M prints active targets\n");
+	// optional Bezier patch file, eg teapot
+	else if (ac > 1 && av[1][0] != '-') {
+		if (patches.Read(av[1])) {
+			patches.Standardize(.8f);
+			printf("read %i patches from %s, C toggles CPU/GPU tessellation\n", patches.NPatches(), av[1]);
+		}
+		else
+			printf("can't read %s\n", av[1]);
+	}
 	// callbacks
 	RegisterMouseMove(MouseMove);
 	RegisterMouseButton(MouseButton);
 	RegisterMouseWheel(MouseWheel);
 	RegisterResize(Resize);
+	RegisterKeyboard(Keyboard);
 	// event loop
 	while (!glfwWindowShouldClose(w)) {
 		Display(w);
 		glfwPollEvents();
 		glfwSwapBuffers(w);
 	}
+	patches.Release();
+	morph.Release();
+	DeleteBuffer(morphIndices);
+	if (morphVArray)
+		glDeleteVertexArrays(1, &morphVArray);
+	DeleteProgram(morphProgram);
+	DeleteTexture(textureName);
+	DeleteProgram(program);
+	gpuRegistry.DumpLive();
 	glfwDestroyWindow(w);
 	glfwTerminate();
 }
@@ -2,11 +2,27 @@
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
+#include <string.h>
+#include <chrono>
+#include "AssetLoader.h"
+#include "BezierBatch.h"
 #include "Camera.h"
+#include "Culling.h"
 #include "Draw.h"
+#include "Fleet.h"
+#include "FrameCapture.h"
+#include "FramePacer.h"
+#include "FrameTable.h"
+#include "GLState.h"
 #include "GLXtras.h"
+#include "GPUResources.h"
 #include "IO.h"
+#include "JobPool.h"
+#include "MatKernels.h"
 #include "Misc.h"
+#include "ScenePack.h"
+#include "SharedUniforms.h"
+#include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
 
@@ -16,7 +32,16 @@ const char* bodyObjectFilename = "Airplane-Body.obj";
 const char* propObjectFilename = "Airplane-Propeller.obj";
 
 // OpenGL IDs
-GLuint		 program = 0;
+GLuint		 program = 0, uboProgram = 0, packProgram = 0;  // per-mesh uniforms, per-mesh blocks, packed
+GLuint		 fleetProgram = 0;                              // instanced, matrices from the fleet buffer
+
+// per-frame (camera, lights) and per-object uniform blocks; U toggles glUniform calls per mesh
+SharedUniforms uniforms;
+bool		 uniformBlocks = true;
+
+// N frames in flight (N cycles 1-3), per-frame uniforms and flight path in the pacer's slot
+FramePacer	 pacer;
+PacedLines	 pathLines;
 
 // window, camera
 int          winWidth = 800, winHeight = 800;
@@ -24,52 +49,132 @@ Camera		 camera(0, 0, winWidth, winHeight, vec3(0, 0, 0), vec3(0, 0, -4.5f), 30,
 vec3		 charcoalGrey(34.0f / 255.0f, 34.0f / 255.0f, 34.0f / 255.0f), hotPink(255.0f / 255.0f, 105.0f / 255.0f, 180.0f / 255.0f), 
 			 grn(.1f, .6f, .1f), orange(255.0f / 255.0f, 165.0f / 255.0f, 0.0f), blu(0, 0, 1);
 
+// background loading
+AssetLoader	 loader;
+
 struct Mesh {
 	vector<vec3> points, normals;  // from .obj file
 	vector<vec2> uvs;              // from .obj file
 	vector<int3> triangles;        // from .obj file
 	mat4 toWorld;                  // object-to-world transformation
-	GLuint vBuffer = 0;            // GPU vertex buffer
+	GLuint vBuffer = 0;            // GPU vertex buffer, 0 if evicted
+	GLuint cached = 0;             // vBuffer as last registered for eviction
+	const char *filename = "";
+	vec4 sphere;                   // object-space bounds (center, radius)
+	size_t nBounded = 0;           // points.size() when sphere computed
+	int packId = -1;               // mesh index in scene pack
+	size_t nPacked = 0;            // points.size() when packed
 
 	int textureUnit = 0;
 
 	void Read(const char* objFileName) {
-		if (!ReadAsciiObj(objFileName, points, triangles, &normals, &uvs))
-			printf("can't read %s\n", bodyObjectFilename);
+		// decoded and buffered (points, normals) in background, placeholder until loaded
+		filename = objFileName;
+		loader.LoadMesh(objFileName, &points, &triangles, &normals, NULL, &vBuffer);
+	}
+
+	void Rebuffer() {
+		// evicted under the GPU budget: the CPU copy is still here
+		size_t sPoints = points.size()*sizeof(vec3), sNormals = normals.size()*sizeof(vec3);
 		glGenBuffers(1, &vBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-		int sPoints = points.size() * sizeof(vec3), sNormals = normals.size() * sizeof(vec3);
-		glBufferData(GL_ARRAY_BUFFER, sPoints + sNormals, NULL, GL_STATIC_DRAW);
+		glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
+		glBufferData(GL_ARRAY_BUFFER, sPoints+sNormals, NULL, GL_STATIC_DRAW);
 		glBufferSubData(GL_ARRAY_BUFFER, 0, sPoints, points.data());
 		glBufferSubData(GL_ARRAY_BUFFER, sPoints, sNormals, normals.data());
+		gpuRegistry.Track(GPURegistry::Buffer, vBuffer, sPoints+sNormals, filename);
+	}
+
+	vec4 Bounds() {
+		// recomputed when the loaded mesh replaces the placeholder
+		if (nBounded != points.size()) {
+			sphere = BoundingSphere(points);
+			nBounded = points.size();
+		}
+		return sphere;
 	}
 
 	void Render(const vec3 color) {
-		glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
-		VertexAttribPointer(program, "point", 3, 0, (void*)0);
-		VertexAttribPointer(program, "normal", 3, 0, (void*)(points.size() * sizeof(vec3)));
-		SetUniform(program, "modelview", camera.modelview * toWorld);
-		SetUniform(program, "persp", camera.persp);
-		SetUniform(program, "color", color);
+		Render(color, toWorld);
+	}
+
+	void Bind(GLuint p) {
+		if (!vBuffer)
+			Rebuffer();
+		if (vBuffer != cached) {                           // new placeholder, load or rebuffer
+			gpuRegistry.Cache(GPURegistry::Buffer, &vBuffer);
+			cached = vBuffer;
+		}
+		gpuRegistry.Touch(GPURegistry::Buffer, vBuffer);
+		glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);      // filtered for meshes sharing a buffer
+		VertexAttribPointer(p, "point", 3, 0, (void*)0);
+		VertexAttribPointer(p, "normal", 3, 0, (void*)(points.size() * sizeof(vec3)));
+	}
+
+	void Render(const vec3 color, mat4 m) {
+		GLuint p = uniformBlocks? uboProgram : program;
+		Bind(p);
+		if (uniformBlocks)
+			uniforms.BindObject(uniforms.AddObject(m, color));
+		else {
+			SetUniform(program, "modelview", camera.modelview * m);
+			SetUniform(program, "persp", camera.persp);
+			SetUniform(program, "color", color);
+		}
 		glDrawElements(GL_TRIANGLES, 3 * triangles.size(), GL_UNSIGNED_INT, triangles.data());
 	}
+
+	void RenderInstances(GLuint p, const vec3 color, int n) {
+		// per-instance matrices from the SSBO bound by Fleet::Bind
+		Bind(p);
+		SetUniform(p, "color", color);
+		glDrawElementsInstanced(GL_TRIANGLES, 3 * triangles.size(), GL_UNSIGNED_INT, triangles.data(), n);
+	}
 };
 Mesh body, prop;  
 
+// scene objects, culled before drawing; -scene N adds N static objects
+struct Object {
+	Mesh *mesh;
+	mat4 toWorld;
+	vec3 color;
+};
+vector<Object> scenery, objects;             // objects: plane parts + scenery, rebuilt per frame
+
+// -scene N a.obj b.obj ...: scenery meshes, each in its own vertex buffer, assigned to grid
+// columns; meshes out of view aren't drawn, so under -budget their buffers are evicted
+// (without files, scenery is the body)
+vector<Mesh *> sceneryMeshes;
+
+// culling
+Frustum		 frustum;
+HiZ			 hiZ;
+bool		 occlusionCulling = true;
+CullStats	 cullStats;
+vector<float> sx, sy, sz, sr;                // world bounding spheres, SoA
+vector<unsigned char> inFrustum;
+
+// drawing: one multi-draw-indirect for all objects (P toggles per-mesh draws), G culls on GPU
+ScenePack	 pack;
+bool		 packed = true, gpuCulling = false;
+
 class Bezier {
 public:
 	vec3* pts = NULL;					 // pointer to four control points
 	Bezier(vec3* pts) : pts(pts) { }
 	vec3 Position(float t) {
 		// curve starts at t = 0, ends at t = 1
-		float t2 = t * t, t3 = t * t2;
-		return (-t3 + 3 * t2 - 3 * t + 1) * pts[0] + (3 * t3 - 6 * t2 + 3 * t) * pts[1] + (3 * t2 - 3 * t3) * pts[2] + t3 * pts[3];
+		return BezierPosition(pts, t);
 	}
 	void Draw(int res = 50, float curveWidth = 3.5f, float meshWidth = 2.5f) {
 		vec3 lineColor = charcoalGrey, meshColor = charcoalGrey, pointColor = grn;
-		// draw curve as res number of straight segments
+		// evaluate res+1 curve points in one batch, draw as res straight segments
+		vector<float> ts(res+1);
+		vector<vec3> ps(res+1);
+		for (int i = 0; i <= res; i++)
+			ts[i] = (float)i / res;
+		BezierPositions(pts, ts.data(), res+1, ps.data());
 		for (int i = 0; i < res; i++)
-			Line(Position((float)i / res), Position((float)(i + 1) / res), curveWidth, lineColor);
+			pathLines.Add(ps[i], ps[i + 1], curveWidth, lineColor);
 		// draw control mesh
 		for (int i = 0; i < 3; i++)
 			LineDash(pts[i], pts[i + 1], meshWidth, meshColor, meshColor);
@@ -78,20 +183,12 @@ public:
 			Disk(pts[i], 5 * curveWidth, pointColor);
 	}
 	vec3 Velocity(float t) {
-		float t2 = t * t;
-		// compute derivative of curve
-		return (-3 * t2 + 6 * t - 3) * pts[0] + (9 * t2 - 12 * t + 3) * pts[1] + (6 * t - 9 * t2) * pts[2] + 3 * t2 * pts[3];
+		// derivative of curve
+		return BezierVelocity(pts, t);
 	}
 	mat4 Frame(float t) {
-		vec3 p = Position(t), v = normalize(Velocity(t)), n = normalize(cross(v, vec3(0, 1, 0)));
-		vec3 b = normalize(cross(n, v));
-		mat4 m = mat4(
-			vec4(n[0], b[0], -v[0], p[0]),
-			vec4(n[1], b[1], -v[1], p[1]),
-			vec4(n[2], b[2], -v[2], p[2]),
-			vec4(0, 0, 0, 1)
-		);
-		return m;
+		// columns: side, up, -velocity, position
+		return BezierFrame(pts, t);
 	}
 };
 vec3 path[] = {
@@ -105,7 +202,21 @@ const int nPath = sizeof(path) / sizeof(vec3) - 1;                         // sk
 Bezier bezier[] = { Bezier(&path[0]), Bezier(&path[3]), Bezier(&path[6]), Bezier(&path[9]) };
 const int nBezier = sizeof(bezier) / sizeof(Bezier);
 
-time_t startTime = clock();                                      // app start time
+FrameTable frames;                                               // rotation-minimizing frames along path
+
+// -fleet N: N small planes on lanes around the path, animated across all cores each frame
+const int  nLanes = 4;
+vec3	   lanes[nLanes][nPath+1];                                // path scaled out and raised
+FrameTable laneFrames[nLanes];
+Fleet	   fleet;
+JobPool	  *fleetPool = NULL;
+double	   fleetMs = 0;                                           // CPU time in Fleet::Update
+
+FrameClock frameClock;                                           // real time, fixed steps when recording
+
+FrameCapture capture;                                            // -record
+bool recording = false;
+int recordFrames = 0;                                            // 0: one flight around the path
 float duration = 3;                                              // time to fly path 
 
 
@@ -124,22 +235,97 @@ Mover		mover;
 const char *vertexShader = R"(
 	#version 130
 	in vec3 point, normal;
-	out vec3 vPoint, vNormal;
+	out vec3 vPoint, vNormal, vColor;
 	uniform mat4 modelview, persp;
+	uniform vec3 color;
 	void main() {
 		vPoint = (modelview*vec4(point, 1)).xyz;
 		vNormal = (modelview*vec4(normal, 0)).xyz;
+		vColor = color;
+		gl_Position = persp*vec4(vPoint, 1);
+	}
+)";
+
+const char *uboVertexShader = R"(
+	#version 330
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
+	layout(std140, row_major) uniform Object { mat4 objectModelview; vec4 objectColor; };
+	in vec3 point, normal;
+	out vec3 vPoint, vNormal, vColor;
+	void main() {
+		vPoint = (objectModelview*vec4(point, 1)).xyz;
+		vNormal = (objectModelview*vec4(normal, 0)).xyz;
+		vColor = objectColor.rgb;
+		gl_Position = persp*vec4(vPoint, 1);
+	}
+)";
+
+const char *packVertexShader = R"(
+	#version 460
+	struct Object { mat4 toWorld; vec4 color; vec4 sphere; ivec4 mesh; };
+	layout(std430, binding = 0, row_major) readonly buffer Objects { Object objects[]; };
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
+	in vec3 point, normal;
+	out vec3 vPoint, vNormal, vColor;
+	void main() {
+		Object o = objects[gl_DrawID];
+		mat4 m = modelview*o.toWorld;
+		vPoint = (m*vec4(point, 1)).xyz;
+		vNormal = (m*vec4(normal, 0)).xyz;
+		vColor = o.color.rgb;
+		gl_Position = persp*vec4(vPoint, 1);
+	}
+)";
+
+const char *fleetVertexShader = R"(
+	#version 430
+	layout(std430, binding = 3, row_major) readonly buffer Fleet { mat4 fleet[]; };
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
+	in vec3 point, normal;
+	out vec3 vPoint, vNormal, vColor;
+	uniform vec3 color;
+	void main() {
+		mat4 m = modelview*fleet[gl_InstanceID];
+		vPoint = (m*vec4(point, 1)).xyz;
+		vNormal = (m*vec4(normal, 0)).xyz;
+		vColor = color;
 		gl_Position = persp*vec4(vPoint, 1);
 	}
 )";
 
 const char *pixelShader = R"(
-	#version 130
-	in vec3 vPoint, vNormal;
-	uniform int nLights = 0;
+	#version 330
+	layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
+	in vec3 vPoint, vNormal, vColor;
+	uniform float amb = .1, dif = .7, spc =.7;		// ambient, diffuse, specular
+	uniform bool highlights = true;
+	out vec4 pColor;
+	void main() {
+		float d = 0, s = 0;							// diffuse, specular terms
+		vec3 N = normalize(vNormal);				// surface normal
+		vec3 E = normalize(vPoint);					// eye vector
+		for (int i = 0; i < nLights; i++) {
+			vec3 L = normalize(lights[i].xyz-vPoint);	// light vector
+			vec3 R = reflect(L, N);					// highlight vector
+			d += max(0, dot(N, L));					// one-sided diffuse
+			if (highlights) {
+				float h = max(0, dot(R, E));		// highlight term
+				s += pow(h, 100);					// specular term
+			}
+		}
+		float ads = clamp(amb+dif*d+spc*s, 0, 1);
+		pColor = vec4(ads*vColor, 1);
+	}
+)";
+
+// for the glUniform path: default-block lights, as a named block's members would clash with
+// vertexShader's modelview and persp
+const char *legacyPixelShader = R"(
+	#version 330
 	uniform vec3 lights[20];
+	uniform int nLights = 0;
+	in vec3 vPoint, vNormal, vColor;
 	uniform float amb = .1, dif = .7, spc =.7;		// ambient, diffuse, specular
-	uniform vec3 color;
 	uniform bool highlights = true;
 	out vec4 pColor;
 	void main() {
@@ -156,34 +342,160 @@ const char *pixelShader = R"(
 			}
 		}
 		float ads = clamp(amb+dif*d+spc*s, 0, 1);
-		pColor = vec4(ads*color, 1);
+		pColor = vec4(ads*vColor, 1);
 	}
 )";
 
+// culling
+
+void SyncPack() {
+	// meshes repacked when loaded over their placeholders, objects mirrored each frame
+	vector<Mesh *> meshes = { &body, &prop };
+	meshes.insert(meshes.end(), sceneryMeshes.begin(), sceneryMeshes.end());
+	for (Mesh *m : meshes)
+		if (m->packId < 0 || m->nPacked != m->points.size()) {
+			if (m->packId < 0)
+				m->packId = pack.AddMesh(m->points, m->normals, m->triangles);
+			else
+				pack.SetMesh(m->packId, m->points, m->normals, m->triangles);
+			m->nPacked = m->points.size();
+		}
+	if (pack.NObjects() != (int) objects.size()) {
+		pack.ClearObjects();
+		for (Object &o : objects)
+			pack.AddObject(o.mesh->packId, o.toWorld, o.color);
+	}
+	else
+		for (int i = 0; i < (int) objects.size(); i++)
+			pack.SetObject(i, objects[i].toWorld, objects[i].color);
+}
+
+void DrawObjects() {
+	objects.resize(0);
+	objects.push_back({&body, body.toWorld, hotPink});
+	objects.push_back({&prop, prop.toWorld, blu});
+	objects.insert(objects.end(), scenery.begin(), scenery.end());
+	int n = (int) objects.size();
+	if (packed)
+		SyncPack();
+	if (packed && gpuCulling) {
+		// compute shader writes the commands and counts them; the count shown is a few frames old
+		pack.CullAndDraw(packProgram, camera.persp*camera.modelview);
+		cullStats.objects = n;
+		cullStats.drawn = pack.NVisible();
+		cullStats.frustumCulled = n-cullStats.drawn;
+		cullStats.occluded = 0;
+		return;
+	}
+	sx.resize(n); sy.resize(n); sz.resize(n); sr.resize(n);
+	inFrustum.resize(n);
+	for (int i = 0; i < n; i++) {
+		vec4 s = TransformSphere(objects[i].toWorld, objects[i].mesh->Bounds());
+		sx[i] = s.x; sy[i] = s.y; sz[i] = s.z; sr[i] = s.w;
+	}
+	// batched frustum test, then previous frame's depth pyramid for the survivors
+	frustum.Set(camera.persp*camera.modelview);
+	int nVisible = frustum.Visible(sx.data(), sy.data(), sz.data(), sr.data(), n, inFrustum.data());
+	cullStats.objects = n;
+	cullStats.frustumCulled = n-nVisible;
+	cullStats.occluded = cullStats.drawn = 0;
+	for (int i = 0; i < n; i++) {
+		bool visible = inFrustum[i] != 0;
+		if (visible && occlusionCulling && hiZ.Occluded(vec4(sx[i], sy[i], sz[i], sr[i]))) {
+			cullStats.occluded++;
+			visible = false;
+		}
+		cullStats.drawn += visible;
+		if (packed)
+			pack.SetVisible(i, visible);
+		else if (visible)
+			objects[i].mesh->Render(objects[i].color, objects[i].toWorld);
+	}
+	if (packed)
+		pack.Draw(packProgram);
+}
+
+void DrawFleet() {
+	// two instanced draws, bodies then propellers, matrices already in this frame's region
+	int n = fleet.instances.N();
+	if (!n || !fleetProgram)
+		return;
+	glState.UseProgram(fleetProgram);
+	fleet.Bind(0);
+	body.RenderInstances(fleetProgram, orange, n);
+	fleet.Bind(1);
+	prop.RenderInstances(fleetProgram, charcoalGrey, n);
+}
+
+const char *DrawMode() {
+	return !packed? uniformBlocks? "per-mesh draws, uniform blocks" : "per-mesh draws, glUniform" :
+		   gpuCulling? "GPU culled multi-draw" : "multi-draw";
+}
+
 void Display(GLFWwindow *w) {
 	// clear screen, enable blend, z-buffer
 	glClearColor(1, 1, 1, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	// enable shader program and GPU buffer, update matrices
-	glUseProgram(program);
-	// send transformed lights
-	vec3 xLights[nLights];
-	for (int i = 0; i < nLights; i++) {
-		vec4 xLight = camera.modelview*vec4(lights[i]);
-		xLights[i] = vec3(xLight.x, xLight.y, xLight.z);
-	}
-	SetUniform(program, "nLights", nLights);
-	SetUniform3v(program, "lights", nLights, (float *) xLights);
-	// render plane parts
-	body.Render(hotPink);
-	prop.Render(blu);
+	glState.Invalidate();                                        // Draw.h, Text.h bypass the cache
+	glState.ResetCounts();
+	glState.Enable(GL_DEPTH_TEST);
+	// camera and transformed lights, written once for all programs
+	uniforms.BeginFrame(camera.modelview, camera.persp, lights, nLights);
+	// enable shader program (per-mesh uniform path sets matrices per draw)
+	glState.UseProgram(packed? packProgram : uniformBlocks? uboProgram : program);
+	if (!packed && !uniformBlocks) {
+		vec3 xLights[nLights];
+		TransformPoints(camera.modelview, lights, xLights, nLights);
+		SetUniform(program, "nLights", nLights);
+		SetUniform3v(program, "lights", nLights, (float *) xLights);
+	}
+	// render plane parts and scenery that survive culling, keep depth for next frame's occlusion test
+	if (occlusionCulling)
+		hiZ.Begin();                                             // draw into the HiZ target
+	DrawObjects();
+	DrawFleet();
+	if (occlusionCulling)
+		hiZ.Capture(camera.persp*camera.modelview);
 	// draw flight path
 	UseDrawShader(camera.fullview);
 	for (int i = 0; i < 4; i++) {
 		bezier[i].Draw();
 	}
-	glFlush();
+	pathLines.Draw(camera.fullview);                             // all curve segments, one call
+	Text(10, 10, charcoalGrey, 8, "%i objects: %i outside frustum, %i occluded%s, %i drawn (%s)", cullStats.objects,
+		 cullStats.frustumCulled, cullStats.occluded, occlusionCulling && !(packed && gpuCulling)? "" : " (off)", cullStats.drawn,
+		 DrawMode());
+	Text(10, 30, charcoalGrey, 8, "GL state calls: %i issued, %i filtered", glState.issued, glState.filtered);
+	if (fleet.instances.N())
+		Text(10, 50, charcoalGrey, 8, "fleet: %i planes, %i threads", fleet.instances.N(), fleetPool->NThreads());
+	uniforms.EndFrame();
+}
+
+// Fleet
+
+void UpdateLanes() {
+	// lanes follow the path as it's edited
+	for (int k = 0; k < nLanes; k++) {
+		for (int i = 0; i <= nPath; i++)
+			lanes[k][i] = (1+.15f*(k+1))*path[i]+vec3(0, .08f*(k+1), 0);
+		laneFrames[k].Invalidate();
+	}
+}
+
+void StartFleet(int n) {
+	// spread evenly along each lane (golden ratio phases), speeds within 20% of the hero plane's
+	UpdateLanes();
+	for (int k = 0; k < nLanes; k++) {
+		laneFrames[k].Build(lanes[k], nBezier, true);
+		fleet.paths.push_back(&laneFrames[k]);
+	}
+	for (int i = 0; i < n; i++) {
+		float phase = fmod(.618034f * i, 1.f), jitter = fmod(.754878f * i, 1.f);
+		fleet.instances.Add(i % nLanes, phase, (.8f + .4f * jitter) / duration);
+	}
+	fleet.bodyLocal = Scale(.06f) * RotateY(-90);
+	fleet.propLocal = Translate(-.6f, 0, 0) * RotateY(-90) * Scale(.25f);
+	fleetPool = new JobPool();
 }
 
 // Mouse Handlers
@@ -197,6 +509,12 @@ void MouseButton(float x, float y, bool left, bool down) {
 				picked = &mover;
 				mover.Down(&lights[i], (int) x, (int) y, camera.modelview, camera.persp);
 			}
+		// path control point picked?
+		for (int i = 0; i < nPath && picked == NULL; i++)
+			if (MouseOver(x, y, path[i], camera.fullview)) {
+				picked = &mover;
+				mover.Down(&path[i], (int) x, (int) y, camera.modelview, camera.persp);
+			}
 		if (picked == NULL) {
 			picked = &camera;
 			camera.Down(x, y, Shift());
@@ -207,8 +525,14 @@ void MouseButton(float x, float y, bool left, bool down) {
 
 void MouseMove(float x, float y, bool leftDown, bool rightDown) {
 	if (leftDown) {
-		if (picked == &mover)
+		if (picked == &mover) {
 			mover.Drag((int) x, (int) y, camera.modelview, camera.persp);
+			if (mover.point >= path && mover.point < path + nPath) {
+				path[nPath] = path[0];                       // keep path closed
+				frames.Invalidate();                         // rebuild frame table on next lookup
+				UpdateLanes();
+			}
+		}
 		if (picked == &camera)
 			camera.Drag(x, y);
 	}
@@ -220,44 +544,203 @@ void MouseWheel(float spin) {
 
 // Application
 
+void Keyboard(int key, bool press, bool shift, bool control) {
+	if (press && key == 'O') {
+		occlusionCulling = !occlusionCulling;
+		printf("occlusion culling %s\n", occlusionCulling? "on" : "off");
+	}
+	if (press && key == 'P')
+		packed = !packed && packProgram;
+	if (press && key == 'G')
+		gpuCulling = !gpuCulling;
+	if (press && key == 'U')
+		uniformBlocks = !uniformBlocks;
+	if (press && key == 'N') {
+		pacer.Report();
+		pacer.SetFramesInFlight(pacer.FramesInFlight()%FramePacer::maxFrames+1);
+		pacer.ResetStats();
+	}
+}
+
+void Scatter(int n) {
+	// n objects on a ground grid below the path, a scenery mesh per range of columns
+	int side = (int) ceil(sqrt((float) n));
+	float spacing = .6f;
+	for (int i = 0; i < n; i++) {
+		float x = spacing*(i%side-side/2.f), z = spacing*(i/side-side/2.f);
+		mat4 m = Translate(x, -.6f, z)*RotateY((float) (37*i%360))*Scale(.2f);
+		vec3 color = .5f*vec3((i%7)/7.f, (i%5)/5.f, (i%3)/3.f)+vec3(.3f, .3f, .3f);
+		int nMeshes = (int) sceneryMeshes.size();
+		scenery.push_back({nMeshes? sceneryMeshes[(i%side)*nMeshes/side] : &body, m, color});
+	}
+}
+
 void Resize(int width, int height) {
 	camera.Resize(width, height);
 }
 
 
 void Animate() {
-	float elapsed = (float)(clock() - startTime) / CLOCKS_PER_SEC, a = nBezier * elapsed / duration;
-	float b = fmod(a, nBezier), t = b - floor(b);
-	int i = (int)floor(b);
-	mat4 f = bezier[i].Frame(t);
-	body.toWorld = f * Scale(.35f) * RotateY(-90);
-	prop.toWorld = body.toWorld * Translate(-.6f, 0, 0) * RotateY(-90) * Scale(.25f) * RotateZ(1500 * elapsed);
+	float elapsed = (float) frameClock.Seconds(), a = nBezier * elapsed / duration;
+	float b = fmod(a, nBezier);
+	mat4 f = frames.Frame(b);                                    // table lookup + slerp
+	body.toWorld = MatMul(f, Scale(.35f), RotateY(-90));
+	prop.toWorld = MatMul(MatMul(body.toWorld, Translate(-.6f, 0, 0), RotateY(-90)), Scale(.25f), RotateZ(1500 * elapsed));
+	if (fleetPool) {
+		// straight into the pacer's slot of the mapped instance buffer
+		std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+		fleet.Update(*fleetPool, elapsed, pacer.Slot());
+		fleetMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+	}
 }
 
 int main(int argc, char **argv) {
+	// -bench: report batch Bezier throughput and exit, nonzero if batch and scalar results differ
+	if (argc > 1 && !strcmp(argv[1], "-bench"))
+		return BezierBatchBenchmark() != 0;
+	// -fleetbench [N]: report fleet animation throughput across thread counts and exit,
+	// nonzero if threaded matrices differ from single-thread
+	if (argc > 1 && !strcmp(argv[1], "-fleetbench"))
+		return FleetBenchmark(path, nBezier, argc > 2? atoi(argv[2]) : 100000) != 0;
+	// -scene N [a.obj b.obj ...]: add N static objects to exercise culling, drawn with the
+	//                            given meshes by grid column, else with the body
+	// -record frame%04d.png or name.y4m, -frames N: record N frames (default one flight)
+	// -budget MB: evict least recently drawn mesh buffers beyond MB (per-mesh draws, P key)
+	// -inflight N: frames the GPU may queue, 1 to 3 (default 2)
+	// -fleet N: N more planes on lanes around the path, animated in parallel
+	// -stats: every 120 frames print Display CPU time, fleet time, pacing and GPU memory
+	const char *recordName = NULL;
+	bool stats = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-stats"))
+			stats = true;
+		if (!strcmp(argv[i], "-scene") && i+1 < argc) {
+			int n = atoi(argv[++i]);
+			for (; i+1 < argc && argv[i+1][0] != '-'; i++) {
+				sceneryMeshes.push_back(new Mesh);
+				sceneryMeshes.back()->filename = argv[i+1];
+			}
+			Scatter(n);
+		}
+		if (!strcmp(argv[i], "-record") && i+1 < argc)
+			recordName = argv[++i];
+		if (!strcmp(argv[i], "-frames") && i+1 < argc)
+			recordFrames = atoi(argv[++i]);
+		if (!strcmp(argv[i], "-budget") && i+1 < argc)
+			gpuRegistry.budget = (size_t) (atof(argv[++i])*1e6);
+		if (!strcmp(argv[i], "-inflight") && i+1 < argc)
+			pacer.SetFramesInFlight(atoi(argv[++i]));
+		if (!strcmp(argv[i], "-fleet") && i+1 < argc)
+			StartFleet(atoi(argv[++i]));
+	}
 	// enable anti-alias, init app window and GL context
 	GLFWwindow *w = InitGLFW(100, 100, winWidth, winHeight, "Aerial Animation");
-	// init shader, read from file, fill GPU vertex buffer, read texture
-	program = LinkProgramViaCode(&vertexShader, &pixelShader);
-	// fill GPU with object vertices
+	if (recordName) {
+		// offscreen at framebuffer size, fixed time step, window hidden
+		int width, height;
+		glfwGetFramebufferSize(w, &width, &height);
+		recording = capture.Start(recordName, width, height);
+		frameClock.SetFixed(1./capture.fps);
+		if (recordFrames <= 0)
+			recordFrames = (int) (duration*capture.fps+.5f);
+		if (recording)
+			glfwHideWindow(w);
+		occlusionCulling = false;                                // depends on readback timing
+	}
+	// fill GPU with object vertices, in background
+	loader.Start(w);
 	body.Read(bodyObjectFilename);
 	prop.Read(propObjectFilename);
+	for (Mesh *m : sceneryMeshes)
+		m->Read(m->filename);
+	// init shader while meshes decode
+	program = LinkProgramViaCode(&vertexShader, &legacyPixelShader);
+	uboProgram = LinkProgramViaCode(&uboVertexShader, &pixelShader);
+	packProgram = LinkProgramViaCode(&packVertexShader, &pixelShader);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "per-mesh uniforms");
+	gpuRegistry.Track(GPURegistry::Program, uboProgram, 0, "uniform blocks");
+	gpuRegistry.Track(GPURegistry::Program, packProgram, 0, "scene pack");
+	if (fleetPool) {
+		fleetProgram = LinkProgramViaCode(&fleetVertexShader, &pixelShader);
+		gpuRegistry.Track(GPURegistry::Program, fleetProgram, 0, "fleet");
+		fleet.Init(fleet.instances.N());
+	}
+	packed = packProgram != 0;
+	uniforms.Init((int) scenery.size()+2);
+	for (GLuint p : { program, uboProgram, packProgram, fleetProgram })
+		if (p)
+			uniforms.Bind(p);
+	uniforms.SetPacer(&pacer);
+	pathLines.Init();
+	// precompute orientation along the closed flight path
+	frames.Build(path, nBezier, true);
 	// callbacks
 	RegisterMouseMove(MouseMove);
 	RegisterMouseButton(MouseButton);
 	RegisterMouseWheel(MouseWheel);
 	RegisterResize(Resize);
+	RegisterKeyboard(Keyboard);
 
 	// event loop
+	typedef std::chrono::steady_clock Clock;
+	double displayMs = 0;                                        // CPU time in Display, mostly driver
+	int nTimed = 0;
 	while (!glfwWindowShouldClose(w)) {
+		// record only once meshes have loaded, so output doesn't depend on load timing
+		bool record = recording && loader.Loaded();
+		pathLines.Begin(pacer.BeginFrame());                     // the frame N ago is done
 		Animate();
+		if (record)
+			capture.BeginFrame();
+		Clock::time_point t = Clock::now();
 		Display(w);
+		displayMs += std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+		if (record) {
+			capture.EndFrame();
+			frameClock.Tick();
+			if (frameClock.Frame() == recordFrames)
+				break;
+		}
+		if (stats && ++nTimed == 120) {
+			printf("Display CPU %.3f ms/frame (%s)\n", displayMs/nTimed, DrawMode());
+			if (fleetPool)
+				printf("fleet: %i planes in %.3f ms/frame, %i threads\n", fleet.instances.N(), fleetMs/nTimed, fleetPool->NThreads());
+			pacer.Report();
+			pacer.ResetStats();
+			gpuRegistry.Report();
+			displayMs = fleetMs = 0;
+			nTimed = 0;
+		}
 		glfwPollEvents();
 		glfwSwapBuffers(w);
+		pacer.EndFrame();
+		loader.Update();
+		gpuRegistry.EndFrame();
 	}
 	// cleanup
+	if (recording) {
+		capture.Stop();
+		printf("recorded %i frames to %s\n", capture.FramesWritten(), recordName);
+	}
+	loader.Stop();
+	hiZ.Release();
+	pack.Release();
+	pacer.Release();
+	pathLines.Release();
+	uniforms.Release();
+	fleet.Release();
+	delete fleetPool;
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &body.vBuffer);
+	DeleteBuffer(body.vBuffer);
+	DeleteBuffer(prop.vBuffer);
+	for (Mesh *m : sceneryMeshes) {
+		DeleteBuffer(m->vBuffer);
+		delete m;
+	}
+	for (GLuint *p : { &program, &uboProgram, &packProgram, &fleetProgram })
+		DeleteProgram(*p);
+	gpuRegistry.Report();
+	gpuRegistry.DumpLive();                                      // anything listed leaked
 	glfwDestroyWindow(w);
 	glfwTerminate();
-}
\ No newline at end of file
+}
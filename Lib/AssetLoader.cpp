@@ -0,0 +1,279 @@
+// AssetLoader.cpp: decode meshes and images on worker threads, upload on a shared GL context
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "AssetLoader.h"
+#include "GPUResources.h"
+#include "IO.h"
+#include "stb_image.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point programStart = Clock::now();   // static init, close enough to launch
+
+static double Milliseconds(Clock::time_point t) {
+	return std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+}
+
+struct AssetLoader::Asset {
+	std::string filename;
+	bool isMesh = true, ok = false;
+	GLuint name = 0;                      // buffer or texture, set by upload thread
+	// mesh
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	vector<vec3> *dPoints = NULL, *dNormals = NULL;
+	vector<vec2> *dUvs = NULL;
+	vector<int3> *dTriangles = NULL;
+	GLuint *dBuffer = NULL;
+	Prepare prepare;
+	// image
+	vector<unsigned char> pixels;
+	int width = 0, height = 0, nChannels = 0;
+	GLuint *dTexture = NULL;
+	bool flip = true;
+};
+
+// Placeholders
+
+static void Cube(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles) {
+	// 6 faces, 4 vertices each so normals are per face
+	vec3 n[] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+	points.resize(0); normals.resize(0); uvs.resize(0); triangles.resize(0);
+	for (int f = 0; f < 6; f++) {
+		vec3 a = n[(f+2)%6], b = cross(n[f], a);
+		int base = (int) points.size();
+		for (int k = 0; k < 4; k++) {
+			float s = k == 1 || k == 2? 1.f : -1.f, t = k >= 2? 1.f : -1.f;
+			points.push_back(.3f*(n[f]+s*a+t*b));
+			normals.push_back(n[f]);
+			uvs.push_back(vec2((s+1)/2, (t+1)/2));
+		}
+		triangles.push_back(int3(base, base+1, base+2));
+		triangles.push_back(int3(base, base+2, base+3));
+	}
+}
+
+static GLuint BufferMesh(const vector<vec3> &points, const vector<vec3> *normals, const vector<vec2> *uvs, const char *label) {
+	// points, then uvs, then normals
+	size_t sPoints = points.size()*sizeof(vec3);
+	size_t sUvs = uvs? uvs->size()*sizeof(vec2) : 0, sNormals = normals? normals->size()*sizeof(vec3) : 0;
+	GLuint vBuffer = 0;
+	glGenBuffers(1, &vBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sPoints+sUvs+sNormals, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sPoints, points.data());
+	if (sUvs)
+		glBufferSubData(GL_ARRAY_BUFFER, sPoints, sUvs, uvs->data());
+	if (sNormals)
+		glBufferSubData(GL_ARRAY_BUFFER, sPoints+sUvs, sNormals, normals->data());
+	gpuRegistry.Track(GPURegistry::Buffer, vBuffer, sPoints+sUvs+sNormals, label);
+	return vBuffer;
+}
+
+static GLuint BufferTexture(const unsigned char *pixels, int width, int height, int nChannels, const char *label) {
+	GLenum formats[] = { GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	GLenum format = formats[nChannels < 1? 1 : nChannels > 4? 4 : nChannels];
+	GLuint textureName = 0;
+	glGenTextures(1, &textureName);
+	glBindTexture(GL_TEXTURE_2D, textureName);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// texels as stored (RGB padded to RGBA), plus a third for mipmaps
+	gpuRegistry.Track(GPURegistry::Texture, textureName, (size_t) width*height*(nChannels == 3? 4 : nChannels)*4/3, label);
+	return textureName;
+}
+
+// Start, Stop
+
+void AssetLoader::Start(GLFWwindow *window, int nDecodeThreads) {
+	start = programStart;
+	// hidden window whose context shares buffers and textures with window
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	uploadWindow = glfwCreateWindow(1, 1, "", NULL, window);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	glfwMakeContextCurrent(window);
+	if (!uploadWindow)
+		printf("can't create upload context, loading on main thread\n");
+	decoders = new JobPool(nDecodeThreads);
+	quit = false;
+	if (uploadWindow)
+		uploader = std::thread(&AssetLoader::Upload, this);
+	unsigned char checker[] = { 160, 160, 160, 96, 96, 96, 96, 96, 96, 160, 160, 160 };
+	placeholderTexture = BufferTexture(checker, 2, 2, 3, "placeholder texture");
+}
+
+void AssetLoader::Stop() {
+	if (!decoders)
+		return;
+	delete decoders;                              // finishes queued decodes
+	decoders = NULL;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	uploadReady.notify_all();
+	if (uploader.joinable())
+		uploader.join();
+	for (Asset *a : toUpload)
+		delete a;
+	for (Asset *a : uploaded) {
+		if (a->isMesh)
+			DeleteBuffer(a->name);
+		else
+			DeleteTexture(a->name);
+		delete a;
+	}
+	toUpload.clear();
+	uploaded.clear();
+	if (uploadWindow)
+		glfwDestroyWindow(uploadWindow);
+	uploadWindow = NULL;
+	// failed or unfinished textures still name the placeholder, deleted here, not by the app
+	for (GLuint *t : textureNames)
+		if (*t == placeholderTexture)
+			*t = 0;
+	textureNames.clear();
+	DeleteTexture(placeholderTexture);
+}
+
+// Requests (main thread)
+
+void AssetLoader::LoadMesh(const char *filename, vector<vec3> *points, vector<int3> *triangles,
+						   vector<vec3> *normals, vector<vec2> *uvs, GLuint *vBuffer, Prepare prepare) {
+	// placeholder until the mesh arrives
+	vector<vec3> cPoints, cNormals;
+	vector<vec2> cUvs;
+	vector<int3> cTriangles;
+	Cube(cPoints, cNormals, cUvs, cTriangles);
+	*points = cPoints;
+	*triangles = cTriangles;
+	if (normals) *normals = cNormals;
+	if (uvs) *uvs = cUvs;
+	*vBuffer = BufferMesh(*points, normals, uvs, "placeholder mesh");
+	// decode on a worker
+	Asset *a = new Asset;
+	a->filename = filename;
+	a->dPoints = points; a->dTriangles = triangles; a->dNormals = normals; a->dUvs = uvs; a->dBuffer = vBuffer;
+	a->prepare = prepare;
+	nPending++;
+	decoders->Add([this, a]() {
+		a->ok = ReadAsciiObj(a->filename.c_str(), a->points, a->triangles, &a->normals, &a->uvs);
+		if (a->ok && a->prepare)
+			a->prepare(a->points, a->normals, a->uvs, a->triangles);
+		std::lock_guard<std::mutex> lock(mutex);
+		(uploadWindow? toUpload : uploaded).push_back(a);
+		uploadReady.notify_one();
+	});
+}
+
+void AssetLoader::LoadTexture(const char *filename, GLuint *textureName, bool flip) {
+	*textureName = placeholderTexture;
+	textureNames.push_back(textureName);
+	Asset *a = new Asset;
+	a->isMesh = false;
+	a->filename = filename;
+	a->dTexture = textureName;
+	a->flip = flip;
+	nPending++;
+	decoders->Add([this, a]() {
+		unsigned char *data = stbi_load(a->filename.c_str(), &a->width, &a->height, &a->nChannels, 0);
+		if (data) {
+			int rowSize = a->width*a->nChannels;
+			a->pixels.resize((size_t) rowSize*a->height);
+			for (int y = 0; y < a->height; y++)
+				memcpy(&a->pixels[(size_t) y*rowSize], data+(size_t) (a->flip? a->height-1-y : y)*rowSize, rowSize);
+			stbi_image_free(data);
+			a->ok = true;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		(uploadWindow? toUpload : uploaded).push_back(a);
+		uploadReady.notify_one();
+	});
+}
+
+// Upload Thread
+
+void AssetLoader::Upload() {
+	glfwMakeContextCurrent(uploadWindow);
+	for (;;) {
+		Asset *a = NULL;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			uploadReady.wait(lock, [this] { return quit || !toUpload.empty(); });
+			if (toUpload.empty())
+				break;
+			a = toUpload.front();
+			toUpload.erase(toUpload.begin());
+		}
+		if (a->ok) {
+			a->name = a->isMesh?
+				BufferMesh(a->points, a->dNormals? &a->normals : NULL, a->dUvs? &a->uvs : NULL, a->filename.c_str()) :
+				BufferTexture(a->pixels.data(), a->width, a->height, a->nChannels, a->filename.c_str());
+			// wait until the GPU holds the data, so the main context can bind it at once
+			GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+				;
+			glDeleteSync(fence);
+			vector<unsigned char>().swap(a->pixels);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		uploaded.push_back(a);
+	}
+	glfwMakeContextCurrent(NULL);
+}
+
+// Installation (main thread)
+
+void AssetLoader::Install(Asset *a) {
+	if (a->ok && !a->name)                        // no upload context: upload here
+		a->name = a->isMesh?
+			BufferMesh(a->points, a->dNormals? &a->normals : NULL, a->dUvs? &a->uvs : NULL, a->filename.c_str()) :
+			BufferTexture(a->pixels.data(), a->width, a->height, a->nChannels, a->filename.c_str());
+	if (!a->ok)
+		printf("can't read %s\n", a->filename.c_str());
+	else if (a->isMesh) {
+		DeleteBuffer(*a->dBuffer);                // placeholder
+		*a->dBuffer = a->name;
+		a->dPoints->swap(a->points);
+		a->dTriangles->swap(a->triangles);
+		if (a->dNormals) a->dNormals->swap(a->normals);
+		if (a->dUvs) a->dUvs->swap(a->uvs);
+		printf("loaded %s (%i triangles) at %.0f ms\n", a->filename.c_str(), (int) a->dTriangles->size(), Milliseconds(start));
+	}
+	else {
+		*a->dTexture = a->name;
+		printf("loaded %s (%ix%i) at %.0f ms\n", a->filename.c_str(), a->width, a->height, Milliseconds(start));
+	}
+	delete a;
+	nPending--;
+}
+
+void AssetLoader::Update() {
+	if (firstFrame) {
+		printf("first frame at %.0f ms\n", Milliseconds(start));
+		firstFrame = false;
+	}
+	vector<Asset *> ready;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.swap(uploaded);
+	}
+	for (Asset *a : ready)
+		Install(a);
+	if (!ready.empty() && nPending == 0 && !reported) {
+		printf("fully loaded at %.0f ms\n", Milliseconds(start));
+		reported = true;
+	}
+}
+
+bool AssetLoader::Loaded() {
+	return nPending == 0;
+}
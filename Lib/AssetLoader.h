@@ -0,0 +1,57 @@
+// AssetLoader.h: decode meshes and images on worker threads, upload on a shared GL context
+
+#ifndef ASSET_LOADER_HDR
+#define ASSET_LOADER_HDR
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "glad.h"
+#include <GLFW/glfw3.h>
+#include "JobPool.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Files are decoded by a JobPool; an upload thread, current on a hidden window whose context
+// shares objects with the main window, fills buffers and textures and waits on a fence before
+// handing them over. Until then Load* installs a placeholder (a cube, a grey checker) so the
+// first frame is drawn immediately. Update(), called by the main thread after each swap,
+// installs finished assets and reports time-to-first-frame and time-to-fully-loaded.
+// The loader owns the placeholder texture: Stop deletes it and zeroes any texture name still
+// set to it (a texture that failed or never arrived), so the app may delete its names after.
+
+class AssetLoader {
+public:
+	void Start(GLFWwindow *window, int nDecodeThreads = 0);
+	void Stop();                                 // before destroying window
+	~AssetLoader() { Stop(); }
+	// vertex buffer holds points, uvs (if uvs != NULL), normals (if normals != NULL), in that order;
+	// prepare, if given, runs on the worker after decoding (eg, Standardize, ProcessMesh)
+	typedef std::function<void(vector<vec3> &points, vector<vec3> &normals, vector<vec2> &uvs, vector<int3> &triangles)> Prepare;
+	void LoadMesh(const char *filename, vector<vec3> *points, vector<int3> *triangles,
+				  vector<vec3> *normals, vector<vec2> *uvs, GLuint *vBuffer, Prepare prepare = nullptr);
+	void LoadTexture(const char *filename, GLuint *textureName, bool flip = true);
+	void Update();                               // main thread, once per frame after swap
+	bool Loaded();                               // all requested assets installed
+	struct Asset;
+private:
+	GLFWwindow *uploadWindow = NULL;
+	JobPool *decoders = NULL;
+	std::thread uploader;
+	std::mutex mutex;
+	std::condition_variable uploadReady;
+	vector<Asset *> toUpload, uploaded;
+	int nPending = 0;
+	bool quit = false, firstFrame = true, reported = false;
+	GLuint placeholderTexture = 0;
+	vector<GLuint *> textureNames;               // destinations given to LoadTexture
+	std::chrono::steady_clock::time_point start;
+	void Upload();
+	void Install(Asset *a);
+};
+
+#endif
@@ -0,0 +1,355 @@
+// BVH.cpp: binned-SAH bounding volume hierarchy, parallel build, SIMD leaf tests
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <float.h>
+#include <stdlib.h>
+#include <thread>
+#include "BVH.h"
+#include "glad.h"
+#include "Simd.h"
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must be 32 bytes");
+
+// Build
+
+struct Box {
+	vec3 min = vec3(FLT_MAX, FLT_MAX, FLT_MAX), max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	void Grow(vec3 p) { for (int k = 0; k < 3; k++) { min[k] = p[k] < min[k]? p[k] : min[k]; max[k] = p[k] > max[k]? p[k] : max[k]; } }
+	void Grow(const Box &b) { Grow(b.min); Grow(b.max); }
+	float Area() const { vec3 d = max-min; return d.x < 0? 0 : 2*(d.x*d.y+d.y*d.z+d.z*d.x); }
+};
+
+struct BVHBuilder {
+	BVH &bvh;
+	vector<Box> boxes;                      // per triangle
+	vector<vec3> centroids;
+	std::atomic<int> nNodes;
+	int forkDepth = 0;
+	BVHBuilder(BVH &bvh) : bvh(bvh), nNodes(0) { }
+	void Subdivide(int n, int depth);
+	void SetBounds(int n);
+};
+
+void BVHBuilder::SetBounds(int n) {
+	BVHNode &node = bvh.nodes[n];
+	Box b;
+	for (int i = node.leftFirst; i < node.leftFirst+node.count; i++)
+		b.Grow(boxes[bvh.order[i]]);
+	for (int k = 0; k < 3; k++) {
+		node.min[k] = b.min[k];
+		node.max[k] = b.max[k];
+	}
+}
+
+void BVHBuilder::Subdivide(int n, int depth) {
+	const int nBins = 16;
+	BVHNode &node = bvh.nodes[n];
+	int first = node.leftFirst, count = node.count;
+	if (count <= bvh.maxLeafSize || depth >= BVH::maxDepth)
+		return;
+	// centroid bounds
+	Box cb;
+	for (int i = first; i < first+count; i++)
+		cb.Grow(centroids[bvh.order[i]]);
+	// binned SAH over all three axes
+	int bestAxis = -1, bestSplit = 0;
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; axis++) {
+		float lo = cb.min[axis], extent = cb.max[axis]-lo;
+		if (extent <= 0)
+			continue;
+		Box bins[nBins];
+		int counts[nBins] = {0};
+		float scale = nBins/extent;
+		for (int i = first; i < first+count; i++) {
+			int t = bvh.order[i], b = (int) ((centroids[t][axis]-lo)*scale);
+			b = b < nBins-1? b : nBins-1;
+			bins[b].Grow(boxes[t]);
+			counts[b]++;
+		}
+		// sweep from the left and right
+		float leftArea[nBins-1], rightArea[nBins-1];
+		int leftCount[nBins-1], rightCount[nBins-1];
+		Box lb, rb;
+		for (int i = 0, l = 0, r = 0; i < nBins-1; i++) {
+			lb.Grow(bins[i]);
+			l += counts[i];
+			leftArea[i] = lb.Area();
+			leftCount[i] = l;
+			rb.Grow(bins[nBins-1-i]);
+			r += counts[nBins-1-i];
+			rightArea[nBins-2-i] = rb.Area();
+			rightCount[nBins-2-i] = r;
+		}
+		for (int i = 0; i < nBins-1; i++) {
+			float cost = leftCount[i]*leftArea[i]+rightCount[i]*rightArea[i];
+			if (leftCount[i] && rightCount[i] && cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+	Box nb;
+	for (int k = 0; k < 3; k++) {
+		nb.min[k] = node.min[k];
+		nb.max[k] = node.max[k];
+	}
+	float leafCost = count*nb.Area();
+	int mid = first;
+	if (bestAxis >= 0 && (bestCost < leafCost || count > 4*bvh.maxLeafSize)) {
+		// partition in place by bin
+		float lo = cb.min[bestAxis], scale = nBins/(cb.max[bestAxis]-lo);
+		int i = first, j = first+count-1;
+		while (i <= j) {
+			int b = (int) ((centroids[bvh.order[i]][bestAxis]-lo)*scale);
+			if ((b < nBins-1? b : nBins-1) <= bestSplit)
+				i++;
+			else
+				std::swap(bvh.order[i], bvh.order[j--]);
+		}
+		mid = i;
+	}
+	else if (bestAxis < 0 && count > 4*bvh.maxLeafSize)
+		mid = first+count/2;                  // coincident centroids: split by count
+	if (mid == first || mid == first+count)
+		return;                               // leaf
+	int left = nNodes.fetch_add(2);
+	bvh.nodes[left].leftFirst = first;
+	bvh.nodes[left].count = mid-first;
+	bvh.nodes[left+1].leftFirst = mid;
+	bvh.nodes[left+1].count = first+count-mid;
+	node.leftFirst = left;
+	node.count = 0;
+	SetBounds(left);
+	SetBounds(left+1);
+	if (depth < forkDepth) {
+		std::thread t(&BVHBuilder::Subdivide, this, left, depth+1);
+		Subdivide(left+1, depth+1);
+		t.join();
+	}
+	else {
+		Subdivide(left, depth+1);
+		Subdivide(left+1, depth+1);
+	}
+}
+
+void BVH::Build(const vector<vec3> &pts, const vector<int3> &tris) {
+	points = &pts;
+	triangles = &tris;
+	int nTriangles = (int) tris.size();
+	order.resize(nTriangles);
+	nodes.assign(nTriangles > 0? 2*nTriangles-1 : 1, BVHNode());
+	BVHBuilder builder(*this);
+	builder.boxes.resize(nTriangles);
+	builder.centroids.resize(nTriangles);
+	for (int i = 0; i < nTriangles; i++) {
+		const int3 &t = tris[i];
+		Box &b = builder.boxes[i];
+		b = Box();
+		b.Grow(pts[t.i1]);
+		b.Grow(pts[t.i2]);
+		b.Grow(pts[t.i3]);
+		builder.centroids[i] = (b.min+b.max)/2;
+		order[i] = i;
+	}
+	for (int n = (int) std::thread::hardware_concurrency(); n > 1; n /= 2)
+		builder.forkDepth++;
+	builder.nNodes = 1;
+	nodes[0].leftFirst = 0;
+	nodes[0].count = nTriangles;
+	builder.SetBounds(0);
+	builder.Subdivide(0, 0);
+	nNodes = builder.nNodes;
+	nodes.resize(nNodes);
+	// SoA triangle data in BVH order, padded for full-width loads
+	for (int k = 0; k < 9; k++)
+		soa[k].assign(nTriangles+Lanes::N, 0.f);
+	for (int i = 0; i < nTriangles; i++) {
+		const int3 &t = tris[order[i]];
+		vec3 v1 = pts[t.i1], e1 = pts[t.i2]-v1, e2 = pts[t.i3]-v1;
+		for (int k = 0; k < 3; k++) {
+			soa[k][i] = v1[k];
+			soa[3+k][i] = e1[k];
+			soa[6+k][i] = e2[k];
+		}
+	}
+}
+
+// Traversal
+
+static inline bool Slab(const BVHNode &n, vec3 o, vec3 inv, float tMax, float &tNear) {
+	float t1 = (n.min[0]-o.x)*inv.x, t2 = (n.max[0]-o.x)*inv.x;
+	float tmin = t1 < t2? t1 : t2, tmax = t1 < t2? t2 : t1;
+	t1 = (n.min[1]-o.y)*inv.y; t2 = (n.max[1]-o.y)*inv.y;
+	tmin = Max(tmin, t1 < t2? t1 : t2); tmax = Min(tmax, t1 < t2? t2 : t1);
+	t1 = (n.min[2]-o.z)*inv.z; t2 = (n.max[2]-o.z)*inv.z;
+	tmin = Max(tmin, t1 < t2? t1 : t2); tmax = Min(tmax, t1 < t2? t2 : t1);
+	tNear = tmin;
+	return tmax >= tmin && tmax > 0 && tmin < tMax;
+}
+
+bool BVH::Intersect(vec3 o, vec3 d, RayHit &hit, const vector<vec2> *uvs) const {
+	const int N = Lanes::N;
+	hit.triangle = -1;
+	if (!nNodes || order.empty())
+		return false;
+	vec3 inv(1/d.x, 1/d.y, 1/d.z);
+	float best = FLT_MAX, bestU = 0, bestV = 0;
+	int bestI = -1;
+	// one pending sibling per level at most, plus the node being expanded
+	int stack[maxDepth+2], sp = 0;
+	float tEntry[maxDepth+2], tNear;        // entry distance of each stacked node
+	if (!Slab(nodes[0], o, inv, best, tNear))
+		return false;
+	tEntry[sp] = tNear;
+	stack[sp++] = 0;
+	Lanes ox(o.x), oy(o.y), oz(o.z), dx(d.x), dy(d.y), dz(d.z);
+	while (sp) {
+		const BVHNode &node = nodes[stack[--sp]];
+		if (tEntry[sp] >= best)
+			continue;                           // a closer hit was found since this node was pushed
+		if (node.count) {
+			// leaf: Moller-Trumbore, N triangles at a time
+			for (int i = node.leftFirst; i < node.leftFirst+node.count; i += N) {
+				Lanes v1x = Lanes::Load(&soa[0][i]), v1y = Lanes::Load(&soa[1][i]), v1z = Lanes::Load(&soa[2][i]);
+				Lanes e1x = Lanes::Load(&soa[3][i]), e1y = Lanes::Load(&soa[4][i]), e1z = Lanes::Load(&soa[5][i]);
+				Lanes e2x = Lanes::Load(&soa[6][i]), e2y = Lanes::Load(&soa[7][i]), e2z = Lanes::Load(&soa[8][i]);
+				Lanes px = dy*e2z-dz*e2y, py = dz*e2x-dx*e2z, pz = dx*e2y-dy*e2x;
+				Lanes det = e1x*px+e1y*py+e1z*pz, invDet = Lanes(1.f)/det;
+				Lanes tx = ox-v1x, ty = oy-v1y, tz = oz-v1z;
+				Lanes u = (tx*px+ty*py+tz*pz)*invDet;
+				Lanes qx = ty*e1z-tz*e1y, qy = tz*e1x-tx*e1z, qz = tx*e1y-ty*e1x;
+				Lanes v = (dx*qx+dy*qy+dz*qz)*invDet, t = (e2x*qx+e2y*qy+e2z*qz)*invDet;
+				float ds[N], us[N], vs[N], ts[N];
+				det.Store(ds); u.Store(us); v.Store(vs); t.Store(ts);
+				int nLanes = node.leftFirst+node.count-i < N? node.leftFirst+node.count-i : N;
+				for (int k = 0; k < nLanes; k++)
+					if (fabsf(ds[k]) > 1e-12f && us[k] >= 0 && vs[k] >= 0 && us[k]+vs[k] <= 1 && ts[k] > 0 && ts[k] < best) {
+						best = ts[k];
+						bestU = us[k];
+						bestV = vs[k];
+						bestI = i+k;
+					}
+			}
+			continue;
+		}
+		// interior: push farther child first so nearer is popped first
+		int l = node.leftFirst, r = l+1;
+		float tl, tr;
+		bool hl = Slab(nodes[l], o, inv, best, tl), hr = Slab(nodes[r], o, inv, best, tr);
+		assert(sp+2 <= maxDepth+2);
+		if (hl && hr) {
+			bool leftFirst = tl < tr;
+			tEntry[sp] = leftFirst? tr : tl;
+			stack[sp++] = leftFirst? r : l;
+			tEntry[sp] = leftFirst? tl : tr;
+			stack[sp++] = leftFirst? l : r;
+		}
+		else if (hl) {
+			tEntry[sp] = tl;
+			stack[sp++] = l;
+		}
+		else if (hr) {
+			tEntry[sp] = tr;
+			stack[sp++] = r;
+		}
+	}
+	if (bestI < 0)
+		return false;
+	const int3 &tri = (*triangles)[order[bestI]];
+	hit.triangle = order[bestI];
+	hit.t = best;
+	hit.barycentric = vec3(1-bestU-bestV, bestU, bestV);
+	hit.point = o+best*d;
+	if (uvs && (int) uvs->size() == (int) points->size()) {
+		const vector<vec2> &uv = *uvs;
+		hit.uv = hit.barycentric.x*uv[tri.i1]+hit.barycentric.y*uv[tri.i2]+hit.barycentric.z*uv[tri.i3];
+	}
+	return true;
+}
+
+// Screen Ray
+
+static bool Invert(const mat4 &m, mat4 &inv) {
+	// Gauss-Jordan with partial pivoting
+	float a[4][8];
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			a[i][j] = m[i][j];
+			a[i][j+4] = i == j? 1.f : 0.f;
+		}
+	for (int c = 0; c < 4; c++) {
+		int p = c;
+		for (int r = c+1; r < 4; r++)
+			if (fabsf(a[r][c]) > fabsf(a[p][c]))
+				p = r;
+		if (fabsf(a[p][c]) < 1e-12f)
+			return false;
+		for (int j = 0; j < 8; j++)
+			std::swap(a[c][j], a[p][j]);
+		float s = 1/a[c][c];
+		for (int j = 0; j < 8; j++)
+			a[c][j] *= s;
+		for (int r = 0; r < 4; r++)
+			if (r != c) {
+				float f = a[r][c];
+				for (int j = 0; j < 8; j++)
+					a[r][j] -= f*a[c][j];
+			}
+	}
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			inv[i][j] = a[i][j+4];
+	return true;
+}
+
+void ScreenRay(float x, float y, mat4 modelview, mat4 persp, vec3 &origin, vec3 &direction) {
+	GLint vp[4];
+	glGetIntegerv(GL_VIEWPORT, vp);
+	ScreenRay(x-vp[0], y-vp[1], vp[2], vp[3], modelview, persp, origin, direction);
+}
+
+void ScreenRay(float x, float y, int width, int height, mat4 modelview, mat4 persp, vec3 &origin, vec3 &direction) {
+	float nx = 2*x/width-1, ny = 2*y/height-1;
+	mat4 inv;
+	Invert(persp*modelview, inv);
+	vec4 n = inv*vec4(nx, ny, -1, 1), f = inv*vec4(nx, ny, 1, 1);
+	origin = vec3(n.x, n.y, n.z)/n.w;
+	direction = vec3(f.x, f.y, f.z)/f.w-origin;
+}
+
+// Benchmark
+
+void BVHBenchmark(const vector<vec3> &points, const vector<int3> &triangles, int nRays) {
+	typedef std::chrono::steady_clock Clock;
+	BVH bvh;
+	Clock::time_point start = Clock::now();
+	bvh.Build(points, triangles);
+	double buildMs = std::chrono::duration<double, std::milli>(Clock::now()-start).count();
+	// rays from a sphere around the bounds toward random interior points
+	Box b;
+	for (const vec3 &p : points)
+		b.Grow(p);
+	vec3 center = (b.min+b.max)/2, extent = b.max-b.min;
+	float radius = length(extent);
+	srand(1);
+	vector<vec3> origins(nRays), directions(nRays);
+	for (int i = 0; i < nRays; i++) {
+		vec3 r(rand()/(float) RAND_MAX-.5f, rand()/(float) RAND_MAX-.5f, rand()/(float) RAND_MAX-.5f);
+		vec3 target = center+r*extent;
+		origins[i] = center+radius*normalize(vec3(rand()/(float) RAND_MAX-.5f, rand()/(float) RAND_MAX-.5f, rand()/(float) RAND_MAX-.5f));
+		directions[i] = target-origins[i];
+	}
+	int nHits = 0;
+	RayHit hit;
+	start = Clock::now();
+	for (int i = 0; i < nRays; i++)
+		if (bvh.Intersect(origins[i], directions[i], hit))
+			nHits++;
+	double traceS = std::chrono::duration<double>(Clock::now()-start).count();
+	printf("BVH (%s leaves): %i triangles, %i nodes, build %.1f ms, %.2f Mrays/s, %i%% hit\n",
+		SimdISA(), (int) triangles.size(), bvh.NNodes(), buildMs, nRays/traceS/1e6, (int) (100.*nHits/nRays));
+}
@@ -0,0 +1,59 @@
+// BVH.h: bounding volume hierarchy over a triangle mesh, for ray picking
+
+#ifndef BVH_HDR
+#define BVH_HDR
+
+#include <stdint.h>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Built top-down with binned SAH; the upper levels fork threads. Nodes are 32 bytes, children
+// of an interior node are adjacent. Traversal visits the nearer child first (slab test); leaf
+// triangles are stored SoA in BVH order and tested Lanes::N at a time (Moller-Trumbore). Nodes
+// at maxDepth stay leaves, however many triangles they hold, which bounds the traversal stack.
+
+struct BVHNode {
+	float min[3];
+	int32_t leftFirst;                      // interior: left child (right = left+1); leaf: first triangle
+	float max[3];
+	int32_t count;                          // leaf: number of triangles, interior: 0
+};
+
+struct RayHit {
+	int triangle = -1;                      // index into triangles, -1 if none
+	float t = 0;                            // distance along ray (in units of direction length)
+	vec3 barycentric;                       // weights of triangle vertices 1, 2, 3
+	vec3 point;
+	vec2 uv;                                // interpolated, if uvs given
+};
+
+class BVH {
+public:
+	enum { maxDepth = 48 };
+	int maxLeafSize = 8;
+	void Build(const vector<vec3> &points, const vector<int3> &triangles);
+	bool Intersect(vec3 origin, vec3 direction, RayHit &hit, const vector<vec2> *uvs = NULL) const;
+	int NTriangles() const { return (int) order.size(); }
+	int NNodes() const { return nNodes; }
+	const vector<BVHNode> &Nodes() const { return nodes; }
+private:
+	vector<BVHNode> nodes;
+	vector<int> order;                      // BVH position -> triangle index
+	vector<float> soa[9];                   // v1.xyz, e1.xyz, e2.xyz in BVH order, padded
+	const vector<vec3> *points = NULL;
+	const vector<int3> *triangles = NULL;
+	int nNodes = 0;
+	friend struct BVHBuilder;
+};
+
+// mouse (x, y with origin at lower left of viewport) to object-space ray
+void ScreenRay(float x, float y, mat4 modelview, mat4 persp, vec3 &origin, vec3 &direction);
+// as above, for a width by height viewport at the origin; no GL calls (any thread, no context)
+void ScreenRay(float x, float y, int width, int height, mat4 modelview, mat4 persp, vec3 &origin, vec3 &direction);
+
+// print build time and Mrays/s for random rays through the mesh bounds
+void BVHBenchmark(const vector<vec3> &points, const vector<int3> &triangles, int nRays = 1000000);
+
+#endif
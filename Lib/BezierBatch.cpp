@@ -0,0 +1,307 @@
+// BezierBatch.cpp: batch cubic Bezier evaluation
+
+// no fused multiply-add contraction in this unit (compilers contract a*b+c in scalar code,
+// and gcc in intrinsic code, differently per path), else batch and scalar results differ;
+// ahead of the includes so every function in the unit has the same setting
+#if defined(_MSC_VER)
+	#pragma fp_contract(off)
+#elif defined(__clang__)
+	#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+	#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include "BezierBatch.h"
+#include "Simd.h"
+
+// Kernels (templated on float or Lanes)
+
+template <class F> struct Pt { F x, y, z; };
+
+template <class F> static inline Pt<F> Combine(F b0, F b1, F b2, F b3, const Pt<F> *c) {
+	// weighted sum of four control points, always summed in the same order
+	return {
+		b0*c[0].x+b1*c[1].x+b2*c[2].x+b3*c[3].x,
+		b0*c[0].y+b1*c[1].y+b2*c[2].y+b3*c[3].y,
+		b0*c[0].z+b1*c[1].z+b2*c[2].z+b3*c[3].z
+	};
+}
+
+template <class F> static inline Pt<F> Position(const Pt<F> *c, F t) {
+	// Bernstein form: (1-t)^3, 3t(1-t)^2, 3t^2(1-t), t^3
+	F s = F(1.f)-t, t2 = t*t, s2 = s*s;
+	return Combine(s*s2, F(3.f)*t*s2, F(3.f)*t2*s, t*t2, c);
+}
+
+template <class F> static inline Pt<F> Velocity(const Pt<F> *c, F t) {
+	// derivative of Bernstein form
+	F s = F(1.f)-t, t2 = t*t, s2 = s*s, ts6 = F(6.f)*t*s;
+	return Combine(-(F(3.f)*s2), F(3.f)*s2-ts6, ts6-F(3.f)*t2, F(3.f)*t2, c);
+}
+
+template <class F> static inline Pt<F> Normalize(Pt<F> v) {
+	F l = Sqrt(v.x*v.x+v.y*v.y+v.z*v.z);
+	return { v.x/l, v.y/l, v.z/l };
+}
+
+template <class F> static inline void Frame(const Pt<F> *c, F t, Pt<F> &p, Pt<F> &v, Pt<F> &n, Pt<F> &b) {
+	// v is unit tangent, n = v x (0,1,0), b = n x v
+	p = Position(c, t);
+	v = Normalize(Velocity(c, t));
+	n = Normalize(Pt<F>{ -v.z, F(0.f), v.x });
+	b = Normalize(Pt<F>{ n.y*v.z-n.z*v.y, n.z*v.x-n.x*v.z, n.x*v.y-n.y*v.x });
+}
+
+// Scalar Reference
+
+static void Unpack(const vec3 *ctrl, Pt<float> *c) {
+	for (int k = 0; k < 4; k++)
+		c[k] = { ctrl[k].x, ctrl[k].y, ctrl[k].z };
+}
+
+static mat4 FrameMatrix(const Pt<float> &p, const Pt<float> &v, const Pt<float> &n, const Pt<float> &b) {
+	return mat4(vec4(n.x, b.x, -v.x, p.x),
+				vec4(n.y, b.y, -v.y, p.y),
+				vec4(n.z, b.z, -v.z, p.z),
+				vec4(0, 0, 0, 1));
+}
+
+vec3 BezierPosition(const vec3 *ctrl, float t) {
+	Pt<float> c[4];
+	Unpack(ctrl, c);
+	Pt<float> p = Position(c, t);
+	return vec3(p.x, p.y, p.z);
+}
+
+vec3 BezierVelocity(const vec3 *ctrl, float t) {
+	Pt<float> c[4];
+	Unpack(ctrl, c);
+	Pt<float> v = Velocity(c, t);
+	return vec3(v.x, v.y, v.z);
+}
+
+mat4 BezierFrame(const vec3 *ctrl, float t) {
+	Pt<float> c[4], p, v, n, b;
+	Unpack(ctrl, c);
+	Frame(c, t, p, v, n, b);
+	return FrameMatrix(p, v, n, b);
+}
+
+// Lane Helpers
+
+static const int N = Lanes::N;
+
+static void Store(const Pt<Lanes> &p, vec3 *out, int count = N) {
+	float x[N], y[N], z[N];
+	p.x.Store(x); p.y.Store(y); p.z.Store(z);
+	for (int i = 0; i < count; i++)
+		out[i] = vec3(x[i], y[i], z[i]);
+}
+
+static void Store(const Pt<Lanes> &p, const Pt<Lanes> &v, const Pt<Lanes> &n, const Pt<Lanes> &b, mat4 *out) {
+	float px[N], py[N], pz[N], vx[N], vy[N], vz[N], nx[N], ny[N], nz[N], bx[N], by[N], bz[N];
+	p.x.Store(px); p.y.Store(py); p.z.Store(pz);
+	v.x.Store(vx); v.y.Store(vy); v.z.Store(vz);
+	n.x.Store(nx); n.y.Store(ny); n.z.Store(nz);
+	b.x.Store(bx); b.y.Store(by); b.z.Store(bz);
+	for (int i = 0; i < N; i++)
+		out[i] = FrameMatrix({px[i], py[i], pz[i]}, {vx[i], vy[i], vz[i]}, {nx[i], ny[i], nz[i]}, {bx[i], by[i], bz[i]});
+}
+
+static void Broadcast(const vec3 *ctrl, Pt<Lanes> *c) {
+	for (int k = 0; k < 4; k++)
+		c[k] = { Lanes(ctrl[k].x), Lanes(ctrl[k].y), Lanes(ctrl[k].z) };
+}
+
+// One Curve, Many Parameters
+
+void BezierPositions(const vec3 *ctrl, const float *t, int n, vec3 *positions) {
+	Pt<Lanes> c[4];
+	Broadcast(ctrl, c);
+	int i = 0;
+	for (; i+N <= n; i += N)
+		Store(Position(c, Lanes::Load(t+i)), positions+i);
+	for (; i < n; i++)
+		positions[i] = BezierPosition(ctrl, t[i]);
+}
+
+void BezierVelocities(const vec3 *ctrl, const float *t, int n, vec3 *velocities) {
+	Pt<Lanes> c[4];
+	Broadcast(ctrl, c);
+	int i = 0;
+	for (; i+N <= n; i += N)
+		Store(Velocity(c, Lanes::Load(t+i)), velocities+i);
+	for (; i < n; i++)
+		velocities[i] = BezierVelocity(ctrl, t[i]);
+}
+
+void BezierFrames(const vec3 *ctrl, const float *t, int n, mat4 *frames) {
+	Pt<Lanes> c[4], p, v, nrm, b;
+	Broadcast(ctrl, c);
+	int i = 0;
+	for (; i+N <= n; i += N) {
+		Frame(c, Lanes::Load(t+i), p, v, nrm, b);
+		Store(p, v, nrm, b, frames+i);
+	}
+	for (; i < n; i++)
+		frames[i] = BezierFrame(ctrl, t[i]);
+}
+
+// Many Curves, SoA
+
+void BezierCurves::Add(const vec3 *ctrl) {
+	for (int k = 0; k < 4; k++) {
+		x[k].push_back(ctrl[k].x);
+		y[k].push_back(ctrl[k].y);
+		z[k].push_back(ctrl[k].z);
+	}
+}
+
+void BezierCurves::Set(int i, const vec3 *ctrl) {
+	for (int k = 0; k < 4; k++) {
+		x[k][i] = ctrl[k].x;
+		y[k][i] = ctrl[k].y;
+		z[k][i] = ctrl[k].z;
+	}
+}
+
+void BezierCurves::Clear() {
+	for (int k = 0; k < 4; k++) {
+		x[k].clear();
+		y[k].clear();
+		z[k].clear();
+	}
+}
+
+static void Gather(const BezierCurves &curves, int i, Pt<Lanes> *c) {
+	for (int k = 0; k < 4; k++)
+		c[k] = { Lanes::Load(&curves.x[k][i]), Lanes::Load(&curves.y[k][i]), Lanes::Load(&curves.z[k][i]) };
+}
+
+static void Gather(const BezierCurves &curves, int i, vec3 *ctrl) {
+	for (int k = 0; k < 4; k++)
+		ctrl[k] = vec3(curves.x[k][i], curves.y[k][i], curves.z[k][i]);
+}
+
+void BezierPositions(const BezierCurves &curves, const float *t, vec3 *positions) {
+	int i = 0, n = curves.Size();
+	Pt<Lanes> c[4];
+	for (; i+N <= n; i += N) {
+		Gather(curves, i, c);
+		Store(Position(c, Lanes::Load(t+i)), positions+i);
+	}
+	for (vec3 ctrl[4]; i < n; i++) {
+		Gather(curves, i, ctrl);
+		positions[i] = BezierPosition(ctrl, t[i]);
+	}
+}
+
+void BezierVelocities(const BezierCurves &curves, const float *t, vec3 *velocities) {
+	int i = 0, n = curves.Size();
+	Pt<Lanes> c[4];
+	for (; i+N <= n; i += N) {
+		Gather(curves, i, c);
+		Store(Velocity(c, Lanes::Load(t+i)), velocities+i);
+	}
+	for (vec3 ctrl[4]; i < n; i++) {
+		Gather(curves, i, ctrl);
+		velocities[i] = BezierVelocity(ctrl, t[i]);
+	}
+}
+
+void BezierFrames(const BezierCurves &curves, const float *t, mat4 *frames) {
+	int i = 0, n = curves.Size();
+	Pt<Lanes> c[4], p, v, nrm, b;
+	for (; i+N <= n; i += N) {
+		Gather(curves, i, c);
+		Frame(c, Lanes::Load(t+i), p, v, nrm, b);
+		Store(p, v, nrm, b, frames+i);
+	}
+	for (vec3 ctrl[4]; i < n; i++) {
+		Gather(curves, i, ctrl);
+		frames[i] = BezierFrame(ctrl, t[i]);
+	}
+}
+
+// Benchmark
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+template <class T> static int NDiffer(const vector<T> &a, const vector<T> &b) {
+	int count = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		if (memcmp(&a[i], &b[i], sizeof(T)) != 0)
+			count++;
+	return count;
+}
+
+int BezierBatchBenchmark(int n, int nRepeat) {
+	typedef std::chrono::steady_clock Clock;
+	vec3 ctrl[] = { {2/3.f, 0, 2/3.f}, {1, 0, 1/3.f}, {1, .1f, -1/3.f}, {2/3.f, .1f, -2/3.f} };
+	vector<float> t(n);
+	vector<vec3> sPos(n), bPos(n), sVel(n), bVel(n);
+	vector<mat4> sFrm(n), bFrm(n);
+	BezierCurves curves;
+	for (int i = 0; i < n; i++) {
+		t[i] = n > 1? (float) i/(n-1) : 0;
+		vec3 jitter = (float) (i%7)*vec3(.01f, .02f, -.01f), c[4] = { ctrl[0]+jitter, ctrl[1], ctrl[2], ctrl[3]-jitter };
+		curves.Add(c);
+	}
+	double mevals = (double) n*nRepeat/1e6;
+	printf("Bezier batch (%s, %i lanes), %i evals x %i:\n", SimdISA(), N, n, nRepeat);
+	// one curve
+	Clock::time_point start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		for (int i = 0; i < n; i++)
+			sPos[i] = BezierPosition(ctrl, t[i]);
+	double sp = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		BezierPositions(ctrl, t.data(), n, bPos.data());
+	double bp = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		for (int i = 0; i < n; i++)
+			sVel[i] = BezierVelocity(ctrl, t[i]);
+	double sv = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		BezierVelocities(ctrl, t.data(), n, bVel.data());
+	double bv = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		for (int i = 0; i < n; i++)
+			sFrm[i] = BezierFrame(ctrl, t[i]);
+	double sf = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		BezierFrames(ctrl, t.data(), n, bFrm.data());
+	double bf = Seconds(start);
+	int dp = NDiffer(sPos, bPos), dv = NDiffer(sVel, bVel), df = NDiffer(sFrm, bFrm);
+	printf("  position: scalar %7.1f, batch %7.1f Mevals/s, %i differ\n", mevals/sp, mevals/bp, dp);
+	printf("  velocity: scalar %7.1f, batch %7.1f Mevals/s, %i differ\n", mevals/sv, mevals/bv, dv);
+	printf("  frame:    scalar %7.1f, batch %7.1f Mevals/s, %i differ\n", mevals/sf, mevals/bf, df);
+	// many curves
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		for (int i = 0; i < n; i++) {
+			vec3 c[4];
+			Gather(curves, i, c);
+			sFrm[i] = BezierFrame(c, t[i]);
+		}
+	sf = Seconds(start);
+	start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		BezierFrames(curves, t.data(), bFrm.data());
+	bf = Seconds(start);
+	int ds = NDiffer(sFrm, bFrm);
+	printf("  SoA frame: scalar %6.1f, batch %7.1f Mevals/s, %i differ\n", mevals/sf, mevals/bf, ds);
+	if (dp+dv+df+ds)
+		printf("FAILED: batch results differ from scalar\n");
+	return dp+dv+df+ds;
+}
@@ -0,0 +1,45 @@
+// BezierBatch.h: evaluate cubic Bezier positions, velocities, and frames for arrays of parameters
+
+#ifndef BEZIER_BATCH_HDR
+#define BEZIER_BATCH_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Kernels are AVX2 (8 lanes) when compiled with /arch:AVX2 or -mavx2, else SSE (4 lanes), else scalar.
+// All paths, including the scalar reference below, share one templated kernel with identical
+// operation order, so results match bit-for-bit. That needs no FMA contraction, which
+// BezierBatch.cpp turns off for itself (equivalent to -ffp-contract=off, /fp:contract absent).
+
+// scalar reference, ctrl points to four control points
+vec3 BezierPosition(const vec3 *ctrl, float t);
+vec3 BezierVelocity(const vec3 *ctrl, float t);
+mat4 BezierFrame(const vec3 *ctrl, float t);   // columns: side, up, -velocity, position
+
+// one curve, n parameters
+void BezierPositions(const vec3 *ctrl, const float *t, int n, vec3 *positions);
+void BezierVelocities(const vec3 *ctrl, const float *t, int n, vec3 *velocities);
+void BezierFrames(const vec3 *ctrl, const float *t, int n, mat4 *frames);
+
+// many curves in SoA layout: control point k of curve i is (x[k][i], y[k][i], z[k][i])
+class BezierCurves {
+public:
+	vector<float> x[4], y[4], z[4];
+	int Size() const { return (int) x[0].size(); }
+	void Add(const vec3 *ctrl);
+	void Set(int i, const vec3 *ctrl);
+	void Clear();
+};
+
+// curve i evaluated at t[i], for i in [0, curves.Size())
+void BezierPositions(const BezierCurves &curves, const float *t, vec3 *positions);
+void BezierVelocities(const BezierCurves &curves, const float *t, vec3 *velocities);
+void BezierFrames(const BezierCurves &curves, const float *t, mat4 *frames);
+
+// time scalar vs batch evaluation, print Mevals/s and number of results that differ bitwise;
+// returns the total number that differ (0: batch is bit-exact)
+int BezierBatchBenchmark(int n = 1 << 20, int nRepeat = 10);
+
+#endif
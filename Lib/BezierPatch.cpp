@@ -0,0 +1,370 @@
+// BezierPatch.cpp: bicubic Bezier patch loading, GPU tessellation, CPU fallback
+
+#include <stdio.h>
+#include <string.h>
+#include "BezierPatch.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "IO.h"
+#include "PointKernels.h"
+
+// Shaders
+
+static const char *patchVShader = R"(
+	#version 400
+	in vec3 point;
+	out vec3 vPoint;
+	void main() {
+		vPoint = point;
+	}
+)";
+
+static const char *patchTcShader = R"(
+	#version 400
+	layout (vertices = 16) out;
+	in vec3 vPoint[];
+	out vec3 tcPoint[];
+	uniform mat4 modelview, persp;
+	uniform vec2 viewport;
+	uniform float pixelsPerEdge = 8, maxLevel = 64;
+	vec2 Screen(int i) {
+		vec4 h = persp*modelview*vec4(vPoint[i], 1);
+		return .5*viewport*h.xy/max(h.w, .001);
+	}
+	float Level(int a, int b, int c, int d) {
+		// projected length of a boundary control polygon, in pixels
+		vec2 pa = Screen(a), pb = Screen(b), pc = Screen(c), pd = Screen(d);
+		float len = distance(pa, pb)+distance(pb, pc)+distance(pc, pd);
+		return clamp(len/pixelsPerEdge, 1, maxLevel);
+	}
+	void main() {
+		tcPoint[gl_InvocationID] = vPoint[gl_InvocationID];
+		if (gl_InvocationID == 0) {
+			gl_TessLevelOuter[0] = Level(0, 4, 8, 12);     // u = 0
+			gl_TessLevelOuter[1] = Level(0, 1, 2, 3);      // v = 0
+			gl_TessLevelOuter[2] = Level(3, 7, 11, 15);    // u = 1
+			gl_TessLevelOuter[3] = Level(12, 13, 14, 15);  // v = 1
+			gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+			gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+		}
+	}
+)";
+
+static const char *patchTeShader = R"(
+	#version 400
+	layout (quads, fractional_odd_spacing, ccw) in;
+	in vec3 tcPoint[];
+	out vec3 point, normal;
+	out vec2 uv;
+	uniform mat4 modelview, persp;
+	void Weights(float t, out vec4 b, out vec4 d) {
+		float s = 1-t;
+		b = vec4(s*s*s, 3*t*s*s, 3*t*t*s, t*t*t);
+		d = vec4(-3*s*s, 3*s*s-6*t*s, 6*t*s-3*t*t, 3*t*t);
+	}
+	void Eval(vec2 st, out vec3 p, out vec3 n) {
+		vec4 bu, du, bv, dv;
+		Weights(st.x, bu, du);
+		Weights(st.y, bv, dv);
+		vec3 pu = vec3(0), pv = vec3(0);
+		p = vec3(0);
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				vec3 c = tcPoint[4*i+j];
+				p += bv[i]*bu[j]*c;
+				pu += bv[i]*du[j]*c;
+				pv += dv[i]*bu[j]*c;
+			}
+		n = cross(pu, pv);
+	}
+	void main() {
+		uv = gl_TessCoord.st;
+		vec3 p, n, pTmp;
+		Eval(uv, p, n);
+		if (dot(n, n) < 1e-12)               // collapsed edge (e.g. teapot lid): nudge toward center
+			Eval(mix(uv, vec2(.5), .001), pTmp, n);
+		point = (modelview*vec4(p, 1)).xyz;
+		normal = (modelview*vec4(n, 0)).xyz;
+		gl_Position = persp*vec4(point, 1);
+	}
+)";
+
+static const char *meshVShader = R"(
+	#version 130
+	in vec3 point, normal;
+	in vec2 uv;
+	out vec3 vPoint, vNormal;
+	out vec2 vUv;
+	uniform mat4 modelview, persp;
+	void main() {
+		vPoint = (modelview*vec4(point, 1)).xyz;
+		vNormal = (modelview*vec4(normal, 0)).xyz;
+		vUv = uv;
+		gl_Position = persp*vec4(vPoint, 1);
+	}
+)";
+
+// both paths shade identically, so GPU and CPU tessellation can be compared directly
+static const char *patchPShader = R"(
+	#version 400
+	in vec3 point, normal;
+	in vec2 uv;
+	out vec4 pColor;
+	uniform vec3 light, color;
+	void main() {
+		vec3 N = normalize(normal);					// surface normal
+		vec3 L = normalize(light-point);			// light vector
+		vec3 E = normalize(point);					// eye vertex
+		vec3 R = reflect(L, N);						// highlight vector
+		float dif = abs(dot(N, L));					// two-sided diffuse
+		float spec = pow(max(0, dot(E, R)), 50);
+		float ad = clamp(.15+dif, 0, 1);
+		pColor = vec4(ad*color+vec3(spec), 1);
+	}
+)";
+
+static const char *meshPShader = R"(
+	#version 130
+	in vec3 vPoint, vNormal;
+	in vec2 vUv;
+	out vec4 pColor;
+	uniform vec3 light, color;
+	void main() {
+		vec3 N = normalize(vNormal);
+		vec3 L = normalize(light-vPoint);
+		vec3 E = normalize(vPoint);
+		vec3 R = reflect(L, N);
+		float dif = abs(dot(N, L));
+		float spec = pow(max(0, dot(E, R)), 50);
+		float ad = clamp(.15+dif, 0, 1);
+		pColor = vec4(ad*color+vec3(spec), 1);
+	}
+)";
+
+// File IO
+
+bool BezierPatches::Read(const char *filename) {
+	FILE *in = fopen(filename, "r");
+	if (!in)
+		return false;
+	// treat commas as white space
+	vector<char> text;
+	for (int c; (c = fgetc(in)) != EOF; )
+		text.push_back(c == ',' ? ' ' : (char) c);
+	text.push_back(0);
+	fclose(in);
+	const char *s = text.data();
+	char *end = NULL;
+	int nPatches = (int) strtol(s, &end, 10);
+	if (end == s || nPatches <= 0)
+		return false;
+	indices.resize(16*nPatches);
+	for (int i = 0; i < 16*nPatches; i++) {
+		s = end;
+		indices[i] = (int) strtol(s, &end, 10)-1;
+		if (end == s)
+			return false;
+	}
+	s = end;
+	int nPoints = (int) strtol(s, &end, 10);
+	if (end == s || nPoints <= 0)
+		return false;
+	points.resize(nPoints);
+	for (int i = 0; i < nPoints; i++)
+		for (int k = 0; k < 3; k++) {
+			s = end;
+			points[i][k] = strtof(s, &end);
+			if (end == s)
+				return false;
+		}
+	for (int i : indices)
+		if (i < 0 || i >= nPoints)
+			return false;
+	dirty = true;
+	return true;
+}
+
+void BezierPatches::Standardize(float scale) {
+	StandardizePoints(points.data(), (int) points.size(), scale);
+	dirty = true;
+}
+
+// CPU Tessellation
+
+static void Weights(float t, float b[4], float d[4]) {
+	float s = 1-t;
+	b[0] = s*s*s; b[1] = 3*t*s*s; b[2] = 3*t*t*s; b[3] = t*t*t;
+	d[0] = -3*s*s; d[1] = 3*s*s-6*t*s; d[2] = 6*t*s-3*t*t; d[3] = 3*t*t;
+}
+
+static void Eval(const vec3 *pts, const int *ids, float u, float v, vec3 &p, vec3 &n) {
+	float bu[4], du[4], bv[4], dv[4];
+	Weights(u, bu, du);
+	Weights(v, bv, dv);
+	vec3 pu(0, 0, 0), pv(0, 0, 0);
+	p = vec3(0, 0, 0);
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			vec3 c = pts[ids[4*i+j]];
+			p += (bv[i]*bu[j])*c;
+			pu += (bv[i]*du[j])*c;
+			pv += (dv[i]*bu[j])*c;
+		}
+	n = cross(pu, pv);
+}
+
+void BezierPatches::Tessellate(int res, vector<vec3> &pts, vector<vec3> &nrms, vector<vec2> &uvs, vector<int3> &tris) const {
+	int nPatches = NPatches(), nRow = res+1, nVerts = nRow*nRow;
+	pts.resize(nPatches*nVerts);
+	nrms.resize(nPatches*nVerts);
+	uvs.resize(nPatches*nVerts);
+	tris.resize(2*nPatches*res*res);
+	for (int p = 0; p < nPatches; p++) {
+		const int *ids = &indices[16*p];
+		int base = p*nVerts, t = 2*p*res*res;
+		for (int i = 0; i < nRow; i++)
+			for (int j = 0; j < nRow; j++) {
+				float u = (float) j/res, v = (float) i/res;
+				int k = base+i*nRow+j;
+				vec3 dummy;
+				Eval(points.data(), ids, u, v, pts[k], nrms[k]);
+				if (dot(nrms[k], nrms[k]) < 1e-12f)
+					Eval(points.data(), ids, u+.001f*(.5f-u), v+.001f*(.5f-v), dummy, nrms[k]);
+				nrms[k] = normalize(nrms[k]);
+				uvs[k] = vec2(u, v);
+			}
+		for (int i = 0; i < res; i++)
+			for (int j = 0; j < res; j++) {
+				int k = base+i*nRow+j;
+				tris[t++] = int3(k, k+1, k+nRow+1);
+				tris[t++] = int3(k, k+nRow+1, k+nRow);
+			}
+	}
+}
+
+// GPU
+
+void BezierPatches::Upload() {
+	if (!patchProgram) {
+		patchProgram = LinkProgramViaCode(&patchVShader, &patchTcShader, &patchTeShader, NULL, &patchPShader);
+		meshProgram = LinkProgramViaCode(&meshVShader, &meshPShader);
+		gpuRegistry.Track(GPURegistry::Program, patchProgram, 0, "bezier patch tessellation");
+		gpuRegistry.Track(GPURegistry::Program, meshProgram, 0, "bezier patch mesh");
+		glGenVertexArrays(1, &vArray);
+		glGenBuffers(1, &pBuffer);
+		glGenBuffers(1, &iBuffer);
+		glGenQueries(1, &query);
+	}
+	glBindVertexArray(vArray);
+	glBindBuffer(GL_ARRAY_BUFFER, pBuffer);
+	glBufferData(GL_ARRAY_BUFFER, points.size()*sizeof(vec3), points.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(int), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	gpuRegistry.Track(GPURegistry::Buffer, pBuffer, points.size()*sizeof(vec3), "bezier patch control points");
+	gpuRegistry.Track(GPURegistry::Buffer, iBuffer, indices.size()*sizeof(int), "bezier patch indices");
+	dirty = false;
+	meshRes = 0;
+}
+
+void BezierPatches::UploadMesh() {
+	vector<vec3> pts, nrms;
+	vector<vec2> uvs;
+	vector<int3> tris;
+	Tessellate(cpuRes, pts, nrms, uvs, tris);
+	if (!mBuffer) {
+		glGenBuffers(1, &mBuffer);
+		glGenBuffers(1, &mIndices);
+	}
+	size_t sPts = pts.size()*sizeof(vec3), sUvs = uvs.size()*sizeof(vec2);
+	glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+	glBufferData(GL_ARRAY_BUFFER, 2*sPts+sUvs, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sPts, pts.data());
+	glBufferSubData(GL_ARRAY_BUFFER, sPts, sPts, nrms.data());
+	glBufferSubData(GL_ARRAY_BUFFER, 2*sPts, sUvs, uvs.data());
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndices);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, tris.size()*sizeof(int3), tris.data(), GL_STATIC_DRAW);
+	nMeshTriangles = (int) tris.size();
+	meshRes = cpuRes;
+	gpuRegistry.Track(GPURegistry::Buffer, mBuffer, 2*sPts+sUvs, "bezier patch CPU mesh");
+	gpuRegistry.Track(GPURegistry::Buffer, mIndices, tris.size()*sizeof(int3), "bezier patch CPU mesh triangles");
+}
+
+void BezierPatches::Draw(mat4 modelview, mat4 persp, vec3 light, vec3 color, bool cpu) {
+	if (indices.empty())
+		return;
+	GLint vArrayWas = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vArrayWas);
+	if (dirty)
+		Upload();
+	glBindVertexArray(vArray);
+	if (cpu) {
+		if (meshRes != cpuRes)
+			UploadMesh();
+		glUseProgram(meshProgram);
+		glBindBuffer(GL_ARRAY_BUFFER, mBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndices);
+		int nVerts = NPatches()*(cpuRes+1)*(cpuRes+1);
+		size_t sPts = nVerts*sizeof(vec3);
+		VertexAttribPointer(meshProgram, "point", 3, 0, (void *) 0);
+		VertexAttribPointer(meshProgram, "normal", 3, 0, (void *) sPts);
+		VertexAttribPointer(meshProgram, "uv", 2, 0, (void *) (2*sPts));
+		SetUniform(meshProgram, "modelview", modelview);
+		SetUniform(meshProgram, "persp", persp);
+		SetUniform(meshProgram, "light", light);
+		SetUniform(meshProgram, "color", color);
+		glDrawElements(GL_TRIANGLES, 3*nMeshTriangles, GL_UNSIGNED_INT, 0);
+		nTriangles = nMeshTriangles;
+	}
+	else {
+		// fetch last frame's primitive count without stalling
+		GLint available = 0;
+		if (queryPending)
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (queryPending && available) {
+			GLuint count = 0;
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT, &count);
+			nTriangles = (int) count;
+			queryPending = false;
+		}
+		GLint vp[4];
+		glGetIntegerv(GL_VIEWPORT, vp);
+		glUseProgram(patchProgram);
+		glBindBuffer(GL_ARRAY_BUFFER, pBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+		VertexAttribPointer(patchProgram, "point", 3, 0, (void *) 0);
+		SetUniform(patchProgram, "modelview", modelview);
+		SetUniform(patchProgram, "persp", persp);
+		SetUniform(patchProgram, "viewport", vec2((float) vp[2], (float) vp[3]));
+		SetUniform(patchProgram, "pixelsPerEdge", pixelsPerEdge);
+		SetUniform(patchProgram, "maxLevel", (float) maxLevel);
+		SetUniform(patchProgram, "light", light);
+		SetUniform(patchProgram, "color", color);
+		glPatchParameteri(GL_PATCH_VERTICES, 16);
+		if (!queryPending)
+			glBeginQuery(GL_PRIMITIVES_GENERATED, query);
+		glDrawElements(GL_PATCHES, (GLsizei) indices.size(), GL_UNSIGNED_INT, 0);
+		if (!queryPending) {
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+			queryPending = true;
+		}
+	}
+	glBindVertexArray(vArrayWas);
+}
+
+void BezierPatches::Release() {
+	// call while the GL context is current
+	if (!patchProgram)
+		return;
+	for (GLuint *b : { &pBuffer, &iBuffer, &mBuffer, &mIndices })
+		DeleteBuffer(*b);
+	if (vArray)
+		glDeleteVertexArrays(1, &vArray);
+	if (query)
+		glDeleteQueries(1, &query);
+	DeleteProgram(patchProgram);
+	DeleteProgram(meshProgram);
+	vArray = query = 0;
+	dirty = true;
+	meshRes = 0;
+}
@@ -0,0 +1,43 @@
+// BezierPatch.h: bicubic Bezier patches, tessellated on the GPU or (for comparison) on the CPU
+
+#ifndef BEZIER_PATCH_HDR
+#define BEZIER_PATCH_HDR
+
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Patch files use the Utah teapot layout (commas optional):
+//   nPatches
+//   16 one-based control point indices per patch, row-major
+//   nPoints
+//   x y z per point
+// The GPU path draws each patch as GL_PATCHES with GL_PATCH_VERTICES = 16; the tessellation
+// control shader sets levels from the projected length of each boundary control polygon
+
+class BezierPatches {
+public:
+	vector<vec3> points;       // unique control points
+	vector<int> indices;       // 16 per patch, zero-based
+	float pixelsPerEdge = 8;   // screen-adaptive target for GPU tessellation
+	int maxLevel = 64;         // upper limit on tessellation level
+	int cpuRes = 16;           // quads per patch side for the CPU path
+	int NPatches() const { return (int) indices.size()/16; }
+	bool Read(const char *filename);
+	void Standardize(float scale = 1);    // fit control points to +/- scale, centered at origin
+	void Draw(mat4 modelview, mat4 persp, vec3 light, vec3 color, bool cpu = false);
+	int Triangles() const { return nTriangles; }  // most recent count from either path
+	void Tessellate(int res, vector<vec3> &pts, vector<vec3> &nrms, vector<vec2> &uvs, vector<int3> &tris) const;
+	void Release();                       // free GPU resources, while context is current
+private:
+	GLuint patchProgram = 0, meshProgram = 0, vArray = 0, pBuffer = 0, iBuffer = 0;
+	GLuint mBuffer = 0, mIndices = 0, query = 0;
+	int nTriangles = 0, nMeshTriangles = 0, meshRes = 0;
+	bool dirty = true, queryPending = false;
+	void Upload();
+	void UploadMesh();
+};
+
+#endif
@@ -0,0 +1,405 @@
+// Culling.cpp: bounding spheres, batched frustum test, hierarchical-Z occlusion test
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include "Culling.h"
+#include "GLXtras.h"
+#include "Simd.h"
+
+// Spheres
+
+vec4 BoundingSphere(const vector<vec3> &points) {
+	// center of bounding box, radius to farthest point
+	if (points.empty())
+		return vec4(0, 0, 0, 0);
+	vec3 mn = points[0], mx = points[0];
+	for (const vec3 &p : points)
+		for (int k = 0; k < 3; k++) {
+			mn[k] = p[k] < mn[k]? p[k] : mn[k];
+			mx[k] = p[k] > mx[k]? p[k] : mx[k];
+		}
+	vec3 c = (mn+mx)/2;
+	float r2 = 0;
+	for (const vec3 &p : points) {
+		vec3 d = p-c;
+		float d2 = dot(d, d);
+		r2 = d2 > r2? d2 : r2;
+	}
+	return vec4(c.x, c.y, c.z, sqrtf(r2));
+}
+
+vec4 TransformSphere(mat4 m, vec4 s) {
+	vec4 c = m*vec4(s.x, s.y, s.z, 1);
+	float scale2 = 0;
+	for (int j = 0; j < 3; j++) {
+		float l2 = m[0][j]*m[0][j]+m[1][j]*m[1][j]+m[2][j]*m[2][j];
+		scale2 = l2 > scale2? l2 : scale2;
+	}
+	return vec4(c.x, c.y, c.z, s.w*sqrtf(scale2));
+}
+
+// Frustum
+
+void Frustum::Set(mat4 m) {
+	// Gribb-Hartmann: planes are sums and differences of the rows of viewProj
+	vec4 r0 = m[0], r1 = m[1], r2 = m[2], r3 = m[3];
+	planes[0] = r3+r0; planes[1] = r3-r0;
+	planes[2] = r3+r1; planes[3] = r3-r1;
+	planes[4] = r3+r2; planes[5] = r3-r2;
+	for (vec4 &p : planes) {
+		float l = sqrtf(p.x*p.x+p.y*p.y+p.z*p.z);
+		p = p/(l > 0? l : 1);
+	}
+}
+
+bool Frustum::Visible(vec4 s) const {
+	for (const vec4 &p : planes)
+		if (p.x*s.x+p.y*s.y+p.z*s.z+p.w+s.w < 0)
+			return false;
+	return true;
+}
+
+int Frustum::Visible(const float *x, const float *y, const float *z, const float *r, int n, unsigned char *visible) const {
+	const int N = Lanes::N;
+	int nVisible = 0, i = 0;
+	Lanes a[6], b[6], c[6], d[6];
+	for (int k = 0; k < 6; k++) {
+		a[k] = Lanes(planes[k].x); b[k] = Lanes(planes[k].y);
+		c[k] = Lanes(planes[k].z); d[k] = Lanes(planes[k].w);
+	}
+	for (; i+N <= n; i += N) {
+		// least signed distance over the six planes, plus radius
+		Lanes px = Lanes::Load(x+i), py = Lanes::Load(y+i), pz = Lanes::Load(z+i), pr = Lanes::Load(r+i);
+		Lanes m = a[0]*px+b[0]*py+c[0]*pz+d[0]+pr;
+		for (int k = 1; k < 6; k++)
+			m = Min(m, a[k]*px+b[k]*py+c[k]*pz+d[k]+pr);
+		float ms[N];
+		m.Store(ms);
+		for (int j = 0; j < N; j++)
+			nVisible += visible[i+j] = ms[j] >= 0;
+	}
+	for (; i < n; i++)
+		nVisible += visible[i] = Visible(vec4(x[i], y[i], z[i], r[i]));
+	return nVisible;
+}
+
+// HiZ: GPU reduction
+
+static const char *reduceVShader = R"(
+	#version 330
+	void main() {
+		// full-screen triangle
+		vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+		gl_Position = vec4(2*p-1, 0, 1);
+	}
+)";
+
+static const char *reducePShader = R"(
+	#version 330
+	uniform sampler2D src;
+	out float depth;
+	void main() {
+		// farthest of the 2x2 source texels; clamping covers odd source sizes
+		ivec2 d = 2*ivec2(gl_FragCoord.xy), s = textureSize(src, 0)-1;
+		depth = max(max(texelFetch(src, min(d, s), 0).r, texelFetch(src, min(d+ivec2(1, 0), s), 0).r),
+					max(texelFetch(src, min(d+ivec2(0, 1), s), 0).r, texelFetch(src, min(d+ivec2(1, 1), s), 0).r));
+	}
+)";
+
+static const char *copyPShader = R"(
+	#version 330
+	uniform sampler2D color, depth;
+	uniform vec2 origin;
+	out vec4 pColor;
+	void main() {
+		// resolved target to window, depth included so later drawing is still depth-tested
+		ivec2 t = ivec2(gl_FragCoord.xy-origin);
+		pColor = texelFetch(color, t, 0);
+		gl_FragDepth = texelFetch(depth, t, 0).r;
+	}
+)";
+
+static void SetNearest(GLuint texture) {
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+void HiZ::Allocate(int w, int h) {
+	Release();
+	width = w;
+	height = h;
+	program = LinkProgramViaCode(&reduceVShader, &reducePShader);
+	copyProgram = LinkProgramViaCode(&reduceVShader, &copyPShader);
+	glGenVertexArrays(1, &vao);
+	glGenFramebuffers(1, &framebuffer);
+	GLint textureWas;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &textureWas);
+	// multisampled color and depth, drawn into; formats are ours, so the resolve blit is legal
+	glGenFramebuffers(1, &msFramebuffer);
+	glGenRenderbuffers(1, &msColor);
+	glGenRenderbuffers(1, &msDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, msColor);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples > 1? samples : 0, GL_RGBA8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, msDepth);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples > 1? samples : 0, GL_DEPTH24_STENCIL8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, msFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, msDepth);
+	bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	// single-sample color and depth, resolved into and sampled
+	glGenTextures(1, &colorTexture);
+	SetNearest(colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenTextures(1, &depthTexture);
+	SetNearest(depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, w, h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	glGenFramebuffers(1, &resolveFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	ok = ok && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferWas);
+	if (!ok) {
+		printf("can't create occlusion framebuffer, occlusion test off\n");
+		Release();
+		glBindTexture(GL_TEXTURE_2D, textureWas);
+		return;
+	}
+	// halve until no wider than maxWidth
+	do {
+		w = (w+1)/2;
+		h = (h+1)/2;
+		GLuint t = 0;
+		glGenTextures(1, &t);
+		SetNearest(t);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+		gpuLevels.push_back(t);
+		gpuWidths.push_back(w);
+		gpuHeights.push_back(h);
+	} while (w > maxWidth);
+	glBindTexture(GL_TEXTURE_2D, textureWas);
+	glGenBuffers(2, pbos);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, w*h*sizeof(float), NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void HiZ::Begin() {
+	glGetIntegerv(GL_VIEWPORT, viewportWas);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebufferWas);
+	int w = viewportWas[2], h = viewportWas[3];
+	if (w <= 0 || h <= 0)
+		return;
+	if (w != width || h != height)
+		Allocate(w, h);
+	if (!msFramebuffer) {
+		width = w;                              // failed at this size: don't retry every frame
+		height = h;
+		return;
+	}
+	// the app's clear color and depth, at the origin of the target
+	glBindFramebuffer(GL_FRAMEBUFFER, msFramebuffer);
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	active = true;
+}
+
+void HiZ::Capture(mat4 vp) {
+	if (!active)
+		return;
+	active = false;
+	GLint programWas, vaoWas, readWas, textureWas, texture1Was, activeWas, depthFuncWas;
+	GLboolean depthMaskWas;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programWas);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vaoWas);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readWas);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeWas);
+	glGetIntegerv(GL_DEPTH_FUNC, &depthFuncWas);
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMaskWas);
+	glActiveTexture(GL_TEXTURE1);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture1Was);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &textureWas);
+	GLboolean depthTestWas = glIsEnabled(GL_DEPTH_TEST), blendWas = glIsEnabled(GL_BLEND);
+	// resolve the target: same formats on both sides
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, msFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	// copy color and depth into the window (depth writes need the test on, so always pass)
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferWas);
+	glViewport(viewportWas[0], viewportWas[1], viewportWas[2], viewportWas[3]);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glDepthMask(GL_TRUE);
+	glUseProgram(copyProgram);
+	glBindVertexArray(vao);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	SetUniform(copyProgram, "color", 0);
+	SetUniform(copyProgram, "depth", 1);
+	SetUniform(copyProgram, "origin", vec2((float) viewportWas[0], (float) viewportWas[1]));
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	// max-reduce level by level
+	glDisable(GL_DEPTH_TEST);
+	glDepthFunc(depthFuncWas);
+	glDepthMask(depthMaskWas);
+	glUseProgram(program);
+	glBindVertexArray(vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	SetUniform(program, "src", 0);
+	GLuint src = depthTexture;
+	for (size_t i = 0; i < gpuLevels.size(); i++) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpuLevels[i], 0);
+		glViewport(0, 0, gpuWidths[i], gpuHeights[i]);
+		glBindTexture(GL_TEXTURE_2D, src);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		src = gpuLevels[i];
+	}
+	// start readback of the coarsest level into this frame's PBO
+	int slot = frame++%2;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+	glReadPixels(0, 0, gpuWidths.back(), gpuHeights.back(), GL_RED, GL_FLOAT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (fences[slot])
+		glDeleteSync(fences[slot]);
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pboViewProj[slot] = vp;
+	// restore state
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readWas);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebufferWas);
+	glViewport(viewportWas[0], viewportWas[1], viewportWas[2], viewportWas[3]);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, texture1Was);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textureWas);
+	glActiveTexture(activeWas);
+	glBindVertexArray(vaoWas);
+	glUseProgram(programWas);
+	if (depthTestWas)
+		glEnable(GL_DEPTH_TEST);
+	if (blendWas)
+		glEnable(GL_BLEND);
+	// collect the other slot's readback if the GPU has finished it
+	Receive(1-slot);
+}
+
+// HiZ: CPU pyramid
+
+void HiZ::Receive(int slot) {
+	if (!fences[slot] || glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+		return;
+	glDeleteSync(fences[slot]);
+	fences[slot] = 0;
+	int w = gpuWidths.back(), h = gpuHeights.back();
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+	float *data = (float *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, w*h*sizeof(float), GL_MAP_READ_BIT);
+	if (data) {
+		levels.resize(1);
+		widths.assign(1, w);
+		heights.assign(1, h);
+		levels[0].assign(data, data+w*h);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		viewProj = pboViewProj[slot];
+		// remaining levels down to 1x1
+		while (w > 1 || h > 1) {
+			int pw = w, ph = h;
+			const vector<float> &src = levels.back();
+			w = (w+1)/2;
+			h = (h+1)/2;
+			vector<float> dst(w*h);
+			for (int y = 0; y < h; y++)
+				for (int x = 0; x < w; x++) {
+					int x0 = 2*x, y0 = 2*y, x1 = x0+1 < pw? x0+1 : x0, y1 = y0+1 < ph? y0+1 : y0;
+					float a = src[y0*pw+x0], b = src[y0*pw+x1], c = src[y1*pw+x0], d = src[y1*pw+x1];
+					float m = a > b? a : b, n = c > d? c : d;
+					dst[y*w+x] = m > n? m : n;
+				}
+			levels.push_back(dst);
+			widths.push_back(w);
+			heights.push_back(h);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool HiZ::Occluded(vec4 s) const {
+	if (levels.empty())
+		return false;
+	// screen rectangle and nearest depth of the sphere's bounding box
+	float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX, zNear = FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		vec4 c(s.x+(i&1? s.w : -s.w), s.y+(i&2? s.w : -s.w), s.z+(i&4? s.w : -s.w), 1);
+		vec4 p = viewProj*c;
+		if (p.w <= 0)
+			return false;                       // straddles the eye plane
+		float x = (p.x/p.w+1)/2, y = (p.y/p.w+1)/2, z = (p.z/p.w+1)/2;
+		x0 = x < x0? x : x0; x1 = x > x1? x : x1;
+		y0 = y < y0? y : y0; y1 = y > y1? y : y1;
+		zNear = z < zNear? z : zNear;
+	}
+	if (x1 < 0 || y1 < 0 || x0 > 1 || y0 > 1 || zNear < 0)
+		return false;                           // off screen or crossing near plane: leave to frustum
+	int w = widths[0], h = heights[0];
+	int ix0 = (int) (fmaxf(x0, 0)*w), ix1 = (int) (fminf(x1, 1)*w), iy0 = (int) (fmaxf(y0, 0)*h), iy1 = (int) (fminf(y1, 1)*h);
+	ix1 = ix1 < w? ix1 : w-1;
+	iy1 = iy1 < h? iy1 : h-1;
+	// coarsest level at which the rectangle spans at most 2x2 texels
+	int level = 0;
+	while (level < (int) levels.size()-1 && ((ix1 >> level)-(ix0 >> level) > 1 || (iy1 >> level)-(iy0 >> level) > 1))
+		level++;
+	const vector<float> &d = levels[level];
+	int lw = widths[level];
+	float zFar = 0;
+	for (int y = iy0 >> level; y <= iy1 >> level; y++)
+		for (int x = ix0 >> level; x <= ix1 >> level; x++)
+			zFar = d[y*lw+x] > zFar? d[y*lw+x] : zFar;
+	return zNear > zFar;
+}
+
+void HiZ::Release() {
+	for (int i = 0; i < 2; i++)
+		if (fences[i]) {
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+	if (pbos[0])
+		glDeleteBuffers(2, pbos);
+	pbos[0] = pbos[1] = 0;
+	if (!gpuLevels.empty())
+		glDeleteTextures((GLsizei) gpuLevels.size(), gpuLevels.data());
+	gpuLevels.clear();
+	gpuWidths.clear();
+	gpuHeights.clear();
+	if (msFramebuffer) {
+		glDeleteFramebuffers(1, &msFramebuffer);
+		glDeleteRenderbuffers(1, &msColor);
+		glDeleteRenderbuffers(1, &msDepth);
+	}
+	for (GLuint t : { colorTexture, depthTexture })
+		if (t)
+			glDeleteTextures(1, &t);
+	for (GLuint f : { resolveFramebuffer, framebuffer })
+		if (f)
+			glDeleteFramebuffers(1, &f);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	for (GLuint p : { program, copyProgram })
+		if (p)
+			glDeleteProgram(p);
+	msFramebuffer = msColor = msDepth = colorTexture = depthTexture = resolveFramebuffer = 0;
+	framebuffer = vao = program = copyProgram = 0;
+	active = false;
+	levels.clear();
+	widths.clear();
+	heights.clear();
+	width = height = 0;
+}
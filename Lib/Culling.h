@@ -0,0 +1,67 @@
+// Culling.h: bounding spheres, batched frustum test, hierarchical-Z occlusion test
+
+#ifndef CULLING_HDR
+#define CULLING_HDR
+
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Bounds are spheres (xyz center, w radius): cheap to transform and to test against planes.
+// The frustum test runs Lanes::N spheres at a time over SoA arrays. The occlusion test uses
+// the previous frame's depth: occluders are drawn between HiZ::Begin and HiZ::Capture into a
+// target HiZ owns (the window's depth can't be sampled, nor blitted into a texture unless the
+// formats match). Capture resolves the target, copies its color and depth into the window with
+// a full-screen pass, reduces the depth to a max-depth pyramid on the GPU, reads the coarse
+// level back through a PBO (no stall; the result is a frame late) and finishes the pyramid on
+// the CPU. A sphere is occluded if its nearest depth lies behind the farthest depth of the 2x2
+// pyramid texels covering its screen rectangle.
+
+vec4 BoundingSphere(const vector<vec3> &points);
+vec4 TransformSphere(mat4 m, vec4 sphere);   // radius scaled by the largest axis scale
+
+class Frustum {
+public:
+	vec4 planes[6];                             // left, right, bottom, top, near, far; inward normals
+	void Set(mat4 viewProj);                    // world spheres: viewProj = persp*modelview
+	bool Visible(vec4 sphere) const;
+	// SoA spheres, visible[i] set to 0 or 1; returns number visible
+	int Visible(const float *x, const float *y, const float *z, const float *r, int n, unsigned char *visible) const;
+};
+
+class HiZ {
+public:
+	int maxWidth = 128;                         // GPU reduces to at most this width before readback
+	int samples = 4;                            // multisampling of the owned target
+	void Begin();                               // binds and clears the target, before drawing occluders
+	void Capture(mat4 viewProj);                // after drawing occluders, rebinds the window
+	bool Occluded(vec4 sphere) const;           // false until a pyramid has arrived
+	bool Ready() const { return !levels.empty(); }
+	void Release();
+private:
+	int width = 0, height = 0, frame = 0;       // viewport size
+	GLuint msFramebuffer = 0, msColor = 0, msDepth = 0;                  // multisampled, drawn into
+	GLuint resolveFramebuffer = 0, colorTexture = 0, depthTexture = 0;   // resolved, sampled
+	GLuint framebuffer = 0, program = 0, copyProgram = 0, vao = 0;
+	GLint framebufferWas = 0, viewportWas[4] = {0, 0, 0, 0};
+	bool active = false;
+	vector<GLuint> gpuLevels;
+	vector<int> gpuWidths, gpuHeights;
+	GLuint pbos[2] = {0, 0};
+	GLsync fences[2] = {0, 0};
+	mat4 pboViewProj[2];
+	// CPU pyramid from the latest readback
+	vector<vector<float>> levels;
+	vector<int> widths, heights;
+	mat4 viewProj;
+	void Allocate(int w, int h);
+	void Receive(int slot);
+};
+
+struct CullStats {
+	int objects = 0, frustumCulled = 0, occluded = 0, drawn = 0;
+};
+
+#endif
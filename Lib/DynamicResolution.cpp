@@ -0,0 +1,255 @@
+// DynamicResolution.cpp: render at a GPU-timed, per-frame resolution and upscale to the window
+
+#include <math.h>
+#include <stdio.h>
+#include "DynamicResolution.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+
+static const char *upscaleVShader = R"(
+	#version 330
+	void main() {
+		// full-screen triangle
+		vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+		gl_Position = vec4(2*p-1, 0, 1);
+	}
+)";
+
+static const char *upscalePShader = R"(
+	#version 330
+	uniform sampler2D src;
+	uniform vec2 origin, windowSize, renderSize;
+	uniform int edgeAware = 1;
+	uniform float sharpness = .5;
+	out vec4 pColor;
+	vec3 Texel(ivec2 t) {
+		return texelFetch(src, clamp(t, ivec2(0), ivec2(renderSize)-1), 0).rgb;
+	}
+	void main() {
+		// window pixel to source texel space, clamped to the rendered corner of the target
+		vec2 s = (gl_FragCoord.xy-origin)*renderSize/windowSize;
+		s = clamp(s, vec2(.5), renderSize-.5);
+		vec3 c = texture(src, s/vec2(textureSize(src, 0))).rgb;
+		if (edgeAware == 1) {
+			// contrast-adaptive sharpening: less where the cross is already contrasty, never
+			// beyond its range (no halos)
+			ivec2 t = ivec2(s);
+			vec3 n = Texel(t+ivec2(0, 1)), so = Texel(t-ivec2(0, 1));
+			vec3 e = Texel(t+ivec2(1, 0)), w = Texel(t-ivec2(1, 0));
+			vec3 mn = min(c, min(min(n, so), min(e, w))), mx = max(c, max(max(n, so), max(e, w)));
+			vec3 amp = sqrt(clamp(min(mn, 1-mx)/max(mx, vec3(1e-4)), 0, 1));
+			vec3 k = -amp*mix(.125, .2, sharpness);
+			c = clamp((c+k*(n+so+e+w))/(1+4*k), mn, mx);
+		}
+		pColor = vec4(c, 1);
+	}
+)";
+
+// Target
+
+void DynamicResolution::Allocate(int w, int h) {
+	ReleaseTarget();
+	width = w;
+	height = h;
+	if (!program) {
+		program = LinkProgramViaCode(&upscaleVShader, &upscalePShader);
+		gpuRegistry.Track(GPURegistry::Program, program, 0, "dynamic resolution upscale");
+		glGenVertexArrays(1, &vao);
+		glGenQueries(nQueries, queries);
+	}
+	GLint textureWas, framebufferWas;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &textureWas);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebufferWas);
+	// multisampled color and depth, drawn into
+	glGenFramebuffers(1, &msFramebuffer);
+	glGenRenderbuffers(1, &msColor);
+	glGenRenderbuffers(1, &msDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, msColor);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, msDepth);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, msFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, msColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, msDepth);
+	bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	// single-sample color, resolved into and sampled
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+	ok = ok && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferWas);
+	glBindTexture(GL_TEXTURE_2D, textureWas);
+	// resolved color plus multisampled color and depth
+	int n = samples > 1? samples : 1;
+	gpuRegistry.Track(GPURegistry::Texture, texture, (size_t) 4*w*h*(1+2*n), "dynamic resolution target");
+	failed = !ok;
+	if (failed)
+		printf("can't create %ix%i dynamic resolution framebuffer, rendering to the window\n", w, h);
+}
+
+void DynamicResolution::ReleaseTarget() {
+	if (msFramebuffer) {
+		glDeleteFramebuffers(1, &msFramebuffer);
+		glDeleteRenderbuffers(1, &msColor);
+		glDeleteRenderbuffers(1, &msDepth);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+	DeleteTexture(texture);
+	msFramebuffer = msColor = msDepth = framebuffer = 0;
+	width = height = 0;
+	failed = false;
+}
+
+void DynamicResolution::Release() {
+	ReleaseTarget();
+	DeleteProgram(program);
+	if (vao)
+		glDeleteVertexArrays(1, &vao);
+	vao = 0;
+	if (queries[0])
+		glDeleteQueries(nQueries, queries);
+	for (GLuint &q : queries)
+		q = 0;
+	nIssued = nRead = 0;
+}
+
+// Control
+
+void DynamicResolution::Control(float ms) {
+	gpuMs = ms;
+	// stats for the scale this result was rendered at (near enough: steps are small)
+	double error = ms-targetMs;
+	stats.nFrames++;
+	stats.sumMs += ms;
+	stats.sumAbsError += fabs(error);
+	stats.sumScale += scale;
+	stats.maxMs = ms > stats.maxMs? ms : stats.maxMs;
+	stats.nWithin += fabs(error) <= .1*targetMs;
+	stats.nOver += error > .1*targetMs;
+	if (!enabled)
+		return;
+	smoothedMs = smoothedMs > 0? .75f*smoothedMs+.25f*ms : ms;
+	// cost goes with area; hold still within 5% of target so the image doesn't shimmer
+	float ratio = targetMs/(smoothedMs > .01f? smoothedMs : .01f);
+	if (ratio > .95f && ratio < 1.05f)
+		return;
+	float want = scale*sqrtf(ratio), step = want-scale;
+	step = step > maxStep? maxStep : step < -maxStep? -maxStep : step;
+	scale += step;
+	scale = scale < minScale? minScale : scale > maxScale? maxScale : scale;
+}
+
+void DynamicResolution::ReadQueries() {
+	// results arrive in order; stop at the first not yet available
+	while (nRead < nIssued) {
+		GLuint q = queries[nRead%nQueries];
+		GLint available = 0;
+		glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+		nRead++;
+		Control((float) (ns/1e6));
+	}
+}
+
+// Per Frame
+
+void DynamicResolution::BeginFrame(int windowWidth, int windowHeight) {
+	if (windowWidth <= 0 || windowHeight <= 0)
+		return;
+	if (windowWidth != width || windowHeight != height)
+		Allocate(windowWidth, windowHeight);
+	if (failed)
+		return;
+	ReadQueries();
+	float s = enabled? scale : 1;
+	renderWidth = (int) (s*width+.5f);
+	renderHeight = (int) (s*height+.5f);
+	renderWidth = renderWidth < 1? 1 : renderWidth;
+	renderHeight = renderHeight < 1? 1 : renderHeight;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebufferWas);
+	glGetIntegerv(GL_VIEWPORT, viewportWas);
+	// a query slot is reused only once its result has been read
+	timing = nIssued-nRead < nQueries;
+	if (timing)
+		glBeginQuery(GL_TIME_ELAPSED, queries[nIssued%nQueries]);
+	glBindFramebuffer(GL_FRAMEBUFFER, msFramebuffer);
+	glViewport(0, 0, renderWidth, renderHeight);
+	active = true;
+}
+
+void DynamicResolution::EndFrame() {
+	if (!active)
+		return;
+	active = false;
+	// resolve the rendered corner
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, msFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	// upscale into the window
+	GLint programWas, vaoWas, textureWas, activeWas;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programWas);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vaoWas);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeWas);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &textureWas);
+	GLboolean depthTestWas = glIsEnabled(GL_DEPTH_TEST), blendWas = glIsEnabled(GL_BLEND);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferWas);
+	glViewport(viewportWas[0], viewportWas[1], viewportWas[2], viewportWas[3]);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glUseProgram(program);
+	glBindVertexArray(vao);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	SetUniform(program, "src", 0);
+	SetUniform(program, "origin", vec2((float) viewportWas[0], (float) viewportWas[1]));
+	SetUniform(program, "windowSize", vec2((float) viewportWas[2], (float) viewportWas[3]));
+	SetUniform(program, "renderSize", vec2((float) renderWidth, (float) renderHeight));
+	SetUniform(program, "edgeAware", filter == EdgeAware? 1 : 0);
+	SetUniform(program, "sharpness", sharpness);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	if (timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		nIssued++;
+	}
+	// restore state; clear the window's depth (the app cleared the target's) for annotation
+	glBindTexture(GL_TEXTURE_2D, textureWas);
+	glActiveTexture(activeWas);
+	glBindVertexArray(vaoWas);
+	glUseProgram(programWas);
+	if (depthTestWas)
+		glEnable(GL_DEPTH_TEST);
+	if (blendWas)
+		glEnable(GL_BLEND);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void DynamicResolution::Report() const {
+	const Stats &s = stats;
+	if (!s.nFrames) {
+		printf("dynamic resolution: no timed frames\n");
+		return;
+	}
+	printf("dynamic resolution (%s, target %.1f ms, %s): %i frames, GPU mean %.2f ms, max %.2f ms\n",
+		   enabled? "on" : "off", targetMs, filter == EdgeAware? "edge-aware" : "bilinear",
+		   s.nFrames, s.sumMs/s.nFrames, s.maxMs);
+	printf("  mean |error| %.2f ms, %.0f%% within 10%% of target, %.0f%% over, mean scale %.2f (%.0f%% of pixels)\n",
+		   s.sumAbsError/s.nFrames, 100.*s.nWithin/s.nFrames, 100.*s.nOver/s.nFrames,
+		   s.sumScale/s.nFrames, 100.*(s.sumScale/s.nFrames)*(s.sumScale/s.nFrames));
+}
+
+bool DynamicResolution::Held() const {
+	const Stats &s = stats;
+	return s.nFrames > 0 && (10*s.nOver <= s.nFrames || s.sumScale/s.nFrames < minScale+.01f);
+}
@@ -0,0 +1,67 @@
+// DynamicResolution.h: render at a GPU-timed, per-frame resolution and upscale to the window
+
+#ifndef DYNAMIC_RESOLUTION_HDR
+#define DYNAMIC_RESOLUTION_HDR
+
+#include "glad.h"
+
+// BeginFrame binds an offscreen target and sets the viewport to scale*window size; the app
+// clears and draws its scene as usual (the camera is unchanged, only the viewport shrinks).
+// EndFrame resolves the target and upscales it into the window, bilinear or edge-aware (bilinear
+// plus contrast-adaptive sharpening, clamped to the local range so edges don't ring); draw
+// annotation and text after EndFrame, at full resolution.
+//
+// Each frame is bracketed by a GL_TIME_ELAPSED query. Results are read a few frames later,
+// without waiting, and fed to the controller: fragment cost goes with area, so the new scale is
+// scale*sqrt(target/measured), smoothed and limited per frame so the resolution doesn't pump.
+// The target is allocated at window size and rendered into its lower-left corner, so scale
+// changes never reallocate. If it can't be allocated, BeginFrame and EndFrame do nothing and
+// the app renders straight into the window (until the next resize retries).
+
+class DynamicResolution {
+public:
+	enum Filter { Bilinear, EdgeAware };
+	float targetMs = 16.f;                      // GPU time per frame to hold
+	float minScale = .5f, maxScale = 1.f;       // per axis
+	float maxStep = .05f;                       // largest scale change per frame
+	float sharpness = .5f;                      // EdgeAware only, 0 to 1
+	Filter filter = EdgeAware;
+	int samples = 4;                            // multisampling of the offscreen target
+	bool enabled = true;                        // false: window-size target, no control
+	void BeginFrame(int windowWidth, int windowHeight);
+	void EndFrame();
+	float Scale() const { return scale; }
+	float GpuMs() const { return gpuMs; }       // latest result, a few frames old
+	int Width() const { return renderWidth; }
+	int Height() const { return renderHeight; }
+	void Release();
+	// how closely the target is held, over timed frames since ResetStats
+	struct Stats {
+		int nFrames = 0, nWithin = 0, nOver = 0; // within 10% of target, more than 10% over
+		double sumMs = 0, sumAbsError = 0, sumScale = 0, maxMs = 0;
+	};
+	Stats stats;
+	void ResetStats() { stats = Stats(); }
+	void Report() const;
+	// at most 10% of timed frames more than 10% over target, or the scale held at minScale (the
+	// target is out of reach, not missed by the controller)
+	bool Held() const;
+private:
+	enum { nQueries = 4 };
+	GLuint queries[nQueries] = {};
+	int nIssued = 0, nRead = 0;
+	float scale = 1, gpuMs = 0, smoothedMs = 0;
+	int width = 0, height = 0, renderWidth = 0, renderHeight = 0;
+	GLuint msFramebuffer = 0, msColor = 0, msDepth = 0;   // multisampled, drawn into
+	GLuint framebuffer = 0, texture = 0;                  // resolved, sampled by the upscale
+	GLuint program = 0, vao = 0;
+	GLint framebufferWas = 0, viewportWas[4] = {0, 0, 0, 0};
+	bool active = false, timing = false;
+	bool failed = false;                                  // target incomplete at this size
+	void Allocate(int w, int h);
+	void ReleaseTarget();
+	void ReadQueries();
+	void Control(float ms);
+};
+
+#endif
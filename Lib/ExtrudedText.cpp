@@ -0,0 +1,541 @@
+// ExtrudedText.cpp: glyph outlines to extruded meshes, batched strings in one draw
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <map>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include "ExtrudedText.h"
+#include "GLState.h"
+#include "GPUResources.h"
+
+// Triangulation
+
+static float Cross(vec2 a, vec2 b, vec2 c) {
+	// > 0 if a, b, c turn left
+	return (b.x-a.x)*(c.y-a.y)-(b.y-a.y)*(c.x-a.x);
+}
+
+static float SignedArea(const vector<vec2> &c) {
+	float a = 0;
+	for (size_t i = 0, n = c.size(); i < n; i++)
+		a += c[i].x*c[(i+1)%n].y-c[(i+1)%n].x*c[i].y;
+	return a/2;
+}
+
+static bool Inside(vec2 p, const vector<vec2> &c) {
+	// crossing test
+	bool in = false;
+	for (size_t i = 0, n = c.size(), j = n-1; i < n; j = i++)
+		if ((c[i].y > p.y) != (c[j].y > p.y) && p.x < c[j].x+(p.y-c[j].y)*(c[i].x-c[j].x)/(c[i].y-c[j].y))
+			in = !in;
+	return in;
+}
+
+static bool InTriangle(vec2 p, vec2 a, vec2 b, vec2 c) {
+	// inclusive of edges, for counterclockwise a, b, c
+	return Cross(a, b, p) >= 0 && Cross(b, c, p) >= 0 && Cross(c, a, p) >= 0;
+}
+
+// splice hole (clockwise, indices into pts) into polygon (counterclockwise) through a visible bridge
+static void Bridge(vector<int> &poly, const vector<int> &hole, const vector<vec2> &pts) {
+	// rightmost hole vertex m
+	int mi = 0;
+	for (int i = 1; i < (int) hole.size(); i++)
+		if (pts[hole[i]].x > pts[hole[mi]].x)
+			mi = i;
+	vec2 m = pts[hole[mi]];
+	// nearest polygon edge hit by the ray from m toward +x
+	int n = (int) poly.size(), pi = -1;
+	float nearest = FLT_MAX;
+	vec2 hit;
+	for (int i = 0; i < n; i++) {
+		vec2 a = pts[poly[i]], b = pts[poly[(i+1)%n]];
+		if (a.y == b.y || (a.y > m.y) == (b.y > m.y))
+			continue;
+		float x = a.x+(m.y-a.y)*(b.x-a.x)/(b.y-a.y);
+		if (x >= m.x && x < nearest) {
+			nearest = x;
+			hit = vec2(x, m.y);
+			pi = a.x > b.x? i : (i+1)%n;
+		}
+	}
+	if (pi < 0)
+		return;                                 // hole not inside polygon
+	// a reflex vertex inside triangle (m, hit, p) would block the bridge: use the one nearest the ray
+	vec2 p = pts[poly[pi]];
+	if (p.x != hit.x || p.y != hit.y) {
+		float best = FLT_MAX;
+		vec2 t0 = m, t1 = hit, t2 = p;
+		if (Cross(t0, t1, t2) < 0)
+			std::swap(t1, t2);
+		for (int i = 0; i < n; i++) {
+			vec2 r = pts[poly[i]], prev = pts[poly[(i+n-1)%n]], next = pts[poly[(i+1)%n]];
+			if (i == pi || Cross(prev, r, next) > 0 || r.x < m.x || !InTriangle(r, t0, t1, t2))
+				continue;
+			float slope = fabsf(r.y-m.y)/(r.x-m.x+FLT_MIN);
+			if (slope < best) {
+				best = slope;
+				pi = i;
+			}
+		}
+	}
+	// poly[0..pi], hole from m around to m, back to poly[pi], rest of poly
+	vector<int> merged(poly.begin(), poly.begin()+pi+1);
+	for (int k = 0; k <= (int) hole.size(); k++)
+		merged.push_back(hole[(mi+k)%hole.size()]);
+	merged.insert(merged.end(), poly.begin()+pi, poly.end());
+	poly.swap(merged);
+}
+
+static void EarClip(vector<int> poly, const vector<vec2> &pts, vector<int3> &triangles) {
+	auto Same = [&](int i, int j) { return pts[i].x == pts[j].x && pts[i].y == pts[j].y; };
+	vector<int> reflex;
+	while (poly.size() > 3) {
+		int n = (int) poly.size(), ear = -1;
+		// only reflex (or collinear) vertices can lie inside an ear: gather them once per clip
+		reflex.resize(0);
+		for (int j = 0; j < n; j++)
+			if (Cross(pts[poly[(j+n-1)%n]], pts[poly[j]], pts[poly[(j+1)%n]]) <= 0)
+				reflex.push_back(poly[j]);
+		for (int i = 0; i < n && ear < 0; i++) {
+			int a = poly[(i+n-1)%n], b = poly[i], c = poly[(i+1)%n];
+			if (Cross(pts[a], pts[b], pts[c]) <= 0)
+				continue;
+			bool empty = true;
+			for (size_t j = 0; j < reflex.size() && empty; j++) {
+				int v = reflex[j];
+				if (Same(v, a) || Same(v, b) || Same(v, c))
+					continue;
+				empty = !InTriangle(pts[v], pts[a], pts[b], pts[c]);
+			}
+			if (empty)
+				ear = i;
+		}
+		if (ear < 0) {
+			// no ear: drop a degenerate (collinear) vertex, else clip anyway rather than stall
+			for (int i = 0; i < n && ear < 0; i++)
+				if (Cross(pts[poly[(i+n-1)%n]], pts[poly[i]], pts[poly[(i+1)%n]]) == 0)
+					ear = i;
+			if (ear >= 0) {
+				poly.erase(poly.begin()+ear);
+				continue;
+			}
+			ear = 0;
+		}
+		triangles.push_back(int3(poly[(ear+n-1)%n], poly[ear], poly[(ear+1)%n]));
+		poly.erase(poly.begin()+ear);
+	}
+	if (poly.size() == 3 && Cross(pts[poly[0]], pts[poly[1]], pts[poly[2]]) != 0)
+		triangles.push_back(int3(poly[0], poly[1], poly[2]));
+}
+
+bool Triangulate(const Outline &outline, vector<vec2> &points, vector<int3> &triangles) {
+	points.resize(0);
+	triangles.resize(0);
+	int nContours = (int) outline.size();
+	vector<vector<int>> contours(nContours);
+	vector<float> areas(nContours);
+	for (int c = 0; c < nContours; c++) {
+		for (vec2 p : outline[c]) {
+			contours[c].push_back((int) points.size());
+			points.push_back(p);
+		}
+		areas[c] = SignedArea(outline[c]);
+	}
+	// each hole belongs to the smallest outer contour containing it
+	vector<vector<int>> holes(nContours);
+	for (int h = 0; h < nContours; h++) {
+		if (areas[h] >= 0 || outline[h].size() < 2)
+			continue;
+		vec2 probe = (outline[h][0]+outline[h][1])/2;
+		int parent = -1;
+		for (int c = 0; c < nContours; c++)
+			if (areas[c] > 0 && Inside(probe, outline[c]) && (parent < 0 || areas[c] < areas[parent]))
+				parent = c;
+		if (parent < 0)
+			return false;
+		holes[parent].push_back(h);
+	}
+	for (int c = 0; c < nContours; c++) {
+		if (areas[c] <= 0)
+			continue;
+		// bridge holes rightmost first, so earlier bridges don't cross later holes
+		vector<std::pair<float, int>> order;
+		for (int h : holes[c]) {
+			float right = -FLT_MAX;
+			for (vec2 p : outline[h])
+				right = p.x > right? p.x : right;
+			order.push_back(std::make_pair(-right, h));
+		}
+		std::sort(order.begin(), order.end());
+		vector<int> poly = contours[c];
+		for (auto &o : order)
+			Bridge(poly, contours[o.second], points);
+		EarClip(poly, points, triangles);
+	}
+	return true;
+}
+
+// Extrusion
+
+void Extrude(const Outline &outline, float depth, GlyphMesh &m) {
+	vector<vec2> pts;
+	vector<int3> tris;
+	m.points.resize(0);
+	m.normals.resize(0);
+	m.uvs.resize(0);
+	m.triangles.resize(0);
+	if (!Triangulate(outline, pts, tris))
+		return;
+	vec2 min(FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX);
+	for (vec2 p : pts) {
+		min = vec2(p.x < min.x? p.x : min.x, p.y < min.y? p.y : min.y);
+		max = vec2(p.x > max.x? p.x : max.x, p.y > max.y? p.y : max.y);
+	}
+	vec2 dif = max-min;
+	int n = (int) pts.size();
+	// front (z = 0) then back (z = -depth), planar uvs
+	for (int side = 0; side < 2; side++)
+		for (vec2 p : pts) {
+			m.points.push_back(vec3(p.x, p.y, side? -depth : 0));
+			m.normals.push_back(vec3(0, 0, side? -1.f : 1.f));
+			m.uvs.push_back(vec2(dif.x > 0? (p.x-min.x)/dif.x : 0, dif.y > 0? (p.y-min.y)/dif.y : 0));
+		}
+	for (int3 t : tris) {
+		m.triangles.push_back(t);
+		m.triangles.push_back(int3(n+t.i1, n+t.i3, n+t.i2));
+	}
+	// side walls, outward normal is to the right of each directed edge
+	for (const vector<vec2> &c : outline) {
+		float s = 0;
+		for (size_t i = 0, nc = c.size(); i < nc; i++) {
+			vec2 a = c[i], b = c[(i+1)%nc], e = b-a;
+			float len = length(e);
+			if (len == 0)
+				continue;
+			int base = (int) m.points.size();
+			vec3 normal(e.y/len, -e.x/len, 0);
+			vec3 q[] = { vec3(a.x, a.y, 0), vec3(b.x, b.y, 0), vec3(b.x, b.y, -depth), vec3(a.x, a.y, -depth) };
+			vec2 uv[] = { vec2(s, 0), vec2(s+len, 0), vec2(s+len, 1), vec2(s, 1) };
+			for (int k = 0; k < 4; k++) {
+				m.points.push_back(q[k]);
+				m.normals.push_back(normal);
+				m.uvs.push_back(uv[k]);
+			}
+			m.triangles.push_back(int3(base, base+3, base+2));
+			m.triangles.push_back(int3(base, base+2, base+1));
+			s += len;
+		}
+	}
+}
+
+// Bitmap outlines
+
+Outline BitmapOutline(const char *const *rows, int width, int height) {
+	auto Filled = [&](int x, int y) {   // y up from the bottom row
+		return x >= 0 && x < width && y >= 0 && y < height && rows[height-1-y][x] == '#';
+	};
+	// boundary edges of filled cells, directed with the cell on the left
+	typedef std::pair<int, int> Vertex;
+	std::multimap<Vertex, Vertex> edges;
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			if (!Filled(x, y))
+				continue;
+			if (!Filled(x, y-1)) edges.insert({ {x, y}, {x+1, y} });
+			if (!Filled(x+1, y)) edges.insert({ {x+1, y}, {x+1, y+1} });
+			if (!Filled(x, y+1)) edges.insert({ {x+1, y+1}, {x, y+1} });
+			if (!Filled(x-1, y)) edges.insert({ {x, y+1}, {x, y} });
+		}
+	// chain into loops; where two loops touch at a corner take the leftmost turn, keeping them apart
+	Outline outline;
+	float cell = 1.f/height;
+	while (!edges.empty()) {
+		Vertex start = edges.begin()->first, from = start, to = edges.begin()->second;
+		edges.erase(edges.begin());
+		vector<Vertex> loop(1, start);
+		while (to != start || edges.count(to)) {
+			int dx = to.first-from.first, dy = to.second-from.second, bestTurn = 3;
+			auto best = edges.end();
+			auto range = edges.equal_range(to);
+			for (auto e = range.first; e != range.second; e++) {
+				int ex = e->second.first-to.first, ey = e->second.second-to.second;
+				int c = dx*ey-dy*ex, turn = c > 0? 0 : c == 0? 1 : 2;
+				if (turn < bestTurn) {
+					bestTurn = turn;
+					best = e;
+				}
+			}
+			// back at the start, close unless an unused edge turns further left than the first
+			if (to == start) {
+				int ex = loop.size() > 1? loop[1].first-start.first : 0, ey = loop.size() > 1? loop[1].second-start.second : 0;
+				int c = dx*ey-dy*ex, firstTurn = c > 0? 0 : c == 0? 1 : 2;
+				if (best == edges.end() || firstTurn <= bestTurn)
+					break;
+			}
+			if (best == edges.end())
+				break;
+			loop.push_back(to);
+			from = to;
+			to = best->second;
+			edges.erase(best);
+		}
+		// drop collinear vertices
+		vector<vec2> contour;
+		int n = (int) loop.size();
+		for (int i = 0; i < n; i++) {
+			Vertex a = loop[(i+n-1)%n], b = loop[i], c = loop[(i+1)%n];
+			if ((b.first-a.first)*(c.second-b.second)-(b.second-a.second)*(c.first-b.first) != 0)
+				contour.push_back(vec2(b.first*cell, b.second*cell));
+		}
+		if (contour.size() >= 3)
+			outline.push_back(contour);
+	}
+	return outline;
+}
+
+// Font
+
+static const struct { char c; const char *rows[7]; } blockFont[] = {
+	{'0', {".###.", "#...#", "#..##", "#.#.#", "##..#", "#...#", ".###."}},
+	{'1', {"..#..", ".##..", "..#..", "..#..", "..#..", "..#..", ".###."}},
+	{'2', {".###.", "#...#", "....#", "...#.", "..#..", ".#...", "#####"}},
+	{'3', {"#####", "...#.", "..#..", "...#.", "....#", "#...#", ".###."}},
+	{'4', {"...#.", "..##.", ".#.#.", "#..#.", "#####", "...#.", "...#."}},
+	{'5', {"#####", "#....", "####.", "....#", "....#", "#...#", ".###."}},
+	{'6', {"..##.", ".#...", "#....", "####.", "#...#", "#...#", ".###."}},
+	{'7', {"#####", "....#", "...#.", "..#..", ".#...", ".#...", ".#..."}},
+	{'8', {".###.", "#...#", "#...#", ".###.", "#...#", "#...#", ".###."}},
+	{'9', {".###.", "#...#", "#...#", ".####", "....#", "...#.", ".##.."}},
+	{'A', {".###.", "#...#", "#...#", "#####", "#...#", "#...#", "#...#"}},
+	{'B', {"####.", "#...#", "#...#", "####.", "#...#", "#...#", "####."}},
+	{'C', {".###.", "#...#", "#....", "#....", "#....", "#...#", ".###."}},
+	{'D', {"###..", "#..#.", "#...#", "#...#", "#...#", "#..#.", "###.."}},
+	{'E', {"#####", "#....", "#....", "####.", "#....", "#....", "#####"}},
+	{'F', {"#####", "#....", "#....", "####.", "#....", "#....", "#...."}},
+	{'G', {".###.", "#...#", "#....", "#.###", "#...#", "#...#", ".####"}},
+	{'H', {"#...#", "#...#", "#...#", "#####", "#...#", "#...#", "#...#"}},
+	{'I', {".###.", "..#..", "..#..", "..#..", "..#..", "..#..", ".###."}},
+	{'J', {"..###", "...#.", "...#.", "...#.", "...#.", "#..#.", ".##.."}},
+	{'K', {"#...#", "#..#.", "#.#..", "##...", "#.#..", "#..#.", "#...#"}},
+	{'L', {"#....", "#....", "#....", "#....", "#....", "#....", "#####"}},
+	{'M', {"#...#", "##.##", "#.#.#", "#.#.#", "#...#", "#...#", "#...#"}},
+	{'N', {"#...#", "#...#", "##..#", "#.#.#", "#..##", "#...#", "#...#"}},
+	{'O', {".###.", "#...#", "#...#", "#...#", "#...#", "#...#", ".###."}},
+	{'P', {"####.", "#...#", "#...#", "####.", "#....", "#....", "#...."}},
+	{'Q', {".###.", "#...#", "#...#", "#...#", "#.#.#", "#..#.", ".##.#"}},
+	{'R', {"####.", "#...#", "#...#", "####.", "#.#..", "#..#.", "#...#"}},
+	{'S', {".####", "#....", "#....", ".###.", "....#", "....#", "####."}},
+	{'T', {"#####", "..#..", "..#..", "..#..", "..#..", "..#..", "..#.."}},
+	{'U', {"#...#", "#...#", "#...#", "#...#", "#...#", "#...#", ".###."}},
+	{'V', {"#...#", "#...#", "#...#", "#...#", "#...#", ".#.#.", "..#.."}},
+	{'W', {"#...#", "#...#", "#...#", "#.#.#", "#.#.#", "#.#.#", ".#.#."}},
+	{'X', {"#...#", "#...#", ".#.#.", "..#..", ".#.#.", "#...#", "#...#"}},
+	{'Y', {"#...#", "#...#", ".#.#.", "..#..", "..#..", "..#..", "..#.."}},
+	{'Z', {"#####", "....#", "...#.", "..#..", ".#...", "#....", "#####"}},
+	{'.', {".....", ".....", ".....", ".....", ".....", ".##..", ".##.."}},
+	{',', {".....", ".....", ".....", ".....", ".##..", "..#..", ".#..."}},
+	{'-', {".....", ".....", ".....", "#####", ".....", ".....", "....."}},
+	{'!', {"..#..", "..#..", "..#..", "..#..", "..#..", ".....", "..#.."}},
+	{'?', {".###.", "#...#", "....#", "...#.", "..#..", ".....", "..#.."}},
+	{':', {".....", ".##..", ".##..", ".....", ".##..", ".##..", "....."}},
+	{'\'', {"..#..", "..#..", ".#...", ".....", ".....", ".....", "....."}},
+	{' ', {".....", ".....", ".....", ".....", ".....", ".....", "....."}}
+};
+
+ExtrudedFont::ExtrudedFont() : glyphs(256) {
+	for (auto &g : blockFont) {
+		Outline o = BitmapOutline(g.rows, 5, 7);
+		SetGlyph(g.c, o, 6.f/7);
+		if (g.c >= 'A' && g.c <= 'Z')
+			SetGlyph(g.c-'A'+'a', o, 6.f/7);
+	}
+}
+
+void ExtrudedFont::SetGlyph(int c, const Outline &outline, float advance) {
+	if (c < 0 || c >= (int) glyphs.size())
+		return;
+	Entry &e = glyphs[c];
+	e.outline = outline;
+	e.advance = advance;
+	e.defined = true;
+	e.built = false;
+}
+
+const GlyphMesh *ExtrudedFont::Glyph(int c) {
+	if (c < 0 || c >= (int) glyphs.size() || !glyphs[c].defined)
+		return NULL;
+	Entry &e = glyphs[c];
+	if (!e.built) {
+		Extrude(e.outline, depth, e.mesh);
+		e.mesh.advance = e.advance;
+		e.built = true;
+	}
+	return &e.mesh;
+}
+
+// Batch
+
+void TextBatch::Clear() {
+	vertices.resize(0);
+	triangles.resize(0);
+	nGlyphs = 0;
+}
+
+void TextBatch::Add(ExtrudedFont &font, const char *text, vec3 origin, float height) {
+	vec3 pen = origin;
+	for (const char *s = text; *s; s++) {
+		if (*s == '\n') {
+			pen = vec3(origin.x, pen.y-height*font.LineSpacing(), origin.z);
+			continue;
+		}
+		const GlyphMesh *g = font.Glyph((unsigned char) *s);
+		if (!g)
+			g = font.Glyph('?');
+		if (!g)
+			continue;
+		int base = (int) vertices.size();
+		for (size_t i = 0; i < g->points.size(); i++)
+			vertices.push_back({ pen+height*g->points[i], g->normals[i], g->uvs[i] });
+		for (int3 t : g->triangles)
+			triangles.push_back(int3(base+t.i1, base+t.i2, base+t.i3));
+		if (!g->triangles.empty())
+			nGlyphs++;
+		pen.x += height*g->advance;
+	}
+}
+
+void TextBatch::Upload() {
+	if (!vBuffer) {
+		glGenBuffers(1, &vBuffer);
+		glGenBuffers(1, &iBuffer);
+	}
+	glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+	glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size()*sizeof(int3), triangles.data(), GL_STATIC_DRAW);
+	glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	gpuRegistry.Track(GPURegistry::Buffer, vBuffer, vertices.size()*sizeof(Vertex), "text batch vertices");
+	gpuRegistry.Track(GPURegistry::Buffer, iBuffer, triangles.size()*sizeof(int3), "text batch triangles");
+	nUploaded = (int) triangles.size();
+}
+
+void TextBatch::Draw(GLuint program) {
+	if (!nUploaded)
+		return;
+	glState.UseProgram(program);
+	glState.BindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	const char *names[] = { "point", "normal", "uv" };
+	int sizes[] = { 3, 3, 2 };
+	size_t offsets[] = { offsetof(Vertex, point), offsetof(Vertex, normal), offsetof(Vertex, uv) };
+	for (int k = 0; k < 3; k++) {
+		GLint id = glGetAttribLocation(program, names[k]);
+		if (id < 0)
+			continue;
+		glEnableVertexAttribArray(id);
+		glVertexAttribPointer(id, sizes[k], GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *) offsets[k]);
+	}
+	glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	glDrawElements(GL_TRIANGLES, 3*nUploaded, GL_UNSIGNED_INT, 0);
+	glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);  // callers may draw from client-side indices
+}
+
+void TextBatch::Release() {
+	DeleteBuffer(vBuffer);
+	DeleteBuffer(iBuffer);
+	nUploaded = 0;
+}
+
+// Benchmark
+
+static bool Filled(vec2 p, const Outline &outline) {
+	// even-odd over all contours
+	int n = 0;
+	for (const vector<vec2> &c : outline)
+		n += Inside(p, c);
+	return n%2 == 1;
+}
+
+static int CheckGlyph(const Outline &outline, const GlyphMesh &m, int nCells, int height) {
+	// 0 if the outline's winding gives the cells' area, every triangle faces along its normal,
+	// the front face covers exactly the cells (holes left open), and walls face out
+	float cellArea = 1.f/(height*height), outlineArea = 0, frontArea = 0;
+	int bad = 0;
+	for (const vector<vec2> &c : outline) {
+		float a = SignedArea(c);
+		outlineArea += a;
+		bad += a == 0;
+	}
+	bad += fabsf(outlineArea-nCells*cellArea) > 1e-4f;
+	for (int3 t : m.triangles) {
+		vec3 p1 = m.points[t.i1], p2 = m.points[t.i2], p3 = m.points[t.i3], nrm = m.normals[t.i1];
+		vec3 g = cross(p2-p1, p3-p1);
+		if (dot(g, g) == 0)
+			continue;
+		bad += dot(g, nrm) <= 0;                    // inverted
+		if (nrm.z > 0)
+			frontArea += g.z/2;
+		if (nrm.z == 0) {
+			// wall: just outside is empty, just inside is filled
+			vec3 c = (p1+p2+p3)/3;
+			vec2 q(c.x, c.y), d = 1e-3f*vec2(nrm.x, nrm.y);
+			bad += Filled(q+d, outline) || !Filled(q-d, outline);
+		}
+	}
+	bad += fabsf(frontArea-nCells*cellArea) > 1e-4f;
+	return bad;
+}
+
+// the block glyphs' strokes meet only at corners, so none encloses a hole: these do
+static const struct { const char *name; const char *rows[7]; } holeBitmaps[] = {
+	{"ring", {".......", ".#####.", ".#...#.", ".#...#.", ".#...#.", ".#####.", "......."}},
+	{"three holes", {".......", ".......", "#######", "#.#.#.#", "#######", ".......", "......."}},
+	{"island in a hole", {"#######", "#.....#", "#.###.#", "#.#.#.#", "#.###.#", "#.....#", "#######"}}
+};
+
+int ExtrudedTextBenchmark(int nRepeat) {
+	// built-in glyphs: triangulation time; then the checks above on each glyph and hole bitmap
+	typedef std::chrono::steady_clock Clock;
+	struct Test { std::string name; const char *const *rows; int width; Outline outline; };
+	vector<Test> tests;
+	for (auto &g : blockFont)
+		tests.push_back({ std::string("'")+g.c+"'", g.rows, 5, BitmapOutline(g.rows, 5, 7) });
+	int nGlyphs = (int) tests.size(), nTriangles = 0, nFailed = 0;
+	for (auto &h : holeBitmaps)
+		tests.push_back({ h.name, h.rows, 7, BitmapOutline(h.rows, 7, 7) });
+	vector<vec2> pts;
+	vector<int3> tris;
+	Clock::time_point start = Clock::now();
+	for (int r = 0; r < nRepeat; r++)
+		for (int g = 0; g < nGlyphs; g++) {
+			Triangulate(tests[g].outline, pts, tris);
+			nTriangles += r == 0? (int) tris.size() : 0;
+		}
+	double ms = std::chrono::duration<double, std::milli>(Clock::now()-start).count();
+	printf("extruded text, %i glyphs (%i triangles) x %i: %.1f glyphs/ms triangulated\n",
+		   nGlyphs, nTriangles, nRepeat, (double) nGlyphs*nRepeat/ms);
+	int nHoles = 0;
+	for (Test &t : tests) {
+		int nCells = 0;
+		for (int y = 0; y < 7; y++)
+			for (int x = 0; x < t.width; x++)
+				nCells += t.rows[y][x] == '#';
+		for (const vector<vec2> &c : t.outline)
+			nHoles += SignedArea(c) < 0;
+		GlyphMesh m;
+		Extrude(t.outline, .2f, m);
+		if (CheckGlyph(t.outline, m, nCells, 7)) {
+			printf("  %s (%i contours) fails\n", t.name.c_str(), (int) t.outline.size());
+			nFailed++;
+		}
+	}
+	printf("  checked %i outlines, %i holes: winding, front area, facing\n", (int) tests.size(), nHoles);
+	if (nFailed)
+		printf("FAILED: %i outlines with wrong winding, area or facing\n", nFailed);
+	return nFailed;
+}
@@ -0,0 +1,71 @@
+// ExtrudedText.h: glyph outlines to extruded meshes, batched strings in one draw
+
+#ifndef EXTRUDED_TEXT_HDR
+#define EXTRUDED_TEXT_HDR
+
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// A glyph is an Outline: closed contours, outer boundaries counterclockwise, holes clockwise
+// (filled region on the left). Triangulate bridges each hole into its enclosing contour and
+// ear-clips the result. A glyph's extrusion is its front face at z = 0 and back face at
+// z = -depth (as the hand-built letters), plus one quad per contour edge for the side walls,
+// with flat normals. Front and back uvs are planar over the outline bounds (as SetUvs);
+// side uvs run along the contour and across the depth. Each glyph is built on first use and
+// cached; TextBatch appends cached glyphs into one vertex and index buffer per string or
+// paragraph, drawn with one glDrawElements.
+
+typedef vector<vector<vec2>> Outline;
+
+bool Triangulate(const Outline &outline, vector<vec2> &points, vector<int3> &triangles);
+
+struct GlyphMesh {
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	float advance = 0;
+};
+
+void Extrude(const Outline &outline, float depth, GlyphMesh &mesh);
+
+class ExtrudedFont {
+public:
+	float depth = .2f;                          // in units of glyph height
+	ExtrudedFont();                             // built-in 5x7 block capitals, digits, punctuation
+	void SetGlyph(int c, const Outline &outline, float advance);  // glyph height 1, baseline 0
+	const GlyphMesh *Glyph(int c);              // built on first use; null if undefined
+	float LineSpacing() const { return 9.f/7; }
+private:
+	struct Entry { Outline outline; float advance = 0; GlyphMesh mesh; bool defined = false, built = false; };
+	vector<Entry> glyphs;                       // by character code
+};
+
+// outline of the filled cells of a bitmap, rows top to bottom, '#' filled; cell size 1/height
+Outline BitmapOutline(const char *const *rows, int width, int height);
+
+// time triangulation of the built-in glyphs, then check each, and bitmaps with holes, once
+// extruded: contour winding sums to the cell area, front face area equals it (holes open), no
+// triangle faces against its normal, walls face out; returns the number failing (0: pass)
+int ExtrudedTextBenchmark(int nRepeat = 1000);
+
+class TextBatch {
+public:
+	void Clear();
+	void Add(ExtrudedFont &font, const char *text, vec3 origin, float height);  // '\n' starts a line
+	void Upload();                              // to GPU, after adding
+	void Draw(GLuint program);                  // shader inputs "point", "normal", "uv" (those present)
+	void Release();
+	int NGlyphs() const { return nGlyphs; }
+	int NTriangles() const { return (int) triangles.size(); }
+private:
+	struct Vertex { vec3 point, normal; vec2 uv; };
+	vector<Vertex> vertices;
+	vector<int3> triangles;
+	GLuint vBuffer = 0, iBuffer = 0;
+	int nGlyphs = 0, nUploaded = 0;
+};
+
+#endif
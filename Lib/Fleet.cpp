@@ -0,0 +1,148 @@
+// Fleet.cpp: thousands of path followers animated in parallel into a mapped instance buffer
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "Fleet.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "MatKernels.h"
+
+// Instances
+
+int FleetInstances::Add(int p, float ph, float s) {
+	path.push_back(p);
+	phase.push_back(ph);
+	speed.push_back(s);
+	return N()-1;
+}
+
+// Animation
+
+void Fleet::Prepare() {
+	// tables rebuild lazily on lookup; do it here, once, so the workers only read them
+	for (FrameTable *f : paths)
+		if (f->Dirty())
+			f->Frame(0);
+}
+
+void Fleet::Animate(JobPool &pool, float time, mat4 *body, mat4 *prop, int grain) {
+	Prepare();
+	const int *p = instances.path.data();
+	const float *ph = instances.phase.data(), *sp = instances.speed.data();
+	steals = ParallelFor(pool, instances.N(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			FrameTable *f = paths[p[i]];
+			float loops = ph[i]+sp[i]*time;
+			mat4 b = MatMul(f->Frame((loops-floorf(loops))*f->NCurves()), bodyLocal);
+			body[i] = b;
+			prop[i] = MatMul(b, propLocal, RotateZ(propSpin*time+360*ph[i]));
+		}
+	}, grain);
+}
+
+// GPU Buffer
+
+void Fleet::Init(int n) {
+	Release();
+	capacity = n;
+	GLint alignment = 256;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = alignment < (GLint) sizeof(mat4)? (GLint) sizeof(mat4) : alignment;
+	partBytes = (capacity*sizeof(mat4)+alignment-1)/alignment*alignment;
+	size_t bytes = (size_t) 2*maxRegions*partBytes;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, NULL, flags);
+	memory = (unsigned char *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (!memory)
+		printf("Fleet: can't map instance buffer\n");
+	gpuRegistry.Track(GPURegistry::Buffer, buffer, bytes, "fleet instances");
+}
+
+void Fleet::Update(JobPool &pool, float time, int s) {
+	if (instances.N() > capacity)
+		Init(instances.N());                    // the old buffer lives until the GPU is done with it
+	slot = s;
+	if (memory)
+		Animate(pool, time, (mat4 *) (memory+2*slot*partBytes), (mat4 *) (memory+(2*slot+1)*partBytes));
+}
+
+void Fleet::Bind(int part) {
+	if (memory && instances.N())
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, buffer, (2*slot+part)*partBytes, instances.N()*sizeof(mat4));
+}
+
+void Fleet::Release() {
+	if (buffer) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		if (memory)
+			glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		DeleteBuffer(buffer);
+	}
+	memory = NULL;
+	capacity = 0;
+}
+
+// Benchmark
+
+int FleetBenchmark(const vec3 *path, int nCurves, int n) {
+	typedef std::chrono::steady_clock Clock;
+	// four closed lanes, path scaled out and raised
+	const int nPoints = 3*nCurves+1, nLanes = 4;
+	vector<vec3> lanes(nLanes*nPoints);
+	FrameTable tables[nLanes];
+	Fleet fleet;
+	for (int k = 0; k < nLanes; k++) {
+		for (int i = 0; i < nPoints; i++)
+			lanes[k*nPoints+i] = (1+.2f*k)*path[i]+vec3(0, .1f*k, 0);
+		tables[k].Build(&lanes[k*nPoints], nCurves, true);
+		fleet.paths.push_back(&tables[k]);
+	}
+	for (int i = 0; i < n; i++)
+		fleet.instances.Add(i%nLanes, fmodf(.618034f*i, 1), .2f+.1f*(i%7)/7);
+	fleet.bodyLocal = Scale(.05f)*RotateY(-90);
+	fleet.propLocal = Translate(-.6f, 0, 0)*RotateY(-90)*Scale(.25f);
+	vector<mat4> body(n), prop(n), body1(n), prop1(n);
+	auto Time = [&](JobPool &pool, int grain) {
+		double best = 1e9;
+		for (int r = 0; r < 10; r++) {
+			Clock::time_point t = Clock::now();
+			fleet.Animate(pool, .5f+r/60.f, body.data(), prop.data(), grain);
+			double ms = std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+			best = ms < best? ms : best;
+		}
+		return best;
+	};
+	int maxThreads = (int) std::thread::hardware_concurrency();
+	maxThreads = maxThreads < 1? 1 : maxThreads;
+	printf("fleet animation, %i instances on %i paths, instances/ms (best of 10):\n", n, nLanes);
+	printf("%8s %12s %12s %8s %8s %8s\n", "threads", "static", "stealing", "speedup", "steals", "differ");
+	double ms1 = 0;
+	int nDiffer = 0;
+	for (int t = 1; t <= maxThreads; t = t < maxThreads && 2*t > maxThreads? maxThreads : 2*t) {
+		JobPool pool(t);
+		double stat = Time(pool, (n+t-1)/t);    // one chunk per thread: never steals
+		double steal = Time(pool, 256);
+		int steals = fleet.Steals(), differ = 0;
+		if (t == 1) {
+			ms1 = steal;
+			fleet.Animate(pool, .5f, body1.data(), prop1.data());
+		}
+		else {
+			fleet.Animate(pool, .5f, body.data(), prop.data());
+			for (int i = 0; i < n; i++)
+				differ += memcmp(&body[i], &body1[i], sizeof(mat4)) || memcmp(&prop[i], &prop1[i], sizeof(mat4));
+		}
+		printf("%8i %12.0f %12.0f %7.1fx %8i %8i\n", t, n/stat, n/steal, ms1/steal, steals, differ);
+		nDiffer += differ;
+	}
+	if (nDiffer)
+		printf("FAILED: %i instances differ from the single-thread matrices\n", nDiffer);
+	return nDiffer;
+}
@@ -0,0 +1,61 @@
+// Fleet.h: thousands of path followers animated in parallel into a mapped instance buffer
+
+#ifndef FLEET_HDR
+#define FLEET_HDR
+
+#include <vector>
+#include "glad.h"
+#include "FrameTable.h"
+#include "JobPool.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Each instance follows one of several closed paths (FrameTable), at its own phase and speed;
+// its body matrix is the path frame times a body-local matrix, its propeller's the body times
+// a propeller-local matrix and a spin about z. Instances are stored as structure of arrays, so
+// the per-frame pass reads three dense streams, and Animate runs it with ParallelFor (JobPool.h),
+// writing each instance's matrices once into the destination, typically the persistent-mapped,
+// write-combined region for this frame (Update): no staging copy, no readback.
+// The vertex shader reads the matrices with gl_InstanceID:
+//   layout(std430, binding = 3, row_major) readonly buffer Fleet { mat4 fleet[]; };
+
+struct FleetInstances {
+	vector<int> path;                           // index into Fleet::paths
+	vector<float> phase;                        // path fraction at time 0
+	vector<float> speed;                        // loops per second
+	int Add(int path, float phase, float speed);
+	int N() const { return (int) path.size(); }
+};
+
+class Fleet {
+public:
+	enum { maxRegions = 3 };                    // as FramePacer::maxFrames
+	FleetInstances instances;
+	vector<FrameTable *> paths;
+	mat4 bodyLocal, propLocal;
+	float propSpin = 1500;                      // degrees per second
+	// matrices for all instances at time, bodies to body[i], propellers to prop[i]
+	void Animate(JobPool &pool, float time, mat4 *body, mat4 *prop, int grain = 256);
+	// GPU: maxRegions regions of capacity body and propeller matrices; region slot is written only
+	// after the frame that last used it has finished (the pacer's slot)
+	void Init(int capacity);
+	void Update(JobPool &pool, float time, int slot);
+	void Bind(int part);                        // 0: body, 1: propeller matrices of the current slot
+	int Capacity() const { return capacity; }
+	int Steals() const { return steals; }       // last Animate
+	void Release();
+private:
+	GLuint buffer = 0;
+	unsigned char *memory = NULL;
+	GLsizeiptr partBytes = 0;                   // capacity matrices, rounded to the SSBO alignment
+	int capacity = 0, slot = 0, steals = 0;
+	void Prepare();
+};
+
+// instances per ms across thread counts, nInstances over four lanes around path (3*nCurves+1
+// points, closed), CPU only; returns the number of instances whose matrices differ from the
+// single-thread result (0: pass)
+int FleetBenchmark(const vec3 *path, int nCurves, int nInstances = 100000);
+
+#endif
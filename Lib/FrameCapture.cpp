@@ -0,0 +1,343 @@
+// FrameCapture.cpp: record rendered frames to PNG sequences or Y4M video without stalling
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include "FrameCapture.h"
+
+// Clock
+
+void FrameClock::Start() {
+	start = std::chrono::steady_clock::now();
+	frame = 0;
+}
+
+void FrameClock::SetFixed(double d) {
+	dt = d;
+}
+
+double FrameClock::Seconds() const {
+	if (dt > 0)
+		return frame*dt;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+// PNG: RGB, 8 bits, zlib stored (uncompressed) blocks; fast to write, no dependencies
+
+static uint32_t Crc(const unsigned char *p, size_t n, uint32_t crc = 0) {
+	static uint32_t table[256];
+	if (!table[1])
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1? 0xedb88320u^(c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	crc = ~crc;
+	for (size_t i = 0; i < n; i++)
+		crc = table[(crc^p[i]) & 0xff]^(crc >> 8);
+	return ~crc;
+}
+
+static void Put32(vector<unsigned char> &v, uint32_t n) {
+	unsigned char b[] = { (unsigned char) (n >> 24), (unsigned char) (n >> 16), (unsigned char) (n >> 8), (unsigned char) n };
+	v.insert(v.end(), b, b+4);
+}
+
+static void Chunk(FILE *f, const char *type, const vector<unsigned char> &data) {
+	vector<unsigned char> c;
+	Put32(c, (uint32_t) data.size());
+	c.insert(c.end(), type, type+4);
+	c.insert(c.end(), data.begin(), data.end());
+	Put32(c, Crc(&c[4], c.size()-4));
+	fwrite(c.data(), 1, c.size(), f);
+}
+
+bool WritePng(const char *filename, const unsigned char *rgba, int width, int height, bool flip) {
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+		return false;
+	const unsigned char signature[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	fwrite(signature, 1, 8, f);
+	vector<unsigned char> header;
+	Put32(header, width);
+	Put32(header, height);
+	unsigned char rest[] = { 8, 2, 0, 0, 0 };   // 8 bit, RGB, deflate, no filter, no interlace
+	header.insert(header.end(), rest, rest+5);
+	Chunk(f, "IHDR", header);
+	// scanlines: filter byte 0, then RGB
+	size_t rowSize = 1+3*(size_t) width;
+	vector<unsigned char> raw(rowSize*height);
+	for (int y = 0; y < height; y++) {
+		const unsigned char *src = rgba+4*(size_t) width*(flip? height-1-y : y);
+		unsigned char *dst = &raw[y*rowSize];
+		*dst++ = 0;
+		for (int x = 0; x < width; x++, src += 4, dst += 3) {
+			dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+		}
+	}
+	// zlib stream of stored blocks, Adler-32 trailer
+	vector<unsigned char> z = { 0x78, 0x01 };
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++) {
+		a = (a+raw[i])%65521;
+		b = (b+a)%65521;
+	}
+	for (size_t pos = 0; pos < raw.size() || pos == 0; ) {
+		size_t n = raw.size()-pos < 65535? raw.size()-pos : 65535;
+		bool last = pos+n == raw.size();
+		unsigned char h[] = { (unsigned char) last, (unsigned char) n, (unsigned char) (n >> 8), (unsigned char) ~n, (unsigned char) (~n >> 8) };
+		z.insert(z.end(), h, h+5);
+		z.insert(z.end(), raw.begin()+pos, raw.begin()+pos+n);
+		pos += n;
+		if (last)
+			break;
+	}
+	Put32(z, (b << 16) | a);
+	Chunk(f, "IDAT", z);
+	Chunk(f, "IEND", vector<unsigned char>());
+	fclose(f);
+	return true;
+}
+
+// Y4M: 4:2:0, BT.601 studio range
+
+void WriteY4mFrame(FILE *f, const unsigned char *rgba, int width, int height, bool flip) {
+	int cw = (width+1)/2, ch = (height+1)/2;
+	vector<unsigned char> y(width*height), u(cw*ch), v(cw*ch);
+	vector<float> us(cw*ch, 0), vs(cw*ch, 0), ns(cw*ch, 0);
+	for (int j = 0; j < height; j++) {
+		const unsigned char *p = rgba+4*(size_t) width*(flip? height-1-j : j);
+		for (int i = 0; i < width; i++, p += 4) {
+			float r = p[0], g = p[1], b = p[2];
+			y[j*width+i] = (unsigned char) (16.5f+(65.481f*r+128.553f*g+24.966f*b)/255);
+			int c = (j/2)*cw+i/2;
+			us[c] += (-37.797f*r-74.203f*g+112.f*b)/255;
+			vs[c] += (112.f*r-93.786f*g-18.214f*b)/255;
+			ns[c] += 1;
+		}
+	}
+	for (int c = 0; c < cw*ch; c++) {
+		u[c] = (unsigned char) (128.5f+us[c]/ns[c]);
+		v[c] = (unsigned char) (128.5f+vs[c]/ns[c]);
+	}
+	fputs("FRAME\n", f);
+	fwrite(y.data(), 1, y.size(), f);
+	fwrite(u.data(), 1, u.size(), f);
+	fwrite(v.data(), 1, v.size(), f);
+}
+
+// Start, Stop
+
+static bool SplitFrameFormat(const std::string &name, std::string &prefix, std::string &format, std::string &suffix) {
+	// exactly one integer conversion (%d or %i, with flags, width, precision); %% is a literal %
+	prefix = format = suffix = "";
+	for (size_t i = 0; i < name.size(); i++) {
+		std::string &literal = format.empty()? prefix : suffix;
+		if (name[i] != '%') {
+			literal += name[i];
+			continue;
+		}
+		if (i+1 < name.size() && name[i+1] == '%') {
+			literal += '%';
+			i++;
+			continue;
+		}
+		size_t j = i+1;
+		while (j < name.size() && strchr("-+ 0#", name[j]))
+			j++;
+		while (j < name.size() && (isdigit((unsigned char) name[j]) || name[j] == '.'))
+			j++;
+		if (!format.empty() || j >= name.size() || (name[j] != 'd' && name[j] != 'i'))
+			return false;
+		format = name.substr(i, j-i+1);
+		i = j;
+	}
+	return !format.empty();
+}
+
+bool FrameCapture::Start(const char *name, int w, int h) {
+	filename = name;
+	width = w;
+	height = h;
+	y4m = filename.size() > 4 && filename.compare(filename.size()-4, 4, ".y4m") == 0;
+	if (!y4m && !SplitFrameFormat(filename, namePrefix, frameFormat, nameSuffix)) {
+		printf("can't record to %s: need one integer format for the frame (e.g. frame%%04d.png) or .y4m\n", name);
+		return false;
+	}
+	if (y4m) {
+		video = fopen(name, "wb");
+		if (!video) {
+			printf("can't write %s\n", name);
+			return false;
+		}
+		fprintf(video, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n", width, height, fps);
+	}
+	// offscreen target, single-sample so it can be read directly
+	glGenFramebuffers(1, &framebuffer);
+	glGenRenderbuffers(1, &colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!ok) {
+		printf("can't create capture framebuffer\n");
+		Stop();
+		return false;
+	}
+	pbos.resize(ringSize);
+	fences.assign(ringSize, (GLsync) 0);
+	glGenBuffers(ringSize, pbos.data());
+	for (GLuint pbo : pbos) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, 4*(size_t) width*height, NULL, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	nStarted = nReceived = nWritten = nDropped = 0;
+	quit = false;
+	encoder = std::thread(&FrameCapture::Encode, this);
+	return true;
+}
+
+void FrameCapture::Stop() {
+	if (framebuffer) {
+		while (nReceived < nStarted) {
+			int was = nReceived;
+			Receive(true);
+			if (nReceived == was)
+				DropOldest();                   // the wait failed: don't spin on it
+		}
+		if (nDropped)
+			printf("FrameCapture: %i frames dropped\n", nDropped);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &colorBuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+	}
+	framebuffer = colorBuffer = depthBuffer = 0;
+	if (!pbos.empty())
+		glDeleteBuffers((GLsizei) pbos.size(), pbos.data());
+	pbos.clear();
+	fences.clear();
+	if (encoder.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		queued.notify_all();
+		encoder.join();
+	}
+	if (video)
+		fclose(video);
+	video = NULL;
+}
+
+// Per Frame
+
+void FrameCapture::BeginFrame() {
+	if (!framebuffer)
+		return;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebufferWas);
+	glGetIntegerv(GL_VIEWPORT, viewportWas);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+}
+
+void FrameCapture::EndFrame() {
+	if (!framebuffer)
+		return;
+	// ring full: oldest readback must be collected before its PBO is reused
+	if (nStarted-nReceived == ringSize)
+		Receive(true);
+	if (nStarted-nReceived == ringSize)
+		DropOldest();
+	int slot = nStarted%ringSize;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nStarted++;
+	// preview
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebufferWas);
+	glBlitFramebuffer(0, 0, width, height, viewportWas[0], viewportWas[1], viewportWas[0]+viewportWas[2],
+					  viewportWas[1]+viewportWas[3], GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferWas);
+	glViewport(viewportWas[0], viewportWas[1], viewportWas[2], viewportWas[3]);
+	// collect any finished readbacks without waiting
+	Receive(false);
+}
+
+void FrameCapture::Receive(bool wait) {
+	while (nReceived < nStarted) {
+		int slot = nReceived%ringSize;
+		GLenum r = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, wait? GL_TIMEOUT_IGNORED : 0);
+		if (r == GL_TIMEOUT_EXPIRED || r == GL_WAIT_FAILED)
+			return;
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+		size_t size = 4*(size_t) width*height;
+		vector<unsigned char> pixels(size);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (data) {
+			memcpy(pixels.data(), data, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		nReceived++;
+		// hand to encoder, blocking only if it has fallen maxQueued frames behind
+		std::unique_lock<std::mutex> lock(mutex);
+		dequeued.wait(lock, [this] { return (int) frames.size() < maxQueued; });
+		frames.push_back(std::move(pixels));
+		queued.notify_one();
+		wait = false;                           // waited for at most one frame
+	}
+}
+
+void FrameCapture::DropOldest() {
+	int slot = nReceived%ringSize;
+	if (fences[slot])
+		glDeleteSync(fences[slot]);
+	fences[slot] = 0;
+	nReceived++;
+	nDropped++;
+}
+
+// Encoder Thread
+
+void FrameCapture::Write(const vector<unsigned char> &rgba, int frame) {
+	if (y4m)
+		WriteY4mFrame(video, rgba.data(), width, height, true);
+	else {
+		char number[100];
+		snprintf(number, sizeof(number), frameFormat.c_str(), frame);
+		std::string name = namePrefix+number+nameSuffix;
+		if (!WritePng(name.c_str(), rgba.data(), width, height, true))
+			printf("can't write %s\n", name.c_str());
+	}
+}
+
+void FrameCapture::Encode() {
+	for (int frame = 0; ; frame++) {
+		vector<unsigned char> rgba;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [this] { return quit || !frames.empty(); });
+			if (frames.empty())
+				break;
+			rgba = std::move(frames.front());
+			frames.pop_front();
+		}
+		dequeued.notify_one();
+		Write(rgba, frame);
+		nWritten = frame+1;
+	}
+}
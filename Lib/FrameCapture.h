@@ -0,0 +1,79 @@
+// FrameCapture.h: record rendered frames to PNG sequences or Y4M video without stalling
+
+#ifndef FRAME_CAPTURE_HDR
+#define FRAME_CAPTURE_HDR
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glad.h"
+
+using std::vector;
+
+// While recording, the app renders into an offscreen framebuffer (so a hidden window works on
+// a headless machine), which is copied to the window for preview. EndFrame starts an
+// asynchronous glReadPixels into the next PBO of a ring and fences it; frames come off the ring
+// in order, a ring length later, when their fence has signaled, so the GPU never waits on the
+// CPU. An encoder thread writes each frame: filename containing one printf integer conversion
+// (e.g. "frame%04d.png", "%%" for a literal %) gives a PNG sequence, a ".y4m" filename gives
+// YUV4MPEG2 (4:2:0) video; Start rejects any other filename.
+
+// real time, or fixed steps when recording so animation is independent of frame rate
+class FrameClock {
+public:
+	void Start();
+	void SetFixed(double dt);                   // dt = 0: real time
+	void Tick() { frame++; }                    // once per frame
+	double Seconds() const;
+	int Frame() const { return frame; }
+private:
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double dt = 0;
+	int frame = 0;
+};
+
+class FrameCapture {
+public:
+	int ringSize = 3, maxQueued = 8;            // PBOs in flight, encoded frames waiting
+	int fps = 30;                               // Y4M header
+	bool Start(const char *filename, int width, int height);
+	void BeginFrame();                          // bind offscreen target (call before clearing)
+	void EndFrame();                            // preview to window, start readback (before swap)
+	void Stop();                                // drain ring and encoder
+	bool Recording() const { return framebuffer != 0; }
+	int FramesWritten() const { return nWritten; }
+	int FramesDropped() const { return nDropped; }  // readbacks whose fence wait failed (eg, context lost)
+private:
+	std::string filename;
+	std::string namePrefix, frameFormat, nameSuffix;  // PNG names: prefix, frame number, suffix
+	bool y4m = false;
+	FILE *video = NULL;
+	int width = 0, height = 0, nStarted = 0, nReceived = 0, nDropped = 0;
+	std::atomic<int> nWritten{0};
+	GLuint framebuffer = 0, colorBuffer = 0, depthBuffer = 0;
+	GLint framebufferWas = 0, viewportWas[4] = {0, 0, 0, 0};
+	vector<GLuint> pbos;
+	vector<GLsync> fences;
+	// encoder
+	std::thread encoder;
+	std::mutex mutex;
+	std::condition_variable queued, dequeued;
+	std::deque<vector<unsigned char>> frames;   // RGBA, bottom row first
+	bool quit = false;
+	void Receive(bool wait);
+	void DropOldest();
+	void Encode();
+	void Write(const vector<unsigned char> &rgba, int frame);
+};
+
+// minimal encoders, exposed for reuse
+bool WritePng(const char *filename, const unsigned char *rgba, int width, int height, bool flipVertical);
+void WriteY4mFrame(FILE *file, const unsigned char *rgba, int width, int height, bool flipVertical);
+
+#endif
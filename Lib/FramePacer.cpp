@@ -0,0 +1,201 @@
+// FramePacer.cpp: explicit frames in flight, and per-frame annotation geometry that follows them
+
+#include <stddef.h>
+#include <stdio.h>
+#include "FramePacer.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Pacing
+
+void FramePacer::Wait(int s, bool record) {
+	if (!fences[s])
+		return;
+	Clock::time_point t = Clock::now();
+	while (glClientWaitSync(fences[s], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+		;
+	if (record)
+		stats.cpuWaitMs += std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+	glDeleteSync(fences[s]);
+	fences[s] = 0;
+	// the frame is done, so are its timestamps
+	if (timed[s]) {
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(queries[2*s], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(queries[2*s+1], GL_QUERY_RESULT, &end);
+		if (record) {
+			stats.gpuBusyMs += (end-begin)/1e6;
+			stats.nGpu++;
+		}
+		timed[s] = false;
+	}
+}
+
+void FramePacer::SetFramesInFlight(int n) {
+	// may be called mid-frame (eg, from a key callback): changing slot before EndFrame would
+	// fence the wrong region, so only record the request
+	pending = n < 1? 1 : n > maxFrames? maxFrames : n;
+}
+
+int FramePacer::BeginFrame() {
+	if (!queries[0])
+		glGenQueries(2*maxFrames, queries);
+	if (pending) {
+		// drain frames in flight, then restart the ring
+		for (int s = 0; s < maxFrames; s++)
+			Wait(s, false);
+		nFrames = pending;
+		pending = 0;
+		frame = slot = 0;
+	}
+	Clock::time_point now = Clock::now();
+	if (begun) {
+		stats.frameMs += std::chrono::duration<double, std::milli>(now-lastBegin).count();
+		stats.nFrames++;
+	}
+	lastBegin = now;
+	begun = true;
+	slot = frame%nFrames;
+	Wait(slot, true);                           // the frame nFrames ago
+	glQueryCounter(queries[2*slot], GL_TIMESTAMP);
+	return slot;
+}
+
+void FramePacer::EndFrame() {
+	glQueryCounter(queries[2*slot+1], GL_TIMESTAMP);
+	timed[slot] = true;
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);   // flushed by the wait
+	frame++;
+}
+
+void FramePacer::Release() {
+	for (int s = 0; s < maxFrames; s++)
+		Wait(s, false);
+	if (queries[0])
+		glDeleteQueries(2*maxFrames, queries);
+	for (GLuint &q : queries)
+		q = 0;
+	begun = false;
+}
+
+void FramePacer::Report() const {
+	const Stats &s = stats;
+	if (!s.nFrames)
+		return;
+	printf("%i frame%s in flight: %.2f ms/frame, CPU waits %.2f ms, GPU busy %.2f ms\n", nFrames, nFrames > 1? "s" : "",
+		   s.frameMs/s.nFrames, s.cpuWaitMs/s.nFrames, s.nGpu? s.gpuBusyMs/s.nGpu : 0.);
+}
+
+// Annotation Lines
+
+static const char *linesVShader = R"(
+	#version 330
+	in vec3 point, other, color;
+	in float side;
+	out vec3 vColor;
+	uniform mat4 fullview;
+	uniform vec2 halfViewport;
+	void main() {
+		// offset perpendicular to the segment on screen, side pixels
+		vec4 p = fullview*vec4(point, 1), q = fullview*vec4(other, 1);
+		vec2 d = q.xy/q.w-p.xy/p.w;
+		d *= halfViewport;
+		d = length(d) > 0? normalize(d) : vec2(1, 0);
+		p.xy += vec2(-d.y, d.x)*side/halfViewport*p.w;
+		gl_Position = p;
+		vColor = color;
+	}
+)";
+
+static const char *linesPShader = R"(
+	#version 330
+	in vec3 vColor;
+	out vec4 pColor;
+	void main() {
+		pColor = vec4(vColor, 1);
+	}
+)";
+
+void PacedLines::Init(int n) {
+	Release();
+	maxSegments = n;
+	program = LinkProgramViaCode(&linesVShader, &linesPShader);
+	gpuRegistry.Track(GPURegistry::Program, program, 0, "paced lines");
+	GLint vArrayWas, bufferWas;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vArrayWas);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &bufferWas);
+	size_t bytes = (size_t) FramePacer::maxFrames*6*maxSegments*sizeof(Vertex);
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenVertexArrays(1, &vArray);
+	glBindVertexArray(vArray);
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferStorage(GL_ARRAY_BUFFER, bytes, NULL, flags);
+	memory = (Vertex *) glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+	if (!memory)
+		printf("PacedLines: can't map vertex buffer\n");
+	gpuRegistry.Track(GPURegistry::Buffer, buffer, bytes, "paced lines");
+	// attributes once; regions are selected by the first vertex of the draw
+	const char *names[] = { "point", "other", "color", "side" };
+	int sizes[] = { 3, 3, 3, 1 };
+	size_t offsets[] = { offsetof(Vertex, point), offsetof(Vertex, other), offsetof(Vertex, color), offsetof(Vertex, side) };
+	for (int k = 0; k < 4; k++) {
+		GLint id = glGetAttribLocation(program, names[k]);
+		if (id < 0)
+			continue;
+		glEnableVertexAttribArray(id);
+		glVertexAttribPointer(id, sizes[k], GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *) offsets[k]);
+	}
+	glBindVertexArray(vArrayWas);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferWas);
+}
+
+void PacedLines::Begin(int s) {
+	slot = s;
+	nSegments = 0;
+}
+
+void PacedLines::Add(vec3 a, vec3 b, float width, vec3 color) {
+	if (!memory || nSegments >= maxSegments)
+		return;
+	// two triangles; at b the direction reverses, so does the side: corners a+, a-, b+, b-
+	float h = width/2;
+	Vertex *v = memory+(size_t) 6*(slot*maxSegments+nSegments++);
+	Vertex corners[4] = { {a, b, color, h}, {a, b, color, -h}, {b, a, color, -h}, {b, a, color, h} };
+	int order[] = { 0, 2, 3, 0, 3, 1 };
+	for (int i = 0; i < 6; i++)
+		v[i] = corners[order[i]];
+}
+
+void PacedLines::Draw(mat4 fullview) {
+	if (!nSegments)
+		return;
+	GLint programWas, vArrayWas, viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programWas);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vArrayWas);
+	glUseProgram(program);
+	glBindVertexArray(vArray);
+	SetUniform(program, "fullview", fullview);
+	SetUniform(program, "halfViewport", vec2(viewport[2]/2.f, viewport[3]/2.f));
+	glDrawArrays(GL_TRIANGLES, 6*slot*maxSegments, 6*nSegments);
+	glBindVertexArray(vArrayWas);
+	glUseProgram(programWas);
+}
+
+void PacedLines::Release() {
+	if (buffer) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (memory)
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		DeleteBuffer(buffer);
+	}
+	memory = NULL;
+	if (vArray)
+		glDeleteVertexArrays(1, &vArray);
+	vArray = 0;
+	DeleteProgram(program);
+}
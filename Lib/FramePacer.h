@@ -0,0 +1,66 @@
+// FramePacer.h: explicit frames in flight, and per-frame annotation geometry that follows them
+
+#ifndef FRAME_PACER_HDR
+#define FRAME_PACER_HDR
+
+#include <chrono>
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Instead of leaving frame queuing to the driver (glFlush, then swap), the app lets at most N
+// frames (1 to 3) be in flight: BeginFrame waits on the fence EndFrame placed after the swap N
+// frames ago, then returns a slot, 0 to N-1. Per-frame dynamic data written into region
+// Slot() of a ring (SharedUniforms::SetPacer, PacedLines) is then never still being read by the
+// GPU, with no fences of their own. N = 1 gives least latency, CPU and GPU taking turns; N = 3
+// gives most overlap. Each frame records the CPU's wait in BeginFrame and, from timestamp queries
+// read when the slot's fence has passed, the GPU time from the frame's first command to its swap.
+
+class FramePacer {
+public:
+	enum { maxFrames = 3 };
+	void SetFramesInFlight(int n);              // 1 to maxFrames; takes effect at the next BeginFrame
+	int FramesInFlight() const { return pending? pending : nFrames; }
+	int BeginFrame();                           // before any GL work; returns Slot()
+	void EndFrame();                            // after glfwSwapBuffers
+	int Slot() const { return slot; }
+	void Release();
+	struct Stats {
+		int nFrames = 0, nGpu = 0;
+		double cpuWaitMs = 0, gpuBusyMs = 0, frameMs = 0; // sums
+	};
+	Stats stats;
+	void ResetStats() { stats = Stats(); }
+	void Report() const;                        // per-frame means
+private:
+	int nFrames = 2, slot = 0, frame = 0;
+	int pending = 0;                            // requested nFrames, 0 if none
+	GLsync fences[maxFrames] = {};
+	GLuint queries[2*maxFrames] = {};           // begin, end timestamp per slot
+	bool timed[maxFrames] = {};
+	std::chrono::steady_clock::time_point lastBegin;
+	bool begun = false;
+	void Wait(int s, bool record);
+};
+
+// thick, screen-space lines rebuilt each frame (eg, a dragged curve) in a persistent,
+// mapped buffer of maxFrames regions; Begin(slot) starts region slot, Draw issues one call for
+// the current viewport
+class PacedLines {
+public:
+	void Init(int maxSegments = 4096);
+	void Begin(int slot);
+	void Add(vec3 a, vec3 b, float width, vec3 color);   // width in pixels
+	void Draw(mat4 fullview);
+	int NSegments() const { return nSegments; }
+	void Release();
+private:
+	struct Vertex { vec3 point, other; vec3 color; float side; };   // six per segment
+	GLuint buffer = 0, vArray = 0, program = 0;
+	Vertex *memory = NULL;
+	int maxSegments = 0, nSegments = 0, slot = 0;
+};
+
+#endif
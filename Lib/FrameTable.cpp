@@ -0,0 +1,157 @@
+// FrameTable.cpp: rotation-minimizing frames via double reflection, stored as quaternions
+
+#include <math.h>
+#include "BezierBatch.h"
+#include "FrameTable.h"
+
+// Quaternion Helpers
+
+static vec4 MatrixToQuat(vec3 X, vec3 Y, vec3 Z) {
+	// X, Y, Z are the orthonormal columns of a rotation matrix
+	float trace = X.x+Y.y+Z.z;
+	if (trace > 0) {
+		float s = 2*sqrtf(trace+1);
+		return vec4((Y.z-Z.y)/s, (Z.x-X.z)/s, (X.y-Y.x)/s, s/4);
+	}
+	if (X.x > Y.y && X.x > Z.z) {
+		float s = 2*sqrtf(1+X.x-Y.y-Z.z);
+		return vec4(s/4, (Y.x+X.y)/s, (Z.x+X.z)/s, (Y.z-Z.y)/s);
+	}
+	if (Y.y > Z.z) {
+		float s = 2*sqrtf(1+Y.y-X.x-Z.z);
+		return vec4((Y.x+X.y)/s, s/4, (Z.y+Y.z)/s, (Z.x-X.z)/s);
+	}
+	float s = 2*sqrtf(1+Z.z-X.x-Y.y);
+	return vec4((Z.x+X.z)/s, (Z.y+Y.z)/s, s/4, (X.y-Y.x)/s);
+}
+
+static vec4 Slerp(vec4 q1, vec4 q2, float a) {
+	float c = dot(q1, q2);
+	if (c < 0) {
+		q2 = -1*q2;
+		c = -c;
+	}
+	float w1 = 1-a, w2 = a;
+	if (c < .9995f) {
+		// nearly parallel quaternions use (normalized) lerp
+		float angle = acosf(c), s = sinf(angle);
+		w1 = sinf(w1*angle)/s;
+		w2 = sinf(w2*angle)/s;
+	}
+	vec4 q = w1*q1+w2*q2;
+	return q/sqrtf(dot(q, q));
+}
+
+static mat4 QuatToMatrix(vec4 q, vec3 p) {
+	float x = q.x, y = q.y, z = q.z, w = q.w;
+	return mat4(vec4(1-2*(y*y+z*z), 2*(x*y-z*w),   2*(x*z+y*w),   p.x),
+				vec4(2*(x*y+z*w),   1-2*(x*x+z*z), 2*(y*z-x*w),   p.y),
+				vec4(2*(x*z-y*w),   2*(y*z+x*w),   1-2*(x*x+y*y), p.z),
+				vec4(0, 0, 0, 1));
+}
+
+// Table Construction
+
+void FrameTable::Build(const vec3 *p, int n, bool c, int s) {
+	path = p;
+	nCurves = n;
+	closed = c;
+	samplesPerCurve = s < 1? 1 : s;
+	Rebuild();
+}
+
+void FrameTable::Rebuild() {
+	dirty = false;
+	quats.clear();
+	if (!path || nCurves < 1)
+		return;
+	int S = samplesPerCurve, n = nCurves*S+1;
+	vector<float> ts(S);
+	vector<vec3> x(n), t(n), r(n);
+	for (int k = 0; k < S; k++)
+		ts[k] = (float) k/S;
+	// sample positions and tangents, S per curve plus the path end
+	for (int i = 0; i < nCurves; i++) {
+		BezierPositions(path+3*i, ts.data(), S, &x[i*S]);
+		BezierVelocities(path+3*i, ts.data(), S, &t[i*S]);
+	}
+	x[n-1] = BezierPosition(path+3*(nCurves-1), 1);
+	t[n-1] = BezierVelocity(path+3*(nCurves-1), 1);
+	for (int i = 0; i < n; i++) {
+		// zero velocity (coincident control points) borrows the neighboring chord
+		float len = length(t[i]);
+		if (len < 1e-6f)
+			t[i] = i < n-1? x[i+1]-x[i] : x[i]-x[i-1];
+		t[i] = normalize(t[i]);
+	}
+	// initial up vector matches the frame Bezier::Frame used at t = 0
+	vec3 side = cross(t[0], vec3(0, 1, 0));
+	if (length(side) < 1e-3f)
+		side = cross(t[0], vec3(1, 0, 0));
+	r[0] = normalize(cross(side, t[0]));
+	// double reflection: reflect frame across the chord bisector, then across the tangent bisector
+	for (int i = 0; i < n-1; i++) {
+		vec3 v1 = x[i+1]-x[i];
+		float c1 = dot(v1, v1);
+		if (c1 < 1e-12f) {
+			r[i+1] = normalize(r[i]-dot(r[i], t[i+1])*t[i+1]);
+			continue;
+		}
+		vec3 rL = r[i]-(2/c1)*dot(v1, r[i])*v1, tL = t[i]-(2/c1)*dot(v1, t[i])*v1;
+		vec3 v2 = t[i+1]-tL;
+		float c2 = dot(v2, v2);
+		r[i+1] = c2 < 1e-12f? rL : rL-(2/c2)*dot(v2, rL)*v2;
+	}
+	if (closed) {
+		// spread the holonomy twist so the end frame equals the start frame
+		float twist = atan2f(dot(cross(r[n-1], r[0]), t[n-1]), dot(r[n-1], r[0]));
+		for (int i = 1; i < n; i++) {
+			float a = twist*i/(n-1);
+			r[i] = cosf(a)*r[i]+sinf(a)*cross(t[i], r[i]);
+		}
+	}
+	// store as quaternions for columns (side, up, -tangent), kept in one hemisphere
+	quats.resize(n);
+	for (int i = 0; i < n; i++) {
+		quats[i] = MatrixToQuat(cross(t[i], r[i]), r[i], -t[i]);
+		if (i > 0 && dot(quats[i], quats[i-1]) < 0)
+			quats[i] = -1*quats[i];
+	}
+}
+
+// Lookup
+
+static void Locate(float u, int nCurves, int S, bool closed, int &curve, float &t, int &k, float &a) {
+	if (closed)
+		u = fmodf(u, (float) nCurves)+(u < 0? nCurves : 0);
+	u = u < 0? 0 : u > nCurves? (float) nCurves : u;
+	curve = (int) u < nCurves? (int) u : nCurves-1;
+	t = u-curve;
+	float f = t*S;
+	k = (int) f < S? (int) f : S-1;
+	a = f-k;
+}
+
+vec4 FrameTable::Orientation(float u) {
+	if (dirty)
+		Rebuild();
+	if (quats.empty())
+		return vec4(0, 0, 0, 1);
+	int curve, k;
+	float t, a;
+	Locate(u, nCurves, samplesPerCurve, closed, curve, t, k, a);
+	int i = curve*samplesPerCurve+k;
+	return Slerp(quats[i], quats[i+1], a);
+}
+
+mat4 FrameTable::Frame(float u) {
+	if (dirty)
+		Rebuild();
+	if (quats.empty())
+		return mat4();
+	int curve, k;
+	float t, a;
+	Locate(u, nCurves, samplesPerCurve, closed, curve, t, k, a);
+	int i = curve*samplesPerCurve+k;
+	return QuatToMatrix(Slerp(quats[i], quats[i+1], a), BezierPosition(path+3*curve, t));
+}
@@ -0,0 +1,34 @@
+// FrameTable.h: rotation-minimizing frames along a piecewise cubic Bezier path
+
+#ifndef FRAME_TABLE_HDR
+#define FRAME_TABLE_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Frames are propagated with the double-reflection method (Wang et al. 2008), which does not
+// flip at vertical tangents, then stored as unit quaternions; Frame() is a table lookup,
+// a slerp, and a single curve position evaluation.
+
+class FrameTable {
+public:
+	// path holds 3*nCurves+1 points, curve i uses path[3*i]..path[3*i+3]; if closed, the residual
+	// twist at the end is spread along the path so the last frame matches the first
+	void Build(const vec3 *path, int nCurves, bool closed = false, int samplesPerCurve = 64);
+	void Invalidate() { dirty = true; }   // call when a control point moves, table is rebuilt on next Frame()
+	bool Dirty() const { return dirty; }
+	mat4 Frame(float u);                  // u in [0, nCurves), columns: side, up, -tangent, position
+	vec4 Orientation(float u);            // unit quaternion (x, y, z, w) at u
+	int NSamples() const { return (int) quats.size(); }
+	int NCurves() const { return nCurves; }
+private:
+	const vec3 *path = NULL;
+	int nCurves = 0, samplesPerCurve = 0;
+	bool closed = false, dirty = true;
+	vector<vec4> quats;                   // samplesPerCurve per curve, plus end sample
+	void Rebuild();
+};
+
+#endif
@@ -0,0 +1,98 @@
+// GLState.cpp: thin state cache that filters redundant GL binds and enables
+
+#include "GLState.h"
+
+GLState glState;
+
+bool GLState::Changed(bool &known, GLuint &current, GLuint value) {
+	if (known && current == value) {
+		filtered++;
+		return false;
+	}
+	known = true;
+	current = value;
+	issued++;
+	return true;
+}
+
+void GLState::UseProgram(GLuint p) {
+	if (Changed(programKnown, program, p))
+		glUseProgram(p);
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer) {
+	if (target == GL_ARRAY_BUFFER) {
+		if (Changed(arrayKnown, arrayBuffer, buffer))
+			glBindBuffer(target, buffer);
+	}
+	else if (target == GL_ELEMENT_ARRAY_BUFFER) {
+		if (Changed(elementKnown, elementBuffer, buffer))
+			glBindBuffer(target, buffer);
+	}
+	else {
+		issued++;                               // other targets are not tracked
+		glBindBuffer(target, buffer);
+	}
+}
+
+void GLState::BindVertexArray(GLuint v) {
+	if (Changed(vArrayKnown, vArray, v)) {
+		glBindVertexArray(v);
+		elementKnown = false;                   // element buffer binding is vertex array state
+	}
+}
+
+void GLState::SetCap(GLenum cap, bool enable) {
+	int i = 0;
+	while (i < nCaps && caps[i] != cap)
+		i++;
+	if (i == maxCaps) {
+		issued++;                               // table full: not tracked
+		enable? glEnable(cap) : glDisable(cap);
+		return;
+	}
+	if (i == nCaps) {
+		caps[nCaps++] = cap;
+		capKnown[i] = false;
+	}
+	if (Changed(capKnown[i], capEnabled[i], enable? 1 : 0))
+		enable? glEnable(cap) : glDisable(cap);
+}
+
+void GLState::Enable(GLenum cap) {
+	SetCap(cap, true);
+}
+
+void GLState::Disable(GLenum cap) {
+	SetCap(cap, false);
+}
+
+void GLState::ActiveTexture(int unit) {
+	if (Changed(unitKnown, activeUnit, (GLuint) unit))
+		glActiveTexture(GL_TEXTURE0+unit);
+}
+
+void GLState::BindTexture(int unit, GLuint texture, GLenum target) {
+	// select the unit first, so the bind applies to it
+	if (unit < 0 || unit >= maxUnits || target != GL_TEXTURE_2D) {
+		ActiveTexture(unit);
+		issued++;
+		glBindTexture(target, texture);
+		return;
+	}
+	bool known = textureKnown[unit];
+	if (known && textures[unit] == texture) {
+		filtered++;
+		return;
+	}
+	ActiveTexture(unit);
+	Changed(textureKnown[unit], textures[unit], texture);
+	glBindTexture(target, texture);
+}
+
+void GLState::Invalidate() {
+	programKnown = vArrayKnown = arrayKnown = elementKnown = unitKnown = false;
+	for (int i = 0; i < maxUnits; i++)
+		textureKnown[i] = false;
+	nCaps = 0;
+}
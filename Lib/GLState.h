@@ -0,0 +1,42 @@
+// GLState.h: thin state cache that filters redundant GL binds and enables
+
+#ifndef GL_STATE_HDR
+#define GL_STATE_HDR
+
+#include "glad.h"
+
+// Wraps glUseProgram, glBindBuffer, glBindVertexArray, glEnable/glDisable, glActiveTexture and
+// glBindTexture: a call is issued only if it changes the tracked value. BindTexture selects the
+// unit before binding, so the texture always lands on the intended unit. Code that bypasses the
+// cache (Draw.h, Text.h, other libraries) leaves it stale: call Invalidate() at the start of
+// each frame, and after such code if cached calls follow it in the same frame.
+
+class GLState {
+public:
+	enum { maxUnits = 32, maxCaps = 8 };
+	int issued = 0, filtered = 0;               // calls passed to GL, calls elided
+	void UseProgram(GLuint program);
+	void BindBuffer(GLenum target, GLuint buffer);
+	void BindVertexArray(GLuint vArray);
+	void Enable(GLenum cap);
+	void Disable(GLenum cap);
+	void ActiveTexture(int unit);               // unit index, not GL_TEXTURE0+unit
+	void BindTexture(int unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+	void Invalidate();                          // forget everything, next calls are issued
+	void ResetCounts() { issued = filtered = 0; }
+private:
+	bool Changed(bool &known, GLuint &current, GLuint value);
+	GLuint program = 0, vArray = 0, arrayBuffer = 0, elementBuffer = 0, activeUnit = 0;
+	bool programKnown = false, vArrayKnown = false, arrayKnown = false, elementKnown = false, unitKnown = false;
+	GLuint textures[maxUnits] = {};
+	bool textureKnown[maxUnits] = {};
+	GLenum caps[maxCaps] = {};                  // capabilities seen since Invalidate
+	GLuint capEnabled[maxCaps] = {};
+	bool capKnown[maxCaps] = {};
+	int nCaps = 0;
+	void SetCap(GLenum cap, bool enable);
+};
+
+extern GLState glState;
+
+#endif
@@ -0,0 +1,190 @@
+// GPUResources.cpp: registry of GPU buffers, textures and programs, with budget and leak report
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+#include "GPUResources.h"
+
+GPURegistry gpuRegistry;
+
+static const char *categoryNames[] = { "buffer", "texture", "program" };
+
+// Registry
+
+void GPURegistry::Track(Category c, GLuint name, size_t n, const char *label) {
+	if (!name)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	Remove(c, name);                            // GL reused a name we never saw deleted
+	Entry e;
+	e.category = c;
+	e.name = name;
+	e.bytes = n;
+	e.label = label? label : "";
+	e.lastUse = frame;
+	entries[Key(c, name)] = e;
+	bytes[c] += n;
+	count[c]++;
+}
+
+void GPURegistry::Untrack(Category c, GLuint name) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Remove(c, name);
+}
+
+void GPURegistry::Remove(Category c, GLuint name) {
+	auto i = entries.find(Key(c, name));
+	if (i == entries.end())
+		return;
+	bytes[c] -= i->second.bytes;
+	count[c]--;
+	if (i->second.owner)
+		cachedBytes -= i->second.bytes;
+	entries.erase(i);
+}
+
+void GPURegistry::SetBytes(Category c, GLuint name, size_t n) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto i = entries.find(Key(c, name));
+	if (i == entries.end())
+		return;
+	Entry &e = i->second;
+	bytes[c] += n-e.bytes;
+	if (e.owner)
+		cachedBytes += n-e.bytes;
+	e.bytes = n;
+}
+
+void GPURegistry::Cache(Category c, GLuint *owner) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto i = entries.find(Key(c, *owner));
+	if (i == entries.end() || i->second.owner)
+		return;
+	i->second.owner = owner;
+	cachedBytes += i->second.bytes;
+}
+
+void GPURegistry::Touch(Category c, GLuint name) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto i = entries.find(Key(c, name));
+	if (i != entries.end())
+		i->second.lastUse = frame;
+}
+
+void GPURegistry::EndFrame() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (budget && cachedBytes > budget) {
+		// least recently used first; objects used this frame stay
+		std::vector<Entry *> lru;
+		for (auto &i : entries)
+			if (i.second.owner && i.second.lastUse < frame)
+				lru.push_back(&i.second);
+		std::sort(lru.begin(), lru.end(), [](Entry *a, Entry *b) { return a->lastUse < b->lastUse; });
+		for (size_t k = 0; k < lru.size() && cachedBytes > budget; k++) {
+			Entry e = *lru[k];
+			printf("evicting %s %u (%.1f MB) %s\n", categoryNames[e.category], e.name, e.bytes/1e6, e.label.c_str());
+			*e.owner = 0;
+			Remove(e.category, e.name);
+			if (e.category == Buffer) glDeleteBuffers(1, &e.name);
+			if (e.category == Texture) glDeleteTextures(1, &e.name);
+			if (e.category == Program) glDeleteProgram(e.name);
+			nEvictions++;
+		}
+	}
+	frame++;
+}
+
+void GPURegistry::Report() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int c = 0; c < nCategories; c++)
+		printf("%s%i %ss (%.1f MB)", c? ", " : "GPU: ", count[c], categoryNames[c], bytes[c]/1e6);
+	printf("; cached %.1f MB", cachedBytes/1e6);
+	if (budget)
+		printf(" of %.1f MB budget, %i evicted", budget/1e6, nEvictions);
+	printf("\n");
+}
+
+int GPURegistry::DumpLive() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (entries.empty()) {
+		printf("no live GPU objects\n");
+		return 0;
+	}
+	std::vector<const Entry *> live;
+	for (auto &i : entries)
+		live.push_back(&i.second);
+	std::sort(live.begin(), live.end(), [](const Entry *a, const Entry *b) {
+		return a->category != b->category? a->category < b->category : a->name < b->name;
+	});
+	printf("%i live GPU objects:\n", (int) live.size());
+	for (const Entry *e : live)
+		printf("  %s %u (%.1f MB) %s\n", categoryNames[e->category], e->name, e->bytes/1e6, e->label.c_str());
+	return (int) live.size();
+}
+
+// Sizes
+
+size_t BufferBytes(GLuint buffer) {
+	// query through the copy-read binding, leaving array and element bindings alone
+	GLint was = 0;
+	GLint64 size = 0;
+	glGetIntegerv(GL_COPY_READ_BUFFER_BINDING, &was);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+	glBindBuffer(GL_COPY_READ_BUFFER, was);
+	return (size_t) size;
+}
+
+static int TexelBytes(GLint format) {
+	switch (format) {
+		case GL_R8: case GL_RED: return 1;
+		case GL_RG8: case GL_RG: case GL_R16F: return 2;
+		case GL_RGBA16F: case GL_RG32F: return 8;
+		case GL_RGBA32F: return 16;
+		default: return 4;                      // RGB8 is generally stored as RGBA8
+	}
+}
+
+size_t TextureBytes(GLuint texture) {
+	GLint was = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &was);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	size_t total = 0;
+	for (int level = 0; level < 16; level++) {
+		GLint w = 0, h = 0, format = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &h);
+		if (!w || !h)
+			break;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_INTERNAL_FORMAT, &format);
+		total += (size_t) w*h*TexelBytes(format);
+	}
+	glBindTexture(GL_TEXTURE_2D, was);
+	return total;
+}
+
+// Deletion
+
+void DeleteBuffer(GLuint &buffer) {
+	if (!buffer)
+		return;
+	gpuRegistry.Untrack(GPURegistry::Buffer, buffer);
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+}
+
+void DeleteTexture(GLuint &texture) {
+	if (!texture)
+		return;
+	gpuRegistry.Untrack(GPURegistry::Texture, texture);
+	glDeleteTextures(1, &texture);
+	texture = 0;
+}
+
+void DeleteProgram(GLuint &program) {
+	if (!program)
+		return;
+	gpuRegistry.Untrack(GPURegistry::Program, program);
+	glDeleteProgram(program);
+	program = 0;
+}
@@ -0,0 +1,95 @@
+// GPUResources.h: registry of GPU buffers, textures and programs, with budget and leak report
+
+#ifndef GPU_RESOURCES_HDR
+#define GPU_RESOURCES_HDR
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include "glad.h"
+
+// Every tracked object has a category, a byte count and a label (usually a filename). Objects
+// marked as cached may be evicted: when EndFrame finds cached bytes over budget, it deletes the
+// least recently touched cached objects (never one touched this frame) and zeroes the owner's
+// id, so the owner can reload on next use. DumpLive, called at shutdown after cleanup, lists
+// whatever is still alive. Delete* untrack and delete in one step; GPUBuffer, GPUTexture and
+// GPUProgram do so on destruction.
+
+class GPURegistry {
+public:
+	enum Category { Buffer, Texture, Program, nCategories };
+	size_t budget = 0;                          // bytes of cached objects; 0: no limit
+	void Track(Category c, GLuint name, size_t bytes, const char *label);
+	void Untrack(Category c, GLuint name);
+	void SetBytes(Category c, GLuint name, size_t bytes);
+	void Cache(Category c, GLuint *owner);      // *owner may be evicted, then set to 0
+	void Touch(Category c, GLuint name);        // used this frame
+	void EndFrame();                            // enforce budget
+	size_t Bytes(Category c) const { return bytes[c]; }
+	int Count(Category c) const { return count[c]; }
+	int Evictions() const { return nEvictions; }
+	void Report() const;                        // counts and bytes per category
+	int DumpLive() const;                       // print live objects, return how many
+	// tracking may come from any thread (eg, an upload context); deletion is up to the caller
+private:
+	struct Entry {
+		Category category;
+		GLuint name;
+		size_t bytes;
+		std::string label;
+		GLuint *owner = NULL;                   // non-null if cached
+		uint64_t lastUse = 0;
+	};
+	std::unordered_map<uint64_t, Entry> entries;
+	size_t bytes[nCategories] = {}, cachedBytes = 0;
+	int count[nCategories] = {}, nEvictions = 0;
+	uint64_t frame = 1;
+	mutable std::mutex mutex;
+	void Remove(Category c, GLuint name);
+	static uint64_t Key(Category c, GLuint name) { return ((uint64_t) c << 32) | name; }
+};
+
+extern GPURegistry gpuRegistry;
+
+// sizes queried from GL (textures include mipmaps allocated so far)
+size_t BufferBytes(GLuint buffer);
+size_t TextureBytes(GLuint texture);
+
+// untrack, delete, zero
+void DeleteBuffer(GLuint &buffer);
+void DeleteTexture(GLuint &texture);
+void DeleteProgram(GLuint &program);
+
+// owning handle: tracks on Adopt, deletes on Release or destruction; movable, not copyable
+template<GPURegistry::Category C>
+class GPUHandle {
+public:
+	GPUHandle() { }
+	~GPUHandle() { Release(); }
+	GPUHandle(const GPUHandle &) = delete;
+	GPUHandle &operator=(const GPUHandle &) = delete;
+	GPUHandle(GPUHandle &&h) : name(h.name) { h.name = 0; }
+	GPUHandle &operator=(GPUHandle &&h) { if (this != &h) { Release(); name = h.name; h.name = 0; } return *this; }
+	GLuint Adopt(GLuint n, const char *label) {
+		Release();
+		name = n;
+		if (name)
+			gpuRegistry.Track(C, name, C == GPURegistry::Buffer? BufferBytes(name) : C == GPURegistry::Texture? TextureBytes(name) : 0, label);
+		return name;
+	}
+	void Release() {
+		if (name)
+			C == GPURegistry::Buffer? DeleteBuffer(name) : C == GPURegistry::Texture? DeleteTexture(name) : DeleteProgram(name);
+	}
+	operator GLuint() const { return name; }
+	GLuint *Id() { return &name; }              // for Cache
+private:
+	GLuint name = 0;
+};
+
+typedef GPUHandle<GPURegistry::Buffer> GPUBuffer;
+typedef GPUHandle<GPURegistry::Texture> GPUTexture;
+typedef GPUHandle<GPURegistry::Program> GPUProgram;
+
+#endif
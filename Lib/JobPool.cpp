@@ -0,0 +1,135 @@
+// JobPool.cpp: fixed set of worker threads running queued jobs
+
+#include <atomic>
+#include <stdint.h>
+#include "JobPool.h"
+
+JobPool::JobPool(int nThreads) {
+	if (nThreads <= 0)
+		nThreads = (int) std::thread::hardware_concurrency();
+	if (nThreads <= 0)
+		nThreads = 1;
+	for (int i = 0; i < nThreads; i++)
+		threads.push_back(std::thread(&JobPool::Work, this));
+}
+
+JobPool::~JobPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	jobReady.notify_all();
+	for (std::thread &t : threads)
+		t.join();
+}
+
+void JobPool::Add(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	jobReady.notify_one();
+}
+
+void JobPool::Wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [this] { return jobs.empty() && nBusy == 0; });
+}
+
+void JobPool::Work() {
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobReady.wait(lock, [this] { return quit || !jobs.empty(); });
+			if (jobs.empty())
+				return;                        // quit, with nothing left to do
+			job = jobs.front();
+			jobs.pop_front();
+			nBusy++;
+		}
+		job();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			nBusy--;
+			if (jobs.empty() && nBusy == 0)
+				allDone.notify_all();
+		}
+	}
+}
+
+void ParallelRanges(int n, std::function<void(int, int)> f, int grain) {
+	int nThreads = (int) std::thread::hardware_concurrency(), maxThreads = n/(grain > 0? grain : 1)+1;
+	nThreads = nThreads < 1? 1 : nThreads > maxThreads? maxThreads : nThreads;
+	if (nThreads == 1) {
+		f(0, n);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (int t = 0; t < nThreads; t++)
+		threads.push_back(std::thread(f, (int) ((long long) n*t/nThreads), (int) ((long long) n*(t+1)/nThreads)));
+	for (std::thread &t : threads)
+		t.join();
+}
+
+// Work Stealing
+
+// a range [begin, end) packed in one word, so the owner (advancing begin) and a thief (lowering
+// end) each update it with a single compare-exchange; padded to a cache line against false sharing
+struct alignas(64) StealRange {
+	std::atomic<uint64_t> range;
+};
+
+static uint64_t Pack(int begin, int end) { return (uint64_t) (uint32_t) end << 32 | (uint32_t) begin; }
+static int Begin(uint64_t r) { return (int) (uint32_t) r; }
+static int End(uint64_t r) { return (int) (r >> 32); }
+
+int ParallelFor(JobPool &pool, int n, std::function<void(int, int)> f, int grain) {
+	grain = grain < 1? 1 : grain;
+	int nThreads = pool.NThreads(), maxThreads = (n+grain-1)/grain;
+	nThreads = nThreads > maxThreads? maxThreads : nThreads;
+	if (nThreads <= 1) {
+		for (int i = 0; i < n; i += grain)
+			f(i, i+grain < n? i+grain : n);
+		return 0;
+	}
+	std::vector<StealRange> ranges(nThreads);
+	for (int t = 0; t < nThreads; t++)
+		ranges[t].range = Pack((int) ((long long) n*t/nThreads), (int) ((long long) n*(t+1)/nThreads));
+	std::atomic<int> nSteals(0);
+	for (int t = 0; t < nThreads; t++)
+		pool.Add([&, t]() {
+			std::atomic<uint64_t> &own = ranges[t].range;
+			for (;;) {
+				// next chunk from the front of our range
+				uint64_t r = own.load();
+				int b = Begin(r), e = End(r);
+				if (b < e) {
+					int chunkEnd = e-b > grain? b+grain : e;
+					if (own.compare_exchange_weak(r, Pack(chunkEnd, e)))
+						f(b, chunkEnd);
+					continue;
+				}
+				// ours is empty: steal the back half of the fullest range longer than a chunk
+				int victim = -1, most = grain;
+				for (int v = 0; v < nThreads; v++) {
+					uint64_t rv = ranges[v].range.load();
+					if (End(rv)-Begin(rv) > most) {
+						victim = v;
+						most = End(rv)-Begin(rv);
+					}
+				}
+				if (victim < 0)
+					return;                    // what's left belongs to threads still working on it
+				uint64_t rv = ranges[victim].range.load();
+				int vb = Begin(rv), ve = End(rv), mid = vb+(ve-vb)/2;
+				if (ve-vb <= grain || !ranges[victim].range.compare_exchange_strong(rv, Pack(vb, mid)))
+					continue;
+				// no one steals from an empty range, so ours is unchanged
+				own.store(Pack(mid, ve));
+				nSteals++;
+			}
+		});
+	pool.Wait();
+	return nSteals;
+}
@@ -0,0 +1,39 @@
+// JobPool.h: fixed set of worker threads running queued jobs
+
+#ifndef JOB_POOL_HDR
+#define JOB_POOL_HDR
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobPool {
+public:
+	JobPool(int nThreads = 0);                  // 0: one thread per hardware core
+	~JobPool();
+	void Add(std::function<void()> job);
+	void Wait();                                // block until queue is empty and all jobs finished
+	int NThreads() const { return (int) threads.size(); }
+private:
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable jobReady, allDone;
+	int nBusy = 0;
+	bool quit = false;
+	void Work();
+};
+
+// split [0, n) into contiguous ranges, at least grain long, one thread each; returns when all finish
+void ParallelRanges(int n, std::function<void(int begin, int end)> f, int grain = 4096);
+
+// split [0, n) into one range per pool thread; each thread takes chunks of at most grain from the
+// front of its range, and once it runs dry steals the back half of the fullest remaining range,
+// so uneven work or a descheduled thread doesn't leave the other cores idle; returns when all
+// finish, with the number of steals
+int ParallelFor(JobPool &pool, int n, std::function<void(int begin, int end)> f, int grain = 256);
+
+#endif
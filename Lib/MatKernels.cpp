@@ -0,0 +1,275 @@
+// MatKernels.cpp: SIMD mat4 products and batch transforms over the VecMat types
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "JobPool.h"
+#include "MatKernels.h"
+#include "Simd.h"
+
+static_assert(sizeof(mat4) == 16*sizeof(float) && sizeof(vec4) == 4*sizeof(float), "mat4 must be four packed rows");
+
+typedef std::chrono::steady_clock Clock;
+
+static const int grain = 1 << 16;               // vectors per thread, at least
+static const int parallelMin = 1 << 18;         // below this, threads cost more than they save
+
+#if defined(SIMD_AVX2) || defined(SIMD_SSE)
+
+// rows of m as registers; columns by transposing them
+static inline void Rows(const mat4 &m, __m128 r[4]) {
+	for (int i = 0; i < 4; i++)
+		r[i] = _mm_loadu_ps(&m[i].x);
+}
+
+static inline void Columns(const mat4 &m, __m128 c[4]) {
+	Rows(m, c);
+	_MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+}
+
+// sum of columns scaled by components, added in the order of VecMat's dot product
+static inline __m128 Apply(const __m128 c[4], __m128 v) {
+	__m128 s = _mm_add_ps(_mm_mul_ps(c[0], _mm_shuffle_ps(v, v, 0x00)), _mm_mul_ps(c[1], _mm_shuffle_ps(v, v, 0x55)));
+	s = _mm_add_ps(s, _mm_mul_ps(c[2], _mm_shuffle_ps(v, v, 0xaa)));
+	return _mm_add_ps(s, _mm_mul_ps(c[3], _mm_shuffle_ps(v, v, 0xff)));
+}
+
+static inline __m128 Apply3(const __m128 c[4], const vec3 &p, bool point) {
+	__m128 s = _mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(p.x)), _mm_mul_ps(c[1], _mm_set1_ps(p.y)));
+	s = _mm_add_ps(s, _mm_mul_ps(c[2], _mm_set1_ps(p.z)));
+	return point? _mm_add_ps(s, c[3]) : s;
+}
+
+static inline void Store3(float *o, __m128 v) {
+	// exactly three floats: in place, the next vec3 is not yet read
+	_mm_storel_pi((__m64 *) o, v);
+	_mm_store_ss(o+2, _mm_movehl_ps(v, v));
+}
+
+mat4 MatMul(const mat4 &a, const mat4 &b) {
+	__m128 r[4];
+	Rows(b, r);
+	mat4 m;
+	for (int i = 0; i < 4; i++) {
+		const float *ai = &a[i].x;
+		__m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ai[0]), r[0]), _mm_mul_ps(_mm_set1_ps(ai[1]), r[1]));
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(ai[2]), r[2]));
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(ai[3]), r[3]));
+		_mm_storeu_ps(&m[i].x, s);
+	}
+	return m;
+}
+
+vec4 Transform(const mat4 &m, const vec4 &v) {
+	__m128 c[4];
+	Columns(m, c);
+	vec4 r;
+	_mm_storeu_ps(&r.x, Apply(c, _mm_loadu_ps(&v.x)));
+	return r;
+}
+
+static void TransformRange(const mat4 &m, const vec4 *in, vec4 *out, int n) {
+	__m128 c[4];
+	Columns(m, c);
+	int i = 0;
+#if defined(SIMD_AVX2)
+	// two vectors per register, each 128-bit half its own vector
+	__m256 c2[4];
+	for (int k = 0; k < 4; k++)
+		c2[k] = _mm256_insertf128_ps(_mm256_castps128_ps256(c[k]), c[k], 1);
+	for (; i+2 <= n; i += 2) {
+		__m256 v = _mm256_loadu_ps(&in[i].x);
+		__m256 s = _mm256_add_ps(_mm256_mul_ps(c2[0], _mm256_permute_ps(v, 0x00)), _mm256_mul_ps(c2[1], _mm256_permute_ps(v, 0x55)));
+		s = _mm256_add_ps(s, _mm256_mul_ps(c2[2], _mm256_permute_ps(v, 0xaa)));
+		s = _mm256_add_ps(s, _mm256_mul_ps(c2[3], _mm256_permute_ps(v, 0xff)));
+		_mm256_storeu_ps(&out[i].x, s);
+	}
+#endif
+	for (; i < n; i++)
+		_mm_storeu_ps(&out[i].x, Apply(c, _mm_loadu_ps(&in[i].x)));
+}
+
+static void Transform3Range(const mat4 &m, const vec3 *in, vec3 *out, int n, bool points) {
+	// four points per step: three registers of x,y,z,x,y,z... shuffled to x, y and z
+	// registers, transformed by broadcast matrix entries, shuffled back
+	__m128 e[3][4], c[4];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 4; j++)
+			e[i][j] = _mm_set1_ps(j < 3 || points? m[i][j] : 0.f);
+	int i = 0;
+	for (; i+4 <= n; i += 4) {
+		const float *f = &in[i].x;
+		__m128 a = _mm_loadu_ps(f), b = _mm_loadu_ps(f+4), d = _mm_loadu_ps(f+8);
+		__m128 lo = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 3, 0)), hi = _mm_shuffle_ps(b, d, _MM_SHUFFLE(1, 1, 2, 2));
+		__m128 x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 1, 0));
+		lo = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+		hi = _mm_shuffle_ps(b, d, _MM_SHUFFLE(2, 2, 3, 3));
+		__m128 y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+		lo = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+		hi = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 0, 3, 0));
+		__m128 z = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(1, 0, 2, 0));
+		__m128 r[3];
+		for (int k = 0; k < 3; k++) {
+			__m128 s = _mm_add_ps(_mm_mul_ps(e[k][0], x), _mm_mul_ps(e[k][1], y));
+			s = _mm_add_ps(s, _mm_mul_ps(e[k][2], z));
+			r[k] = points? _mm_add_ps(s, e[k][3]) : s;
+		}
+		__m128 xy01 = _mm_unpacklo_ps(r[0], r[1]), xy23 = _mm_unpackhi_ps(r[0], r[1]);
+		__m128 t = _mm_shuffle_ps(r[2], xy01, _MM_SHUFFLE(2, 2, 0, 0));
+		a = _mm_shuffle_ps(xy01, t, _MM_SHUFFLE(2, 0, 1, 0));
+		t = _mm_shuffle_ps(xy01, r[2], _MM_SHUFFLE(1, 1, 3, 3));
+		b = _mm_shuffle_ps(t, xy23, _MM_SHUFFLE(1, 0, 2, 0));
+		lo = _mm_shuffle_ps(r[2], xy23, _MM_SHUFFLE(2, 2, 2, 2));
+		hi = _mm_shuffle_ps(xy23, r[2], _MM_SHUFFLE(3, 3, 3, 3));
+		d = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+		float *o = &out[i].x;
+		_mm_storeu_ps(o, a);
+		_mm_storeu_ps(o+4, b);
+		_mm_storeu_ps(o+8, d);
+	}
+	Columns(m, c);
+	for (; i < n; i++)
+		Store3(&out[i].x, Apply3(c, in[i], points));
+}
+
+#else
+
+mat4 MatMul(const mat4 &a, const mat4 &b) {
+	return a*b;
+}
+
+vec4 Transform(const mat4 &m, const vec4 &v) {
+	return m*v;
+}
+
+static void TransformRange(const mat4 &m, const vec4 *in, vec4 *out, int n) {
+	for (int i = 0; i < n; i++)
+		out[i] = m*in[i];
+}
+
+static void Transform3Range(const mat4 &m, const vec3 *in, vec3 *out, int n, bool points) {
+	for (int i = 0; i < n; i++) {
+		vec4 v = m*vec4(in[i].x, in[i].y, in[i].z, points? 1.f : 0.f);
+		out[i] = vec3(v.x, v.y, v.z);
+	}
+}
+
+#endif
+
+mat4 MatMul(const mat4 &a, const mat4 &b, const mat4 &c) {
+	return MatMul(MatMul(a, b), c);
+}
+
+void Transform(const mat4 &m, const vec4 *in, vec4 *out, int n) {
+	if (n < parallelMin)
+		TransformRange(m, in, out, n);
+	else
+		ParallelRanges(n, [&](int b, int e) { TransformRange(m, in+b, out+b, e-b); }, grain);
+}
+
+void TransformPoints(const mat4 &m, const vec3 *in, vec3 *out, int n) {
+	if (n < parallelMin)
+		Transform3Range(m, in, out, n, true);
+	else
+		ParallelRanges(n, [&](int b, int e) { Transform3Range(m, in+b, out+b, e-b, true); }, grain);
+}
+
+void TransformVectors(const mat4 &m, const vec3 *in, vec3 *out, int n) {
+	if (n < parallelMin)
+		Transform3Range(m, in, out, n, false);
+	else
+		ParallelRanges(n, [&](int b, int e) { Transform3Range(m, in+b, out+b, e-b, false); }, grain);
+}
+
+// Benchmark
+
+static double Ns(Clock::time_point t, long long count) {
+	return std::chrono::duration<double, std::nano>(Clock::now()-t).count()/count;
+}
+
+static float Random() {
+	return (rand()%20001-10000)/5000.f;
+}
+
+int MatKernelBenchmark() {
+	const int maxN = 1 << 20;
+	const long long work = 1 << 24;             // items per measurement, over repetitions
+	std::vector<vec4> v4(maxN), s4(maxN), k4(maxN);
+	std::vector<vec3> v3(maxN), s3(maxN), k3(maxN);
+	std::vector<mat4> ms(maxN), sm(maxN), km(maxN);
+	srand(1);
+	mat4 m;
+	for (int i = 0; i < 4; i++)
+		m[i] = vec4(Random(), Random(), Random(), Random());
+	for (int i = 0; i < maxN; i++) {
+		v4[i] = vec4(Random(), Random(), Random(), Random());
+		v3[i] = vec3(Random(), Random(), Random());
+		for (int r = 0; r < 4; r++)
+			ms[i][r] = vec4(Random(), Random(), Random(), Random());
+	}
+	printf("mat4 kernels (%s), ns per item, scalar VecMat operators / kernel:\n", SimdISA());
+	printf("%9s %22s %22s %22s\n", "batch", "mat4*vec4", "points (w = 1)", "mat4*mat4");
+	const float tolerance = 1e-5f;
+	float maxError = 0;
+	int nOver = 0;
+	for (int n = 4; n <= maxN; n *= 4) {
+		int reps = (int) (work/n > 0? work/n : 1);
+		double t[6];
+		Clock::time_point c = Clock::now();
+		for (int r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++)
+				s4[i] = m*v4[i];
+		t[0] = Ns(c, (long long) reps*n);
+		c = Clock::now();
+		for (int r = 0; r < reps; r++)
+			Transform(m, v4.data(), k4.data(), n);
+		t[1] = Ns(c, (long long) reps*n);
+		c = Clock::now();
+		for (int r = 0; r < reps; r++)
+			for (int i = 0; i < n; i++) {
+				vec4 p = m*vec4(v3[i].x, v3[i].y, v3[i].z, 1);
+				s3[i] = vec3(p.x, p.y, p.z);
+			}
+		t[2] = Ns(c, (long long) reps*n);
+		c = Clock::now();
+		for (int r = 0; r < reps; r++)
+			TransformPoints(m, v3.data(), k3.data(), n);
+		t[3] = Ns(c, (long long) reps*n);
+		int mReps = reps/4 > 0? reps/4 : 1;     // products are four times the work
+		c = Clock::now();
+		for (int r = 0; r < mReps; r++)
+			for (int i = 0; i < n; i++)
+				sm[i] = m*ms[i];
+		t[4] = Ns(c, (long long) mReps*n);
+		c = Clock::now();
+		for (int r = 0; r < mReps; r++)
+			for (int i = 0; i < n; i++)
+				km[i] = MatMul(m, ms[i]);
+		t[5] = Ns(c, (long long) mReps*n);
+		for (int i = 0; i < n; i++) {
+			float e = 0;
+			for (int k = 0; k < 4; k++) {
+				e = fmaxf(e, fabsf(s4[i][k]-k4[i][k]));
+				if (k < 3)
+					e = fmaxf(e, fabsf(s3[i][k]-k3[i][k]));
+				for (int j = 0; j < 4; j++)
+					e = fmaxf(e, fabsf(sm[i][k][j]-km[i][k][j]));
+			}
+			maxError = fmaxf(maxError, e);
+			nOver += e > tolerance;
+		}
+		printf("%9i", n);
+		for (int j = 0; j < 6; j += 2) {
+			char s[40];
+			snprintf(s, sizeof(s), "%.2f/%.2f (%.1fx)", t[j], t[j+1], t[j]/t[j+1]);
+			printf(" %22s", s);
+		}
+		printf("\n");
+	}
+	printf("max difference from scalar: %g\n", maxError);
+	if (nOver)
+		printf("FAILED: %i items differ from scalar by more than %g\n", nOver, tolerance);
+	return nOver;
+}
@@ -0,0 +1,25 @@
+// MatKernels.h: SIMD mat4 products and batch transforms over the VecMat types
+
+#ifndef MAT_KERNELS_HDR
+#define MAT_KERNELS_HDR
+
+#include "VecMat.h"
+
+// Same types, same results as VecMat's operators (a*b, m*v, Vec3(m*vec4(p, 1))), computed four
+// floats at a time: m*v is the sum of m's columns scaled by v's components, so each vector
+// costs four broadcasts and four multiply-adds, with m transposed once per call. With AVX2 two
+// vectors share each 8-wide instruction. Batches of a few hundred thousand or more are split
+// across all cores. out may equal in. Without SSE the kernels are plain loops.
+
+mat4 MatMul(const mat4 &a, const mat4 &b);                              // a*b
+mat4 MatMul(const mat4 &a, const mat4 &b, const mat4 &c);               // a*b*c
+vec4 Transform(const mat4 &m, const vec4 &v);                           // m*v
+void Transform(const mat4 &m, const vec4 *in, vec4 *out, int n);
+void TransformPoints(const mat4 &m, const vec3 *in, vec3 *out, int n);  // w = 1, no divide
+void TransformVectors(const mat4 &m, const vec3 *in, vec3 *out, int n); // w = 0
+
+// scalar operators vs kernels, batch sizes 4 to 1M; prints ns per item and speedup; returns
+// the number of items differing from the scalar result by more than 1e-5 (0: pass)
+int MatKernelBenchmark();
+
+#endif
@@ -0,0 +1,225 @@
+// Material.cpp: channel-packed material textures, decoded and packed off the main thread
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "GLState.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "JobPool.h"
+#include "Material.h"
+#include "stb_image.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct MaterialCacheHeader {
+	char magic[8];                              // "MATPACK1"
+	int workflow, width, height, pad;
+};
+
+static size_t WithMips(size_t bytes) {
+	return bytes*4/3;                           // full mip chain adds a third
+}
+
+// Requests
+
+void Material::LoadMetalRough(const char *metallic, const char *roughness, const char *height,
+							  const char *normal, const char *cache) {
+	workflow = MetalRough;
+	sources = { metallic, roughness, height, normal };
+	cacheFilename = cache;
+	Start();
+}
+
+void Material::LoadSpecGloss(const char *specular, const char *glossiness, const char *normal, const char *cache) {
+	workflow = SpecGloss;
+	sources = { specular, glossiness, normal };
+	cacheFilename = cache;
+	Start();
+}
+
+void Material::Start() {
+	Release();
+	loadStart = Clock::now();
+	done = false;
+	worker = std::thread(&Material::Work, this);
+}
+
+// Worker
+
+static bool Newer(const std::string &a, const std::string &b) {
+	struct stat sa, sb;
+	return stat(a.c_str(), &sa) == 0 && stat(b.c_str(), &sb) == 0 && sa.st_mtime >= sb.st_mtime;
+}
+
+bool Material::ReadCache() {
+	for (const std::string &s : sources)
+		if (!Newer(cacheFilename, s))
+			return false;
+	FILE *in = fopen(cacheFilename.c_str(), "rb");
+	if (!in)
+		return false;
+	MaterialCacheHeader h;
+	bool valid = fread(&h, sizeof(h), 1, in) == 1 && !strncmp(h.magic, "MATPACK1", 8) &&
+				 h.workflow == workflow && h.width > 0 && h.height > 0;
+	if (valid) {
+		width = h.width;
+		height = h.height;
+		params.resize((size_t) 4*width*height);
+		normal.resize((size_t) 2*width*height);
+		valid = fread(params.data(), 1, params.size(), in) == params.size() &&
+				fread(normal.data(), 1, normal.size(), in) == normal.size();
+	}
+	fclose(in);
+	return valid;
+}
+
+void Material::WriteCache() {
+	FILE *out = fopen(cacheFilename.c_str(), "wb");
+	if (!out) {
+		printf("can't write %s\n", cacheFilename.c_str());
+		return;
+	}
+	MaterialCacheHeader h = { {'M', 'A', 'T', 'P', 'A', 'C', 'K', '1'}, workflow, width, height, 0 };
+	fwrite(&h, sizeof(h), 1, out);
+	fwrite(params.data(), 1, params.size(), out);
+	fwrite(normal.data(), 1, normal.size(), out);
+	fclose(out);
+}
+
+void Material::Work() {
+	int nSources = (int) sources.size();
+	// channels each source contributes, and what one texture per map would cost
+	vector<int> want(nSources), sourceChannels(nSources, 0);
+	for (int i = 0; i < nSources; i++)
+		want[i] = i == nSources-1 || (workflow == SpecGloss && i == 0)? 3 : 1;
+	stats.fetchesUnpacked = nSources;
+	stats.bytesUnpacked = 0;
+	for (int i = 0; i < nSources; i++) {
+		int w = 0, h = 0;
+		// drivers generally store RGB8 as RGBA8
+		if (stbi_info(sources[i].c_str(), &w, &h, &sourceChannels[i]))
+			stats.bytesUnpacked += WithMips((size_t) w*h*(sourceChannels[i] == 3? 4 : sourceChannels[i]));
+	}
+	stats.cached = ReadCache();
+	if (!stats.cached) {
+		// decode every map at once
+		vector<unsigned char *> maps(nSources, NULL);
+		vector<int> widths(nSources, 0), heights(nSources, 0);
+		vector<std::thread> decoders;
+		for (int i = 0; i < nSources; i++)
+			decoders.push_back(std::thread([&, i]() {
+				int n;
+				maps[i] = stbi_load(sources[i].c_str(), &widths[i], &heights[i], &n, want[i]);
+			}));
+		for (std::thread &t : decoders)
+			t.join();
+		ok = true;
+		for (int i = 0; i < nSources; i++) {
+			if (!maps[i])
+				printf("can't read %s\n", sources[i].c_str());
+			else if (widths[i] != widths[0] || heights[i] != heights[0])
+				printf("%s: %ix%i, expected %ix%i\n", sources[i].c_str(), widths[i], heights[i], widths[0], heights[0]);
+			else
+				continue;
+			ok = false;
+		}
+		if (ok) {
+			width = widths[0];
+			height = heights[0];
+			params.resize((size_t) 4*width*height);
+			normal.resize((size_t) 2*width*height);
+			const unsigned char *n = maps[nSources-1];
+			// pack rows, bottom row first (as AssetLoader flips)
+			ParallelRanges(height, [&](int y0, int y1) {
+				for (int y = y0; y < y1; y++) {
+					size_t src = (size_t) (height-1-y)*width, dst = (size_t) y*width;
+					for (int x = 0; x < width; x++) {
+						size_t s = src+x, d = dst+x;
+						unsigned char *p = &params[4*d];
+						if (workflow == MetalRough) {
+							p[0] = maps[0][s];
+							p[1] = maps[1][s];
+							p[2] = maps[2][s];
+							p[3] = 255;
+						}
+						else {
+							memcpy(p, &maps[0][3*s], 3);
+							p[3] = maps[1][s];
+						}
+						normal[2*d] = n[3*s];
+						normal[2*d+1] = n[3*s+1];
+					}
+				}
+			}, 64);
+			WriteCache();
+		}
+		for (unsigned char *m : maps)
+			if (m)
+				stbi_image_free(m);
+	}
+	else
+		ok = true;
+	stats.bytesPacked = WithMips((size_t) (4+2)*width*height);
+	done = true;
+}
+
+// Installation
+
+static GLuint Texture(const unsigned char *texels, int width, int height, GLenum internal, GLenum format, const char *label) {
+	GLuint name = 0;
+	glGenTextures(1, &name);
+	glBindTexture(GL_TEXTURE_2D, name);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, GL_UNSIGNED_BYTE, texels);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	gpuRegistry.Track(GPURegistry::Texture, name, TextureBytes(name), label);
+	return name;
+}
+
+bool Material::Update() {
+	if (!done || !worker.joinable())
+		return false;
+	worker.join();
+	if (!ok)
+		return false;
+	paramsTexture = Texture(params.data(), width, height, GL_RGBA8, GL_RGBA, (cacheFilename+" params").c_str());
+	normalTexture = Texture(normal.data(), width, height, GL_RG8, GL_RG, (cacheFilename+" normal").c_str());
+	glState.Invalidate();                       // bound behind the cache
+	vector<unsigned char>().swap(params);
+	vector<unsigned char>().swap(normal);
+	stats.loadMs = std::chrono::duration<double, std::milli>(Clock::now()-loadStart).count();
+	printf("material %ix%i (%s) %s in %.0f ms\n", width, height, workflow == MetalRough? "metal/rough" : "spec/gloss",
+		   stats.cached? "read from cache" : "decoded and packed", stats.loadMs);
+	printf("  packed:   %i fetches/fragment, %.0f MB\n", stats.fetchesPacked, stats.bytesPacked/1e6);
+	printf("  unpacked: %i fetches/fragment, %.0f MB\n", stats.fetchesUnpacked, stats.bytesUnpacked/1e6);
+	return true;
+}
+
+bool Material::Bind(GLuint program, int firstUnit) {
+	if (!Ready())
+		return false;
+	glState.BindTexture(firstUnit, paramsTexture);
+	glState.BindTexture(firstUnit+1, normalTexture);
+	SetUniform(program, "materialParams", firstUnit);
+	SetUniform(program, "materialNormal", firstUnit+1);
+	SetUniform(program, "specGloss", workflow == SpecGloss? 1 : 0);
+	return true;
+}
+
+void Material::Release() {
+	if (worker.joinable())
+		worker.join();
+	DeleteTexture(paramsTexture);
+	DeleteTexture(normalTexture);
+}
+
+Material::~Material() {
+	if (worker.joinable())
+		worker.join();
+}
@@ -0,0 +1,57 @@
+// Material.h: channel-packed material textures, decoded and packed off the main thread
+
+#ifndef MATERIAL_HDR
+#define MATERIAL_HDR
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "glad.h"
+
+using std::vector;
+
+// Scalar maps are packed into one RGBA8 texture:
+//   MetalRough: R metallic, G roughness, B height, A 1
+//   SpecGloss:  RGB specular, A glossiness
+// The normal map keeps only x and y, in an RG8 texture; shaders rebuild z = sqrt(1-x*x-y*y).
+// So a material is two fetches per fragment, whatever the workflow. Source images are decoded
+// in parallel on worker threads and packed; the packed texels go to a cache file, reused while
+// it is newer than every source, so later runs skip PNG decoding altogether. Update(), on the
+// main thread, uploads once the worker finishes. Bind() binds both textures and sets
+// "materialParams", "materialNormal", and "specGloss" on the program.
+
+class Material {
+public:
+	enum Workflow { MetalRough, SpecGloss };
+	void LoadMetalRough(const char *metallic, const char *roughness, const char *height,
+						const char *normal, const char *cacheFilename);
+	void LoadSpecGloss(const char *specular, const char *glossiness, const char *normal,
+					   const char *cacheFilename);
+	bool Update();                              // main thread, each frame; true when just installed
+	bool Ready() const { return paramsTexture != 0; }
+	bool Bind(GLuint program, int firstUnit);   // uses units firstUnit, firstUnit+1; false if not ready
+	void Release();
+	~Material();
+	// fetches per fragment and texture memory (with mipmaps), packed vs one texture per map
+	struct Stats { int fetchesPacked = 2, fetchesUnpacked = 0; size_t bytesPacked = 0, bytesUnpacked = 0; double loadMs = 0; bool cached = false; };
+	Stats stats;
+private:
+	Workflow workflow = MetalRough;
+	vector<std::string> sources;                // scalar or color maps, then normal map
+	std::string cacheFilename;
+	std::thread worker;
+	std::atomic<bool> done{false};
+	std::chrono::steady_clock::time_point loadStart;
+	bool ok = false;
+	int width = 0, height = 0;
+	vector<unsigned char> params, normal;       // RGBA, RG; freed after upload
+	GLuint paramsTexture = 0, normalTexture = 0;
+	void Start();
+	void Work();
+	bool ReadCache();
+	void WriteCache();
+};
+
+#endif
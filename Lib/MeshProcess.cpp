@@ -0,0 +1,221 @@
+// MeshProcess.cpp: vertex welding and smooth normals for meshes read without them
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "JobPool.h"
+#include "MeshProcess.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double Milliseconds(Clock::time_point t) {
+	return std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+}
+
+// Weld
+
+static uint64_t Hash(const float *f, int n) {
+	// FNV-1a over the bit patterns
+	uint64_t h = 14695981039346656037ull;
+	const unsigned char *b = (const unsigned char *) f;
+	for (int i = 0; i < 4*n; i++)
+		h = (h^b[i])*1099511628211ull;
+	return h;
+}
+
+// vertices with equal keys (nFloats per vertex) map to one; returns remap, fills firstOf
+static vector<int> Unique(const vector<float> &keys, int nFloats, int nVertices, vector<int> &firstOf) {
+	vector<uint64_t> hashes(nVertices);
+	ParallelRanges(nVertices, [&](int b, int e) {
+		for (int i = b; i < e; i++)
+			hashes[i] = Hash(&keys[(size_t) i*nFloats], nFloats);
+	});
+	// open addressing, table at least twice the vertex count
+	size_t size = 1;
+	while (size < 2*(size_t) nVertices)
+		size <<= 1;
+	vector<int> table(size, -1), remap(nVertices);
+	firstOf.resize(0);
+	for (int i = 0; i < nVertices; i++) {
+		size_t slot = hashes[i] & (size-1);
+		for (;;) {
+			int u = table[slot];
+			if (u < 0) {
+				table[slot] = (int) firstOf.size();
+				remap[i] = (int) firstOf.size();
+				firstOf.push_back(i);
+				break;
+			}
+			int f = firstOf[u];
+			if (hashes[f] == hashes[i] && !memcmp(&keys[(size_t) f*nFloats], &keys[(size_t) i*nFloats], nFloats*sizeof(float))) {
+				remap[i] = u;
+				break;
+			}
+			slot = (slot+1) & (size-1);
+		}
+	}
+	return remap;
+}
+
+int Weld(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles) {
+	int n = (int) points.size();
+	bool hasUvs = (int) uvs.size() == n, hasNormals = (int) normals.size() == n;
+	int nFloats = 3+(hasUvs? 2 : 0)+(hasNormals? 3 : 0);
+	vector<float> keys((size_t) n*nFloats);
+	ParallelRanges(n, [&](int b, int e) {
+		for (int i = b; i < e; i++) {
+			float *k = &keys[(size_t) i*nFloats];
+			memcpy(k, &points[i], sizeof(vec3));
+			if (hasUvs) memcpy(k+3, &uvs[i], sizeof(vec2));
+			if (hasNormals) memcpy(k+3+(hasUvs? 2 : 0), &normals[i], sizeof(vec3));
+		}
+	});
+	vector<int> firstOf, remap = Unique(keys, nFloats, n, firstOf);
+	int nWelded = (int) firstOf.size();
+	vector<vec3> wPoints(nWelded), wNormals(hasNormals? nWelded : 0);
+	vector<vec2> wUvs(hasUvs? nWelded : 0);
+	for (int u = 0; u < nWelded; u++) {
+		wPoints[u] = points[firstOf[u]];
+		if (hasUvs) wUvs[u] = uvs[firstOf[u]];
+		if (hasNormals) wNormals[u] = normals[firstOf[u]];
+	}
+	ParallelRanges((int) triangles.size(), [&](int b, int e) {
+		for (int t = b; t < e; t++)
+			for (int k = 0; k < 3; k++)
+				triangles[t][k] = remap[triangles[t][k]];
+	});
+	points.swap(wPoints);
+	if (hasUvs) uvs.swap(wUvs);
+	if (hasNormals) normals.swap(wNormals);
+	return nWelded;
+}
+
+// Normals
+
+void SmoothNormals(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles, float crease) {
+	int nVertices = (int) points.size(), nTriangles = (int) triangles.size();
+	bool hasUvs = (int) uvs.size() == nVertices;
+	// group vertices by position only, so seams in uv don't break smoothing
+	vector<float> keys(3*(size_t) nVertices);
+	memcpy(keys.data(), points.data(), keys.size()*sizeof(float));
+	vector<int> firstOf, position = Unique(keys, 3, nVertices, firstOf);
+	int nPositions = (int) firstOf.size();
+	// face normals (length = twice area) and corner angles
+	vector<vec3> faceNormals(nTriangles);
+	vector<float> angles(3*(size_t) nTriangles);
+	ParallelRanges(nTriangles, [&](int b, int e) {
+		for (int t = b; t < e; t++) {
+			const int3 &tri = triangles[t];
+			vec3 p[] = { points[tri.i1], points[tri.i2], points[tri.i3] };
+			faceNormals[t] = cross(p[1]-p[0], p[2]-p[0]);
+			for (int k = 0; k < 3; k++) {
+				vec3 a = p[(k+1)%3]-p[k], c = p[(k+2)%3]-p[k];
+				float la = length(a), lc = length(c);
+				float cosAngle = la > 0 && lc > 0? dot(a, c)/(la*lc) : 1;
+				angles[3*t+k] = acosf(cosAngle < -1? -1 : cosAngle > 1? 1 : cosAngle);
+			}
+		}
+	});
+	// corners around each position (counting sort)
+	vector<int> start(nPositions+1, 0), corners(3*(size_t) nTriangles);
+	for (int t = 0; t < nTriangles; t++)
+		for (int k = 0; k < 3; k++)
+			start[position[triangles[t][k]]+1]++;
+	for (int i = 0; i < nPositions; i++)
+		start[i+1] += start[i];
+	vector<int> fill(start.begin(), start.end()-1);
+	for (int t = 0; t < nTriangles; t++)
+		for (int k = 0; k < 3; k++)
+			corners[fill[position[triangles[t][k]]]++] = 3*t+k;
+	// per corner: weighted sum of faces within the crease angle of the corner's own face
+	float cosCrease = cosf(crease*3.1415926f/180);
+	vector<vec3> cornerNormals(3*(size_t) nTriangles);
+	vector<vec3> unitFace(nTriangles);
+	ParallelRanges(nTriangles, [&](int b, int e) {
+		for (int t = b; t < e; t++) {
+			float l = length(faceNormals[t]);
+			unitFace[t] = l > 0? faceNormals[t]/l : vec3(0, 0, 0);
+		}
+	});
+	ParallelRanges(nPositions, [&](int b, int e) {
+		for (int p = b; p < e; p++)
+			for (int i = start[p]; i < start[p+1]; i++) {
+				int c = corners[i], t = c/3;
+				vec3 sum(0, 0, 0);
+				for (int j = start[p]; j < start[p+1]; j++) {
+					int c2 = corners[j], t2 = c2/3;
+					if (t2 == t || dot(unitFace[t], unitFace[t2]) >= cosCrease)
+						sum += angles[c2]*faceNormals[t2];
+				}
+				float l = length(sum);
+				cornerNormals[c] = l > 0? sum/l : unitFace[t];
+			}
+	});
+	// one output vertex per (input vertex, distinct corner normal); count, offset, then write
+	vector<int> nOut(nPositions+1, 0), cornerVertex(3*(size_t) nTriangles);
+	auto Same = [](vec3 a, vec3 b) { return dot(a, b) > .99999f; };
+	ParallelRanges(nPositions, [&](int b, int e) {
+		for (int p = b; p < e; p++) {
+			int count = 0;
+			for (int i = start[p]; i < start[p+1]; i++) {
+				int c = corners[i], v = triangles[c/3][c%3], match = -1;
+				for (int j = start[p]; j < i && match < 0; j++) {
+					int c2 = corners[j];
+					if (triangles[c2/3][c2%3] == v && Same(cornerNormals[c], cornerNormals[c2]))
+						match = j;
+				}
+				cornerVertex[c] = match < 0? count++ : cornerVertex[corners[match]];
+			}
+			nOut[p+1] = count;
+		}
+	});
+	for (int p = 0; p < nPositions; p++)
+		nOut[p+1] += nOut[p];
+	int nNew = nOut[nPositions];
+	vector<vec3> newPoints(nNew), newNormals(nNew);
+	vector<vec2> newUvs(hasUvs? nNew : 0);
+	vector<int3> newTriangles(nTriangles);
+	ParallelRanges(nPositions, [&](int b, int e) {
+		for (int p = b; p < e; p++)
+			for (int i = start[p]; i < start[p+1]; i++) {
+				int c = corners[i], v = triangles[c/3][c%3], out = nOut[p]+cornerVertex[c];
+				newPoints[out] = points[v];
+				newNormals[out] = cornerNormals[c];
+				if (hasUvs) newUvs[out] = uvs[v];
+				newTriangles[c/3][c%3] = out;
+			}
+	});
+	points.swap(newPoints);
+	normals.swap(newNormals);
+	if (hasUvs) uvs.swap(newUvs);
+	triangles.swap(newTriangles);
+}
+
+// Report
+
+MeshStats ProcessMesh(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles,
+					  float crease, bool recompute) {
+	MeshStats s;
+	s.verticesIn = (int) points.size();
+	s.triangles = (int) triangles.size();
+	bool needNormals = recompute || normals.size() != points.size();
+	if (needNormals)
+		normals.resize(0);                      // don't weld on stale normals
+	Clock::time_point t = Clock::now();
+	s.verticesWelded = Weld(points, uvs, normals, triangles);
+	s.weldMs = Milliseconds(t);
+	if (needNormals) {
+		t = Clock::now();
+		SmoothNormals(points, uvs, normals, triangles, crease);
+		s.normalMs = Milliseconds(t);
+	}
+	s.verticesOut = (int) points.size();
+	double ms = s.weldMs+s.normalMs;
+	printf("mesh: %i vertices, welded to %i", s.verticesIn, s.verticesWelded);
+	if (needNormals)
+		printf(", %i after %.0f degree crease split", s.verticesOut, crease);
+	printf("; %i triangles in %.1f ms (%.1f Mtriangles/s)\n", s.triangles, ms, ms > 0? s.triangles/ms/1000 : 0.);
+	return s;
+}
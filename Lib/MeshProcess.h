@@ -0,0 +1,31 @@
+// MeshProcess.h: vertex welding and smooth normals for meshes read without them
+
+#ifndef MESH_PROCESS_HDR
+#define MESH_PROCESS_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Weld merges vertices whose (point, uv, normal) are bitwise equal; uvs and normals may be
+// empty, else they parallel points. SmoothNormals replaces normals: each triangle corner gets
+// the sum of the face normals around its position (weighted by face area and by the corner
+// angle), excluding faces more than creaseDegrees from the corner's own face. Adjacency is by
+// position, so uv seams are smoothed across; a vertex whose corners disagree (a crease) is
+// split. Face and corner normals are computed on all cores.
+
+struct MeshStats {
+	int verticesIn = 0, verticesWelded = 0, verticesOut = 0, triangles = 0;
+	double weldMs = 0, normalMs = 0;
+};
+
+int Weld(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles);
+void SmoothNormals(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles,
+				   float creaseDegrees = 60);
+
+// weld, then compute normals if absent (or always, if recompute); prints vertex counts, throughput
+MeshStats ProcessMesh(vector<vec3> &points, vector<vec2> &uvs, vector<vec3> &normals, vector<int3> &triangles,
+					  float creaseDegrees = 60, bool recompute = false);
+
+#endif
@@ -0,0 +1,652 @@
+// MeshStream.cpp: out-of-core mesh display from a spatially chunked cache file
+
+#include <algorithm>
+#include <float.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "MeshStream.h"
+#include "PointKernels.h"
+
+// Cache Conversion
+
+static uint32_t Spread(uint32_t x) {
+	// insert two zero bits between each of the low 10 bits
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+uint32_t Morton(vec3 p, vec3 min, vec3 scale) {
+	vec3 q = (p-min)*scale;
+	return Spread((uint32_t) q.x) | (Spread((uint32_t) q.y) << 1) | (Spread((uint32_t) q.z) << 2);
+}
+
+bool WriteChunkCache(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+					 vector<vec2> &uvs, vector<int3> &triangles, int maxChunkTriangles) {
+	int nPoints = (int) points.size(), nTriangles = (int) triangles.size();
+	if (!nPoints || !nTriangles)
+		return false;
+	vec3 min, max;
+	PointBounds(points.data(), nPoints, min, max);
+	vec3 dif = max-min, scale;
+	for (int k = 0; k < 3; k++)
+		scale[k] = dif[k] > 0? 1023.f/dif[k] : 0;
+	// sort triangles by Morton code of centroid
+	vector<uint64_t> keys(nTriangles);
+	for (int i = 0; i < nTriangles; i++) {
+		int3 &t = triangles[i];
+		vec3 c = (points[t.i1]+points[t.i2]+points[t.i3])/3;
+		keys[i] = ((uint64_t) Morton(c, min, scale) << 32) | (uint32_t) i;
+	}
+	std::sort(keys.begin(), keys.end());
+	// cut the sorted sequence into chunks
+	vector<int> remap(nPoints, -1), stamp(nPoints, -1), firstTri, nChunkVerts;
+	for (int i = 0; i < nTriangles; i++) {
+		if (i%maxChunkTriangles == 0) {
+			firstTri.push_back(i);
+			nChunkVerts.push_back(0);
+		}
+		int c = (int) firstTri.size()-1, *v = &triangles[(uint32_t) keys[i]].i1;
+		for (int k = 0; k < 3; k++)
+			if (stamp[v[k]] != c) {
+				stamp[v[k]] = c;
+				nChunkVerts[c]++;
+			}
+	}
+	firstTri.push_back(nTriangles);
+	int nChunks = (int) nChunkVerts.size();
+	ChunkHeader header;
+	memcpy(header.magic, "MESHCHK1", 8);
+	header.nChunks = nChunks;
+	header.maxChunkBytes = 0;
+	for (int k = 0; k < 3; k++) {
+		header.min[k] = min[k];
+		header.max[k] = max[k];
+	}
+	vector<ChunkInfo> infos(nChunks);
+	uint64_t offset = sizeof(ChunkHeader)+nChunks*sizeof(ChunkInfo);
+	for (int c = 0; c < nChunks; c++) {
+		ChunkInfo &ci = infos[c];
+		ci.offset = offset;
+		ci.nVertices = nChunkVerts[c];
+		ci.nTriangles = firstTri[c+1]-firstTri[c];
+		uint32_t bytes = ci.nVertices*sizeof(ChunkVertex)+3*ci.nTriangles*sizeof(uint32_t);
+		header.maxChunkBytes = bytes > header.maxChunkBytes? bytes : header.maxChunkBytes;
+		offset += bytes;
+	}
+	FILE *out = fopen(filename, "wb");
+	if (!out)
+		return false;
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(infos.data(), sizeof(ChunkInfo), nChunks, out);   // rewritten below with bounding spheres
+	// chunk data
+	vector<ChunkVertex> verts;
+	vector<uint32_t> indices;
+	std::fill(stamp.begin(), stamp.end(), -1);
+	for (int c = 0; c < nChunks; c++) {
+		verts.resize(0);
+		indices.resize(0);
+		vec3 cMin(FLT_MAX, FLT_MAX, FLT_MAX), cMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int i = firstTri[c]; i < firstTri[c+1]; i++) {
+			int *v = &triangles[(uint32_t) keys[i]].i1;
+			for (int k = 0; k < 3; k++) {
+				int p = v[k];
+				if (stamp[p] != c) {
+					stamp[p] = c;
+					remap[p] = (int) verts.size();
+					ChunkVertex cv = {};
+					vec3 n = p < (int) normals.size()? normals[p] : vec3(0, 0, 0);
+					vec2 uv = p < (int) uvs.size()? uvs[p] : vec2(0, 0);
+					for (int j = 0; j < 3; j++) {
+						cv.point[j] = points[p][j];
+						cv.normal[j] = n[j];
+						cMin[j] = std::min(cMin[j], points[p][j]);
+						cMax[j] = std::max(cMax[j], points[p][j]);
+					}
+					cv.uv[0] = uv.x;
+					cv.uv[1] = uv.y;
+					verts.push_back(cv);
+				}
+				indices.push_back(remap[p]);
+			}
+		}
+		vec3 center = (cMin+cMax)/2;
+		float r2 = 0;
+		for (ChunkVertex &cv : verts) {
+			vec3 d = vec3(cv.point)-center;
+			r2 = std::max(r2, dot(d, d));
+		}
+		for (int k = 0; k < 3; k++)
+			infos[c].center[k] = center[k];
+		infos[c].radius = sqrtf(r2);
+		fwrite(verts.data(), sizeof(ChunkVertex), verts.size(), out);
+		fwrite(indices.data(), sizeof(uint32_t), indices.size(), out);
+	}
+	fseek(out, sizeof(ChunkHeader), SEEK_SET);
+	fwrite(infos.data(), sizeof(ChunkInfo), nChunks, out);
+	return fclose(out) == 0;
+}
+
+// Bounded Conversion
+
+static int Seek(FILE *f, int64_t offset) {
+#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+template<typename T>
+class PagedArray {
+	// array kept in a temporary file behind an LRU cache of maxPages pages: random access to
+	// more items than fit in memory costs a page read (and a write, if modified) per miss
+public:
+	enum { pageItems = 4096 };
+	~PagedArray() {
+		if (file) {
+			fclose(file);
+			remove(filename.c_str());
+		}
+	}
+	bool Open(const std::string &name, int pages = 64) {
+		filename = name;
+		maxPages = pages;
+		file = fopen(name.c_str(), "w+b");
+		return file != NULL;
+	}
+	int64_t Size() const { return size; }
+	bool Failed() const { return failed; }
+	void Push(const T &t) { Item(size++, true) = t; }
+	T Get(int64_t i) { return Item(i, false); }
+	T &Set(int64_t i) { return Item(i, true); }     // valid until the next access
+private:
+	struct Page { int64_t index = -1; uint64_t lastUse = 0; bool dirty = false; vector<T> items; };
+	std::string filename;
+	FILE *file = NULL;
+	int maxPages = 64;
+	int64_t size = 0, nStored = 0;                   // items, items in file
+	uint64_t clock = 0;
+	bool failed = false;
+	vector<Page> pages;
+	std::unordered_map<int64_t, int> resident;      // page index to slot
+	void Flush(Page &pg) {
+		if (!pg.dirty)
+			return;
+		int64_t first = pg.index*pageItems, n = std::min<int64_t>(pageItems, size-first);
+		if (Seek(file, first*sizeof(T)) || fwrite(pg.items.data(), sizeof(T), (size_t) n, file) != (size_t) n)
+			failed = true;
+		nStored = std::max(nStored, first+n);
+		pg.dirty = false;
+	}
+	T &Item(int64_t i, bool modify) {
+		int64_t p = i/pageItems;
+		auto r = resident.find(p);
+		int slot = r != resident.end()? r->second : 0;
+		if (r == resident.end()) {
+			if ((int) pages.size() < maxPages) {
+				slot = (int) pages.size();
+				pages.push_back(Page());
+			}
+			else {
+				for (int s = 1; s < maxPages; s++)
+					if (pages[s].lastUse < pages[slot].lastUse)
+						slot = s;
+				Flush(pages[slot]);
+				resident.erase(pages[slot].index);
+			}
+			Page &pg = pages[slot];
+			pg.index = p;
+			pg.items.assign(pageItems, T());
+			int64_t first = p*pageItems, n = std::min<int64_t>(pageItems, nStored-first);
+			if (n > 0 && (Seek(file, first*sizeof(T)) || fread(pg.items.data(), sizeof(T), (size_t) n, file) != (size_t) n))
+				failed = true;
+			resident[p] = slot;
+		}
+		Page &pg = pages[slot];
+		pg.lastUse = ++clock;
+		pg.dirty = pg.dirty || modify;
+		return pg.items[i-p*pageItems];
+	}
+};
+
+struct ObjTriangle {
+	int32_t v[3], t[3], n[3];                        // 0-based point, uv, normal; -1 if absent
+};
+
+struct BucketedTriangle {
+	uint32_t morton;
+	ObjTriangle triangle;
+};
+
+struct Corner {
+	int32_t v, t, n;
+	bool operator==(const Corner &c) const { return v == c.v && t == c.t && n == c.n; }
+};
+
+struct CornerHash {
+	size_t operator()(const Corner &c) const { return (size_t) c.v*73856093u ^ (size_t) c.t*19349663u ^ (size_t) c.n*83492791u; }
+};
+
+static bool ParseCorner(const char *&s, int64_t nPoints, int64_t nUvs, int64_t nNormals, Corner &c) {
+	// v, v/t, v//n or v/t/n; negative indices count back from the last defined
+	auto Resolve = [](long i, int64_t n) { return (int32_t) (i > 0? i-1 : i < 0 && n+i >= 0? n+i : -1); };
+	char *e;
+	long v = strtol(s, &e, 10), t = 0, n = 0;
+	if (e == s)
+		return false;
+	s = e;
+	if (*s == '/') {
+		t = strtol(++s, &e, 10);
+		s = e;
+		if (*s == '/') {
+			n = strtol(++s, &e, 10);
+			s = e;
+		}
+	}
+	c = { Resolve(v, nPoints), Resolve(t, nUvs), Resolve(n, nNormals) };
+	return true;
+}
+
+bool ConvertObjToChunkCache(const char *objFilename, const char *cacheFilename, int maxChunkTriangles) {
+	// the OBJ is parsed once into temporary files next to the cache, read back through page
+	// caches; triangles are bucketed by the top 12 bits of the Morton code of their centroid,
+	// then each bucket is sorted in memory and cut into chunks: memory is the page caches,
+	// the bucket write buffers and the largest bucket (about 1/4096 of a typical mesh)
+	const int nBuckets = 4096, bucketShift = 18, bufferedPerBucket = 32;
+	FILE *in = fopen(objFilename, "r");
+	if (!in)
+		return false;
+	std::string temp = std::string(cacheFilename)+".tmp";
+	PagedArray<vec3> points, fileNormals, smoothNormals;
+	PagedArray<vec2> uvs;
+	PagedArray<ObjTriangle> triangles;
+	if (!points.Open(temp+"0") || !fileNormals.Open(temp+"1") || !smoothNormals.Open(temp+"2") ||
+		!uvs.Open(temp+"3") || !triangles.Open(temp+"4")) {
+		fclose(in);
+		return false;
+	}
+	// pass 1: parse, triangulate polygons as fans, bound points
+	vec3 min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	bool needNormals = false;
+	vector<char> line(1 << 16);
+	vector<Corner> polygon;
+	while (fgets(line.data(), (int) line.size(), in)) {
+		const char *s = line.data();
+		float x, y, z;
+		if (s[0] == 'v' && s[1] == ' ' && sscanf(s+2, "%f %f %f", &x, &y, &z) == 3) {
+			vec3 p(x, y, z);
+			points.Push(p);
+			for (int k = 0; k < 3; k++) {
+				min[k] = std::min(min[k], p[k]);
+				max[k] = std::max(max[k], p[k]);
+			}
+		}
+		else if (s[0] == 'v' && s[1] == 't' && sscanf(s+3, "%f %f", &x, &y) == 2)
+			uvs.Push(vec2(x, y));
+		else if (s[0] == 'v' && s[1] == 'n' && sscanf(s+3, "%f %f %f", &x, &y, &z) == 3)
+			fileNormals.Push(vec3(x, y, z));
+		else if (s[0] == 'f' && s[1] == ' ') {
+			polygon.resize(0);
+			Corner c;
+			for (s += 2; ParseCorner(s, points.Size(), uvs.Size(), fileNormals.Size(), c); )
+				polygon.push_back(c);
+			for (size_t k = 2; k < polygon.size(); k++) {
+				Corner *t[] = { &polygon[0], &polygon[k-1], &polygon[k] };
+				ObjTriangle tri;
+				for (int j = 0; j < 3; j++) {
+					tri.v[j] = t[j]->v;
+					tri.t[j] = t[j]->t;
+					tri.n[j] = t[j]->n;
+					needNormals = needNormals || t[j]->n < 0;
+				}
+				triangles.Push(tri);
+			}
+		}
+	}
+	fclose(in);
+	int64_t nPoints = points.Size(), nTriangles = triangles.Size();
+	if (!nPoints || !nTriangles)
+		return false;
+	for (int64_t i = 0; i < nTriangles; i++) {
+		ObjTriangle tri = triangles.Get(i);
+		for (int k = 0; k < 3; k++) {
+			if (tri.v[k] < 0 || tri.v[k] >= nPoints) {
+				printf("%s: triangle %lld has a bad point index\n", objFilename, (long long) i);
+				return false;
+			}
+			needNormals = needNormals || tri.n[k] >= fileNormals.Size();
+		}
+	}
+	// area-weighted vertex normals for corners without one
+	if (needNormals) {
+		for (int64_t i = 0; i < nPoints; i++)
+			smoothNormals.Push(vec3(0, 0, 0));
+		for (int64_t i = 0; i < nTriangles; i++) {
+			ObjTriangle tri = triangles.Get(i);
+			vec3 p1 = points.Get(tri.v[0]), p2 = points.Get(tri.v[1]), p3 = points.Get(tri.v[2]);
+			vec3 n = cross(p2-p1, p3-p1);
+			for (int k = 0; k < 3; k++)
+				smoothNormals.Set(tri.v[k]) += n;
+		}
+	}
+	// pass 2: count, then scatter triangles into contiguous buckets of a temporary file
+	vec3 dif = max-min, scale;
+	for (int k = 0; k < 3; k++)
+		scale[k] = dif[k] > 0? 1023.f/dif[k] : 0;
+	auto Key = [&](const ObjTriangle &tri) {
+		vec3 c = (points.Get(tri.v[0])+points.Get(tri.v[1])+points.Get(tri.v[2]))/3;
+		return Morton(c, min, scale);
+	};
+	vector<int64_t> bucketStart(nBuckets+1, 0), bucketFill(nBuckets, 0);
+	for (int64_t i = 0; i < nTriangles; i++)
+		bucketStart[(Key(triangles.Get(i)) >> bucketShift)+1]++;
+	for (int b = 0; b < nBuckets; b++)
+		bucketStart[b+1] += bucketStart[b];
+	std::string bucketFilename = temp+"5";
+	FILE *buckets = fopen(bucketFilename.c_str(), "w+b");
+	if (!buckets)
+		return false;
+	bool ok = true;
+	vector<vector<BucketedTriangle>> buffered(nBuckets);
+	auto FlushBucket = [&](int b) {
+		vector<BucketedTriangle> &v = buffered[b];
+		if (v.empty())
+			return;
+		if (Seek(buckets, (bucketStart[b]+bucketFill[b])*sizeof(BucketedTriangle)) ||
+			fwrite(v.data(), sizeof(BucketedTriangle), v.size(), buckets) != v.size())
+			ok = false;
+		bucketFill[b] += v.size();
+		v.resize(0);
+	};
+	for (int64_t i = 0; i < nTriangles; i++) {
+		BucketedTriangle bt;
+		bt.triangle = triangles.Get(i);
+		bt.morton = Key(bt.triangle);
+		int b = bt.morton >> bucketShift;
+		buffered[b].push_back(bt);
+		if ((int) buffered[b].size() == bufferedPerBucket)
+			FlushBucket(b);
+	}
+	for (int b = 0; b < nBuckets; b++) {
+		FlushBucket(b);
+		vector<BucketedTriangle>().swap(buffered[b]);
+	}
+	// pass 3: sort each bucket, cut into chunks, write chunk data, then the chunk table
+	int nChunks = (int) ((nTriangles+maxChunkTriangles-1)/maxChunkTriangles);
+	ChunkHeader header;
+	memcpy(header.magic, "MESHCHK1", 8);
+	header.nChunks = nChunks;
+	header.maxChunkBytes = 0;
+	for (int k = 0; k < 3; k++) {
+		header.min[k] = min[k];
+		header.max[k] = max[k];
+	}
+	vector<ChunkInfo> infos(nChunks);
+	FILE *out = ok? fopen(cacheFilename, "wb") : NULL;
+	if (!out) {
+		fclose(buckets);
+		remove(bucketFilename.c_str());
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(infos.data(), sizeof(ChunkInfo), nChunks, out);   // rewritten below
+	uint64_t offset = sizeof(ChunkHeader)+nChunks*sizeof(ChunkInfo);
+	int chunk = 0;
+	vector<ChunkVertex> verts;
+	vector<uint32_t> indices;
+	std::unordered_map<Corner, uint32_t, CornerHash> remap;
+	auto WriteChunk = [&]() {
+		vec3 cMin(FLT_MAX, FLT_MAX, FLT_MAX), cMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (ChunkVertex &cv : verts)
+			for (int k = 0; k < 3; k++) {
+				cMin[k] = std::min(cMin[k], cv.point[k]);
+				cMax[k] = std::max(cMax[k], cv.point[k]);
+			}
+		vec3 center = (cMin+cMax)/2;
+		float r2 = 0;
+		for (ChunkVertex &cv : verts) {
+			vec3 d = vec3(cv.point)-center;
+			r2 = std::max(r2, dot(d, d));
+		}
+		ChunkInfo &ci = infos[chunk++];
+		ci.offset = offset;
+		ci.nVertices = (uint32_t) verts.size();
+		ci.nTriangles = (uint32_t) indices.size()/3;
+		for (int k = 0; k < 3; k++)
+			ci.center[k] = center[k];
+		ci.radius = sqrtf(r2);
+		uint32_t bytes = ci.nVertices*sizeof(ChunkVertex)+3*ci.nTriangles*sizeof(uint32_t);
+		header.maxChunkBytes = std::max(header.maxChunkBytes, bytes);
+		offset += bytes;
+		fwrite(verts.data(), sizeof(ChunkVertex), verts.size(), out);
+		fwrite(indices.data(), sizeof(uint32_t), indices.size(), out);
+		verts.resize(0);
+		indices.resize(0);
+		remap.clear();
+	};
+	vector<BucketedTriangle> bucket;
+	for (int b = 0; b < nBuckets && ok; b++) {
+		bucket.resize((size_t) (bucketStart[b+1]-bucketStart[b]));
+		if (bucket.empty())
+			continue;
+		if (Seek(buckets, bucketStart[b]*sizeof(BucketedTriangle)) ||
+			fread(bucket.data(), sizeof(BucketedTriangle), bucket.size(), buckets) != bucket.size()) {
+			ok = false;
+			break;
+		}
+		std::stable_sort(bucket.begin(), bucket.end(), [](const BucketedTriangle &a, const BucketedTriangle &b) {
+			return a.morton < b.morton;
+		});
+		for (BucketedTriangle &bt : bucket) {
+			ObjTriangle &tri = bt.triangle;
+			for (int k = 0; k < 3; k++) {
+				Corner c = { tri.v[k], tri.t[k] < uvs.Size()? tri.t[k] : -1, tri.n[k] < fileNormals.Size()? tri.n[k] : -1 };
+				auto r = remap.find(c);
+				if (r == remap.end()) {
+					vec3 p = points.Get(c.v), n = c.n >= 0? fileNormals.Get(c.n) : vec3(0, 0, 0);
+					vec2 uv = c.t >= 0? uvs.Get(c.t) : vec2(0, 0);
+					if (c.n < 0) {
+						n = smoothNormals.Get(c.v);
+						float len = length(n);
+						n = len > 0? n/len : n;
+					}
+					ChunkVertex cv = {};
+					for (int j = 0; j < 3; j++) {
+						cv.point[j] = p[j];
+						cv.normal[j] = n[j];
+					}
+					cv.uv[0] = uv.x;
+					cv.uv[1] = uv.y;
+					r = remap.insert({c, (uint32_t) verts.size()}).first;
+					verts.push_back(cv);
+				}
+				indices.push_back(r->second);
+			}
+			if ((int) indices.size() == 3*maxChunkTriangles)
+				WriteChunk();
+		}
+	}
+	if (!indices.empty())
+		WriteChunk();
+	fclose(buckets);
+	remove(bucketFilename.c_str());
+	ok = ok && chunk == nChunks && !points.Failed() && !uvs.Failed() && !fileNormals.Failed() &&
+		 !smoothNormals.Failed() && !triangles.Failed();
+	fseek(out, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(infos.data(), sizeof(ChunkInfo), nChunks, out);
+	ok = fclose(out) == 0 && ok;
+	if (!ok)
+		remove(cacheFilename);
+	return ok;
+}
+
+// Streaming
+
+bool MeshStream::Open(const char *cacheFilename) {
+	Close();
+	file = fopen(cacheFilename, "rb");
+	if (!file)
+		return false;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "MESHCHK1", 8) || !header.nChunks) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	int nChunks = header.nChunks;
+	chunks.resize(nChunks);
+	if (fread(chunks.data(), sizeof(ChunkInfo), nChunks, file) != (size_t) nChunks) {
+		Close();
+		return false;
+	}
+	// GPU-resident destination buffers, sized for the whole mesh
+	size_t nVertices = 0, nIndices = 0;
+	counts.resize(nChunks);
+	indexOffsets.resize(nChunks);
+	baseVertices.resize(nChunks);
+	for (int c = 0; c < nChunks; c++) {
+		counts[c] = 3*chunks[c].nTriangles;
+		indexOffsets[c] = (GLvoid *) (nIndices*sizeof(uint32_t));
+		baseVertices[c] = (GLint) nVertices;
+		nVertices += chunks[c].nVertices;
+		nIndices += counts[c];
+	}
+	glGenBuffers(1, &vBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, nVertices*sizeof(ChunkVertex), NULL, GL_STATIC_DRAW);
+	gpuRegistry.Track(GPURegistry::Buffer, vBuffer, nVertices*sizeof(ChunkVertex), "stream vertices");
+	glGenBuffers(1, &iBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, iBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, nIndices*sizeof(uint32_t), NULL, GL_STATIC_DRAW);
+	gpuRegistry.Track(GPURegistry::Buffer, iBuffer, nIndices*sizeof(uint32_t), "stream indices");
+	// persistent-mapped staging ring
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	size_t ringSize = (size_t) ringSlots*header.maxChunkBytes;
+	glGenBuffers(1, &ring);
+	glBindBuffer(GL_COPY_READ_BUFFER, ring);
+	glBufferStorage(GL_COPY_READ_BUFFER, ringSize, NULL, flags);
+	ringMemory = (unsigned char *) glMapBufferRange(GL_COPY_READ_BUFFER, 0, ringSize, flags);
+	gpuRegistry.Track(GPURegistry::Buffer, ring, ringSize, "stream staging ring");
+	slots.assign(ringSlots, Slot());
+	nArrived = nextToCopy = 0;
+	trianglesArrived = 0;
+	quit = false;
+	reader = std::thread(&MeshStream::Read, this);
+	return true;
+}
+
+void MeshStream::Read() {
+	// chunks are stored in order, so the file is read sequentially
+	for (int c = 0; c < (int) chunks.size(); c++) {
+		Slot &s = slots[c%ringSlots];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slotFreed.wait(lock, [&] { return quit || s.state == Free; });
+			if (quit)
+				return;
+			s.state = Filling;
+		}
+		size_t bytes = chunks[c].nVertices*sizeof(ChunkVertex)+3*chunks[c].nTriangles*sizeof(uint32_t);
+		bool ok = fread(ringMemory+(size_t) (c%ringSlots)*header.maxChunkBytes, 1, bytes, file) == bytes;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!ok) {
+			printf("chunk cache truncated at chunk %i\n", c);
+			s.state = Free;
+			return;
+		}
+		s.chunk = c;
+		s.state = Filled;
+	}
+}
+
+void MeshStream::Update() {
+	if (!ring)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	// recycle slots whose copies have completed
+	bool freed = false;
+	for (Slot &s : slots)
+		if (s.state == Copying && glClientWaitSync(s.fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+			glDeleteSync(s.fence);
+			s.fence = 0;
+			s.state = Free;
+			freed = true;
+		}
+	if (freed)
+		slotFreed.notify_all();
+	// copy filled slots to GPU buffers, in chunk order
+	glBindBuffer(GL_COPY_READ_BUFFER, ring);
+	while (nextToCopy < (int) chunks.size()) {
+		int c = nextToCopy;
+		Slot &s = slots[c%ringSlots];
+		if (s.state != Filled || s.chunk != c)
+			break;
+		size_t slotOffset = (size_t) (c%ringSlots)*header.maxChunkBytes;
+		size_t vBytes = chunks[c].nVertices*sizeof(ChunkVertex), iBytes = counts[c]*sizeof(uint32_t);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, vBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slotOffset, baseVertices[c]*sizeof(ChunkVertex), vBytes);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, iBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slotOffset+vBytes, (size_t) indexOffsets[c], iBytes);
+		s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		s.state = Copying;
+		trianglesArrived += chunks[c].nTriangles;
+		nArrived = ++nextToCopy;
+	}
+}
+
+void MeshStream::Draw(GLuint program) {
+	if (!nArrived)
+		return;
+	GLsizei stride = sizeof(ChunkVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	VertexAttribPointer(program, "point", 3, stride, (void *) offsetof(ChunkVertex, point));
+	VertexAttribPointer(program, "uv", 2, stride, (void *) offsetof(ChunkVertex, uv));
+	VertexAttribPointer(program, "normal", 3, stride, (void *) offsetof(ChunkVertex, normal));
+	glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, indexOffsets.data(), nArrived, baseVertices.data());
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+mat4 MeshStream::Fit(float scale) {
+	vec3 min(header.min[0], header.min[1], header.min[2]), max(header.max[0], header.max[1], header.max[2]);
+	vec3 dif = max-min, center = (min+max)/2;
+	float range = std::max(dif.x, std::max(dif.y, dif.z));
+	return Scale(range > 0? 2*scale/range : 1)*Translate(-center);
+}
+
+void MeshStream::Close() {
+	if (reader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		slotFreed.notify_all();
+		reader.join();
+	}
+	if (file)
+		fclose(file);
+	file = NULL;
+	for (Slot &s : slots)
+		if (s.fence)
+			glDeleteSync(s.fence);
+	slots.clear();
+	if (ring) {
+		glBindBuffer(GL_COPY_READ_BUFFER, ring);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	for (GLuint *b : { &ring, &vBuffer, &iBuffer })
+		DeleteBuffer(*b);
+	ringMemory = NULL;
+	chunks.clear();
+	nArrived = nextToCopy = 0;
+}
@@ -0,0 +1,87 @@
+// MeshStream.h: out-of-core mesh display from a spatially chunked cache file
+
+#ifndef MESH_STREAM_HDR
+#define MESH_STREAM_HDR
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Cache layout (little-endian):
+//   ChunkHeader, nChunks ChunkInfo, then per chunk: nVertices ChunkVertex, 3*nTriangles uint32
+//   (indices local to the chunk). Triangles are sorted by Morton code of their centroid
+//   so each chunk is spatially coherent.
+// Streaming: a reader thread freads each chunk straight into a slot of a persistent-mapped
+// staging ring; the main thread copies filled slots into GPU-resident vertex/index buffers,
+// fences the copy, and recycles the slot once the fence signals. CPU memory stays at the ring
+// size plus the chunk table regardless of mesh size. Draw() renders the chunks arrived so far.
+
+struct ChunkHeader {
+	char magic[8];                          // "MESHCHK1"
+	uint32_t nChunks, maxChunkBytes;
+	float min[3], max[3];                   // bounds of the whole mesh
+};
+
+struct ChunkInfo {
+	uint64_t offset;                        // file offset of chunk data
+	uint32_t nVertices, nTriangles;
+	float center[3], radius;                // bounding sphere
+};
+
+struct ChunkVertex {
+	float point[3], uv[2], normal[3];       // 32 bytes, interleaved
+};
+
+// 30-bit Morton code of p, 10 bits per axis; scale maps bounds to 0-1023
+uint32_t Morton(vec3 p, vec3 min, vec3 scale);
+
+// one-time conversion of a mesh already in memory
+bool WriteChunkCache(const char *filename, vector<vec3> &points, vector<vec3> &normals,
+					 vector<vec2> &uvs, vector<int3> &triangles, int maxChunkTriangles = 32768);
+
+// one-time conversion in bounded memory: the OBJ is streamed into temporary files beside the
+// cache and read back through fixed-size page caches, triangles are bucketed by Morton prefix
+// and each bucket sorted in memory; memory is a few tens of MB plus the largest bucket
+bool ConvertObjToChunkCache(const char *objFilename, const char *cacheFilename, int maxChunkTriangles = 32768);
+
+class MeshStream {
+public:
+	int ringSlots = 8;                      // staging ring holds ringSlots*maxChunkBytes
+	bool Open(const char *cacheFilename);   // read header and chunk table, start reader
+	void Update();                          // main thread, each frame: move arrived chunks to GPU
+	void Draw(GLuint program);              // attributes "point", "uv", "normal"
+	void Close();
+	mat4 Fit(float scale = 1);              // map bounds to +/- scale, centered at origin
+	int NChunks() const { return (int) chunks.size(); }
+	int NArrived() const { return nArrived; }
+	size_t TrianglesArrived() const { return trianglesArrived; }
+	const vector<ChunkInfo> &Chunks() const { return chunks; }
+private:
+	enum SlotState { Free, Filling, Filled, Copying };
+	struct Slot { SlotState state = Free; int chunk = -1; GLsync fence = 0; };
+	ChunkHeader header;
+	vector<ChunkInfo> chunks;
+	vector<GLsizei> counts;                 // per chunk draw parameters
+	vector<GLvoid *> indexOffsets;
+	vector<GLint> baseVertices;
+	vector<Slot> slots;
+	FILE *file = NULL;
+	GLuint ring = 0, vBuffer = 0, iBuffer = 0;
+	unsigned char *ringMemory = NULL;
+	std::thread reader;
+	std::mutex mutex;
+	std::condition_variable slotFreed;
+	bool quit = false;
+	int nArrived = 0, nextToCopy = 0;
+	size_t trianglesArrived = 0;
+	void Read();
+};
+
+#endif
@@ -0,0 +1,244 @@
+// MeshWriter.cpp: fast OBJ, binary PLY and chunk cache export
+
+#include <charconv>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "JobPool.h"
+#include "MeshStream.h"
+#include "MeshWriter.h"
+
+#if defined(_WIN32)
+	#include <io.h>
+#else
+	#include <fcntl.h>
+	#include <limits.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+typedef vector<char> Block;
+
+static const int linesPerBlock = 1 << 16;
+
+MeshData::MeshData(const vector<vec3> &p, const vector<vec3> &n, const vector<vec2> &u, const vector<int3> &t) {
+	nPoints = (int) p.size();
+	nTriangles = (int) t.size();
+	points = p.data();
+	normals = (int) n.size() == nPoints? n.data() : NULL;
+	uvs = (int) u.size() == nPoints? u.data() : NULL;
+	triangles = t.data();
+}
+
+// Output
+
+static size_t WriteBlocks(const char *filename, const vector<Block> &blocks) {
+	size_t total = 0;
+#if defined(_WIN32)
+	FILE *out = fopen(filename, "wb");
+	if (!out)
+		return 0;
+	for (const Block &b : blocks)
+		total += fwrite(b.data(), 1, b.size(), out);
+	return fclose(out) == 0? total : 0;
+#else
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return 0;
+	vector<iovec> iov;
+	for (const Block &b : blocks)
+		if (b.size())
+			iov.push_back({ (void *) b.data(), b.size() });
+	// writev takes at most IOV_MAX entries and may write partially
+	for (size_t i = 0; i < iov.size(); ) {
+		int n = (int) (iov.size()-i < IOV_MAX? iov.size()-i : IOV_MAX);
+		ssize_t w = writev(fd, &iov[i], n);
+		if (w < 0) {
+			close(fd);
+			return 0;
+		}
+		total += w;
+		for (; i < iov.size() && (size_t) w >= iov[i].iov_len; i++)
+			w -= iov[i].iov_len;
+		if (i < iov.size() && w > 0) {
+			iov[i].iov_base = (char *) iov[i].iov_base+w;
+			iov[i].iov_len -= w;
+		}
+	}
+	return close(fd) == 0? total : 0;
+#endif
+}
+
+// format nItems into blocks of linesPerBlock, in parallel; format(item, dst) returns end
+template<typename F>
+static void FormatBlocks(vector<Block> &blocks, int nItems, size_t maxItemBytes, F format) {
+	int nBlocks = (nItems+linesPerBlock-1)/linesPerBlock, first = (int) blocks.size();
+	blocks.resize(first+nBlocks);
+	ParallelRanges(nBlocks, [&](int b, int e) {
+		for (int k = b; k < e; k++) {
+			int i0 = k*linesPerBlock, i1 = i0+linesPerBlock < nItems? i0+linesPerBlock : nItems;
+			Block &block = blocks[first+k];
+			block.resize((i1-i0)*maxItemBytes);
+			char *p = block.data();
+			for (int i = i0; i < i1; i++)
+				p = format(i, p);
+			block.resize(p-block.data());
+		}
+	}, 1);
+}
+
+static void Append(vector<Block> &blocks, const std::string &s) {
+	blocks.push_back(Block(s.begin(), s.end()));
+}
+
+// OBJ
+
+static const int maxFloatChars = 16, maxIntChars = 11;
+
+static char *Put(char *p, float f) {
+	*p++ = ' ';
+	return std::to_chars(p, p+maxFloatChars, f).ptr;
+}
+
+static char *Put(char *p, int i) {
+	return std::to_chars(p, p+maxIntChars, i).ptr;
+}
+
+static char *Put(char *p, const char *s) {
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+size_t WriteObj(const char *filename, const MeshData &m) {
+	vector<Block> blocks;
+	char header[100];
+	snprintf(header, sizeof(header), "# %i vertices, %i triangles\n", m.nPoints, m.nTriangles);
+	Append(blocks, header);
+	FormatBlocks(blocks, m.nPoints, 2+3*(maxFloatChars+1)+1, [&](int i, char *p) {
+		p = Put(Put(Put(Put(p, "v"), m.points[i].x), m.points[i].y), m.points[i].z);
+		*p++ = '\n';
+		return p;
+	});
+	if (m.uvs)
+		FormatBlocks(blocks, m.nPoints, 3+2*(maxFloatChars+1)+1, [&](int i, char *p) {
+			p = Put(Put(Put(p, "vt"), m.uvs[i].x), m.uvs[i].y);
+			*p++ = '\n';
+			return p;
+		});
+	if (m.normals)
+		FormatBlocks(blocks, m.nPoints, 3+3*(maxFloatChars+1)+1, [&](int i, char *p) {
+			p = Put(Put(Put(Put(p, "vn"), m.normals[i].x), m.normals[i].y), m.normals[i].z);
+			*p++ = '\n';
+			return p;
+		});
+	// f v, f v/t, f v//n or f v/t/n, 1-based
+	FormatBlocks(blocks, m.nTriangles, 2+3*(3*(maxIntChars+1)+1)+1, [&](int i, char *p) {
+		*p++ = 'f';
+		const int *t = &m.triangles[i].i1;
+		for (int k = 0; k < 3; k++) {
+			int v = t[k]+1;
+			*p++ = ' ';
+			p = Put(p, v);
+			if (m.uvs || m.normals) {
+				*p++ = '/';
+				if (m.uvs)
+					p = Put(p, v);
+				if (m.normals) {
+					*p++ = '/';
+					p = Put(p, v);
+				}
+			}
+		}
+		*p++ = '\n';
+		return p;
+	});
+	return WriteBlocks(filename, blocks);
+}
+
+// PLY
+
+size_t WritePly(const char *filename, const MeshData &m) {
+	vector<Block> blocks;
+	std::string header = "ply\nformat binary_little_endian 1.0\n";
+	header += "element vertex "+std::to_string(m.nPoints)+"\n";
+	header += "property float x\nproperty float y\nproperty float z\n";
+	if (m.normals)
+		header += "property float nx\nproperty float ny\nproperty float nz\n";
+	if (m.uvs)
+		header += "property float s\nproperty float t\n";
+	header += "element face "+std::to_string(m.nTriangles)+"\n";
+	header += "property list uchar int vertex_indices\nend_header\n";
+	Append(blocks, header);
+	size_t vertexBytes = sizeof(vec3)+(m.normals? sizeof(vec3) : 0)+(m.uvs? sizeof(vec2) : 0);
+	FormatBlocks(blocks, m.nPoints, vertexBytes, [&](int i, char *p) {
+		memcpy(p, &m.points[i], sizeof(vec3));
+		p += sizeof(vec3);
+		if (m.normals) {
+			memcpy(p, &m.normals[i], sizeof(vec3));
+			p += sizeof(vec3);
+		}
+		if (m.uvs) {
+			memcpy(p, &m.uvs[i], sizeof(vec2));
+			p += sizeof(vec2);
+		}
+		return p;
+	});
+	FormatBlocks(blocks, m.nTriangles, 1+sizeof(int3), [&](int i, char *p) {
+		*p++ = 3;
+		memcpy(p, &m.triangles[i], sizeof(int3));
+		return p+sizeof(int3);
+	});
+	return WriteBlocks(filename, blocks);
+}
+
+// Dispatch
+
+static bool HasExtension(const char *filename, const char *ext) {
+	size_t n = strlen(filename), e = strlen(ext);
+	if (n < e)
+		return false;
+	for (size_t i = 0; i < e; i++)
+		if (tolower(filename[n-e+i]) != ext[i])
+			return false;
+	return true;
+}
+
+size_t WriteMesh(const char *filename, const MeshData &m) {
+	if (HasExtension(filename, ".obj"))
+		return WriteObj(filename, m);
+	if (HasExtension(filename, ".ply"))
+		return WritePly(filename, m);
+	if (HasExtension(filename, ".chunks")) {
+		// WriteChunkCache takes vectors
+		vector<vec3> points(m.points, m.points+m.nPoints), normals;
+		vector<vec2> uvs;
+		vector<int3> triangles(m.triangles, m.triangles+m.nTriangles);
+		if (m.normals) normals.assign(m.normals, m.normals+m.nPoints);
+		if (m.uvs) uvs.assign(m.uvs, m.uvs+m.nPoints);
+		if (!WriteChunkCache(filename, points, normals, uvs, triangles))
+			return 0;
+		FILE *f = fopen(filename, "rb");
+		if (!f)
+			return 0;
+		fseek(f, 0, SEEK_END);
+		size_t size = (size_t) ftell(f);
+		fclose(f);
+		return size;
+	}
+	printf("can't write %s: unknown extension\n", filename);
+	return 0;
+}
+
+size_t WriteMeshes(vector<MeshFile> &files) {
+	vector<std::thread> threads;
+	for (MeshFile &f : files)
+		threads.push_back(std::thread([&f]() { f.bytes = WriteMesh(f.filename.c_str(), f.mesh); }));
+	size_t total = 0;
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+		total += files[i].bytes;
+	}
+	return total;
+}
@@ -0,0 +1,40 @@
+// MeshWriter.h: fast OBJ, binary PLY and chunk cache export
+
+#ifndef MESH_WRITER_HDR
+#define MESH_WRITER_HDR
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// Text is formatted with std::to_chars: shortest digits that read back to the same float,
+// independent of locale. Vertex and triangle ranges are formatted on all cores into separate
+// blocks, which are written with one writev (POSIX) or sequential fwrites, without ever
+// joining them into one buffer. Binary PLY is little-endian, float vertices, int indices.
+
+struct MeshData {
+	const vec3 *points = NULL, *normals = NULL; // normals, uvs may be null
+	const vec2 *uvs = NULL;
+	const int3 *triangles = NULL;
+	int nPoints = 0, nTriangles = 0;
+	MeshData() { }
+	MeshData(const vector<vec3> &points, const vector<vec3> &normals, const vector<vec2> &uvs, const vector<int3> &triangles);
+};
+
+// each returns bytes written, 0 on failure
+size_t WriteObj(const char *filename, const MeshData &mesh);
+size_t WritePly(const char *filename, const MeshData &mesh);
+size_t WriteMesh(const char *filename, const MeshData &mesh);  // by extension: .obj, .ply, .chunks
+
+// write several files at once, one thread each; returns total bytes
+struct MeshFile {
+	std::string filename;
+	MeshData mesh;
+	size_t bytes = 0;
+};
+size_t WriteMeshes(vector<MeshFile> &files);
+
+#endif
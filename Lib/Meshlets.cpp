@@ -0,0 +1,335 @@
+// Meshlets.cpp: small triangle clusters with bounding spheres and normal cones, culled on the GPU
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include "Culling.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "MeshStream.h"
+#include "Meshlets.h"
+#include "PointKernels.h"
+
+static_assert(sizeof(Meshlet) == 48, "Meshlet must match std430 Meshlet");
+
+// one thread per meshlet: frustum and cone tests, survivors appended to the command list
+static const char *cullShader = R"(
+	#version 430
+	layout(local_size_x = 64) in;
+	struct Meshlet { vec4 sphere, cone; uint firstTriangle, nTriangles, pad0, pad1; };
+	struct Command { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };
+	layout(std430, binding = 0) readonly buffer Meshlets { Meshlet meshlets[]; };
+	layout(std430, binding = 1) writeonly buffer Commands { Command commands[]; };
+	layout(std430, binding = 2) buffer Counts { uint nCommands, drawn, frustumCulled, backfacing; };
+	uniform mat4 modelview;
+	uniform vec4 planes[6];                     // object space
+	uniform float scale;                        // largest axis scale of modelview
+	uniform int nMeshlets;
+	uniform bool backfaceCull;
+	void main() {
+		uint i = gl_GlobalInvocationID.x;
+		if (i >= uint(nMeshlets))
+			return;
+		Meshlet m = meshlets[i];
+		bool inside = true;
+		for (int k = 0; k < 6; k++)
+			inside = inside && dot(planes[k].xyz, m.sphere.xyz)+planes[k].w+m.sphere.w >= 0;
+		if (!inside) {
+			atomicAdd(frustumCulled, m.nTriangles);
+			return;
+		}
+		// eye at origin: center-eye is the view-space center
+		vec3 c = (modelview*vec4(m.sphere.xyz, 1)).xyz;
+		vec3 axis = normalize((modelview*vec4(m.cone.xyz, 0)).xyz);
+		if (backfaceCull && dot(c, axis) >= m.cone.w*length(c)+m.sphere.w*scale) {
+			atomicAdd(backfacing, m.nTriangles);
+			return;
+		}
+		atomicAdd(drawn, m.nTriangles);
+		commands[atomicAdd(nCommands, 1u)] = Command(3*m.nTriangles, 1u, 3*m.firstTriangle, 0, 0u);
+	}
+)";
+
+// Clustering
+
+static vec3 FaceNormal(const vector<vec3> &points, const int3 &t) {
+	vec3 n = cross(points[t.i2]-points[t.i1], points[t.i3]-points[t.i1]);
+	float l = length(n);
+	return l > 0? n/l : vec3(0, 0, 0);
+}
+
+static Meshlet MakeMeshlet(const vector<vec3> &points, const vector<int3> &triangles, int first, int count) {
+	Meshlet m;
+	m.firstTriangle = first;
+	m.nTriangles = count;
+	m.pad[0] = m.pad[1] = 0;
+	// sphere: center of bounding box, radius to farthest vertex
+	vec3 mn = points[triangles[first].i1], mx = mn, axis(0, 0, 0);
+	for (int i = first; i < first+count; i++) {
+		const int *v = &triangles[i].i1;
+		for (int k = 0; k < 3; k++) {
+			const vec3 &p = points[v[k]];
+			for (int j = 0; j < 3; j++) {
+				mn[j] = p[j] < mn[j]? p[j] : mn[j];
+				mx[j] = p[j] > mx[j]? p[j] : mx[j];
+			}
+		}
+		axis += FaceNormal(points, triangles[i]);
+	}
+	vec3 c = (mn+mx)/2;
+	float r2 = 0;
+	for (int i = first; i < first+count; i++) {
+		const int *v = &triangles[i].i1;
+		for (int k = 0; k < 3; k++) {
+			vec3 d = points[v[k]]-c;
+			r2 = std::max(r2, dot(d, d));
+		}
+	}
+	m.sphere = vec4(c.x, c.y, c.z, sqrtf(r2));
+	// cone: mean normal, widest deviation; beyond ~84 degrees the cone never rejects
+	float l = length(axis), minDot = 1;
+	axis = l > 0? axis/l : vec3(0, 0, 1);
+	for (int i = first; i < first+count; i++) {
+		vec3 n = FaceNormal(points, triangles[i]);
+		if (dot(n, n) > 0)
+			minDot = std::min(minDot, dot(n, axis));
+	}
+	float cutoff = l > 0 && minDot > .1f? sqrtf(1-minDot*minDot) : 1;
+	m.cone = vec4(axis.x, axis.y, axis.z, cutoff);
+	return m;
+}
+
+int Meshlets::Build(const vector<vec3> &points, vector<int3> &triangles, int maxTriangles, int minTriangles) {
+	meshlets.clear();
+	int nPoints = (int) points.size(), n = (int) triangles.size();
+	if (!nPoints || !n)
+		return 0;
+	vec3 min, max;
+	PointBounds(points.data(), nPoints, min, max);
+	vec3 dif = max-min, scale;
+	for (int k = 0; k < 3; k++)
+		scale[k] = dif[k] > 0? 1023.f/dif[k] : 0;
+	// sort triangles by Morton code of centroid
+	vector<uint64_t> keys(n);
+	for (int i = 0; i < n; i++) {
+		int3 &t = triangles[i];
+		vec3 c = (points[t.i1]+points[t.i2]+points[t.i3])/3;
+		keys[i] = ((uint64_t) Morton(c, min, scale) << 32) | (uint32_t) i;
+	}
+	std::sort(keys.begin(), keys.end());
+	vector<int3> sorted(n);
+	for (int i = 0; i < n; i++)
+		sorted[i] = triangles[(uint32_t) keys[i]];
+	triangles.swap(sorted);
+	// cut at maxTriangles, or past minTriangles where a normal leaves a 45 degree cone
+	const float cosLimit = .7071f;
+	vec3 sum(0, 0, 0);
+	int first = 0;
+	for (int i = 0; i < n; i++) {
+		vec3 nrm = FaceNormal(points, triangles[i]);
+		int count = i-first;
+		float l = length(sum);
+		if (count == maxTriangles || (count >= minTriangles && l > 0 && dot(nrm, sum/l) < cosLimit)) {
+			meshlets.push_back(MakeMeshlet(points, triangles, first, count));
+			first = i;
+			sum = vec3(0, 0, 0);
+		}
+		sum += nrm;
+	}
+	meshlets.push_back(MakeMeshlet(points, triangles, first, n-first));
+	return (int) meshlets.size();
+}
+
+// Cache
+
+struct MeshletHeader {
+	char magic[8];                              // "MESHLET1"
+	uint32_t nPoints, nTriangles, nMeshlets, hash;
+};
+
+static uint32_t Hash(const vector<vec3> &points) {
+	// FNV-1a over the point data
+	uint32_t h = 2166136261u;
+	const unsigned char *b = (const unsigned char *) points.data();
+	for (size_t i = 0; i < points.size()*sizeof(vec3); i++)
+		h = (h^b[i])*16777619u;
+	return h;
+}
+
+bool Meshlets::Write(const char *filename, const vector<vec3> &points, const vector<int3> &triangles) const {
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	MeshletHeader h;
+	memcpy(h.magic, "MESHLET1", 8);
+	h.nPoints = (uint32_t) points.size();
+	h.nTriangles = (uint32_t) triangles.size();
+	h.nMeshlets = (uint32_t) meshlets.size();
+	h.hash = Hash(points);
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1 &&
+			  fwrite(meshlets.data(), sizeof(Meshlet), meshlets.size(), file) == meshlets.size() &&
+			  fwrite(triangles.data(), sizeof(int3), triangles.size(), file) == triangles.size();
+	fclose(file);
+	if (!ok)
+		remove(filename);
+	return ok;
+}
+
+bool Meshlets::Read(const char *filename, const vector<vec3> &points, vector<int3> &triangles) {
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return false;
+	MeshletHeader h;
+	bool ok = fread(&h, sizeof(h), 1, file) == 1 && !memcmp(h.magic, "MESHLET1", 8) &&
+			  h.nPoints == points.size() && h.nTriangles == triangles.size() && h.hash == Hash(points);
+	vector<Meshlet> m(ok? h.nMeshlets : 0);
+	vector<int3> t(ok? h.nTriangles : 0);
+	ok = ok && fread(m.data(), sizeof(Meshlet), m.size(), file) == m.size() &&
+		 fread(t.data(), sizeof(int3), t.size(), file) == t.size();
+	fclose(file);
+	for (size_t i = 0; ok && i < t.size(); i++)
+		for (int k = 0, *v = &t[i].i1; k < 3; k++)
+			ok = ok && v[k] >= 0 && v[k] < (int) h.nPoints;
+	if (!ok)
+		return false;
+	meshlets.swap(m);
+	triangles.swap(t);
+	return true;
+}
+
+// Culling
+
+void Meshlets::Upload(const vector<int3> &triangles) {
+	if (!program) {
+		// compute (4.3) and a GPU-sourced draw count (4.6 or ARB_indirect_parameters)
+		if (!GLAD_GL_VERSION_4_3 || !(GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_indirect_parameters))
+			printf("meshlets: no GL 4.6 or ARB_indirect_parameters, drawing unculled\n");
+		else if (!(program = LinkProgramViaCode(&cullShader)))
+			printf("meshlets: can't link cull shader, drawing unculled\n");
+		else
+			gpuRegistry.Track(GPURegistry::Program, program, 0, "meshlet cull");
+	}
+	for (GLuint *b : { &meshletBuffer, &indexBuffer, &commandBuffer, &countBuffer, &readback[0], &readback[1] })
+		if (!*b)
+			glGenBuffers(1, b);
+	nTriangles = (int) triangles.size();
+	size_t n = meshlets.size();
+	// via the copy target: leave element and indirect bindings alone
+	struct { GLuint buffer; size_t bytes; const void *data; GLenum usage; const char *label; } uploads[] = {
+		{ meshletBuffer, n*sizeof(Meshlet), meshlets.data(), GL_STATIC_DRAW, "meshlets" },
+		{ indexBuffer, triangles.size()*sizeof(int3), triangles.data(), GL_STATIC_DRAW, "meshlet indices" },
+		{ commandBuffer, n*5*sizeof(GLuint), NULL, GL_DYNAMIC_COPY, "meshlet commands" },
+		{ countBuffer, 4*sizeof(GLuint), NULL, GL_DYNAMIC_COPY, "meshlet counts" },
+		{ readback[0], 4*sizeof(GLuint), NULL, GL_STREAM_READ, "meshlet readback" },
+		{ readback[1], 4*sizeof(GLuint), NULL, GL_STREAM_READ, "meshlet readback" } };
+	for (auto &u : uploads) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, u.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, u.bytes, u.data, u.usage);
+		gpuRegistry.Track(GPURegistry::Buffer, u.buffer, u.bytes, u.label);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void Meshlets::Receive(int s) {
+	GLenum status = glClientWaitSync(fences[s], 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return;
+	glDeleteSync(fences[s]);
+	fences[s] = 0;
+	GLuint counts[4];
+	glBindBuffer(GL_COPY_READ_BUFFER, readback[s]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counts), counts);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	stats.frames++;
+	stats.triangles += nTriangles;
+	stats.drawn += counts[1];
+	stats.frustumCulled += counts[2];
+	stats.backfacing += counts[3];
+}
+
+void Meshlets::CullAndDraw(mat4 modelview, mat4 persp, bool backfaceCull) {
+	if (!indexBuffer || meshlets.empty())
+		return;
+	if (!program) {
+		// fallback: the triangles are still in meshlet order, draw them all
+		GLint elementsWas;
+		glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elementsWas);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		glDrawElements(GL_TRIANGLES, 3*nTriangles, GL_UNSIGNED_INT, (void *) 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsWas);
+		return;
+	}
+	for (int s = 0; s < 2; s++)
+		if (fences[s])
+			Receive(s);
+	GLint programWas, elementsWas, indirectWas, parameterWas;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programWas);
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elementsWas);
+	glGetIntegerv(GL_DRAW_INDIRECT_BUFFER_BINDING, &indirectWas);
+	glGetIntegerv(GL_PARAMETER_BUFFER_BINDING, &parameterWas);
+	// cull
+	Frustum frustum;
+	frustum.Set(persp*modelview);
+	float scale2 = 0;
+	for (int j = 0; j < 3; j++)
+		scale2 = std::max(scale2, modelview[0][j]*modelview[0][j]+modelview[1][j]*modelview[1][j]+modelview[2][j]*modelview[2][j]);
+	GLuint zero[4] = {0, 0, 0, 0};
+	glBindBuffer(GL_COPY_WRITE_BUFFER, countBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(zero), zero);
+	glUseProgram(program);
+	glUniform4fv(glGetUniformLocation(program, "planes"), 6, (float *) frustum.planes);
+	SetUniform(program, "modelview", modelview);
+	SetUniform(program, "scale", sqrtf(scale2));
+	SetUniform(program, "nMeshlets", (int) meshlets.size());
+	SetUniform(program, "backfaceCull", backfaceCull);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshletBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, countBuffer);
+	glDispatchCompute((GLuint) (meshlets.size()+63)/64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glUseProgram(programWas);
+	// draw survivors, count from the GPU
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+	if (GLAD_GL_VERSION_4_6)
+		glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) 0, 0, (GLsizei) meshlets.size(), 0);
+	else
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) 0, 0, (GLsizei) meshlets.size(), 0);
+	// counts for statistics, read once fenced (skipped while both readbacks are in flight)
+	if (!fences[slot]) {
+		glBindBuffer(GL_COPY_READ_BUFFER, countBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, readback[slot]);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(zero));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot = 1-slot;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementsWas);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectWas);
+	glBindBuffer(GL_PARAMETER_BUFFER, parameterWas);
+}
+
+void Meshlets::Report() const {
+	const Stats &s = stats;
+	if (!s.frames || s.triangles <= 0) {
+		printf("meshlets: no frames measured\n");
+		return;
+	}
+	printf("%i meshlets, %.0f triangles, %i frames: %.1f%% culled (%.1f%% outside frustum, %.1f%% back-facing)\n",
+		   (int) meshlets.size(), s.triangles/s.frames, s.frames, 100*(s.frustumCulled+s.backfacing)/s.triangles,
+		   100*s.frustumCulled/s.triangles, 100*s.backfacing/s.triangles);
+}
+
+void Meshlets::Release() {
+	for (GLsync &f : fences)
+		if (f) {
+			glDeleteSync(f);
+			f = 0;
+		}
+	for (GLuint *b : { &meshletBuffer, &indexBuffer, &commandBuffer, &countBuffer, &readback[0], &readback[1] })
+		DeleteBuffer(*b);
+	DeleteProgram(program);
+	slot = 0;
+}
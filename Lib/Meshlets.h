@@ -0,0 +1,65 @@
+// Meshlets.h: small triangle clusters with bounding spheres and normal cones, culled on the GPU
+
+#ifndef MESHLETS_HDR
+#define MESHLETS_HDR
+
+#include <stdint.h>
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// Build() sorts triangles by the Morton code of their centroid and cuts the sequence into
+// meshlets of at most maxTriangles; once a meshlet has minTriangles, it is also cut where a
+// triangle turns too far from the meshlet's mean normal, keeping cones narrow. Triangles are
+// reordered in place so each meshlet is a contiguous index range. A meshlet's cone (axis,
+// cutoff = sine of the widest normal's angle from the axis) lets a whole meshlet be rejected as
+// back-facing: dot(center-eye, axis) >= cutoff*|center-eye|+radius (as in meshoptimizer).
+// Each frame a compute shader tests every meshlet against the frustum and its cone and appends
+// the survivors to a compacted indirect command list, drawn with one
+// glMultiDrawElementsIndirectCount (GL 4.6, or ARB_indirect_parameters). Culling counts are
+// copied to one of two readback buffers and read a frame later, once fenced, so statistics
+// never stall. Without either, or if the cull shader fails to link, CullAndDraw draws every
+// triangle with one glDrawElements.
+//
+// The meshlet table and the triangle order are cached (Write, Read) beside the mesh, keyed by
+// vertex and triangle counts and a hash of the points.
+
+struct Meshlet {
+	vec4 sphere;                                // center, radius
+	vec4 cone;                                  // axis, cutoff (1: never back-facing)
+	GLuint firstTriangle, nTriangles, pad[2];   // matches std430 in the cull shader
+};
+
+class Meshlets {
+public:
+	vector<Meshlet> meshlets;
+	// reorders triangles; returns number of meshlets
+	int Build(const vector<vec3> &points, vector<int3> &triangles, int maxTriangles = 128, int minTriangles = 64);
+	bool Write(const char *filename, const vector<vec3> &points, const vector<int3> &triangles) const;
+	bool Read(const char *filename, const vector<vec3> &points, vector<int3> &triangles);  // false if stale
+	int NMeshlets() const { return (int) meshlets.size(); }
+	// GL context current
+	void Upload(const vector<int3> &triangles); // index buffer, meshlet table
+	bool Uploaded() const { return indexBuffer != 0; }
+	bool Culling() const { return program != 0; }  // false: fallback, all triangles drawn
+	// cull, then draw with the caller's program and vertex attributes
+	void CullAndDraw(mat4 modelview, mat4 persp, bool backfaceCull = true);
+	void Release();
+	struct Stats {
+		int frames = 0;
+		double triangles = 0, frustumCulled = 0, backfacing = 0, drawn = 0;   // sums over frames
+	};
+	Stats stats;
+	void ResetStats() { stats = Stats(); }
+	void Report() const;                        // mean fraction culled per view
+private:
+	GLuint program = 0, meshletBuffer = 0, indexBuffer = 0, commandBuffer = 0, countBuffer = 0;
+	GLuint readback[2] = {0, 0};
+	GLsync fences[2] = {0, 0};
+	int slot = 0, nTriangles = 0;
+	void Receive(int slot);
+};
+
+#endif
@@ -0,0 +1,295 @@
+// MorphTargets.cpp: sparse blend shapes for OBJ meshes, accumulated by a compute shader
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "IO.h"
+#include "MorphTargets.h"
+
+static_assert(sizeof(GLuint)+6*sizeof(float) == 28, "Delta must match std430 Delta");
+
+// one thread per delta of one target
+static const char *morphShader = R"(
+	#version 430
+	layout(local_size_x = 256) in;
+	struct Delta { uint vertex; float px, py, pz, nx, ny, nz; };
+	layout(std430, binding = 0) readonly buffer Deltas { Delta deltas[]; };
+	layout(std430, binding = 1) buffer Vertices { float v[]; };   // points, then normals
+	uniform uint first, count, nVertices;
+	uniform float weight;
+	void main() {
+		uint i = gl_GlobalInvocationID.x;
+		if (i >= count)
+			return;
+		Delta d = deltas[first+i];
+		uint p = 3*d.vertex, n = 3*(nVertices+d.vertex);
+		v[p] += weight*d.px; v[p+1] += weight*d.py; v[p+2] += weight*d.pz;
+		v[n] += weight*d.nx; v[n+1] += weight*d.ny; v[n+2] += weight*d.nz;
+	}
+)";
+
+// Base, Targets
+
+static void VertexNormals(const vector<vec3> &points, const vector<int3> &triangles, vector<vec3> &normals) {
+	// area-weighted face normals summed at each vertex; vertex count unchanged
+	normals.assign(points.size(), vec3(0, 0, 0));
+	for (const int3 &t : triangles) {
+		const int *v = &t.i1;
+		vec3 n = cross(points[v[1]]-points[v[0]], points[v[2]]-points[v[0]]);
+		for (int k = 0; k < 3; k++)
+			normals[v[k]] += n;
+	}
+	for (vec3 &n : normals) {
+		float l = length(n);
+		n = l > 0? n/l : vec3(0, 0, 1);
+	}
+}
+
+bool MorphMesh::SetBase(const vector<vec3> &points, const vector<vec3> &normals) {
+	if (normals.size() != points.size())
+		return false;
+	basePoints = points;
+	baseNormals = normals;
+	deltas.clear();
+	targets.clear();
+	geometryDirty = weightsDirty = true;
+	return true;
+}
+
+bool MorphMesh::ReadBase(const char *filename) {
+	vector<vec3> points, normals;
+	if (!ReadAsciiObj(filename, points, triangles, &normals)) {
+		printf("can't read %s\n", filename);
+		return false;
+	}
+	if (normals.size() != points.size())
+		VertexNormals(points, triangles, normals);
+	return SetBase(points, normals);
+}
+
+int MorphMesh::AddTarget(const vector<vec3> &points, const vector<vec3> &normals, float epsilon) {
+	if (points.size() != basePoints.size() || (!normals.empty() && normals.size() != points.size()))
+		return -1;
+	// keep only the vertices that move (or turn) by more than epsilon
+	vector<int> vertices;
+	vector<vec3> dPoints, dNormals;
+	for (size_t i = 0; i < points.size(); i++) {
+		vec3 dp = points[i]-basePoints[i], dn = normals.empty()? vec3(0, 0, 0) : normals[i]-baseNormals[i];
+		if (dot(dp, dp) > epsilon*epsilon || dot(dn, dn) > epsilon*epsilon) {
+			vertices.push_back((int) i);
+			dPoints.push_back(dp);
+			dNormals.push_back(dn);
+		}
+	}
+	return AddSparseTarget(vertices, dPoints, dNormals);
+}
+
+int MorphMesh::AddTarget(const char *filename, float epsilon) {
+	vector<vec3> points, normals;
+	vector<int3> tris;
+	if (!ReadAsciiObj(filename, points, tris, &normals)) {
+		printf("can't read %s\n", filename);
+		return -1;
+	}
+	if (normals.size() != points.size() && points.size() == basePoints.size())
+		VertexNormals(points, triangles.empty()? tris : triangles, normals);
+	int t = AddTarget(points, normals, epsilon);
+	if (t < 0)
+		printf("%s: %i vertices, base has %i\n", filename, (int) points.size(), NVertices());
+	return t;
+}
+
+int MorphMesh::AddSparseTarget(const vector<int> &vertices, const vector<vec3> &dPoints, const vector<vec3> &dNormals) {
+	if (dPoints.size() != vertices.size() || (!dNormals.empty() && dNormals.size() != vertices.size()))
+		return -1;
+	Target t;
+	t.first = (int) deltas.size();
+	t.count = (int) vertices.size();
+	for (size_t i = 0; i < vertices.size(); i++) {
+		vec3 p = dPoints[i], n = dNormals.empty()? vec3(0, 0, 0) : dNormals[i];
+		deltas.push_back({(GLuint) vertices[i], {p.x, p.y, p.z}, {n.x, n.y, n.z}});
+	}
+	targets.push_back(t);
+	geometryDirty = weightsDirty = true;
+	return (int) targets.size()-1;
+}
+
+void MorphMesh::SetWeight(int target, float weight) {
+	if (target < 0 || target >= (int) targets.size() || targets[target].weight == weight)
+		return;
+	targets[target].weight = weight;
+	weightsDirty = true;
+}
+
+// Evaluation
+
+void MorphMesh::Upload() {
+	if (!program) {
+		program = LinkProgramViaCode(&morphShader);
+		gpuRegistry.Track(GPURegistry::Program, program, 0, "morph");
+	}
+	size_t n = basePoints.size(), sPoints = n*sizeof(vec3);
+	for (GLuint *b : { &baseBuffer, &deltaBuffer, &outBuffer })
+		if (!*b)
+			glGenBuffers(1, b);
+	// copied rather than bound: leave array and element bindings alone
+	glBindBuffer(GL_COPY_WRITE_BUFFER, baseBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, 2*sPoints, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sPoints, basePoints.data());
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sPoints, sPoints, baseNormals.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, deltaBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, deltas.size()*sizeof(Delta), deltas.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, outBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, 2*sPoints, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	gpuRegistry.Track(GPURegistry::Buffer, baseBuffer, 2*sPoints, "morph base");
+	gpuRegistry.Track(GPURegistry::Buffer, deltaBuffer, deltas.size()*sizeof(Delta), "morph deltas");
+	gpuRegistry.Track(GPURegistry::Buffer, outBuffer, 2*sPoints, "morph output");
+	geometryDirty = false;
+}
+
+void MorphMesh::Update() {
+	if (basePoints.empty() || (!weightsDirty && !geometryDirty))
+		return;
+	if (geometryDirty)
+		Upload();
+	GLint programWas;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programWas);
+	// base, then each weighted target in turn
+	GLsizeiptr size = 2*basePoints.size()*sizeof(vec3);
+	glBindBuffer(GL_COPY_READ_BUFFER, baseBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, outBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glUseProgram(program);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, deltaBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, outBuffer);
+	glUniform1ui(glGetUniformLocation(program, "nVertices"), (GLuint) basePoints.size());
+	GLint firstId = glGetUniformLocation(program, "first"), countId = glGetUniformLocation(program, "count");
+	GLint weightId = glGetUniformLocation(program, "weight");
+	nActive = 0;
+	for (const Target &t : targets) {
+		if (t.weight == 0 || !t.count)
+			continue;
+		if (nActive++)
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);   // previous target's writes
+		glUniform1ui(firstId, (GLuint) t.first);
+		glUniform1ui(countId, (GLuint) t.count);
+		glUniform1f(weightId, t.weight);
+		glDispatchCompute((GLuint) (t.count+255)/256, 1, 1);
+	}
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(programWas);
+	weightsDirty = false;
+}
+
+void MorphMesh::Evaluate(vector<vec3> &points, vector<vec3> &normals) const {
+	points = basePoints;
+	normals = baseNormals;
+	for (const Target &t : targets) {
+		if (t.weight == 0)
+			continue;
+		float w = t.weight;
+		for (int i = t.first; i < t.first+t.count; i++) {
+			const Delta &d = deltas[i];
+			points[d.vertex] += w*vec3(d.dp[0], d.dp[1], d.dp[2]);
+			normals[d.vertex] += w*vec3(d.dn[0], d.dn[1], d.dn[2]);
+		}
+	}
+}
+
+void MorphMesh::Release() {
+	for (GLuint *b : { &baseBuffer, &deltaBuffer, &outBuffer })
+		DeleteBuffer(*b);
+	DeleteProgram(program);
+	geometryDirty = weightsDirty = true;
+}
+
+// Benchmark
+
+int MorphBenchmark() {
+	// a res x res grid wrapped on a sphere; each target a smooth bump over ~1.5% of it, every
+	// other target at weight zero
+	typedef std::chrono::steady_clock Clock;
+	int resolutions[] = { 100, 316, 1000 }, targetCounts[] = { 8, 64, 256 }, reps = 20, nDiffer = 0;
+	GLuint query;
+	glGenQueries(1, &query);
+	printf("morph targets: GPU (compute) vs CPU (one core), ms per update, half the weights zero\n");
+	printf("%10s %8s %10s %10s %8s %8s %8s\n", "vertices", "targets", "deltas", "delta MB", "GPU", "CPU", "max err");
+	for (int res : resolutions) {
+		vector<vec3> points(res*res), normals(res*res);
+		for (int y = 0; y < res; y++)
+			for (int x = 0; x < res; x++) {
+				float u = 6.2831853f*x/res, v = 3.1415927f*(y+.5f)/res;
+				vec3 p(sinf(v)*cosf(u), cosf(v), sinf(v)*sinf(u));
+				points[y*res+x] = p;
+				normals[y*res+x] = p;
+			}
+		for (int nTargets : targetCounts) {
+			MorphMesh m;
+			m.SetBase(points, normals);
+			srand(1);
+			int radius = res/14 > 1? res/14 : 1;
+			for (int t = 0; t < nTargets; t++) {
+				int cx = rand()%res, cy = rand()%res;
+				vector<int> vertices;
+				vector<vec3> dp, dn;
+				for (int y = cy-radius; y <= cy+radius; y++)
+					for (int x = cx-radius; x <= cx+radius; x++) {
+						if (y < 0 || y >= res)
+							continue;
+						float d2 = (float) ((x-cx)*(x-cx)+(y-cy)*(y-cy))/(radius*radius);
+						if (d2 >= 1)
+							continue;
+						int i = y*res+(x+res)%res;
+						float f = (1-d2)*(1-d2);
+						vertices.push_back(i);
+						dp.push_back(.1f*f*normals[i]);
+						dn.push_back(vec3(.05f*f, 0, 0));
+					}
+				m.AddSparseTarget(vertices, dp, dn);
+			}
+			double gpuMs = 0, cpuMs = 0;
+			vector<vec3> cpuPoints, cpuNormals;
+			for (int r = 0; r <= reps; r++) {
+				for (int t = 0; t < nTargets; t++)
+					m.SetWeight(t, t%2? 0 : .5f+.5f*sinf(.3f*r+t));
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				m.Update();
+				glEndQuery(GL_TIME_ELAPSED);
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+				Clock::time_point c = Clock::now();
+				m.Evaluate(cpuPoints, cpuNormals);
+				double ms = std::chrono::duration<double, std::milli>(Clock::now()-c).count();
+				if (r) {                                    // first round uploads
+					gpuMs += ns/1e6;
+					cpuMs += ms;
+				}
+			}
+			// compare last round
+			vector<vec3> gpuPoints(m.NVertices());
+			glBindBuffer(GL_COPY_READ_BUFFER, m.VertexBuffer());
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, gpuPoints.size()*sizeof(vec3), gpuPoints.data());
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			float maxErr = 0;
+			for (size_t i = 0; i < gpuPoints.size(); i++) {
+				vec3 d = gpuPoints[i]-cpuPoints[i];
+				float e = fabsf(d.x)+fabsf(d.y)+fabsf(d.z);
+				maxErr = e > maxErr? e : maxErr;
+				nDiffer += e > 1e-4f;                       // summation order differs, not much else
+			}
+			printf("%10i %8i %10i %10.1f %8.3f %8.3f %8.1e\n", m.NVertices(), nTargets, m.NDeltas(),
+				   m.NDeltas()*28/1e6, gpuMs/reps, cpuMs/reps, maxErr);
+			m.Release();
+		}
+	}
+	glDeleteQueries(1, &query);
+	if (nDiffer)
+		printf("FAILED: %i vertices differ between GPU and CPU\n", nDiffer);
+	return nDiffer;
+}
@@ -0,0 +1,56 @@
+// MorphTargets.h: sparse blend shapes for OBJ meshes, accumulated by a compute shader
+
+#ifndef MORPH_TARGETS_HDR
+#define MORPH_TARGETS_HDR
+
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// A morph mesh is a base (points, normals) plus any number of targets, each stored sparsely as
+// (vertex, point delta, normal delta) for only the vertices it moves. Update() copies the base
+// into the output vertex buffer (a buffer-to-buffer copy) and then, for each target whose weight
+// is non-zero, dispatches one compute thread per stored delta: out[v] += weight*delta. A target
+// touches each vertex at most once, so no atomics are needed; a barrier separates targets. Zero
+// weight targets cost nothing. Output is laid out as the demos' vertex buffers: all points, then
+// all normals (three floats each); normals are a weighted sum, shaders normalize. Update does
+// nothing if no weight changed. Evaluate() is the same sum on the CPU, for checking and timing.
+
+class MorphMesh {
+public:
+	vector<int3> triangles;                     // from ReadBase, else left to the caller
+	bool SetBase(const vector<vec3> &points, const vector<vec3> &normals);
+	bool ReadBase(const char *objFilename);     // normals computed if the file has none
+	// target as a full mesh of the base's vertex count; returns target index, -1 on mismatch
+	int AddTarget(const vector<vec3> &points, const vector<vec3> &normals, float epsilon = 1e-6f);
+	int AddTarget(const char *objFilename, float epsilon = 1e-6f);
+	int AddSparseTarget(const vector<int> &vertices, const vector<vec3> &dPoints, const vector<vec3> &dNormals);
+	void SetWeight(int target, float weight);
+	float Weight(int target) const { return targets[target].weight; }
+	void Update();                              // GL context current
+	void Evaluate(vector<vec3> &points, vector<vec3> &normals) const;
+	GLuint VertexBuffer() const { return outBuffer; }
+	int NVertices() const { return (int) basePoints.size(); }
+	int NTargets() const { return (int) targets.size(); }
+	int NDeltas() const { return (int) deltas.size(); }
+	int NActive() const { return nActive; }     // targets applied by the last Update
+	void Release();
+private:
+	struct Delta { GLuint vertex; float dp[3], dn[3]; };   // matches std430 in the shader
+	struct Target { int first = 0, count = 0; float weight = 0; };
+	vector<vec3> basePoints, baseNormals;
+	vector<Delta> deltas;                       // targets' deltas, consecutive
+	vector<Target> targets;
+	GLuint program = 0, baseBuffer = 0, deltaBuffer = 0, outBuffer = 0;
+	bool geometryDirty = true, weightsDirty = true;
+	int nActive = 0;
+	void Upload();
+};
+
+// GPU and CPU time per update across mesh sizes and target counts (GL context current);
+// returns the number of vertices where GPU and CPU results differ beyond tolerance, 0 if none
+int MorphBenchmark();
+
+#endif
@@ -0,0 +1,202 @@
+// PointKernels.cpp: bounds, standardize and planar uvs over large point arrays
+
+#include <chrono>
+#include <float.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "JobPool.h"
+#include "PointKernels.h"
+#include "Simd.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int grain = 1 << 16;               // points per thread, at least
+
+// Bounds
+
+// min/max of D-component points [b, e) of f
+template<int D>
+static void BoundsRange(const float *f, int b, int e, float *min, float *max) {
+	const int N = Lanes::N;
+	Lanes mn[D], mx[D];
+	for (int r = 0; r < D; r++) {
+		mn[r] = Lanes(FLT_MAX);
+		mx[r] = Lanes(-FLT_MAX);
+	}
+	int i = b;
+	for (; i+N <= e; i += N) {
+		const float *p = f+(size_t) D*i;
+		for (int r = 0; r < D; r++) {
+			Lanes v = Lanes::Load(p+r*N);
+			mn[r] = Min(mn[r], v);
+			mx[r] = Max(mx[r], v);
+		}
+	}
+	for (int k = 0; k < D; k++) {
+		min[k] = FLT_MAX;
+		max[k] = -FLT_MAX;
+	}
+	// lane j of register r holds component (r*N+j)%D
+	for (int r = 0; r < D; r++) {
+		float a[N], z[N];
+		mn[r].Store(a);
+		mx[r].Store(z);
+		for (int j = 0; j < N; j++) {
+			int k = (r*N+j)%D;
+			min[k] = Min(min[k], a[j]);
+			max[k] = Max(max[k], z[j]);
+		}
+	}
+	for (; i < e; i++)
+		for (int k = 0; k < D; k++) {
+			min[k] = Min(min[k], f[D*i+k]);
+			max[k] = Max(max[k], f[D*i+k]);
+		}
+}
+
+template<int D>
+static float Bounds(const float *f, int n, float *min, float *max) {
+	std::mutex mutex;
+	for (int k = 0; k < D; k++) {
+		min[k] = FLT_MAX;
+		max[k] = -FLT_MAX;
+	}
+	ParallelRanges(n, [&](int b, int e) {
+		float mn[D], mx[D];
+		BoundsRange<D>(f, b, e, mn, mx);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int k = 0; k < D; k++) {
+			min[k] = Min(min[k], mn[k]);
+			max[k] = Max(max[k], mx[k]);
+		}
+	}, grain);
+	float range = 0;
+	for (int k = 0; k < D; k++)
+		range = Max(range, max[k]-min[k]);
+	return range;
+}
+
+float PointBounds(const vec3 *points, int n, vec3 &min, vec3 &max) {
+	return Bounds<3>((const float *) points, n, &min.x, &max.x);
+}
+
+float PointBounds(const vec2 *points, int n, vec2 &min, vec2 &max) {
+	return Bounds<2>((const float *) points, n, &min.x, &max.x);
+}
+
+// Standardize
+
+// p = s*p+offset; uv, if not null, = (p.x-min.x)/dif.x, (p.y-min.y)/dif.y (of untransformed p)
+template<int D>
+static void TransformRange(float *f, int b, int e, float s, const float *offset, float *uv, const float *uvScale, const float *uvOffset) {
+	const int N = Lanes::N;
+	float pattern[D*N];
+	for (int k = 0; k < D*N; k++)
+		pattern[k] = offset[k%D];
+	Lanes scale(s), off[D];
+	for (int r = 0; r < D; r++)
+		off[r] = Lanes::Load(pattern+r*N);
+	int i = b;
+	for (; i+N <= e; i += N) {
+		float *p = f+(size_t) D*i;
+		if (uv)
+			for (int j = 0; j < N; j++) {
+				uv[2*(i+j)] = p[D*j]*uvScale[0]+uvOffset[0];
+				uv[2*(i+j)+1] = p[D*j+1]*uvScale[1]+uvOffset[1];
+			}
+		for (int r = 0; r < D; r++)
+			(Lanes::Load(p+r*N)*scale+off[r]).Store(p+r*N);
+	}
+	for (; i < e; i++) {
+		float *p = f+(size_t) D*i;
+		if (uv) {
+			uv[2*i] = p[0]*uvScale[0]+uvOffset[0];
+			uv[2*i+1] = p[1]*uvScale[1]+uvOffset[1];
+		}
+		for (int k = 0; k < D; k++)
+			p[k] = p[k]*s+offset[k];
+	}
+}
+
+template<int D>
+static float Standardize(float *f, int n, float scale, float *uv) {
+	float min[D], max[D], offset[D], uvScale[2], uvOffset[2];
+	float range = Bounds<D>(f, n, min, max);
+	if (n == 0)
+		return 1;
+	float s = range > 0? 2*scale/range : 1;
+	for (int k = 0; k < D; k++)
+		offset[k] = -s*(min[k]+max[k])/2;
+	for (int k = 0; k < 2; k++) {
+		float dif = max[k]-min[k];
+		uvScale[k] = dif > 0? 1/dif : 0;
+		uvOffset[k] = -min[k]*uvScale[k];
+	}
+	ParallelRanges(n, [&](int b, int e) {
+		TransformRange<D>(f, b, e, s, offset, uv, uvScale, uvOffset);
+	}, grain);
+	return s;
+}
+
+float StandardizePoints(vec3 *points, int n, float scale, vec2 *planarUvs) {
+	return Standardize<3>((float *) points, n, scale, (float *) planarUvs);
+}
+
+float StandardizePoints(vec2 *points, int n, float scale) {
+	return Standardize<2>((float *) points, n, scale, NULL);
+}
+
+// Benchmark
+
+static double Seconds(Clock::time_point t) {
+	return std::chrono::duration<double>(Clock::now()-t).count();
+}
+
+int PointKernelBenchmark(int nPoints) {
+	std::vector<vec3> original(nPoints), scalar, fast;
+	std::vector<vec2> scalarUvs(nPoints), fastUvs(nPoints);
+	srand(1);
+	for (vec3 &p : original)
+		p = vec3(rand()%20001-10000.f, rand()%20001-10000.f, rand()%20001-10000.f)/100+vec3(3, -7, 11);
+	scalar = original;
+	fast = original;
+	// scalar: separate passes, as in SetUvs and NormalizePoints
+	Clock::time_point t = Clock::now();
+	vec3 min = scalar[0], max = scalar[0];
+	for (vec3 &p : scalar)
+		for (int k = 0; k < 3; k++) {
+			if (p[k] < min[k]) min[k] = p[k];
+			if (p[k] > max[k]) max[k] = p[k];
+		}
+	vec3 dif = max-min, center = (min+max)/2;
+	float range = dif.x > dif.y? (dif.x > dif.z? dif.x : dif.z) : (dif.y > dif.z? dif.y : dif.z);
+	for (int i = 0; i < nPoints; i++)
+		scalarUvs[i] = vec2((scalar[i].x-min.x)/dif.x, (scalar[i].y-min.y)/dif.y);
+	float s = 2*.8f/range;
+	for (vec3 &p : scalar)
+		p = s*(p-center);
+	double scalarTime = Seconds(t);
+	// fused
+	t = Clock::now();
+	StandardizePoints(fast.data(), nPoints, .8f, fastUvs.data());
+	double fastTime = Seconds(t);
+	float maxError = 0, tolerance = 1e-5f;
+	int nOver = 0;
+	for (int i = 0; i < nPoints; i++) {
+		vec3 d = fast[i]-scalar[i];
+		vec2 e = fastUvs[i]-scalarUvs[i];
+		float err = Max(Max(fabsf(d.x), fabsf(d.y)), Max(Max(fabsf(d.z), fabsf(e.x)), fabsf(e.y)));
+		maxError = Max(maxError, err);
+		nOver += err > tolerance;
+	}
+	// minimum traffic: read points twice (bounds, transform), write points and uvs once
+	double gb = (double) nPoints*(3*sizeof(vec3)+sizeof(vec2))/1e9;
+	printf("standardize + planar uvs, %i points (%.0f MB), %s:\n", nPoints, nPoints*(sizeof(vec3)+sizeof(vec2))/1e6, SimdISA());
+	printf("  scalar: %.1f ms (%.2f GB/s)\n", 1000*scalarTime, gb/scalarTime);
+	printf("  fused:  %.1f ms (%.2f GB/s), %.1fx, max difference %g\n", 1000*fastTime, gb/fastTime, scalarTime/fastTime, maxError);
+	if (nOver)
+		printf("FAILED: %i points differ from scalar by more than %g\n", nOver, tolerance);
+	return nOver;
+}
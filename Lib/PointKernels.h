@@ -0,0 +1,26 @@
+// PointKernels.h: bounds, standardize and planar uvs over large point arrays
+
+#ifndef POINT_KERNELS_HDR
+#define POINT_KERNELS_HDR
+
+#include "VecMat.h"
+
+// Drop-in for Bounds, Standardize and the demos' NormalizePoints/SetUvs. The x,y,z (or x,y)
+// stream is read as whole Lanes registers: N points fill 3 (or 2) registers, and lane k of the
+// block always holds component k%3, so min/max and scale/offset need no shuffles. Ranges of
+// points run on all cores. StandardizePoints makes two passes (bounds, then transform); if
+// planarUvs is given, the transform pass also writes the xy-projected uv (as SetUvs does),
+// rather than walking the points a third time.
+
+float PointBounds(const vec3 *points, int n, vec3 &min, vec3 &max);    // returns largest extent
+float PointBounds(const vec2 *points, int n, vec2 &min, vec2 &max);
+
+// center at origin and scale to +/- scale; returns the scale factor applied
+float StandardizePoints(vec3 *points, int n, float scale = 1, vec2 *planarUvs = NULL);
+float StandardizePoints(vec2 *points, int n, float scale = 1);
+
+// compare against the scalar passes on nPoints random points, print times and GB/s; returns
+// the number of points (or uvs) differing by more than 1e-5 (0: pass)
+int PointKernelBenchmark(int nPoints = 10000000);
+
+#endif
@@ -0,0 +1,83 @@
+// RenderThread.cpp: GL on its own thread, fed by a triple-buffered snapshot of the input state
+
+#include <algorithm>
+#include <stdio.h>
+#include "RenderThread.h"
+
+// Latency
+
+void LatencyMeter::Record(Clock::time_point input) {
+	float t = std::chrono::duration<float, std::milli>(Clock::now()-input).count();
+	std::lock_guard<std::mutex> lock(mutex);
+	ms.push_back(t);
+}
+
+void LatencyMeter::Report(const char *what) const {
+	vector<float> s;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		s = ms;
+	}
+	if (s.empty()) {
+		printf("%s latency: no samples\n", what);
+		return;
+	}
+	std::sort(s.begin(), s.end());
+	double sum = 0;
+	for (float t : s)
+		sum += t;
+	size_t n = s.size();
+	printf("%s latency: %i samples, mean %.1f ms, median %.1f ms, 95%% %.1f ms, max %.1f ms\n",
+		   what, (int) n, sum/n, s[n/2], s[std::min(n-1, n*95/100)], s[n-1]);
+}
+
+void LatencyMeter::Reset() {
+	std::lock_guard<std::mutex> lock(mutex);
+	ms.clear();
+}
+
+// Thread
+
+void RenderThread::Start(GLFWwindow *w, std::function<void()> f) {
+	Stop();
+	window = w;
+	frame = f;
+	quit = false;
+	nFrames = 0;
+	glfwMakeContextCurrent(NULL);               // a context is current on one thread at a time
+	thread = std::thread(&RenderThread::Run, this);
+}
+
+void RenderThread::Post(std::function<void()> task) {
+	std::lock_guard<std::mutex> lock(mutex);
+	posted.push_back(task);
+}
+
+void RenderThread::RunPosted() {
+	vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.swap(posted);
+	}
+	for (std::function<void()> &t : tasks)
+		t();
+}
+
+void RenderThread::Run() {
+	glfwMakeContextCurrent(window);
+	while (!quit) {
+		RunPosted();
+		frame();
+		nFrames++;
+	}
+	RunPosted();
+	glfwMakeContextCurrent(NULL);
+}
+
+void RenderThread::Stop() {
+	if (!thread.joinable())
+		return;
+	quit = true;
+	thread.join();
+	glfwMakeContextCurrent(window);
+}
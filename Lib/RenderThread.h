@@ -0,0 +1,76 @@
+// RenderThread.h: GL on its own thread, fed by a triple-buffered snapshot of the input state
+
+#ifndef RENDER_THREAD_HDR
+#define RENDER_THREAD_HDR
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <GLFW/glfw3.h>
+
+using std::vector;
+
+// The main thread keeps GLFW events and input (GLFW requires it); the window's GL context moves
+// to a render thread that draws and swaps as fast as vsync allows. The main thread never waits
+// on a frame: it fills TripleBuffer::Back() and publishes; the render thread acquires the newest
+// complete snapshot at the start of each frame. Neither side blocks, and a snapshot published
+// twice before a frame simply replaces the first. Work that must touch GL or render-thread data
+// (picking the loaded mesh, exporting it) is posted to run between frames.
+
+template<class T>
+class TripleBuffer {
+public:
+	T &Back() { return slots[back]; }           // writer: fill, then Publish
+	void Publish() { back = middle.exchange(back | fresh) & 3; }
+	bool Acquire() {                            // reader: true if a newer snapshot arrived
+		if (!(middle.load() & fresh))
+			return false;
+		front = middle.exchange(front) & 3;
+		return true;
+	}
+	const T &Front() const { return slots[front]; }
+private:
+	enum { fresh = 4 };
+	T slots[3];
+	int back = 0, front = 1;                    // each owned by one side
+	std::atomic<int> middle{2};                 // slot index, plus fresh when newly published
+};
+
+// input-to-swap latency: timestamp an event when it arrives, record when a frame showing it is
+// swapped
+class LatencyMeter {
+public:
+	typedef std::chrono::steady_clock Clock;
+	void Record(Clock::time_point input);
+	void Report(const char *what) const;        // count, mean, median, 95th percentile, max
+	void Reset();
+private:
+	mutable std::mutex mutex;
+	vector<float> ms;
+};
+
+class RenderThread {
+public:
+	// release the context from the calling thread, then call frame repeatedly on the render
+	// thread with the context current; frame does its own swap
+	void Start(GLFWwindow *window, std::function<void()> frame);
+	void Post(std::function<void()> task);      // run on the render thread before the next frame
+	void Stop();                                // finish the frame, run posted tasks, context returns
+	bool Running() const { return thread.joinable(); }
+	int Frames() const { return nFrames; }
+private:
+	GLFWwindow *window = NULL;
+	std::function<void()> frame;
+	std::thread thread;
+	std::atomic<bool> quit{false};
+	std::atomic<int> nFrames{0};
+	std::mutex mutex;
+	vector<std::function<void()>> posted;
+	void Run();
+	void RunPosted();
+};
+
+#endif
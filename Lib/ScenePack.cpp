@@ -0,0 +1,299 @@
+// ScenePack.cpp: many meshes in shared buffers, drawn with one multi-draw-indirect call
+
+#include <string.h>
+#include "Culling.h"
+#include "GLXtras.h"
+#include "GPUResources.h"
+#include "ScenePack.h"
+
+static_assert(sizeof(PackedObject) == 112, "PackedObject must match std430 Object");
+static_assert(sizeof(DrawCommand) == 20, "DrawCommand must match DrawElementsIndirectCommand");
+
+// one thread per object: frustum-test its world bounding sphere, write its draw command
+static const char *cullShader = R"(
+	#version 460
+	layout(local_size_x = 64) in;
+	struct Object { mat4 toWorld; vec4 color; vec4 sphere; ivec4 mesh; };
+	struct Command { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };
+	struct Range { uint firstIndex, count; int baseVertex, pad; };
+	layout(std430, binding = 0, row_major) readonly buffer Objects { Object objects[]; };
+	layout(std430, binding = 1) writeonly buffer Commands { Command commands[]; };
+	layout(std430, binding = 2) readonly buffer Meshes { Range meshes[]; };
+	layout(std430, binding = 3) buffer Visible { uint nVisible; };
+	uniform vec4 planes[6];
+	uniform int nObjects;
+	void main() {
+		uint i = gl_GlobalInvocationID.x;
+		if (i >= uint(nObjects))
+			return;
+		Object o = objects[i];
+		vec3 c = (o.toWorld*vec4(o.sphere.xyz, 1)).xyz;
+		float s = max(dot(o.toWorld[0].xyz, o.toWorld[0].xyz), max(dot(o.toWorld[1].xyz, o.toWorld[1].xyz), dot(o.toWorld[2].xyz, o.toWorld[2].xyz)));
+		float r = o.sphere.w*sqrt(s);
+		bool visible = true;
+		for (int k = 0; k < 6; k++)
+			visible = visible && dot(planes[k].xyz, c)+planes[k].w+r >= 0;
+		Range m = meshes[o.mesh.x];
+		commands[i] = Command(m.count, visible? 1u : 0u, m.firstIndex, m.baseVertex, 0u);
+		if (visible)
+			atomicAdd(nVisible, 1u);
+	}
+)";
+
+// Meshes, Objects
+
+static vector<float> Interleave(const vector<vec3> &points, const vector<vec3> &normals) {
+	vector<float> v(6*points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		vec3 n = i < normals.size()? normals[i] : vec3(0, 0, 1);
+		float *f = &v[6*i];
+		f[0] = points[i].x; f[1] = points[i].y; f[2] = points[i].z;
+		f[3] = n.x; f[4] = n.y; f[5] = n.z;
+	}
+	return v;
+}
+
+int ScenePack::AddMesh(const vector<vec3> &points, const vector<vec3> &normals, const vector<int3> &triangles) {
+	meshes.push_back(Range());
+	meshVertices.push_back(vector<float>());
+	meshTriangles.push_back(vector<int3>());
+	SetMesh((int) meshes.size()-1, points, normals, triangles);
+	return (int) meshes.size()-1;
+}
+
+void ScenePack::SetMesh(int m, const vector<vec3> &points, const vector<vec3> &normals, const vector<int3> &triangles) {
+	meshVertices[m] = Interleave(points, normals);
+	meshTriangles[m] = triangles;
+	meshes[m].sphere = BoundingSphere(points);
+	for (PackedObject &o : objects)
+		if (o.mesh == m)
+			o.sphere = meshes[m].sphere;
+	geometryDirty = true;
+}
+
+int ScenePack::AddObject(int mesh, mat4 toWorld, vec3 color) {
+	PackedObject o;
+	o.mesh = mesh;
+	o.pad[0] = o.pad[1] = o.pad[2] = 0;
+	o.sphere = meshes[mesh].sphere;
+	objects.push_back(o);
+	visible.push_back(1);
+	SetObject((int) objects.size()-1, toWorld, color);
+	return (int) objects.size()-1;
+}
+
+void ScenePack::SetObject(int i, mat4 toWorld, vec3 color) {
+	objects[i].toWorld = toWorld;
+	objects[i].color = vec4(color.x, color.y, color.z, 1);
+}
+
+void ScenePack::SetVisible(int i, bool v) {
+	visible[i] = v;
+}
+
+void ScenePack::ClearObjects() {
+	objects.resize(0);
+	visible.resize(0);
+}
+
+// GPU Buffers
+
+void ScenePack::Pack() {
+	// concatenate all meshes: one vertex buffer, one index buffer, indices local to each mesh
+	size_t nFloats = 0, nTriangles = 0;
+	for (size_t m = 0; m < meshes.size(); m++) {
+		meshes[m].baseVertex = (GLint) (nFloats/6);
+		meshes[m].firstIndex = (GLuint) (3*nTriangles);
+		meshes[m].count = (GLuint) (3*meshTriangles[m].size());
+		nFloats += meshVertices[m].size();
+		nTriangles += meshTriangles[m].size();
+	}
+	if (!vArray) {
+		glGenVertexArrays(1, &vArray);
+		glGenBuffers(1, &vBuffer);
+		glGenBuffers(1, &iBuffer);
+		glGenBuffers(1, &meshBuffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBufferData(GL_ARRAY_BUFFER, nFloats*sizeof(float), NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, iBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, nTriangles*sizeof(int3), NULL, GL_STATIC_DRAW);
+	for (size_t m = 0; m < meshes.size(); m++) {
+		glBufferSubData(GL_ARRAY_BUFFER, meshes[m].baseVertex*6*sizeof(float), meshVertices[m].size()*sizeof(float), meshVertices[m].data());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, meshes[m].firstIndex*sizeof(int), meshTriangles[m].size()*sizeof(int3), meshTriangles[m].data());
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	gpuRegistry.Track(GPURegistry::Buffer, vBuffer, nFloats*sizeof(float), "scene pack vertices");
+	gpuRegistry.Track(GPURegistry::Buffer, iBuffer, nTriangles*sizeof(int3), "scene pack triangles");
+	// mesh ranges for the cull shader (firstIndex, count, baseVertex, pad)
+	vector<GLint> ranges(4*meshes.size(), 0);
+	for (size_t m = 0; m < meshes.size(); m++) {
+		ranges[4*m] = (GLint) meshes[m].firstIndex;
+		ranges[4*m+1] = (GLint) meshes[m].count;
+		ranges[4*m+2] = meshes[m].baseVertex;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, ranges.size()*sizeof(GLint), ranges.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	gpuRegistry.Track(GPURegistry::Buffer, meshBuffer, ranges.size()*sizeof(GLint), "scene pack ranges");
+	geometryDirty = false;
+}
+
+void ScenePack::ReleaseObjectRing() {
+	for (GLsync &f : objectFences)
+		if (f) {
+			glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(f);
+			f = 0;
+		}
+	if (objectMemory) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	objectMemory = NULL;
+	DeleteBuffer(objectBuffer);
+}
+
+void ScenePack::Upload() {
+	if (geometryDirty)
+		Pack();
+	size_t n = objects.size();
+	if (n > objectCapacity) {
+		// immutable storage: grow by replacing the ring
+		ReleaseObjectRing();
+		objectCapacity = 2*n;
+		GLint alignment = 256;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		// each region: objects, then commands at an aligned offset (the cull shader binds them)
+		commandOffset = (objectCapacity*sizeof(PackedObject)+alignment-1)/alignment*alignment;
+		regionBytes = (commandOffset+objectCapacity*sizeof(DrawCommand)+alignment-1)/alignment*alignment;
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &objectBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, ringRegions*regionBytes, NULL, flags);
+		objectMemory = (unsigned char *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, ringRegions*regionBytes, flags);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		gpuRegistry.Track(GPURegistry::Buffer, objectBuffer, ringRegions*regionBytes, "scene pack objects and commands");
+		region = 0;
+	}
+	// write this frame's region once the GPU is done with it
+	if (objectFences[region]) {
+		while (glClientWaitSync(objectFences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(objectFences[region]);
+		objectFences[region] = 0;
+	}
+	memcpy(objectMemory+region*regionBytes, objects.data(), n*sizeof(PackedObject));
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer, region*regionBytes, n*sizeof(PackedObject));
+}
+
+DrawCommand *ScenePack::Commands() {
+	// mapped, and free to write since Upload waited on this region's fence
+	return (DrawCommand *) (objectMemory+CommandsOffset());
+}
+
+void ScenePack::Submit() {
+	// one call for the whole scene, gl_DrawID = object index
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, objectBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) CommandsOffset(), (GLsizei) objects.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	objectFences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region+1)%ringRegions;
+}
+
+// Draw
+
+void ScenePack::Draw(GLuint program) {
+	if (objects.empty())
+		return;
+	GLint vArrayWas;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vArrayWas);
+	Upload();
+	// commands from CPU visibility, written into the ring
+	counted[region] = false;
+	DrawCommand *commands = Commands();
+	for (size_t i = 0; i < objects.size(); i++) {
+		const Range &m = meshes[objects[i].mesh];
+		commands[i] = { m.count, (GLuint) visible[i], m.firstIndex, m.baseVertex, 0 };
+	}
+	glBindVertexArray(vArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	VertexAttribPointer(program, "point", 3, 6*sizeof(float), (void *) 0);
+	VertexAttribPointer(program, "normal", 3, 6*sizeof(float), (void *) (3*sizeof(float)));
+	Submit();
+	glBindVertexArray(vArrayWas);
+}
+
+void ScenePack::CullAndDraw(GLuint program, mat4 viewProj) {
+	if (objects.empty())
+		return;
+	GLint vArrayWas;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vArrayWas);
+	Upload();
+	if (!cullProgram) {
+		cullProgram = LinkProgramViaCode(&cullShader);
+		gpuRegistry.Track(GPURegistry::Program, cullProgram, 0, "scene pack cull");
+		GLint alignment = 256;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		counterStride = alignment;
+		GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &counterBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, ringRegions*counterStride, NULL, flags);
+		counterMemory = (unsigned char *) glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, ringRegions*counterStride, flags);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		gpuRegistry.Track(GPURegistry::Buffer, counterBuffer, ringRegions*counterStride, "scene pack visible counts");
+	}
+	// this region's count is from ringRegions frames ago, complete since Upload waited on its fence
+	if (counterMemory) {
+		GLuint *count = (GLuint *) (counterMemory+region*counterStride);
+		if (counted[region])
+			nVisible = (int) *count;
+		*count = 0;
+		counted[region] = true;
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, counterBuffer, region*counterStride, sizeof(GLuint));
+	}
+	// commands written by the cull shader
+	Frustum frustum;
+	frustum.Set(viewProj);
+	glUseProgram(cullProgram);
+	glUniform4fv(glGetUniformLocation(cullProgram, "planes"), 6, (float *) frustum.planes);
+	SetUniform(cullProgram, "nObjects", (int) objects.size());
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, objectBuffer, CommandsOffset(), objects.size()*sizeof(DrawCommand));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, meshBuffer);
+	glDispatchCompute((GLuint) (objects.size()+63)/64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	glUseProgram(program);
+	glBindVertexArray(vArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffer);
+	VertexAttribPointer(program, "point", 3, 6*sizeof(float), (void *) 0);
+	VertexAttribPointer(program, "normal", 3, 6*sizeof(float), (void *) (3*sizeof(float)));
+	Submit();
+	glBindVertexArray(vArrayWas);
+}
+
+void ScenePack::Release() {
+	ReleaseObjectRing();
+	if (counterBuffer) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+		if (counterMemory)
+			glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		DeleteBuffer(counterBuffer);
+	}
+	counterMemory = NULL;
+	for (bool &c : counted)
+		c = false;
+	if (vArray) {
+		glDeleteVertexArrays(1, &vArray);
+		for (GLuint *b : { &vBuffer, &iBuffer, &meshBuffer })
+			DeleteBuffer(*b);
+	}
+	DeleteProgram(cullProgram);
+	vArray = 0;
+	objectCapacity = 0;
+	geometryDirty = true;
+}
@@ -0,0 +1,84 @@
+// ScenePack.h: many meshes in shared buffers, drawn with one multi-draw-indirect call
+
+#ifndef SCENE_PACK_HDR
+#define SCENE_PACK_HDR
+
+#include <vector>
+#include "glad.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// All meshes are suballocated into one interleaved vertex buffer (point, normal) and one index
+// buffer; a mesh is a (firstIndex, count, baseVertex) range. Objects (transform, color, mesh)
+// live in an SSBO that the vertex shader reads with objects[gl_DrawID]. Every frame the scene
+// is submitted with one glMultiDrawElementsIndirect holding one command per object; culled
+// objects get instanceCount 0, so gl_DrawID stays equal to the object index. The commands are
+// written on the CPU (Draw, after CPU culling) or by a compute shader that frustum-culls each
+// object's bounding sphere (CullAndDraw). Objects and commands share one persistent-mapped
+// ring, so neither path re-specifies a buffer per frame. Requires GL 4.6 (gl_DrawID).
+//
+// Vertex shaders declare:
+//   struct Object { mat4 toWorld; vec4 color; vec4 sphere; ivec4 mesh; };
+//   layout(std430, binding = 0, row_major) readonly buffer Objects { Object objects[]; };
+
+struct PackedObject {
+	mat4 toWorld;                               // row-major, matched by row_major in GLSL
+	vec4 color;
+	vec4 sphere;                                // object-space bounds of the mesh
+	int mesh, pad[3];
+};
+
+struct DrawCommand {
+	GLuint count, instanceCount, firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+class ScenePack {
+public:
+	// geometry is repacked into the shared buffers on the next draw
+	int AddMesh(const vector<vec3> &points, const vector<vec3> &normals, const vector<int3> &triangles);
+	void SetMesh(int mesh, const vector<vec3> &points, const vector<vec3> &normals, const vector<int3> &triangles);
+	int AddObject(int mesh, mat4 toWorld, vec3 color);
+	void SetObject(int object, mat4 toWorld, vec3 color);
+	void SetVisible(int object, bool visible);  // CPU culling result, used by Draw
+	void ClearObjects();
+	void Draw(GLuint program);                  // attributes "point", "normal"
+	void CullAndDraw(GLuint program, mat4 viewProj);
+	int NObjects() const { return (int) objects.size(); }
+	int NMeshes() const { return (int) meshes.size(); }
+	int NVisible() const { return nVisible; }   // GPU path: counted by the cull shader, a ring behind
+	void Release();
+private:
+	struct Range { GLuint firstIndex = 0, count = 0; GLint baseVertex = 0; vec4 sphere; };
+	vector<Range> meshes;
+	vector<vector<float>> meshVertices;         // interleaved point, normal per mesh
+	vector<vector<int3>> meshTriangles;
+	vector<PackedObject> objects;
+	vector<unsigned char> visible;
+	GLuint vArray = 0, vBuffer = 0, iBuffer = 0, objectBuffer = 0, meshBuffer = 0;
+	GLuint cullProgram = 0;
+	bool geometryDirty = true;
+	size_t objectCapacity = 0;
+	// objects, then draw commands: persistent-mapped ring of three regions, fenced after each submit
+	enum { ringRegions = 3 };
+	unsigned char *objectMemory = NULL;
+	GLsync objectFences[ringRegions] = {0, 0, 0};
+	GLsizeiptr regionBytes = 0, commandOffset = 0;   // commandOffset within a region
+	int region = 0;
+	// visible counts: one mapped counter per ring region, read once the region's fence has passed
+	GLuint counterBuffer = 0;
+	unsigned char *counterMemory = NULL;
+	GLsizeiptr counterStride = 0;
+	bool counted[ringRegions] = {false, false, false};
+	int nVisible = 0;
+	void ReleaseObjectRing();
+	void Pack();
+	void Upload();
+	DrawCommand *Commands();                    // this frame's region
+	GLintptr CommandsOffset() const { return region*regionBytes+commandOffset; }
+	void Submit();
+};
+
+#endif
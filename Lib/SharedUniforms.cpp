@@ -0,0 +1,106 @@
+// SharedUniforms.cpp: per-frame and per-object uniform blocks in persistent-mapped rings
+
+#include <stdio.h>
+#include <string.h>
+#include "GPUResources.h"
+#include "MatKernels.h"
+#include "SharedUniforms.h"
+
+static_assert(sizeof(FrameBlock) == 464, "FrameBlock must match std140 Frame");
+static_assert(sizeof(ObjectBlock) == 80, "ObjectBlock must match std140 Object");
+static_assert((int) SharedUniforms::ringFrames >= (int) FramePacer::maxFrames, "a region per frame in flight");
+
+static GLsizeiptr AlignUp(GLsizeiptr n, GLint alignment) {
+	return alignment > 0? (n+alignment-1)/alignment*alignment : n;
+}
+
+void SharedUniforms::Init(int nMax) {
+	Release();
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	maxObjects = nMax;
+	frameStride = AlignUp(sizeof(FrameBlock), alignment);
+	objectStride = AlignUp(sizeof(ObjectBlock), alignment);
+	regionSize = frameStride+maxObjects*objectStride;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferStorage(GL_UNIFORM_BUFFER, ringFrames*regionSize, NULL, flags);
+	memory = (unsigned char *) glMapBufferRange(GL_UNIFORM_BUFFER, 0, ringFrames*regionSize, flags);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	gpuRegistry.Track(GPURegistry::Buffer, buffer, ringFrames*regionSize, "shared uniforms");
+	if (!memory)
+		printf("SharedUniforms: can't map uniform buffer\n");
+	region = 0;
+}
+
+void SharedUniforms::Bind(GLuint program) {
+	GLuint f = glGetUniformBlockIndex(program, "Frame"), o = glGetUniformBlockIndex(program, "Object");
+	if (f != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, f, frameBinding);
+	if (o != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, o, objectBinding);
+}
+
+void SharedUniforms::BeginFrame(mat4 m, mat4 persp, const vec3 *lights, int nLights) {
+	if (!memory)
+		return;
+	// wait until the GPU has finished with this region (normally long since signaled)
+	if (pacer)
+		region = pacer->Slot();
+	else if (fences[region]) {
+		while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync(fences[region]);
+		fences[region] = 0;
+	}
+	modelview = m;
+	nObjects = 0;
+	FrameBlock block;
+	block.modelview = m;
+	block.persp = persp;
+	block.nLights = nLights < maxLights? nLights : maxLights;
+	block.pad[0] = block.pad[1] = block.pad[2] = 0;
+	for (int i = 0; i < maxLights; i++)
+		block.lights[i] = i < block.nLights? Transform(m, vec4(lights[i].x, lights[i].y, lights[i].z, 1)) : vec4(0, 0, 0, 0);
+	memcpy(memory+region*regionSize, &block, sizeof(block));
+	glBindBufferRange(GL_UNIFORM_BUFFER, frameBinding, buffer, region*regionSize, sizeof(FrameBlock));
+}
+
+int SharedUniforms::AddObject(mat4 toWorld, vec3 color) {
+	if (!memory || nObjects >= maxObjects)
+		return -1;
+	ObjectBlock block;
+	block.modelview = modelview*toWorld;
+	block.color = vec4(color.x, color.y, color.z, 1);
+	memcpy(memory+region*regionSize+frameStride+nObjects*objectStride, &block, sizeof(block));
+	return nObjects++;
+}
+
+void SharedUniforms::BindObject(int object) {
+	if (object >= 0)
+		glBindBufferRange(GL_UNIFORM_BUFFER, objectBinding, buffer, region*regionSize+frameStride+object*objectStride, sizeof(ObjectBlock));
+}
+
+void SharedUniforms::EndFrame() {
+	if (!memory || pacer)
+		return;
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region+1)%ringFrames;
+}
+
+void SharedUniforms::Release() {
+	for (GLsync &f : fences)
+		if (f) {
+			glDeleteSync(f);
+			f = 0;
+		}
+	if (buffer) {
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		if (memory)
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		DeleteBuffer(buffer);
+	}
+	memory = NULL;
+}
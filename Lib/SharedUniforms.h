@@ -0,0 +1,52 @@
+// SharedUniforms.h: per-frame and per-object uniform blocks in persistent-mapped rings
+
+#ifndef SHARED_UNIFORMS_HDR
+#define SHARED_UNIFORMS_HDR
+
+#include "FramePacer.h"
+#include "glad.h"
+#include "VecMat.h"
+
+// Shaders declare (version 330 or later; bindings are set by Bind):
+//   layout(std140, row_major) uniform Frame { mat4 modelview, persp; vec4 lights[20]; int nLights; };
+//   layout(std140, row_major) uniform Object { mat4 objectModelview; vec4 objectColor; };
+// Both blocks live in one buffer, mapped once (persistent, coherent) and divided into
+// ringFrames regions; the CPU writes region i while the GPU may still read regions i-1, i-2.
+// BeginFrame waits on the fence that EndFrame placed after the region's last use, writes the
+// frame block (lights transformed to eye space here, once) and binds it. Each AddObject writes
+// one object block; BindObject points the Object binding at it. No glUniform calls per draw.
+// With SetPacer, the region is the pacer's slot and the pacer's fences stand in for these.
+
+struct FrameBlock {
+	mat4 modelview, persp;
+	vec4 lights[20];                            // eye space; std140 pads vec3 arrays to vec4
+	int nLights, pad[3];
+};
+
+struct ObjectBlock {
+	mat4 modelview;                             // camera modelview * object toWorld
+	vec4 color;
+};
+
+class SharedUniforms {
+public:
+	enum { maxLights = 20, ringFrames = 3, frameBinding = 0, objectBinding = 1 };
+	void Init(int maxObjects = 4096);           // after GL context creation
+	void Bind(GLuint program);                  // assign block bindings (blocks may be absent)
+	void BeginFrame(mat4 modelview, mat4 persp, const vec3 *lights, int nLights);
+	int AddObject(mat4 toWorld, vec3 color);    // returns object index this frame, -1 if full
+	void BindObject(int object);
+	void EndFrame();
+	void SetPacer(const FramePacer *p) { pacer = p; }
+	void Release();
+private:
+	const FramePacer *pacer = NULL;
+	GLuint buffer = 0;
+	unsigned char *memory = NULL;
+	GLsync fences[ringFrames] = {0, 0, 0};
+	GLsizeiptr frameStride = 0, objectStride = 0, regionSize = 0;
+	int maxObjects = 0, region = 0, nObjects = 0;
+	mat4 modelview;
+};
+
+#endif
@@ -0,0 +1,108 @@
+// Simd.h: thin float-lane wrapper over AVX2, SSE, or plain float
+
+#ifndef SIMD_HDR
+#define SIMD_HDR
+
+#include <math.h>
+
+// Lanes is the widest float vector enabled at compile time; templated kernels written
+// against Lanes also instantiate with float, giving a scalar path with the same arithmetic.
+// Comparisons return a bit mask, bit i for lane i
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SIMD_SSE
+#endif
+
+#if defined(SIMD_AVX2)
+
+struct Lanes {
+	enum { N = 8 };
+	__m256 v;
+	Lanes() { }
+	Lanes(float f) : v(_mm256_set1_ps(f)) { }
+	Lanes(__m256 v) : v(v) { }
+	static Lanes Load(const float *p) { return _mm256_loadu_ps(p); }
+	void Store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+inline Lanes operator+(Lanes a, Lanes b) { return _mm256_add_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm256_sub_ps(a.v, b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm256_mul_ps(a.v, b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm256_div_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a.v); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a.v, b.v); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a.v, b.v); }
+inline float HMin(Lanes a) { float f[8]; a.Store(f); float m = f[0]; for (int i = 1; i < 8; i++) m = f[i] < m? f[i] : m; return m; }
+inline float HMax(Lanes a) { float f[8]; a.Store(f); float m = f[0]; for (int i = 1; i < 8; i++) m = f[i] > m? f[i] : m; return m; }
+inline int LessMask(Lanes a, Lanes b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+inline int GreaterEqualMask(Lanes a, Lanes b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+
+#elif defined(SIMD_SSE)
+
+struct Lanes {
+	enum { N = 4 };
+	__m128 v;
+	Lanes() { }
+	Lanes(float f) : v(_mm_set1_ps(f)) { }
+	Lanes(__m128 v) : v(v) { }
+	static Lanes Load(const float *p) { return _mm_loadu_ps(p); }
+	void Store(float *p) const { _mm_storeu_ps(p, v); }
+};
+inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v, b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v, b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm_div_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a.v); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a.v, b.v); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a.v, b.v); }
+inline float HMin(Lanes a) { float f[4]; a.Store(f); float m = f[0]; for (int i = 1; i < 4; i++) m = f[i] < m? f[i] : m; return m; }
+inline float HMax(Lanes a) { float f[4]; a.Store(f); float m = f[0]; for (int i = 1; i < 4; i++) m = f[i] > m? f[i] : m; return m; }
+inline int LessMask(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+inline int GreaterEqualMask(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmpge_ps(a.v, b.v)); }
+
+#else
+
+struct Lanes {
+	enum { N = 1 };
+	float v;
+	Lanes() { }
+	Lanes(float f) : v(f) { }
+	static Lanes Load(const float *p) { return *p; }
+	void Store(float *p) const { *p = v; }
+};
+inline Lanes operator+(Lanes a, Lanes b) { return a.v+b.v; }
+inline Lanes operator-(Lanes a, Lanes b) { return a.v-b.v; }
+inline Lanes operator*(Lanes a, Lanes b) { return a.v*b.v; }
+inline Lanes operator/(Lanes a, Lanes b) { return a.v/b.v; }
+inline Lanes operator-(Lanes a) { return -a.v; }
+inline Lanes Sqrt(Lanes a) { return sqrtf(a.v); }
+inline Lanes Min(Lanes a, Lanes b) { return a.v < b.v? a.v : b.v; }
+inline Lanes Max(Lanes a, Lanes b) { return a.v > b.v? a.v : b.v; }
+inline float HMin(Lanes a) { return a.v; }
+inline float HMax(Lanes a) { return a.v; }
+inline int LessMask(Lanes a, Lanes b) { return a.v < b.v; }
+inline int GreaterEqualMask(Lanes a, Lanes b) { return a.v >= b.v; }
+
+#endif
+
+// float overloads so kernels templated on lane type also compile as scalar code
+inline float Sqrt(float a) { return sqrtf(a); }
+inline float Min(float a, float b) { return a < b? a : b; }   // same operand order as minps
+inline float Max(float a, float b) { return a > b? a : b; }
+
+inline const char *SimdISA() {
+#if defined(SIMD_AVX2)
+	return "AVX2";
+#elif defined(SIMD_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+#endif
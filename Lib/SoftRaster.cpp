@@ -0,0 +1,485 @@
+// SoftRaster.cpp: multithreaded, tile-binned software rasterizer matching the demos' GL pipeline
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "FrameCapture.h"
+#include "MatKernels.h"
+#include "Simd.h"
+#include "SoftRaster.h"
+#include "stb_image.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double Ms(Clock::time_point t) {
+	return std::chrono::duration<double, std::milli>(Clock::now()-t).count();
+}
+
+// Texture
+
+bool SoftTexture::Read(const char *filename, bool flip) {
+	int nChannels;
+	unsigned char *data = stbi_load(filename, &width, &height, &nChannels, 4);
+	if (!data)
+		return false;
+	size_t rowSize = 4*(size_t) width;
+	rgba.resize(rowSize*height);
+	for (int y = 0; y < height; y++)
+		memcpy(&rgba[y*rowSize], data+(flip? height-1-y : y)*rowSize, rowSize);
+	stbi_image_free(data);
+	return true;
+}
+
+vec3 SoftTexture::Sample(vec2 uv) const {
+	if (!width || !height)
+		return vec3(1, 1, 1);
+	// texel centers at +.5, as GL_LINEAR with GL_REPEAT
+	float fx = uv.x*width-.5f, fy = uv.y*height-.5f;
+	float x0 = floorf(fx), y0 = floorf(fy), ax = fx-x0, ay = fy-y0;
+	int ix = (int) x0, iy = (int) y0;
+	vec3 c[4];
+	for (int k = 0; k < 4; k++) {
+		int x = ((ix+(k&1))%width+width)%width, y = ((iy+(k>>1))%height+height)%height;
+		const unsigned char *t = &rgba[4*((size_t) y*width+x)];
+		c[k] = vec3(t[0], t[1], t[2])/255.f;
+	}
+	return (1-ay)*((1-ax)*c[0]+ax*c[1])+ay*((1-ax)*c[2]+ax*c[3]);
+}
+
+// Frame
+
+SoftRaster::SoftRaster(int n) {
+	SetThreads(n);
+}
+
+SoftRaster::~SoftRaster() {
+	delete pool;
+}
+
+void SoftRaster::SetThreads(int n) {
+	delete pool;
+	pool = new JobPool(n);
+	nThreads = pool->NThreads();
+}
+
+void SoftRaster::Resize(int w, int h) {
+	width = w;
+	height = h;
+	stride = (w+Lanes::N-1)/Lanes::N*Lanes::N+Lanes::N;
+	tilesX = (w+tileSize-1)/tileSize;
+	tilesY = (h+tileSize-1)/tileSize;
+	color.resize(4*(size_t) w*h);
+	depth.resize((size_t) stride*h);
+}
+
+void SoftRaster::Clear(vec3 c) {
+	unsigned char rgba[4] = { (unsigned char) (255*c.x+.5f), (unsigned char) (255*c.y+.5f), (unsigned char) (255*c.z+.5f), 255 };
+	for (size_t i = 0; i < color.size(); i += 4)
+		memcpy(&color[i], rgba, 4);
+	std::fill(depth.begin(), depth.end(), 1.f);
+}
+
+// Setup
+
+static SoftRaster::Stats Sum(const vector<SoftRaster::Stats> &s) {
+	SoftRaster::Stats t;
+	for (const SoftRaster::Stats &j : s) {
+		t.rejected += j.rejected;
+		t.clipped += j.clipped;
+		t.binned += j.binned;
+	}
+	return t;
+}
+
+void SoftRaster::Emit(int job, const Vertex *v[3], Stats &s) {
+	Triangle t;
+	for (int k = 0; k < 3; k++) {
+		const Vertex &p = *v[k];
+		float w = 1/p.clip.w;
+		// snapped to 8 subpixel bits, so edges shared by triangles evaluate alike
+		t.x[k] = roundf((p.clip.x*w*.5f+.5f)*width*256)/256;
+		t.y[k] = roundf((p.clip.y*w*.5f+.5f)*height*256)/256;
+		t.z[k] = p.clip.z*w*.5f+.5f;
+		t.w[k] = w;
+		float a[11] = { p.eye.x, p.eye.y, p.eye.z, p.normal.x, p.normal.y, p.normal.z, p.uv.x, p.uv.y,
+						p.color.x, p.color.y, p.color.z };
+		for (int j = 0; j < 11; j++)
+			t.attributes[k][j] = a[j]*w;
+	}
+	float area = (t.x[1]-t.x[0])*(t.y[2]-t.y[0])-(t.x[2]-t.x[0])*(t.y[1]-t.y[0]);
+	if (area == 0 || !(fabsf(area) < FLT_MAX))
+		return;
+	t.invArea = 1/area;
+	// pixels whose centers lie in the bounding box, within the window
+	float xMin = fminf(t.x[0], fminf(t.x[1], t.x[2])), xMax = fmaxf(t.x[0], fmaxf(t.x[1], t.x[2]));
+	float yMin = fminf(t.y[0], fminf(t.y[1], t.y[2])), yMax = fmaxf(t.y[0], fmaxf(t.y[1], t.y[2]));
+	t.x0 = (int) fmaxf(0, ceilf(xMin-.5f));
+	t.x1 = (int) fminf((float) width-1, floorf(xMax-.5f));
+	t.y0 = (int) fmaxf(0, ceilf(yMin-.5f));
+	t.y1 = (int) fminf((float) height-1, floorf(yMax-.5f));
+	if (t.x0 > t.x1 || t.y0 > t.y1)
+		return;
+	// as cross(dFdx, dFdy): toward the eye
+	vec3 n = cross(v[1]->eye-v[0]->eye, v[2]->eye-v[0]->eye);
+	float l = length(n);
+	n = l > 0? n/l : vec3(0, 0, 1);
+	t.faceNormal = dot(n, v[0]->eye) > 0? -n : n;
+	int index = (int) setup[job].size();
+	setup[job].push_back(t);
+	for (int ty = t.y0/tileSize; ty <= t.y1/tileSize; ty++)
+		for (int tx = t.x0/tileSize; tx <= t.x1/tileSize; tx++)
+			bins[job][ty*tilesX+tx].push_back(index);
+	s.binned++;
+}
+
+void SoftRaster::Setup(int job, const vector<int3> &triangles, int begin, int end, Stats &s) {
+	for (int i = begin; i < end; i++) {
+		const int *tv = &triangles[i].i1;
+		const Vertex *v[3] = { &vertices[tv[0]], &vertices[tv[1]], &vertices[tv[2]] };
+		// outside one frustum plane: -w <= x, y, z <= w
+		bool out = false;
+		for (int k = 0; k < 6 && !out; k++) {
+			int axis = k/2;
+			float sign = k%2? -1.f : 1.f;
+			out = true;
+			for (int j = 0; j < 3; j++)
+				out = out && v[j]->clip.w+sign*(&v[j]->clip.x)[axis] < 0;
+		}
+		if (out) {
+			s.rejected++;
+			continue;
+		}
+		float d[3];
+		int nInside = 0;
+		for (int j = 0; j < 3; j++)
+			nInside += (d[j] = v[j]->clip.z+v[j]->clip.w) >= 0;
+		if (nInside == 3) {
+			Emit(job, v, s);
+			continue;
+		}
+		// clip to the near plane, z+w >= 0: one or two triangles
+		Vertex polygon[4];
+		int n = 0;
+		for (int j = 0; j < 3; j++) {
+			int k = (j+1)%3;
+			if (d[j] >= 0)
+				polygon[n++] = *v[j];
+			if ((d[j] >= 0) != (d[k] >= 0)) {
+				float a = d[j]/(d[j]-d[k]);
+				const Vertex &p = *v[j], &q = *v[k];
+				Vertex &r = polygon[n++];
+				r.clip = p.clip+a*(q.clip-p.clip);
+				r.eye = p.eye+a*(q.eye-p.eye);
+				r.normal = p.normal+a*(q.normal-p.normal);
+				r.uv = p.uv+a*(q.uv-p.uv);
+				r.color = p.color+a*(q.color-p.color);
+			}
+		}
+		s.clipped++;
+		for (int j = 1; j+1 < n; j++) {
+			const Vertex *fan[3] = { &polygon[0], &polygon[j], &polygon[j+1] };
+			Emit(job, fan, s);
+		}
+	}
+}
+
+// Raster
+
+static vec3 Shade(const float l[3], const float a[3][11], const float w[3], vec3 faceNormal, const SoftShading &s) {
+	// perspective-correct: attributes and 1/w are linear in the window
+	float r = 1/(l[0]*w[0]+l[1]*w[1]+l[2]*w[2]), v[11];
+	for (int j = 0; j < 11; j++)
+		v[j] = (l[0]*a[0][j]+l[1]*a[1][j]+l[2]*a[2][j])*r;
+	vec3 point(v[0], v[1], v[2]), N = s.faceted? faceNormal : normalize(vec3(v[3], v[4], v[5]));
+	if (s.shader) {
+		SoftFragment f = { point, N, vec3(v[8], v[9], v[10]), vec2(v[6], v[7]) };
+		return s.shader(f, s);
+	}
+	vec3 E = normalize(point);
+	float d = 0, h = 0;
+	for (int i = 0; i < s.nLights; i++) {
+		vec3 L = normalize(s.lights[i]-point);
+		vec3 R = L-2*dot(N, L)*N;               // reflect(L, N)
+		d += fmaxf(0, dot(N, L));
+		h += powf(fmaxf(0, dot(R, E)), s.shininess);
+	}
+	float ads = fminf(1, fmaxf(0, s.amb+s.dif*d+s.spc*h));
+	vec3 color(v[8], v[9], v[10]), c = s.texture? s.texture->Sample(vec2(v[6], v[7]))*color : color;
+	return ads*c;
+}
+
+void SoftRaster::RasterTile(int tile, const SoftShading &shading) {
+	const int N = Lanes::N;
+	int tx = tile%tilesX, ty = tile/tilesX;
+	int X0 = tx*tileSize, Y0 = ty*tileSize;
+	int X1 = std::min(X0+tileSize, width)-1, Y1 = std::min(Y0+tileSize, height)-1;
+	float offsets[N], l[3][N], z[N];
+	for (int i = 0; i < N; i++)
+		offsets[i] = (float) i;
+	Lanes laneOffsets = Lanes::Load(offsets);
+	for (size_t job = 0; job < bins.size(); job++)
+		for (int index : bins[job][tile]) {
+			const Triangle &t = setup[job][index];
+			int xa = std::max(t.x0, X0), xb = std::min(t.x1, X1), ya = std::max(t.y0, Y0), yb = std::min(t.y1, Y1);
+			// edge k runs from vertex k+1 to k+2; barycentric k = edge function*scale, positive
+			// inside. The edge function is evaluated from the edge's lesser endpoint, so triangles
+			// sharing an edge compute it bit for bit alike, up to sign. A center on a left edge
+			// (inside to its right) or a top edge (horizontal, inside below) is covered, on any
+			// other edge it isn't: the bias excludes exact zeros (top-left fill rule)
+			float ex[3], ey[3], bx[3], by[3], scale[3], bias[3];
+			for (int k = 0; k < 3; k++) {
+				int j1 = (k+1)%3, j2 = (k+2)%3;
+				bool swap = t.x[j1] > t.x[j2] || (t.x[j1] == t.x[j2] && t.y[j1] > t.y[j2]);
+				int a = swap? j2 : j1, c = swap? j1 : j2;
+				ex[k] = t.x[c]-t.x[a];
+				ey[k] = t.y[c]-t.y[a];
+				bx[k] = t.x[a];
+				by[k] = t.y[a];
+				scale[k] = swap? -t.invArea : t.invArea;
+				float dx = ex[k]*scale[k], dy = ey[k]*scale[k];   // as oriented in the triangle
+				bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+				bias[k] = topLeft? 0 : FLT_MIN;
+			}
+			for (int y = ya; y <= yb; y++) {
+				float py = y+.5f;
+				Lanes rowE[3];
+				for (int k = 0; k < 3; k++)
+					rowE[k] = Lanes(ex[k]*(py-by[k]));
+				for (int x = xa; x <= xb; x += N) {
+					Lanes px = Lanes(x+.5f)+laneOffsets;
+					int mask = xb-x+1 >= N? (1 << N)-1 : (1 << (xb-x+1))-1;
+					Lanes b[3];
+					for (int k = 0; k < 3 && mask; k++) {
+						b[k] = (rowE[k]-Lanes(ey[k])*(px-Lanes(bx[k])))*Lanes(scale[k]);
+						mask &= GreaterEqualMask(b[k], Lanes(bias[k]));
+					}
+					if (!mask)
+						continue;
+					Lanes zl = Lanes(t.z[0])*b[0]+Lanes(t.z[1])*b[1]+Lanes(t.z[2])*b[2];
+					float *dRow = &depth[(size_t) y*stride+x];
+					mask &= LessMask(zl, Lanes::Load(dRow)) & GreaterEqualMask(zl, Lanes(0.f));
+					if (!mask)
+						continue;
+					zl.Store(z);
+					for (int k = 0; k < 3; k++)
+						b[k].Store(l[k]);
+					for (int i = 0; i < N; i++)
+						if (mask & (1 << i)) {
+							float li[3] = { l[0][i], l[1][i], l[2][i] };
+							vec3 c = Shade(li, t.attributes, t.w, t.faceNormal, shading);
+							unsigned char *p = &color[4*((size_t) y*width+x+i)];
+							p[0] = (unsigned char) (255*fminf(1, fmaxf(0, c.x))+.5f);
+							p[1] = (unsigned char) (255*fminf(1, fmaxf(0, c.y))+.5f);
+							p[2] = (unsigned char) (255*fminf(1, fmaxf(0, c.z))+.5f);
+							p[3] = 255;
+							dRow[i] = z[i];
+						}
+				}
+			}
+		}
+}
+
+// Draw
+
+void SoftRaster::Draw(const vector<vec3> &points, const vector<vec3> &normals, const vector<vec2> &uvs,
+					  const vector<int3> &triangles, mat4 modelview, mat4 persp, const SoftShading &shading) {
+	stats = Stats();
+	stats.triangles = (int) triangles.size();
+	if (!width || !height || triangles.empty())
+		return;
+	// transform
+	Clock::time_point t = Clock::now();
+	int nPoints = (int) points.size(), nJobs = nThreads;
+	vertices.resize(nPoints);
+	for (int j = 0; j < nJobs; j++)
+		pool->Add([&, j]() {
+			// blocks of vertices through the batch kernels (MatKernels.h), then interleaved
+			enum { block = 256 };
+			vec3 eye[block], normal[block];
+			vec4 clip[block];
+			int begin = (int) ((long long) nPoints*j/nJobs), end = (int) ((long long) nPoints*(j+1)/nJobs);
+			for (int b = begin; b < end; b += block) {
+				int n = end-b < block? end-b : block;
+				int nNormals = std::max(0, std::min(n, (int) normals.size()-b));
+				TransformPoints(modelview, &points[b], eye, n);
+				if (nNormals > 0)
+					TransformVectors(modelview, &normals[b], normal, nNormals);
+				for (int i = 0; i < n; i++)
+					clip[i] = vec4(eye[i], 1);
+				Transform(persp, clip, clip, n);
+				for (int i = 0; i < n; i++) {
+					Vertex &v = vertices[b+i];
+					v.eye = eye[i];
+					v.clip = clip[i];
+					v.normal = i < nNormals? normal[i] : vec3(0, 0, 1);
+					v.uv = b+i < (int) uvs.size()? uvs[b+i] : vec2(0, 0);
+					v.color = shading.colors && b+i < (int) shading.colors->size()? (*shading.colors)[b+i] : shading.color;
+				}
+			}
+		});
+	pool->Wait();
+	stats.transformMs = Ms(t);
+	// setup and bin; more jobs than threads, for balance
+	t = Clock::now();
+	int nTriangles = (int) triangles.size(), nTiles = tilesX*tilesY;
+	nJobs = 4*nThreads;
+	setup.resize(nJobs);
+	bins.resize(nJobs);
+	vector<Stats> jobStats(nJobs);
+	for (int j = 0; j < nJobs; j++) {
+		setup[j].clear();
+		bins[j].resize(nTiles);
+		for (vector<int> &b : bins[j])
+			b.clear();
+		pool->Add([&, j]() {
+			Setup(j, triangles, (int) ((long long) nTriangles*j/nJobs), (int) ((long long) nTriangles*(j+1)/nJobs), jobStats[j]);
+		});
+	}
+	pool->Wait();
+	Stats s = Sum(jobStats);
+	stats.rejected = s.rejected;
+	stats.clipped = s.clipped;
+	stats.binned = s.binned;
+	stats.setupMs = Ms(t);
+	// raster, a tile per job
+	t = Clock::now();
+	for (int tile = 0; tile < nTiles; tile++)
+		pool->Add([&, tile]() { RasterTile(tile, shading); });
+	pool->Wait();
+	stats.rasterMs = Ms(t);
+}
+
+// Output
+
+bool SoftRaster::WritePng(const char *filename) const {
+	return ::WritePng(filename, color.data(), width, height, true);
+}
+
+ImageDiff SoftRaster::Compare(const char *filename, int tolerance) const {
+	ImageDiff diff;
+	int w, h, nChannels;
+	unsigned char *data = stbi_load(filename, &w, &h, &nChannels, 4);
+	if (!data || w != width || h != height) {
+		if (data)
+			stbi_image_free(data);
+		diff.fractionOver = 1;
+		diff.maxDifference = 255;
+		return diff;
+	}
+	// png is top row first
+	double sse = 0;
+	size_t nOver = 0;
+	for (int y = 0; y < h; y++) {
+		const unsigned char *a = &color[4*(size_t) (h-1-y)*w], *b = data+4*(size_t) y*w;
+		for (int x = 0; x < w; x++, a += 4, b += 4) {
+			int m = 0;
+			for (int k = 0; k < 3; k++) {
+				int d = abs(a[k]-b[k]);
+				sse += d*d;
+				m = d > m? d : m;
+			}
+			nOver += m > tolerance;
+			diff.maxDifference = m > diff.maxDifference? m : diff.maxDifference;
+		}
+	}
+	stbi_image_free(data);
+	double mse = sse/(3.*w*h);
+	diff.psnr = mse > 0? 10*log10(255.*255./mse) : INFINITY;
+	diff.fractionOver = (float) nOver/((float) w*h);
+	return diff;
+}
+
+int SoftGolden(const SoftRaster &r, const char *imageName, const char *goldenName, float maxFraction) {
+	const SoftRaster::Stats &s = r.stats;
+	printf("software: %i triangles (%i rejected, %i clipped), %.1f ms (transform %.1f, setup %.1f, raster %.1f)\n", s.triangles,
+		   s.rejected, s.clipped, s.transformMs+s.setupMs+s.rasterMs, s.transformMs, s.setupMs, s.rasterMs);
+	if (!r.WritePng(imageName))
+		printf("can't write %s\n", imageName);
+	if (!goldenName)
+		return 0;
+	ImageDiff d = r.Compare(goldenName);
+	printf("vs %s: PSNR %.1f dB, %.2f%% of pixels differ, max difference %i\n", goldenName, d.psnr, 100*d.fractionOver, d.maxDifference);
+	if (d.fractionOver > maxFraction)
+		printf("FAILED: more than %.1f%% of pixels differ\n", 100*maxFraction);
+	return d.fractionOver > maxFraction;
+}
+
+// Benchmark
+
+int SoftRasterBenchmark(int nTriangles) {
+	// res x res/2 grid on a sphere, textured with a checker, two lights
+	int res = (int) sqrtf((float) nTriangles), rows = res/2;
+	vector<vec3> points, normals;
+	vector<vec2> uvs;
+	vector<int3> triangles;
+	for (int y = 0; y <= rows; y++)
+		for (int x = 0; x <= res; x++) {
+			float u = (float) x/res, v = (float) y/rows, a = 6.2831853f*u, b = 3.1415927f*v;
+			vec3 p(sinf(b)*cosf(a), cosf(b), sinf(b)*sinf(a));
+			points.push_back(p);
+			normals.push_back(p);
+			uvs.push_back(vec2(u, v));
+		}
+	for (int y = 0; y < rows; y++)
+		for (int x = 0; x < res; x++) {
+			int i = y*(res+1)+x;
+			triangles.push_back(int3(i, i+res+1, i+1));
+			triangles.push_back(int3(i+1, i+res+1, i+res+2));
+		}
+	SoftTexture checker;
+	checker.width = checker.height = 64;
+	checker.rgba.resize(4*64*64);
+	for (int i = 0; i < 64*64; i++) {
+		unsigned char c = ((i%64)/8+(i/64)/8)%2? 230 : 60;
+		unsigned char *t = &checker.rgba[4*i];
+		t[0] = c; t[1] = c; t[2] = 200; t[3] = 255;
+	}
+	SoftShading shading;
+	shading.nLights = 2;
+	shading.lights[0] = vec3(-1, 1, 1);
+	shading.lights[1] = vec3(1, 2, 0);
+	shading.texture = &checker;
+	mat4 modelview = Translate(0, 0, -2.6f)*RotateY(30), persp = Perspective(30, 1920.f/1080.f, .1f, 10);
+	int maxThreads = (int) std::thread::hardware_concurrency();
+	printf("software raster, %i triangles at 1920x1080, %s, %ix%i tiles:\n", (int) triangles.size(), SimdISA(), SoftRaster::tileSize, SoftRaster::tileSize);
+	printf("%8s %10s %10s %10s %10s %12s\n", "threads", "transform", "setup+bin", "raster", "total ms", "Mtriangles/s");
+	double single = 0;
+	vector<unsigned char> reference;                // single-threaded image
+	int nDiffer = 0;
+	for (int n = 1; ; n = n*2 < maxThreads? n*2 : maxThreads) {
+		SoftRaster r(n);
+		r.Resize(1920, 1080);
+		int reps = 5;
+		double transform = 0, setup = 0, raster = 0;
+		for (int i = 0; i <= reps; i++) {
+			r.Clear(vec3(1, 1, 1));
+			r.Draw(points, normals, uvs, triangles, modelview, persp, shading);
+			if (i) {                                // first frame allocates
+				transform += r.stats.transformMs;
+				setup += r.stats.setupMs;
+				raster += r.stats.rasterMs;
+			}
+		}
+		double total = (transform+setup+raster)/reps;
+		single = n == 1? total : single;
+		printf("%8i %10.1f %10.1f %10.1f %10.1f %12.1f", n, transform/reps, setup/reps, raster/reps, total, triangles.size()/total/1e3);
+		printf(n > 1? " (%.1fx)\n" : "\n", single/total);
+		// bins are walked in submission order, so the image can't depend on the thread count
+		const unsigned char *p = r.Pixels();
+		size_t nBytes = 4*(size_t) r.Width()*r.Height();
+		if (n == 1)
+			reference.assign(p, p+nBytes);
+		else
+			for (size_t i = 0; i < nBytes; i += 4)
+				nDiffer += memcmp(p+i, &reference[i], 4) != 0;
+		if (n >= maxThreads)
+			break;
+	}
+	if (nDiffer)
+		printf("FAILED: %i pixels differ from the single-threaded image\n", nDiffer);
+	return nDiffer;
+}
@@ -0,0 +1,108 @@
+// SoftRaster.h: multithreaded, tile-binned software rasterizer matching the demos' GL pipeline
+
+#ifndef SOFT_RASTER_HDR
+#define SOFT_RASTER_HDR
+
+#include <vector>
+#include "JobPool.h"
+#include "VecMat.h"
+
+using std::vector;
+
+// A reference renderer for machines without a GPU, producing images comparable to the demos'
+// GL output (same matrices, window conventions, depth test and Phong-with-texture shading).
+// Draw runs in three stages, each across a JobPool:
+//   transform: vertices to eye space and clip space, in ranges
+//   setup:     triangles in ranges (one per job); trivially rejected outside a frustum plane,
+//              clipped to the near plane, mapped to the window and binned to the 32x32 pixel
+//              tiles their bounding boxes cover; each job has its own bins, so no locks
+//   raster:    one job per tile, walking the bins in submission order; edge functions and the
+//              depth test run Lanes::N pixels at a time (Simd.h), covered pixels are shaded
+// Depth is GL's window z (0 to 1), compared with GL_LESS; attributes are interpolated
+// perspective-correct; pixel centers are at +.5. Window vertices snap to 1/256 pixel and a
+// top-left fill rule decides pixel centers exactly on an edge, so a pixel on an edge shared by
+// two triangles is shaded once, as by GL. Pixels are RGBA, bottom row first, like glReadPixels.
+
+struct SoftTexture {
+	int width = 0, height = 0;
+	vector<unsigned char> rgba;                 // bottom row first, as uploaded to GL
+	bool Read(const char *filename, bool flip = true);
+	vec3 Sample(vec2 uv) const;                 // bilinear, repeat
+};
+
+struct SoftFragment {
+	vec3 point, normal;                         // eye space; normal unit length
+	vec3 color;                                 // SoftShading color or interpolated vertex color
+	vec2 uv;
+};
+
+struct SoftShading {
+	// as the demos' pixel shaders: ads = clamp(amb+dif*diffuse+spc*specular), color = ads*texture
+	enum { maxLights = 8 };
+	vec3 lights[maxLights];                     // eye space
+	int nLights = 0;
+	float amb = .1f, dif = .8f, spc = .7f, shininess = 100;
+	vec3 color = vec3(1, 1, 1);                 // multiplies the texture, if any
+	const vector<vec3> *colors = NULL;          // per vertex, in place of color
+	const SoftTexture *texture = NULL;
+	bool faceted = false;                       // normal from the triangle, facing the eye
+	// a demo's own pixel shader, in place of the above; result clamped to 0-1
+	vec3 (*shader)(const SoftFragment &f, const SoftShading &s) = NULL;
+};
+
+struct ImageDiff {
+	double psnr = 0;                            // dB, over rgb; infinite if identical
+	float fractionOver = 0;                     // pixels differing by more than tolerance
+	int maxDifference = 0;                      // largest channel difference
+};
+
+class SoftRaster {
+public:
+	enum { tileSize = 32 };
+	SoftRaster(int nThreads = 0);               // 0: one per core
+	~SoftRaster();
+	void SetThreads(int nThreads);
+	void Resize(int width, int height);
+	void Clear(vec3 color);                     // color and depth
+	void Draw(const vector<vec3> &points, const vector<vec3> &normals, const vector<vec2> &uvs,
+			  const vector<int3> &triangles, mat4 modelview, mat4 persp, const SoftShading &shading);
+	const unsigned char *Pixels() const { return color.data(); }
+	int Width() const { return width; }
+	int Height() const { return height; }
+	bool WritePng(const char *filename) const;  // top row first, as FrameCapture
+	ImageDiff Compare(const char *pngFilename, int tolerance = 8) const;
+	struct Stats {
+		int triangles = 0, rejected = 0, clipped = 0, binned = 0;
+		double transformMs = 0, setupMs = 0, rasterMs = 0;
+	};
+	Stats stats;                                // last Draw
+private:
+	struct Vertex { vec4 clip; vec3 eye, normal, color; vec2 uv; };
+	struct Triangle {
+		float x[3], y[3], z[3], w[3];           // window x, y, z; 1/w
+		float attributes[3][11];                // eye point, normal, uv, color; each divided by w
+		float invArea;
+		vec3 faceNormal;
+		int x0, y0, x1, y1;                     // pixel bounds, inclusive
+	};
+	JobPool *pool = NULL;
+	int nThreads = 1, width = 0, height = 0, stride = 0, tilesX = 0, tilesY = 0;
+	vector<unsigned char> color;
+	vector<float> depth;                        // stride per row, padded for full lane loads
+	vector<Vertex> vertices;
+	vector<vector<Triangle>> setup;             // per setup job
+	vector<vector<vector<int>>> bins;           // per setup job, per tile
+	void Setup(int job, const vector<int3> &triangles, int begin, int end, Stats &s);
+	void Emit(int job, const Vertex *v[3], Stats &s);
+	void RasterTile(int tile, const SoftShading &shading);
+};
+
+// write the image and print timing; with a golden image, print the difference and return 1 if
+// more than maxFraction of pixels differ (the demos' -soft image.png -golden reference.png)
+int SoftGolden(const SoftRaster &r, const char *imageName, const char *goldenName, float maxFraction = .01f);
+
+// triangles/s across thread counts, nTriangles on a sphere filling a 1920x1080 frame; returns
+// the number of pixels differing from the single-threaded image, 0 if none
+int SoftRasterBenchmark(int nTriangles = 2000000);
+
+#endif